@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "AppMain.h"
 #include "Cannon/DrawCall.h"
+#include "Cannon/Common/FileUtilities.h"
 
 using namespace winrt;
 
@@ -156,7 +157,166 @@ struct App : implements<App, IFrameworkViewSource, IFrameworkView>
 	}
 };
 
-int __stdcall wWinMain(HINSTANCE, HINSTANCE, PWSTR, int)
+struct HeadlessOptions
 {
+	unsigned frameCount = 0;				// 0 for 100 frames, or until the hand recording ends if there is one
+	std::string logFilename;				// Empty to report to stdout
+	std::string handRecordingFilename;		// See HandRecording.h
+	std::string surfaceRecordingFilename;	// See SurfaceRecording.h
+};
+
+// Runs frames on the null backend, for checking the engine without a GPU, headset or window:
+//  "-headless [frameCount] [-log file] [-hands file] [-surfaces file]"
+// Recorded hands are replayed through MixedReality and TrackedHands one frame per update. Recorded surfaces are
+//  processed as fast as they can be, and the report waits for all of them.
+// Reports what the frames sent to the render context, and returns the number of errors it caught.
+static int RunHeadless(const HeadlessOptions& options)
+{
+	FILE* pLog = stdout;
+	if (!options.logFilename.empty())
+	{
+		pLog = fopen(options.logFilename.c_str(), "w");
+		if (!pLog)
+			return -1;
+	}
+
+	if (!DrawCall::Initialize(RenderBackend::Null))
+	{
+		if (pLog != stdout)
+			fclose(pLog);
+		return -1;
+	}
+
+	unsigned frameCount = 0;
+	unsigned handTrackedFrameCounts[HAND_COUNT] = {};
+	size_t surfaceChunkCount = 0;
+	int replayErrorCount = 0;
+
+	{
+		AppMain main;	// Without init(), mixed reality needs a window
+		MixedReality& mixedReality = main.GetMixedReality();
+
+		bool isHandReplayRunning = false;
+		if (!options.handRecordingFilename.empty())
+		{
+			isHandReplayRunning = mixedReality.StartHandReplay(options.handRecordingFilename);
+			if (!isHandReplayRunning)
+			{
+				fprintf(pLog, "Headless: cannot replay hands from %s\n", options.handRecordingFilename.c_str());
+				++replayErrorCount;
+			}
+		}
+
+		std::shared_ptr<SurfaceMapping> surfaceMapping;
+		if (!options.surfaceRecordingFilename.empty())
+		{
+			mixedReality.EnableSurfaceMapping();
+			surfaceMapping = mixedReality.GetSurfaceMappingInterface();
+			if (!surfaceMapping->StartReplay(options.surfaceRecordingFilename, 0.0f))
+			{
+				fprintf(pLog, "Headless: cannot replay surfaces from %s\n", options.surfaceRecordingFilename.c_str());
+				++replayErrorCount;
+				surfaceMapping = nullptr;
+			}
+		}
+
+		bool isUntilReplayEnd = (options.frameCount == 0 && isHandReplayRunning);
+		unsigned targetFrameCount = options.frameCount ? options.frameCount : 100;
+
+		while (isUntilReplayEnd ? mixedReality.IsHandReplaying() : frameCount < targetFrameCount)
+		{
+			main.Update();
+			main.Render();
+			++frameCount;
+
+			for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+			{
+				if (main.GetHands().IsHandTracked(handIndex))
+					++handTrackedFrameCounts[handIndex];
+			}
+		}
+
+		if (surfaceMapping)
+		{
+			while (!surfaceMapping->IsReplayFinished())
+				Sleep(10);
+
+			surfaceChunkCount = surfaceMapping->GetChunkGrid().GetChunkCount();
+		}
+	}
+
+	const NullRenderContext& context = *DrawCall::GetNullRenderContext();
+	const NullRenderContext::Stats& stats = context.GetStats();
+
+	fprintf(pLog, "Headless: %u frames, %u draws, %llu instances, %llu indices, %zu bytes mapped, %zu bytes updated, %u command lists, %u errors\n",
+		frameCount, stats.draws, (unsigned long long)stats.instances, (unsigned long long)stats.indices, stats.bytesMapped, stats.bytesUpdated, stats.commandListsExecuted, stats.errors);
+
+	for (unsigned type = 0; type < NullRenderContext::COMMAND_TYPE_COUNT; ++type)
+	{
+		if (stats.commandCounts[type] == 0)
+			continue;
+
+		fprintf(pLog, "  %s %u\n", NullRenderContext::GetCommandName((NullRenderContext::CommandType)type), stats.commandCounts[type]);
+	}
+
+	if (!options.handRecordingFilename.empty())
+		fprintf(pLog, "  Hands: left tracked in %u frames, right tracked in %u frames\n", handTrackedFrameCounts[0], handTrackedFrameCounts[1]);
+
+	if (!options.surfaceRecordingFilename.empty())
+		fprintf(pLog, "  Surfaces: %zu chunks after the replay\n", surfaceChunkCount);
+
+	for (auto& error : context.GetErrors())
+		fprintf(pLog, "  Error: %s\n", error.c_str());
+
+	int errorCount = (int)stats.errors + replayErrorCount;
+	DrawCall::Uninitialize();
+
+	if (pLog != stdout)
+		fclose(pLog);
+	else
+		fflush(stdout);
+
+	return errorCount;
+}
+
+// The argument following switchName, which can be quoted, or an empty string if the switch is not there
+static std::string GetSwitchArgument(const wchar_t* commandLine, const wchar_t* switchName)
+{
+	const wchar_t* pSwitch = wcsstr(commandLine, switchName);
+	if (!pSwitch)
+		return std::string();
+
+	const wchar_t* pStart = pSwitch + wcslen(switchName);
+	while (*pStart == L' ')
+		++pStart;
+
+	wchar_t terminator = L' ';
+	if (*pStart == L'"')
+	{
+		terminator = L'"';
+		++pStart;
+	}
+
+	const wchar_t* pEnd = pStart;
+	while (*pEnd && *pEnd != terminator)
+		++pEnd;
+
+	return WideStringToString(std::wstring(pStart, pEnd));
+}
+
+int __stdcall wWinMain(HINSTANCE, HINSTANCE, PWSTR commandLine, int)
+{
+	const wchar_t* headlessSwitch = commandLine ? wcsstr(commandLine, L"-headless") : nullptr;
+	if (headlessSwitch)
+	{
+		HeadlessOptions options;
+		options.frameCount = wcstoul(headlessSwitch + wcslen(L"-headless"), nullptr, 10);
+		options.logFilename = GetSwitchArgument(commandLine, L"-log");
+		options.handRecordingFilename = GetSwitchArgument(commandLine, L"-hands");
+		options.surfaceRecordingFilename = GetSwitchArgument(commandLine, L"-surfaces");
+		return RunHeadless(options);
+	}
+
 	CoreApplication::Run(make<App>());
+	return 0;
 }
\ No newline at end of file
@@ -16,6 +16,8 @@ AppMain::AppMain() : m_textureTest("poly.jpg"), m_transformTest(XMMatrixIdentity
 	DrawCall::vAmbient = XMVectorSet(1.f, 1.f, 1.f, 1.f);
 	DrawCall::vLights[0].vLightPosW = XMVectorSet(0.0f, 1.0f, 0.0f, 0.f);
 	DrawCall::PushBackfaceCullingState(false);
+	DrawCall::EnableRenderQueue(true);
+	DrawCall::SetRecordingThreadCount(max(1u, thread::hardware_concurrency()));
 
 	m_modelTest.LoadMesh("Lit_VS.cso", "LitTexture_PS.cso", std::make_shared<Mesh>("poly.obj"));
 
@@ -31,6 +33,11 @@ void AppMain::DrawObjects()
 
 void AppMain::Render()
 {
+	DrawCall::GetUploadRing().EndFrame();	// Fences the uploads of the previous frame
+	DrawCall::GetUploadRing().ResetStats();
+	DrawCall::ResetRenderQueueStats();
+	DrawCall::ResetShaderConstantStats();
+
 	if (m_mixedReality.IsEnabled())
 	{
 		DrawCall::vLights[0].vLightPosW = m_mixedReality.GetHeadPosition() + XMVectorSet(0.0f, 1.0f, 0.0f, 0.f);
@@ -89,7 +96,8 @@ void AppMain::Render()
 		DrawCall::PopProj();
 		DrawCall::PopRenderPass();
 
-		DrawCall::GetD3DSwapChain()->Present(1, 0);
+		if (DrawCall::GetD3DSwapChain())	// None when running headless
+			DrawCall::GetD3DSwapChain()->Present(1, 0);
 	}
 }
 
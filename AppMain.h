@@ -24,6 +24,10 @@ public:
 
 	void init();
 
+	// For the headless runner, which replays recordings without init()
+	MixedReality& GetMixedReality() { return m_mixedReality; }
+	TrackedHands& GetHands() { return F_hands; }
+
 private:
 	MixedReality m_mixedReality;
 #ifdef _MANY_MODEL
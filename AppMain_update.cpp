@@ -7,7 +7,7 @@ using namespace winrt::Windows::Storage;
 bool AppMain::Update()
 {
 	m_mixedReality.Update();
-	F_hands.UpdateFromMixedReality(m_mixedReality);
+	F_hands.UpdateFromInput(m_mixedReality);
 
 	float frameDelta = F_frameDeltaTimer.GetTime();
 	if (frameDelta >= 3.6)
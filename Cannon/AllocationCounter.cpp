@@ -0,0 +1,68 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+// No precompiled header on purpose, see AllocationCounter.h
+
+#include "AllocationCounter.h"
+
+#ifdef ENABLE_ALLOCATION_COUNTER
+
+#include <cstdlib>
+#include <new>
+
+// Per thread, so allocations by worker threads (surface mapping, async WinRT callbacks) do not show up in the
+//  counts of the thread being measured, and counting needs no synchronization.
+static thread_local size_t s_threadAllocationCount = 0;
+static thread_local size_t s_threadAllocatedBytes = 0;
+
+static void* CountedAllocate(size_t size)
+{
+	++s_threadAllocationCount;
+	s_threadAllocatedBytes += size;
+
+	void* pMemory = malloc(size ? size : 1);
+	if (!pMemory)
+		throw std::bad_alloc();
+
+	return pMemory;
+}
+
+void* operator new(size_t size) { return CountedAllocate(size); }
+void* operator new[](size_t size) { return CountedAllocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	++s_threadAllocationCount;
+	s_threadAllocatedBytes += size;
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+
+void operator delete(void* pMemory) noexcept { free(pMemory); }
+void operator delete[](void* pMemory) noexcept { free(pMemory); }
+void operator delete(void* pMemory, size_t) noexcept { free(pMemory); }
+void operator delete[](void* pMemory, size_t) noexcept { free(pMemory); }
+void operator delete(void* pMemory, const std::nothrow_t&) noexcept { free(pMemory); }
+void operator delete[](void* pMemory, const std::nothrow_t&) noexcept { free(pMemory); }
+
+bool AllocationCounter::IsEnabled() { return true; }
+size_t AllocationCounter::GetThreadAllocationCount() { return s_threadAllocationCount; }
+size_t AllocationCounter::GetThreadAllocatedBytes() { return s_threadAllocatedBytes; }
+
+#else
+
+bool AllocationCounter::IsEnabled() { return false; }
+size_t AllocationCounter::GetThreadAllocationCount() { return 0; }
+size_t AllocationCounter::GetThreadAllocatedBytes() { return 0; }
+
+#endif
@@ -0,0 +1,51 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+// Like HandRecording, this file and AllocationCounter.cpp only depend on the standard library.
+
+#include <cstddef>
+
+// Counts heap allocations made through operator new on the calling thread, to check that per-frame code stays allocation free.
+// Counting replaces the global operator new and delete, so it is only compiled in with ENABLE_ALLOCATION_COUNTER (Debug builds).
+// Without it every count reads zero.
+//
+// Usage:
+//	AllocationCounter counter;
+//	... code that should not allocate ...
+//	assert(counter.GetAllocationCount() == 0);
+class AllocationCounter
+{
+public:
+
+	AllocationCounter() :
+		m_startCount(GetThreadAllocationCount()),
+		m_startBytes(GetThreadAllocatedBytes())
+	{
+	}
+
+	// Since construction
+	size_t GetAllocationCount() const { return GetThreadAllocationCount() - m_startCount; }
+	size_t GetAllocatedBytes() const { return GetThreadAllocatedBytes() - m_startBytes; }
+
+	static bool IsEnabled();
+
+	// Since the thread started
+	static size_t GetThreadAllocationCount();
+	static size_t GetThreadAllocatedBytes();
+
+private:
+
+	size_t m_startCount;
+	size_t m_startBytes;
+};
@@ -0,0 +1,266 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <algorithm>
+
+using namespace DirectX;
+
+// Intersection tests for capsules, every point within radius of the segment from start to end.
+// Along the lines of DirectX::TriangleTests: points and boxes are plain XMVECTORs, so the tests run on whole vectors and
+//  work with DirectXCollision bounds as well as with anything else that has a center and extents.
+namespace CapsuleTests
+{
+	inline XMVECTOR ClosestPointOnSegment(FXMVECTOR point, FXMVECTOR start, FXMVECTOR end)
+	{
+		XMVECTOR direction = end - start;
+		XMVECTOR lengthSquared = XMVector3LengthSq(direction);
+		XMVECTOR t = XMVector3Dot(point - start, direction) / XMVectorMax(lengthSquared, XMVectorReplicate(1e-12f));
+		t = XMVectorClamp(t, XMVectorZero(), XMVectorSplatOne());
+		return XMVectorMultiplyAdd(direction, t, start);
+	}
+
+	// Squared distance between the closest points of two segments (Ericson, Real-Time Collision Detection 5.1.9)
+	inline float SegmentSegmentDistanceSquared(FXMVECTOR start1, FXMVECTOR end1, FXMVECTOR start2, GXMVECTOR end2)
+	{
+		const float epsilon = 1e-12f;
+
+		XMVECTOR d1 = end1 - start1;
+		XMVECTOR d2 = end2 - start2;
+		XMVECTOR r = start1 - start2;
+		float a = XMVectorGetX(XMVector3LengthSq(d1));
+		float e = XMVectorGetX(XMVector3LengthSq(d2));
+		float f = XMVectorGetX(XMVector3Dot(d2, r));
+
+		float s = 0.0f;
+		float t = 0.0f;
+
+		if (a <= epsilon && e <= epsilon)
+		{
+			return XMVectorGetX(XMVector3LengthSq(r));
+		}
+		else if (a <= epsilon)
+		{
+			t = std::min(std::max(f / e, 0.0f), 1.0f);
+		}
+		else
+		{
+			float c = XMVectorGetX(XMVector3Dot(d1, r));
+			if (e <= epsilon)
+			{
+				s = std::min(std::max(-c / a, 0.0f), 1.0f);
+			}
+			else
+			{
+				float b = XMVectorGetX(XMVector3Dot(d1, d2));
+				float denominator = a * e - b * b;
+
+				if (denominator > epsilon)
+					s = std::min(std::max((b * f - c * e) / denominator, 0.0f), 1.0f);
+
+				t = (b * s + f) / e;
+				if (t < 0.0f)
+				{
+					t = 0.0f;
+					s = std::min(std::max(-c / a, 0.0f), 1.0f);
+				}
+				else if (t > 1.0f)
+				{
+					t = 1.0f;
+					s = std::min(std::max((b - c) / a, 0.0f), 1.0f);
+				}
+			}
+		}
+
+		XMVECTOR closest1 = XMVectorMultiplyAdd(d1, XMVectorReplicate(s), start1);
+		XMVECTOR closest2 = XMVectorMultiplyAdd(d2, XMVectorReplicate(t), start2);
+		return XMVectorGetX(XMVector3LengthSq(closest1 - closest2));
+	}
+
+	// Slab test of a segment against the box from boxMin to boxMax, all three axes at once.
+	// On a hit, enter and exit are the fractions of the segment where it is inside the box, clamped to 0..1.
+	inline bool ClipSegmentToBox(FXMVECTOR start, FXMVECTOR end, FXMVECTOR boxMin, GXMVECTOR boxMax, float& enter, float& exit)
+	{
+		const XMVECTOR epsilon = XMVectorReplicate(1e-12f);
+
+		// A direction component of zero becomes a tiny one, which gives slab times far beyond 0..1 of the right sign
+		XMVECTOR direction = end - start;
+		XMVECTOR isTiny = XMVectorLess(XMVectorAbs(direction), epsilon);
+		direction = XMVectorSelect(direction, epsilon, isTiny);
+
+		XMVECTOR t1 = (boxMin - start) / direction;
+		XMVECTOR t2 = (boxMax - start) / direction;
+		XMVECTOR tNear = XMVectorMin(t1, t2);
+		XMVECTOR tFar = XMVectorMax(t1, t2);
+
+		enter = std::max(std::max(XMVectorGetX(tNear), XMVectorGetY(tNear)), std::max(XMVectorGetZ(tNear), 0.0f));
+		exit = std::min(std::min(XMVectorGetX(tFar), XMVectorGetY(tFar)), std::min(XMVectorGetZ(tFar), 1.0f));
+		return enter <= exit;
+	}
+
+	inline bool SegmentIntersectsBox(FXMVECTOR start, FXMVECTOR end, FXMVECTOR boxMin, GXMVECTOR boxMax)
+	{
+		float enter, exit;
+		return ClipSegmentToBox(start, end, boxMin, boxMax, enter, exit);
+	}
+
+	// Capsule against a box centered on the origin of its own space, with start and end already in that space
+	inline bool IntersectsLocalBox(FXMVECTOR start, FXMVECTOR end, float radius, FXMVECTOR extents)
+	{
+		// Exact reject against the box grown by the radius, which only overestimates around its edges and corners
+		XMVECTOR grownExtents = extents + XMVectorReplicate(radius);
+		if (!SegmentIntersectsBox(start, end, -grownExtents, grownExtents))
+			return false;
+
+		if (SegmentIntersectsBox(start, end, -extents, extents))
+			return true;
+
+		// Outside the box, the closest points are an end of the segment and the box, or the segment and one of the box edges
+		float radiusSquared = radius * radius;
+		if (XMVectorGetX(XMVector3LengthSq(start - XMVectorClamp(start, -extents, extents))) <= radiusSquared)
+			return true;
+		if (XMVectorGetX(XMVector3LengthSq(end - XMVectorClamp(end, -extents, extents))) <= radiusSquared)
+			return true;
+
+		static const XMVECTORF32 s_edgeSigns[12][2] =
+		{
+			{ { { -1.0f, -1.0f, -1.0f, 0.0f } }, { { 1.0f, -1.0f, -1.0f, 0.0f } } },
+			{ { { -1.0f, 1.0f, -1.0f, 0.0f } }, { { 1.0f, 1.0f, -1.0f, 0.0f } } },
+			{ { { -1.0f, -1.0f, 1.0f, 0.0f } }, { { 1.0f, -1.0f, 1.0f, 0.0f } } },
+			{ { { -1.0f, 1.0f, 1.0f, 0.0f } }, { { 1.0f, 1.0f, 1.0f, 0.0f } } },
+			{ { { -1.0f, -1.0f, -1.0f, 0.0f } }, { { -1.0f, 1.0f, -1.0f, 0.0f } } },
+			{ { { 1.0f, -1.0f, -1.0f, 0.0f } }, { { 1.0f, 1.0f, -1.0f, 0.0f } } },
+			{ { { -1.0f, -1.0f, 1.0f, 0.0f } }, { { -1.0f, 1.0f, 1.0f, 0.0f } } },
+			{ { { 1.0f, -1.0f, 1.0f, 0.0f } }, { { 1.0f, 1.0f, 1.0f, 0.0f } } },
+			{ { { -1.0f, -1.0f, -1.0f, 0.0f } }, { { -1.0f, -1.0f, 1.0f, 0.0f } } },
+			{ { { 1.0f, -1.0f, -1.0f, 0.0f } }, { { 1.0f, -1.0f, 1.0f, 0.0f } } },
+			{ { { -1.0f, 1.0f, -1.0f, 0.0f } }, { { -1.0f, 1.0f, 1.0f, 0.0f } } },
+			{ { { 1.0f, 1.0f, -1.0f, 0.0f } }, { { 1.0f, 1.0f, 1.0f, 0.0f } } },
+		};
+
+		for (const auto& edge : s_edgeSigns)
+		{
+			if (SegmentSegmentDistanceSquared(start, end, edge[0] * extents, edge[1] * extents) <= radiusSquared)
+				return true;
+		}
+
+		return false;
+	}
+
+	inline bool IntersectsAlignedBox(FXMVECTOR start, FXMVECTOR end, float radius, FXMVECTOR boxCenter, GXMVECTOR boxExtents)
+	{
+		return IntersectsLocalBox(start - boxCenter, end - boxCenter, radius, boxExtents);
+	}
+
+	// boxOrientation is a quaternion, as in DirectX::BoundingOrientedBox
+	inline bool IntersectsOrientedBox(FXMVECTOR start, FXMVECTOR end, float radius, FXMVECTOR boxCenter, GXMVECTOR boxExtents, HXMVECTOR boxOrientation)
+	{
+		XMVECTOR localStart = XMVector3InverseRotate(start - boxCenter, boxOrientation);
+		XMVECTOR localEnd = XMVector3InverseRotate(end - boxCenter, boxOrientation);
+		return IntersectsLocalBox(localStart, localEnd, radius, boxExtents);
+	}
+
+	// The reject of IntersectsLocalBox for four capsules at once, laid out one coordinate per vector: start[0] holds the x of
+	//  all four starts, and so on. Returns a mask with bit n set when capsule n touches the box grown by its radius,
+	//  those are the only ones that still need IntersectsLocalBox.
+	inline unsigned IntersectsGrownLocalBox4(const XMVECTOR start[3], const XMVECTOR end[3], FXMVECTOR radius, FXMVECTOR extents)
+	{
+		const XMVECTOR epsilon = XMVectorReplicate(1e-12f);
+
+		XMVECTOR enter = XMVectorZero();
+		XMVECTOR exit = XMVectorSplatOne();
+		for (unsigned axis = 0; axis < 3; ++axis)
+		{
+			XMVECTOR grownExtent = XMVectorReplicate(XMVectorGetByIndex(extents, axis)) + radius;
+
+			XMVECTOR direction = end[axis] - start[axis];
+			XMVECTOR isTiny = XMVectorLess(XMVectorAbs(direction), epsilon);
+			direction = XMVectorSelect(direction, epsilon, isTiny);
+
+			XMVECTOR t1 = (-grownExtent - start[axis]) / direction;
+			XMVECTOR t2 = (grownExtent - start[axis]) / direction;
+			enter = XMVectorMax(enter, XMVectorMin(t1, t2));
+			exit = XMVectorMin(exit, XMVectorMax(t1, t2));
+		}
+
+		XMVECTOR isHit = XMVectorLessOrEqual(enter, exit);
+		return (XMVectorGetIntX(isHit) & 1) | (XMVectorGetIntY(isHit) & 2) | (XMVectorGetIntZ(isHit) & 4) | (XMVectorGetIntW(isHit) & 8);
+	}
+
+	// Closest point on triangle abc (Ericson 5.1.5)
+	inline XMVECTOR ClosestPointOnTriangle(FXMVECTOR point, FXMVECTOR a, FXMVECTOR b, GXMVECTOR c)
+	{
+		XMVECTOR ab = b - a;
+		XMVECTOR ac = c - a;
+
+		XMVECTOR ap = point - a;
+		float d1 = XMVectorGetX(XMVector3Dot(ab, ap));
+		float d2 = XMVectorGetX(XMVector3Dot(ac, ap));
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+
+		XMVECTOR bp = point - b;
+		float d3 = XMVectorGetX(XMVector3Dot(ab, bp));
+		float d4 = XMVectorGetX(XMVector3Dot(ac, bp));
+		if (d3 >= 0.0f && d4 <= d3)
+			return b;
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return XMVectorMultiplyAdd(ab, XMVectorReplicate(d1 / (d1 - d3)), a);
+
+		XMVECTOR cp = point - c;
+		float d5 = XMVectorGetX(XMVector3Dot(ab, cp));
+		float d6 = XMVectorGetX(XMVector3Dot(ac, cp));
+		if (d6 >= 0.0f && d5 <= d6)
+			return c;
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return XMVectorMultiplyAdd(ac, XMVectorReplicate(d2 / (d2 - d6)), a);
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			return XMVectorMultiplyAdd(c - b, XMVectorReplicate((d4 - d3) / ((d4 - d3) + (d5 - d6))), b);
+
+		float denominator = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denominator) + ac * (vc * denominator);
+	}
+
+	inline bool IntersectsTriangle(FXMVECTOR start, FXMVECTOR end, float radius, FXMVECTOR a, GXMVECTOR b, HXMVECTOR c)
+	{
+		float radiusSquared = radius * radius;
+
+		// A segment through the triangle touches it whatever the radius
+		XMVECTOR normal = XMVector3Cross(b - a, c - a);
+		float startSide = XMVectorGetX(XMVector3Dot(start - a, normal));
+		float endSide = XMVectorGetX(XMVector3Dot(end - a, normal));
+		if (startSide * endSide <= 0.0f && startSide != endSide)
+		{
+			XMVECTOR crossing = XMVectorLerp(start, end, startSide / (startSide - endSide));
+			if (XMVectorGetX(XMVector3LengthSq(ClosestPointOnTriangle(crossing, a, b, c) - crossing)) <= 1e-10f)
+				return true;
+		}
+
+		// Otherwise the closest points are an end of the segment and the face, or the segment and an edge
+		if (XMVectorGetX(XMVector3LengthSq(ClosestPointOnTriangle(start, a, b, c) - start)) <= radiusSquared)
+			return true;
+		if (XMVectorGetX(XMVector3LengthSq(ClosestPointOnTriangle(end, a, b, c) - end)) <= radiusSquared)
+			return true;
+
+		return SegmentSegmentDistanceSquared(start, end, a, b) <= radiusSquared ||
+			SegmentSegmentDistanceSquared(start, end, b, c) <= radiusSquared ||
+			SegmentSegmentDistanceSquared(start, end, c, a) <= radiusSquared;
+	}
+}
@@ -85,7 +85,7 @@ public:
 		{
 			// First apply jitter filter
 			deltaVector = newRawPosition - m_history.filteredPosition;
-			deltaDistance = XMVectorGetX(XMVector3Length(deltaVector));
+			deltaDistance = Length(deltaVector);
 
 			if (deltaDistance <= m_jitterRadius)
 			{
@@ -108,7 +108,7 @@ public:
 
 		// Check that we are not too far away from raw data
 		deltaVector = newPredictedPosition - newRawPosition;
-		deltaDistance = XMVectorGetX(XMVector3Length(deltaVector));
+		deltaDistance = Length(deltaVector);
 
 		if (deltaDistance > m_maxDeviationRadius)
 		{
@@ -128,6 +128,13 @@ public:
 	XMVECTOR GetFilteredValue() { return m_filteredValue; }
 
 private:
+	// Exact square root of the dot product rather than XMVector3Length, which uses a refined estimate on ARM.
+	// FilterDoubleExponentialBatch computes the same sum in the same order, so the two stay bit identical.
+	static float Length(const XMVECTOR& v)
+	{
+		return XMVectorGetX(XMVectorSqrt(XMVector3Dot(v, v)));
+	}
+
 	XMVECTOR m_filteredValue;
 	FilterDoubleExponentialData m_history;
 
@@ -0,0 +1,205 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstring>
+
+using namespace DirectX;
+
+// FilterDoubleExponential for a fixed number of streams, updated together.
+// State is kept as structure of arrays with four streams per XMVECTOR, so every step of the filter (including the
+//  jitter and max deviation clamps, which become per lane selects) runs on four streams per instruction.
+// Results are bit identical to running one FilterDoubleExponential per stream with the same parameters:
+//  every arithmetic operation is the same IEEE operation in the same order, just on a different lane.
+template<size_t StreamCount>
+class FilterDoubleExponentialBatch
+{
+public:
+
+	static const size_t GroupCount = (StreamCount + 3) / 4;
+
+	FilterDoubleExponentialBatch() { SetParameters(); }
+
+	// Same parameters as FilterDoubleExponential, shared by all streams
+	void SetParameters(float smoothing = 0.5f, float correction = 0.0f, float prediction = 0.0f, float jitterRadius = 0.05f, float maxDeviationRadius = 0.05f)
+	{
+		m_maxDeviationRadius = maxDeviationRadius;
+		m_smoothing = smoothing;
+		m_correction = correction;
+		m_prediction = prediction;
+		m_jitterRadius = jitterRadius;
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (size_t group = 0; group < GroupCount; ++group)
+		{
+			for (size_t component = 0; component < 3; ++component)
+			{
+				m_rawPositions[component][group] = XMVectorZero();
+				m_filteredPositions[component][group] = XMVectorZero();
+				m_trends[component][group] = XMVectorZero();
+			}
+		}
+		memset(m_frameCounts, 0, sizeof(m_frameCounts));
+
+		for (size_t stream = 0; stream < StreamCount; ++stream)
+			m_filteredValues[stream] = XMVectorZero();
+	}
+
+	void Reset(size_t stream)
+	{
+		size_t group = stream / 4;
+		size_t lane = stream % 4;
+		for (size_t component = 0; component < 3; ++component)
+		{
+			m_rawPositions[component][group] = XMVectorSetByIndex(m_rawPositions[component][group], 0.0f, lane);
+			m_filteredPositions[component][group] = XMVectorSetByIndex(m_filteredPositions[component][group], 0.0f, lane);
+			m_trends[component][group] = XMVectorSetByIndex(m_trends[component][group], 0.0f, lane);
+		}
+		m_frameCounts[stream] = 0;
+		m_filteredValues[stream] = XMVectorZero();
+	}
+
+	// newRawPositions holds one value per stream
+	void Update(const XMVECTOR* newRawPositions)
+	{
+		// Check for divide by zero. Use an epsilon of a 10th of a millimeter
+		m_jitterRadius = XMMax(0.0001f, m_jitterRadius);
+
+		const XMVECTOR zero = XMVectorZero();
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR half = XMVectorReplicate(0.5f);
+		const XMVECTOR smoothing = XMVectorReplicate(m_smoothing);
+		const XMVECTOR oneMinusSmoothing = XMVectorReplicate(1.0f - m_smoothing);
+		const XMVECTOR correction = XMVectorReplicate(m_correction);
+		const XMVECTOR oneMinusCorrection = XMVectorReplicate(1.0f - m_correction);
+		const XMVECTOR prediction = XMVectorReplicate(m_prediction);
+		const XMVECTOR jitterRadius = XMVectorReplicate(m_jitterRadius);
+		const XMVECTOR maxDeviationRadius = XMVectorReplicate(m_maxDeviationRadius);
+		const XMVECTOR countOne = XMVectorSetInt(1, 1, 1, 1);
+		const XMVECTOR countTwo = XMVectorSetInt(2, 2, 2, 2);
+
+		for (size_t group = 0; group < GroupCount; ++group)
+		{
+			// Transpose four streams into x, y and z lanes, missing streams in the last group are treated as invalid
+			XMMATRIX streams;
+			for (size_t lane = 0; lane < 4; ++lane)
+			{
+				size_t stream = group * 4 + lane;
+				streams.r[lane] = (stream < StreamCount) ? newRawPositions[stream] : zero;
+			}
+			streams = XMMatrixTranspose(streams);
+
+			XMVECTOR raw[3] = { streams.r[0], streams.r[1], streams.r[2] };
+			XMVECTOR previousRaw[3], previousFiltered[3], previousTrend[3];
+			for (size_t component = 0; component < 3; ++component)
+			{
+				previousRaw[component] = m_rawPositions[component][group];
+				previousFiltered[component] = m_filteredPositions[component][group];
+				previousTrend[component] = m_trends[component][group];
+			}
+
+			// If joint is invalid, reset the filter
+			XMVECTOR isInvalid = XMVectorAndInt(XMVectorAndInt(XMVectorEqual(raw[0], zero), XMVectorEqual(raw[1], zero)), XMVectorEqual(raw[2], zero));
+			XMVECTOR frameCounts = XMVectorSelect(XMLoadInt4(&m_frameCounts[group * 4]), zero, isInvalid);
+			XMVECTOR isFirstFrame = XMVectorEqualInt(frameCounts, zero);
+			XMVECTOR isSecondFrame = XMVectorEqualInt(frameCounts, countOne);
+
+			// Jitter filter distance, only used from the third frame on
+			XMVECTOR jitterDelta[3];
+			for (size_t component = 0; component < 3; ++component)
+				jitterDelta[component] = raw[component] - previousFiltered[component];
+			XMVECTOR jitterDistance = XMVectorSqrt(((jitterDelta[0] * jitterDelta[0]) + (jitterDelta[1] * jitterDelta[1])) + (jitterDelta[2] * jitterDelta[2]));
+			XMVECTOR isWithinJitter = XMVectorLessOrEqual(jitterDistance, jitterRadius);
+			XMVECTOR jitterBlend = one - jitterDistance / jitterRadius;
+
+			XMVECTOR filtered[3], trend[3];
+			for (size_t component = 0; component < 3; ++component)
+			{
+				// Second frame
+				XMVECTOR secondFiltered = (raw[component] + previousRaw[component]) * half;
+				XMVECTOR secondTrend = (secondFiltered - previousFiltered[component]) * correction + previousTrend[component] * oneMinusCorrection;
+
+				// Later frames, jitter filter then the double exponential smoothing filter
+				XMVECTOR laterFiltered = XMVectorSelect(raw[component], raw[component] * jitterDistance / jitterRadius + previousFiltered[component] * jitterBlend, isWithinJitter);
+				laterFiltered = laterFiltered * oneMinusSmoothing + (previousFiltered[component] + previousTrend[component]) * smoothing;
+				XMVECTOR laterTrend = (laterFiltered - previousFiltered[component]) * correction + previousTrend[component] * oneMinusCorrection;
+
+				filtered[component] = XMVectorSelect(XMVectorSelect(laterFiltered, secondFiltered, isSecondFrame), raw[component], isFirstFrame);
+				trend[component] = XMVectorSelect(XMVectorSelect(laterTrend, secondTrend, isSecondFrame), zero, isFirstFrame);
+			}
+
+			// Predict into the future to reduce latency
+			XMVECTOR predicted[3], deviation[3];
+			for (size_t component = 0; component < 3; ++component)
+			{
+				predicted[component] = filtered[component] + trend[component] * prediction;
+				deviation[component] = predicted[component] - raw[component];
+			}
+
+			// Check that we are not too far away from raw data
+			XMVECTOR deviationDistance = XMVectorSqrt(((deviation[0] * deviation[0]) + (deviation[1] * deviation[1])) + (deviation[2] * deviation[2]));
+			XMVECTOR isTooFar = XMVectorGreater(deviationDistance, maxDeviationRadius);
+			XMVECTOR deviationBlend = one - maxDeviationRadius / deviationDistance;
+			for (size_t component = 0; component < 3; ++component)
+			{
+				XMVECTOR clamped = predicted[component] * maxDeviationRadius / deviationDistance + raw[component] * deviationBlend;
+				predicted[component] = XMVectorSelect(predicted[component], clamped, isTooFar);
+			}
+
+			// Save the data from this frame
+			for (size_t component = 0; component < 3; ++component)
+			{
+				m_rawPositions[component][group] = raw[component];
+				m_filteredPositions[component][group] = filtered[component];
+				m_trends[component][group] = trend[component];
+			}
+			frameCounts = XMVectorSelect(XMVectorSelect(frameCounts, countTwo, isSecondFrame), countOne, isFirstFrame);
+			XMStoreInt4(&m_frameCounts[group * 4], frameCounts);
+
+			// Output the data, transposed back with w set to one
+			streams.r[0] = predicted[0];
+			streams.r[1] = predicted[1];
+			streams.r[2] = predicted[2];
+			streams.r[3] = one;
+			streams = XMMatrixTranspose(streams);
+			for (size_t lane = 0; lane < 4; ++lane)
+			{
+				size_t stream = group * 4 + lane;
+				if (stream < StreamCount)
+					m_filteredValues[stream] = streams.r[lane];
+			}
+		}
+	}
+
+	XMVECTOR GetFilteredValue(size_t stream) const { return m_filteredValues[stream]; }
+
+private:
+
+	XMVECTOR m_rawPositions[3][GroupCount];
+	XMVECTOR m_filteredPositions[3][GroupCount];
+	XMVECTOR m_trends[3][GroupCount];
+	uint32_t m_frameCounts[GroupCount * 4];
+
+	XMVECTOR m_filteredValues[StreamCount];
+
+	float m_smoothing;
+	float m_correction;
+	float m_prediction;
+	float m_jitterRadius;
+	float m_maxDeviationRadius;
+};
@@ -0,0 +1,123 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// Kalman filter with a constant velocity motion model (state is position and velocity, noise is white acceleration).
+// Noise is the same on every axis, so the three axes share one 2x2 covariance and the whole filter is a few
+//  multiply adds on XMVECTORs per update.
+// Timestamps are in 100 ns ticks, the same clock as the perception timestamps used by MixedReality.
+
+class FilterKalmanConstantVelocity
+{
+public:
+	FilterKalmanConstantVelocity() { SetParameters(); }
+
+	void SetParameters(float processNoise = 2.0f, float measurementNoise = 0.006f, float maxPredictionTime = 0.05f)
+	{
+		m_processNoise = processNoise;							// Acceleration noise density in m^2/s^3. Lags when too low, jitters when too high
+		m_measurementVariance = measurementNoise * measurementNoise;	// measurementNoise is the standard deviation of the input in meters
+		m_maxPredictionTime = maxPredictionTime;				// Longest extrapolation in seconds. Overshoots on stops when too high
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_position = XMVectorZero();
+		m_velocity = XMVectorZero();
+		m_positionVariance = 0.0f;
+		m_covariance = 0.0f;
+		m_velocityVariance = 0.0f;
+		m_timestamp = 0;
+		m_frameCount = 0;
+	}
+
+	void Update(const XMVECTOR& newRawPosition, long long timestamp)
+	{
+		// If joint is invalid, reset the filter
+		if (XMVector3Equal(newRawPosition, XMVectorZero()))
+		{
+			m_frameCount = 0;
+		}
+
+		float deltaTime = (float)(timestamp - m_timestamp) * 1e-7f;
+
+		// Restart after the first frame or a gap in tracking, velocity is unknown so its variance starts large
+		if (m_frameCount == 0 || deltaTime <= 0.0f || deltaTime > s_maxDeltaTime)
+		{
+			m_position = XMVectorSetW(newRawPosition, 1.0f);
+			m_velocity = XMVectorZero();
+			m_positionVariance = m_measurementVariance;
+			m_covariance = 0.0f;
+			m_velocityVariance = s_initialVelocityVariance;
+			m_timestamp = timestamp;
+			m_frameCount = 1;
+			return;
+		}
+
+		// Predict
+		float deltaTime2 = deltaTime * deltaTime;
+		m_position += m_velocity * deltaTime;
+		m_positionVariance += deltaTime * (2.0f * m_covariance + deltaTime * m_velocityVariance) + m_processNoise * deltaTime2 * deltaTime / 3.0f;
+		m_covariance += deltaTime * m_velocityVariance + m_processNoise * deltaTime2 * 0.5f;
+		m_velocityVariance += m_processNoise * deltaTime;
+
+		// Correct
+		float innovationVariance = m_positionVariance + m_measurementVariance;
+		float positionGain = m_positionVariance / innovationVariance;
+		float velocityGain = m_covariance / innovationVariance;
+
+		XMVECTOR innovation = XMVectorSetW(newRawPosition - m_position, 0.0f);
+		m_position += innovation * positionGain;
+		m_velocity += innovation * velocityGain;
+
+		m_velocityVariance -= velocityGain * m_covariance;
+		m_positionVariance *= (1.0f - positionGain);
+		m_covariance *= (1.0f - positionGain);
+
+		m_timestamp = timestamp;
+		++m_frameCount;
+	}
+
+	XMVECTOR GetFilteredValue() const { return m_position; }
+	XMVECTOR GetVelocity() const { return m_velocity; }	// Meters per second
+
+	// Runs the motion model forward to timestamp (usually the predicted display time)
+	XMVECTOR GetPredictedValue(long long timestamp) const
+	{
+		float predictionTime = (float)(timestamp - m_timestamp) * 1e-7f;
+		predictionTime = XMMax(0.0f, XMMin(predictionTime, m_maxPredictionTime));
+
+		return m_position + m_velocity * predictionTime;
+	}
+
+private:
+	static constexpr float s_maxDeltaTime = 0.25f;
+	static constexpr float s_initialVelocityVariance = 1.0f;
+
+	XMVECTOR m_position;
+	XMVECTOR m_velocity;
+	float m_positionVariance;
+	float m_covariance;
+	float m_velocityVariance;
+	long long m_timestamp;
+	unsigned m_frameCount;
+
+	float m_processNoise;
+	float m_measurementVariance;
+	float m_maxPredictionTime;
+};
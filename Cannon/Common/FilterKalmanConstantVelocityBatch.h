@@ -0,0 +1,179 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstring>
+
+using namespace DirectX;
+
+// FilterKalmanConstantVelocity for a fixed number of streams that are sampled together, such as the joints of one hand.
+// Same layout as FilterOneEuroBatch: four streams per XMVECTOR, position, velocity and the three covariance terms of each
+//  stream, and one shared timestamp. A zero input restarts that stream, a gap in time restarts all of them.
+template<size_t StreamCount>
+class FilterKalmanConstantVelocityBatch
+{
+public:
+
+	static const size_t GroupCount = (StreamCount + 3) / 4;
+
+	FilterKalmanConstantVelocityBatch() { SetParameters(); }
+
+	// Same parameters as FilterKalmanConstantVelocity, shared by all streams
+	void SetParameters(float processNoise = 2.0f, float measurementNoise = 0.006f, float maxPredictionTime = 0.05f)
+	{
+		m_processNoise = processNoise;
+		m_measurementVariance = measurementNoise * measurementNoise;
+		m_maxPredictionTime = maxPredictionTime;
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (size_t group = 0; group < GroupCount; ++group)
+		{
+			for (size_t component = 0; component < 3; ++component)
+			{
+				m_positions[component][group] = XMVectorZero();
+				m_velocities[component][group] = XMVectorZero();
+			}
+			m_positionVariances[group] = XMVectorZero();
+			m_covariances[group] = XMVectorZero();
+			m_velocityVariances[group] = XMVectorZero();
+		}
+		memset(m_frameCounts, 0, sizeof(m_frameCounts));
+		m_timestamp = 0;
+	}
+
+	// newRawPositions holds one value per stream, timestamp is in 100 ns ticks
+	void Update(const XMVECTOR* newRawPositions, long long timestamp)
+	{
+		const XMVECTOR zero = XMVectorZero();
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR countOne = XMVectorSetInt(1, 1, 1, 1);
+
+		float deltaTime = (float)(timestamp - m_timestamp) * 1e-7f;
+		bool isGap = (deltaTime <= 0.0f || deltaTime > s_maxDeltaTime);
+		if (isGap)
+			deltaTime = 0.0f;	// Every stream restarts, this only keeps the discarded math finite
+
+		const XMVECTOR restartAll = isGap ? XMVectorTrueInt() : XMVectorFalseInt();
+		const XMVECTOR deltaTimeVector = XMVectorReplicate(deltaTime);
+		const XMVECTOR twoDeltaTime = XMVectorReplicate(2.0f * deltaTime);
+		const XMVECTOR positionNoise = XMVectorReplicate(m_processNoise * deltaTime * deltaTime * deltaTime / 3.0f);
+		const XMVECTOR covarianceNoise = XMVectorReplicate(m_processNoise * deltaTime * deltaTime * 0.5f);
+		const XMVECTOR velocityNoise = XMVectorReplicate(m_processNoise * deltaTime);
+		const XMVECTOR measurementVariance = XMVectorReplicate(m_measurementVariance);
+		const XMVECTOR initialVelocityVariance = XMVectorReplicate(s_initialVelocityVariance);
+
+		for (size_t group = 0; group < GroupCount; ++group)
+		{
+			XMVECTOR raw[3];
+			Transpose(newRawPositions, group, raw);
+
+			// If joint is invalid, reset the filter
+			XMVECTOR isInvalid = XMVectorAndInt(XMVectorAndInt(XMVectorEqual(raw[0], zero), XMVectorEqual(raw[1], zero)), XMVectorEqual(raw[2], zero));
+			XMVECTOR isRestart = XMVectorOrInt(XMVectorOrInt(isInvalid, restartAll), XMVectorEqualInt(XMLoadInt4(&m_frameCounts[group * 4]), zero));
+
+			// Predict
+			XMVECTOR positionVariance = m_positionVariances[group];
+			XMVECTOR covariance = m_covariances[group];
+			XMVECTOR velocityVariance = m_velocityVariances[group];
+			positionVariance += twoDeltaTime * covariance + deltaTimeVector * deltaTimeVector * velocityVariance + positionNoise;
+			covariance += deltaTimeVector * velocityVariance + covarianceNoise;
+			velocityVariance += velocityNoise;
+
+			// Correct
+			XMVECTOR innovationVariance = positionVariance + measurementVariance;
+			XMVECTOR positionGain = positionVariance / innovationVariance;
+			XMVECTOR velocityGain = covariance / innovationVariance;
+
+			for (size_t component = 0; component < 3; ++component)
+			{
+				XMVECTOR position = m_positions[component][group] + m_velocities[component][group] * deltaTimeVector;
+				XMVECTOR innovation = raw[component] - position;
+				XMVECTOR velocity = m_velocities[component][group] + innovation * velocityGain;
+				position += innovation * positionGain;
+
+				m_positions[component][group] = XMVectorSelect(position, raw[component], isRestart);
+				m_velocities[component][group] = XMVectorSelect(velocity, zero, isRestart);
+			}
+
+			velocityVariance -= velocityGain * covariance;
+			positionVariance *= (one - positionGain);
+			covariance *= (one - positionGain);
+
+			// Velocity is unknown after a restart, so its variance starts large
+			m_positionVariances[group] = XMVectorSelect(positionVariance, measurementVariance, isRestart);
+			m_covariances[group] = XMVectorSelect(covariance, zero, isRestart);
+			m_velocityVariances[group] = XMVectorSelect(velocityVariance, initialVelocityVariance, isRestart);
+
+			XMVECTOR frameCounts = XMVectorSelect(XMVectorAddInt(XMLoadInt4(&m_frameCounts[group * 4]), countOne), countOne, isRestart);
+			XMStoreInt4(&m_frameCounts[group * 4], frameCounts);
+		}
+
+		m_timestamp = timestamp;
+	}
+
+	XMVECTOR GetFilteredValue(size_t stream) const { return XMVectorSetW(Gather(m_positions, stream), 1.0f); }
+	XMVECTOR GetVelocity(size_t stream) const { return Gather(m_velocities, stream); }	// Meters per second
+
+	// Runs the motion model of a stream forward to timestamp (usually the predicted display time)
+	XMVECTOR GetPredictedValue(size_t stream, long long timestamp) const
+	{
+		float predictionTime = (float)(timestamp - m_timestamp) * 1e-7f;
+		predictionTime = XMMax(0.0f, XMMin(predictionTime, m_maxPredictionTime));
+
+		return GetFilteredValue(stream) + GetVelocity(stream) * predictionTime;
+	}
+
+private:
+	static constexpr float s_maxDeltaTime = 0.25f;
+	static constexpr float s_initialVelocityVariance = 1.0f;
+
+	// Four streams of a group into x, y and z lanes, missing streams in the last group are treated as invalid
+	static void Transpose(const XMVECTOR* values, size_t group, XMVECTOR components[3])
+	{
+		XMMATRIX streams;
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			size_t stream = group * 4 + lane;
+			streams.r[lane] = (stream < StreamCount) ? values[stream] : XMVectorZero();
+		}
+		streams = XMMatrixTranspose(streams);
+
+		components[0] = streams.r[0];
+		components[1] = streams.r[1];
+		components[2] = streams.r[2];
+	}
+
+	static XMVECTOR Gather(const XMVECTOR components[3][GroupCount], size_t stream)
+	{
+		size_t group = stream / 4;
+		size_t lane = stream % 4;
+		return XMVectorSet(XMVectorGetByIndex(components[0][group], lane), XMVectorGetByIndex(components[1][group], lane), XMVectorGetByIndex(components[2][group], lane), 0.0f);
+	}
+
+	XMVECTOR m_positions[3][GroupCount];
+	XMVECTOR m_velocities[3][GroupCount];
+	XMVECTOR m_positionVariances[GroupCount];
+	XMVECTOR m_covariances[GroupCount];
+	XMVECTOR m_velocityVariances[GroupCount];
+	uint32_t m_frameCounts[GroupCount * 4];
+	long long m_timestamp;
+
+	float m_processNoise;
+	float m_measurementVariance;
+	float m_maxPredictionTime;
+};
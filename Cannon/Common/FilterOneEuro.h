@@ -0,0 +1,109 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// One Euro filter (Casiez et al. 2012): a low pass filter whose cutoff rises with speed.
+// Slow movements get heavy smoothing (no jitter), fast movements a high cutoff (little lag).
+// Timestamps are in 100 ns ticks, the same clock as the perception timestamps used by MixedReality.
+
+class FilterOneEuro
+{
+public:
+	FilterOneEuro() { SetParameters(); }
+
+	void SetParameters(float minCutoff = 1.0f, float beta = 5.0f, float derivativeCutoff = 1.0f, float maxPredictionTime = 0.05f)
+	{
+		m_minCutoff = minCutoff;					// Cutoff in Hz when not moving. Jitters when too high, lags when too low
+		m_beta = beta;								// Cutoff increase per m/s of speed. Lags on fast movements when too low
+		m_derivativeCutoff = derivativeCutoff;		// Cutoff in Hz of the speed estimate
+		m_maxPredictionTime = maxPredictionTime;	// Longest extrapolation in seconds. Overshoots on stops when too high
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_filteredValue = XMVectorZero();
+		m_velocity = XMVectorZero();
+		m_timestamp = 0;
+		m_frameCount = 0;
+	}
+
+	void Update(const XMVECTOR& newRawPosition, long long timestamp)
+	{
+		// If joint is invalid, reset the filter
+		if (XMVector3Equal(newRawPosition, XMVectorZero()))
+		{
+			m_frameCount = 0;
+		}
+
+		float deltaTime = (float)(timestamp - m_timestamp) * 1e-7f;
+
+		// Restart after the first frame or a gap in tracking
+		if (m_frameCount == 0 || deltaTime <= 0.0f || deltaTime > s_maxDeltaTime)
+		{
+			m_filteredValue = XMVectorSetW(newRawPosition, 1.0f);
+			m_velocity = XMVectorZero();
+			m_timestamp = timestamp;
+			m_frameCount = 1;
+			return;
+		}
+
+		XMVECTOR rawVelocity = (newRawPosition - m_filteredValue) / deltaTime;
+		m_velocity = XMVectorLerp(m_velocity, rawVelocity, Alpha(m_derivativeCutoff, deltaTime));
+
+		float speed = XMVectorGetX(XMVector3Length(m_velocity));
+		float cutoff = m_minCutoff + m_beta * speed;
+
+		m_filteredValue = XMVectorSetW(XMVectorLerp(m_filteredValue, newRawPosition, Alpha(cutoff, deltaTime)), 1.0f);
+		m_velocity = XMVectorSetW(m_velocity, 0.0f);
+		m_timestamp = timestamp;
+		++m_frameCount;
+	}
+
+	XMVECTOR GetFilteredValue() const { return m_filteredValue; }
+	XMVECTOR GetVelocity() const { return m_velocity; }	// Meters per second
+
+	// Extrapolates the filtered value to timestamp (usually the predicted display time) along the smoothed velocity
+	XMVECTOR GetPredictedValue(long long timestamp) const
+	{
+		float predictionTime = (float)(timestamp - m_timestamp) * 1e-7f;
+		predictionTime = XMMax(0.0f, XMMin(predictionTime, m_maxPredictionTime));
+
+		return m_filteredValue + m_velocity * predictionTime;
+	}
+
+private:
+	static constexpr float s_maxDeltaTime = 0.25f;
+
+	// Smoothing factor of an exponential filter with the given cutoff frequency
+	static float Alpha(float cutoff, float deltaTime)
+	{
+		float tau = 1.0f / (XM_2PI * cutoff);
+		return 1.0f / (1.0f + tau / deltaTime);
+	}
+
+	XMVECTOR m_filteredValue;
+	XMVECTOR m_velocity;
+	long long m_timestamp;
+	unsigned m_frameCount;
+
+	float m_minCutoff;
+	float m_beta;
+	float m_derivativeCutoff;
+	float m_maxPredictionTime;
+};
@@ -0,0 +1,165 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstring>
+
+using namespace DirectX;
+
+// FilterOneEuro for a fixed number of streams that are sampled together, such as the joints of one hand.
+// Like FilterDoubleExponentialBatch, state is kept as structure of arrays with four streams per XMVECTOR, and only
+//  the state: filtered value and velocity per stream, plus the one timestamp all streams share.
+// Each stream follows FilterOneEuro: a zero input restarts that stream, a gap in time restarts all of them.
+template<size_t StreamCount>
+class FilterOneEuroBatch
+{
+public:
+
+	static const size_t GroupCount = (StreamCount + 3) / 4;
+
+	FilterOneEuroBatch() { SetParameters(); }
+
+	// Same parameters as FilterOneEuro, shared by all streams
+	void SetParameters(float minCutoff = 1.0f, float beta = 5.0f, float derivativeCutoff = 1.0f, float maxPredictionTime = 0.05f)
+	{
+		m_minCutoff = minCutoff;
+		m_beta = beta;
+		m_derivativeCutoff = derivativeCutoff;
+		m_maxPredictionTime = maxPredictionTime;
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (size_t group = 0; group < GroupCount; ++group)
+		{
+			for (size_t component = 0; component < 3; ++component)
+			{
+				m_filteredPositions[component][group] = XMVectorZero();
+				m_velocities[component][group] = XMVectorZero();
+			}
+		}
+		memset(m_frameCounts, 0, sizeof(m_frameCounts));
+		m_timestamp = 0;
+	}
+
+	// newRawPositions holds one value per stream, timestamp is in 100 ns ticks
+	void Update(const XMVECTOR* newRawPositions, long long timestamp)
+	{
+		const XMVECTOR zero = XMVectorZero();
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR countOne = XMVectorSetInt(1, 1, 1, 1);
+
+		float deltaTime = (float)(timestamp - m_timestamp) * 1e-7f;
+		bool isGap = (deltaTime <= 0.0f || deltaTime > s_maxDeltaTime);
+		if (isGap)
+			deltaTime = 1.0f;	// Every stream restarts, this only keeps the discarded math finite
+
+		const XMVECTOR restartAll = isGap ? XMVectorTrueInt() : XMVectorFalseInt();
+		const XMVECTOR derivativeAlpha = XMVectorReplicate(Alpha(m_derivativeCutoff, deltaTime));
+		const XMVECTOR inverseDeltaTime = XMVectorReplicate(1.0f / deltaTime);
+		const XMVECTOR minCutoff = XMVectorReplicate(m_minCutoff);
+		const XMVECTOR beta = XMVectorReplicate(m_beta);
+		const XMVECTOR tauScale = XMVectorReplicate(1.0f / (XM_2PI * deltaTime));
+
+		for (size_t group = 0; group < GroupCount; ++group)
+		{
+			XMVECTOR raw[3];
+			Transpose(newRawPositions, group, raw);
+
+			// If joint is invalid, reset the filter
+			XMVECTOR isInvalid = XMVectorAndInt(XMVectorAndInt(XMVectorEqual(raw[0], zero), XMVectorEqual(raw[1], zero)), XMVectorEqual(raw[2], zero));
+			XMVECTOR isRestart = XMVectorOrInt(XMVectorOrInt(isInvalid, restartAll), XMVectorEqualInt(XMLoadInt4(&m_frameCounts[group * 4]), zero));
+
+			XMVECTOR velocity[3];
+			for (size_t component = 0; component < 3; ++component)
+			{
+				XMVECTOR rawVelocity = (raw[component] - m_filteredPositions[component][group]) * inverseDeltaTime;
+				velocity[component] = XMVectorLerpV(m_velocities[component][group], rawVelocity, derivativeAlpha);
+			}
+
+			// Cutoff rises with speed, alpha = 1 / (1 + tau / deltaTime) with tau = 1 / (2 pi cutoff)
+			XMVECTOR speed = XMVectorSqrt(velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2]);
+			XMVECTOR cutoff = minCutoff + beta * speed;
+			XMVECTOR alpha = one / (one + tauScale / cutoff);
+
+			for (size_t component = 0; component < 3; ++component)
+			{
+				XMVECTOR filtered = XMVectorLerpV(m_filteredPositions[component][group], raw[component], alpha);
+				m_filteredPositions[component][group] = XMVectorSelect(filtered, raw[component], isRestart);
+				m_velocities[component][group] = XMVectorSelect(velocity[component], zero, isRestart);
+			}
+
+			XMVECTOR frameCounts = XMVectorSelect(XMVectorAddInt(XMLoadInt4(&m_frameCounts[group * 4]), countOne), countOne, isRestart);
+			XMStoreInt4(&m_frameCounts[group * 4], frameCounts);
+		}
+
+		m_timestamp = timestamp;
+	}
+
+	XMVECTOR GetFilteredValue(size_t stream) const { return XMVectorSetW(Gather(m_filteredPositions, stream), 1.0f); }
+	XMVECTOR GetVelocity(size_t stream) const { return Gather(m_velocities, stream); }	// Meters per second
+
+	// Extrapolates the filtered value of a stream to timestamp (usually the predicted display time) along its smoothed velocity
+	XMVECTOR GetPredictedValue(size_t stream, long long timestamp) const
+	{
+		float predictionTime = (float)(timestamp - m_timestamp) * 1e-7f;
+		predictionTime = XMMax(0.0f, XMMin(predictionTime, m_maxPredictionTime));
+
+		return GetFilteredValue(stream) + GetVelocity(stream) * predictionTime;
+	}
+
+private:
+	static constexpr float s_maxDeltaTime = 0.25f;
+
+	static float Alpha(float cutoff, float deltaTime)
+	{
+		float tau = 1.0f / (XM_2PI * cutoff);
+		return 1.0f / (1.0f + tau / deltaTime);
+	}
+
+	// Four streams of a group into x, y and z lanes, missing streams in the last group are treated as invalid
+	static void Transpose(const XMVECTOR* values, size_t group, XMVECTOR components[3])
+	{
+		XMMATRIX streams;
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			size_t stream = group * 4 + lane;
+			streams.r[lane] = (stream < StreamCount) ? values[stream] : XMVectorZero();
+		}
+		streams = XMMatrixTranspose(streams);
+
+		components[0] = streams.r[0];
+		components[1] = streams.r[1];
+		components[2] = streams.r[2];
+	}
+
+	static XMVECTOR Gather(const XMVECTOR components[3][GroupCount], size_t stream)
+	{
+		size_t group = stream / 4;
+		size_t lane = stream % 4;
+		return XMVectorSet(XMVectorGetByIndex(components[0][group], lane), XMVectorGetByIndex(components[1][group], lane), XMVectorGetByIndex(components[2][group], lane), 0.0f);
+	}
+
+	XMVECTOR m_filteredPositions[3][GroupCount];
+	XMVECTOR m_velocities[3][GroupCount];
+	uint32_t m_frameCounts[GroupCount * 4];
+	long long m_timestamp;
+
+	float m_minCutoff;
+	float m_beta;
+	float m_derivativeCutoff;
+	float m_maxPredictionTime;
+};
@@ -0,0 +1,51 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <cassert>
+
+// Stack of up to Capacity values held in place, for the render state stacks that are pushed and popped around
+//  every few draws. Same interface as the std::stack it stands in for, without ever allocating.
+// A push past the capacity asserts and is dropped, as is a pop of an empty stack.
+template<typename T, unsigned Capacity>
+class FixedStack
+{
+public:
+
+	FixedStack() : m_size(0) {}
+
+	void push(const T& value)
+	{
+		assert(m_size < Capacity);
+		if (m_size < Capacity)
+			m_values[m_size++] = value;
+	}
+
+	void pop()
+	{
+		assert(m_size > 0);
+		if (m_size > 0)
+			--m_size;
+	}
+
+	T& top() { assert(m_size > 0); return m_values[m_size - 1]; }
+	const T& top() const { assert(m_size > 0); return m_values[m_size - 1]; }
+
+	bool empty() const { return m_size == 0; }
+	unsigned size() const { return m_size; }
+
+private:
+
+	T m_values[Capacity];
+	unsigned m_size;
+};
@@ -0,0 +1,206 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "JointHistory.h"
+
+// Velocity and acceleration of every stream of a JointHistory, from a Savitzky-Golay fit over the last few frames.
+// A quadratic is least squares fit to each stream over the window and differentiated at the newest frame, which
+//  smooths far better than finite differences while adding no lag at the newest frame.
+// The fit only depends on the frame spacing, so the kernel is computed once per window size and then applied to all
+//  streams in one pass over the structure of arrays frames (a multiply add per component per stream per frame).
+// Frames are assumed evenly spaced, the interval is the average over the window.
+template<size_t StreamCount, size_t Capacity>
+class JointDerivatives
+{
+public:
+
+	JointDerivatives() :
+		m_windowSize(7),
+		m_kernelFrameCount(0)
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (size_t component = 0; component < 3; ++component)
+		{
+			for (size_t stream = 0; stream < StreamCount; ++stream)
+			{
+				m_velocities[component][stream] = 0.0f;
+				m_accelerations[component][stream] = 0.0f;
+			}
+		}
+	}
+
+	// Frames in the fit. Larger is smoother but follows sudden changes more slowly.
+	void SetWindowSize(unsigned windowSize)
+	{
+		m_windowSize = std::min(std::max(windowSize, 3u), (unsigned)Capacity);
+		m_kernelFrameCount = 0;
+	}
+
+	unsigned GetWindowSize() const { return m_windowSize; }
+
+	// Call once per new frame in history
+	void Update(const JointHistory<StreamCount, Capacity, 3>& history)
+	{
+		unsigned frameCount = std::min(history.GetFrameCount(), m_windowSize);
+		if (frameCount < 2)
+		{
+			Reset();
+			return;
+		}
+
+		float frameInterval = (float)(history.GetFrame(0).timestamp - history.GetFrame(frameCount - 1).timestamp) * 1e-7f / (float)(frameCount - 1);
+		if (frameInterval <= 0.0f)
+		{
+			Reset();
+			return;
+		}
+
+		if (frameCount != m_kernelFrameCount)
+			BuildKernel(frameCount);
+
+		Reset();
+
+		for (unsigned framesAgo = 0; framesAgo < frameCount; ++framesAgo)
+		{
+			const auto& frame = history.GetFrame(framesAgo);
+			float velocityWeight = m_velocityKernel[framesAgo] / frameInterval;
+			float accelerationWeight = m_accelerationKernel[framesAgo] / (frameInterval * frameInterval);
+
+			for (size_t component = 0; component < 3; ++component)
+			{
+				const float* values = frame.components[component];
+				float* velocities = m_velocities[component];
+				float* accelerations = m_accelerations[component];
+
+				for (size_t stream = 0; stream < StreamCount; ++stream)
+				{
+					velocities[stream] += velocityWeight * values[stream];
+					accelerations[stream] += accelerationWeight * values[stream];
+				}
+			}
+		}
+	}
+
+	// Meters per second, w is zero
+	XMVECTOR GetVelocity(size_t stream) const
+	{
+		if (stream >= StreamCount)
+			return XMVectorZero();
+
+		return XMVectorSet(m_velocities[0][stream], m_velocities[1][stream], m_velocities[2][stream], 0.0f);
+	}
+
+	// Meters per second squared, w is zero
+	XMVECTOR GetAcceleration(size_t stream) const
+	{
+		if (stream >= StreamCount)
+			return XMVectorZero();
+
+		return XMVectorSet(m_accelerations[0][stream], m_accelerations[1][stream], m_accelerations[2][stream], 0.0f);
+	}
+
+private:
+
+	// Fits x(s) = a0 + a1 s + a2 s^2 to samples at s = 0, -1, -2, ... (newest first) by least squares.
+	// Velocity is a1 and acceleration 2 a2, both linear in the samples, so the kernels are the matching rows of (A^T A)^-1 A^T.
+	// Two frames only allow a line, so that falls back to a plain difference with no acceleration.
+	void BuildKernel(unsigned frameCount)
+	{
+		m_kernelFrameCount = frameCount;
+
+		if (frameCount == 2)
+		{
+			m_velocityKernel[0] = 1.0f;
+			m_velocityKernel[1] = -1.0f;
+			m_accelerationKernel[0] = 0.0f;
+			m_accelerationKernel[1] = 0.0f;
+			return;
+		}
+
+		// Normal matrix of the fit, entries are sums of powers of s
+		double powerSums[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+		for (unsigned framesAgo = 0; framesAgo < frameCount; ++framesAgo)
+		{
+			double s = -(double)framesAgo;
+			double power = 1.0;
+			for (size_t i = 0; i < 5; ++i)
+			{
+				powerSums[i] += power;
+				power *= s;
+			}
+		}
+
+		double normal[3][3];
+		for (size_t row = 0; row < 3; ++row)
+		{
+			for (size_t column = 0; column < 3; ++column)
+				normal[row][column] = powerSums[row + column];
+		}
+
+		double inverse[3][3];
+		Invert3x3(normal, inverse);
+
+		for (unsigned framesAgo = 0; framesAgo < frameCount; ++framesAgo)
+		{
+			double s = -(double)framesAgo;
+			double basis[3] = { 1.0, s, s * s };
+
+			double a1 = 0.0, a2 = 0.0;
+			for (size_t i = 0; i < 3; ++i)
+			{
+				a1 += inverse[1][i] * basis[i];
+				a2 += inverse[2][i] * basis[i];
+			}
+
+			m_velocityKernel[framesAgo] = (float)a1;
+			m_accelerationKernel[framesAgo] = (float)(2.0 * a2);
+		}
+	}
+
+	static void Invert3x3(const double m[3][3], double inverse[3][3])
+	{
+		double cofactors[3][3];
+		cofactors[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+		cofactors[0][1] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+		cofactors[0][2] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+		cofactors[1][0] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+		cofactors[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+		cofactors[1][2] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+		cofactors[2][0] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+		cofactors[2][1] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+		cofactors[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+		double determinant = m[0][0] * cofactors[0][0] + m[0][1] * cofactors[0][1] + m[0][2] * cofactors[0][2];
+		assert(determinant != 0.0);
+
+		// m is symmetric, so the adjugate is the cofactor matrix itself
+		for (size_t row = 0; row < 3; ++row)
+		{
+			for (size_t column = 0; column < 3; ++column)
+				inverse[row][column] = cofactors[row][column] / determinant;
+		}
+	}
+
+	unsigned m_windowSize;
+	unsigned m_kernelFrameCount;
+	float m_velocityKernel[Capacity];
+	float m_accelerationKernel[Capacity];
+
+	float m_velocities[3][StreamCount];
+	float m_accelerations[3][StreamCount];
+};
@@ -0,0 +1,99 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cassert>
+
+using namespace DirectX;
+
+// Ring buffer of the last Capacity frames for a fixed set of streams (e.g. all joints of a hand).
+// Each frame is one contiguous block laid out as structure of arrays (all x, then all y, ...), so reading every
+//  stream for a given frame touches a single small block. Capacity must be a power of two, wrapping is a mask.
+// ComponentCount is 3 for positions (read back with w = 1) or 4 for quaternions.
+template<size_t StreamCount, size_t Capacity, size_t ComponentCount = 3>
+class JointHistory
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+	static_assert(ComponentCount == 3 || ComponentCount == 4, "Only 3 or 4 components are supported");
+
+public:
+
+	struct Frame
+	{
+		float components[ComponentCount][StreamCount];
+		long long timestamp;
+	};
+
+	JointHistory() { Reset(); }
+
+	void Reset()
+	{
+		m_newestFrame = 0;
+		m_frameCount = 0;
+	}
+
+	// values holds one vector per stream
+	void Record(const XMVECTOR* values, long long timestamp)
+	{
+		m_newestFrame = (m_newestFrame + 1) & s_mask;
+		if (m_frameCount < Capacity)
+			++m_frameCount;
+
+		Frame& frame = m_frames[m_newestFrame];
+		for (size_t stream = 0; stream < StreamCount; ++stream)
+		{
+			XMFLOAT4 value;
+			XMStoreFloat4(&value, values[stream]);
+			frame.components[0][stream] = value.x;
+			frame.components[1][stream] = value.y;
+			frame.components[2][stream] = value.z;
+			if constexpr (ComponentCount == 4)
+				frame.components[3][stream] = value.w;
+		}
+		frame.timestamp = timestamp;
+	}
+
+	unsigned GetFrameCount() const { return m_frameCount; }
+	static constexpr unsigned GetCapacity() { return (unsigned)Capacity; }
+
+	// framesAgo is clamped to the oldest recorded frame, there must be at least one
+	const Frame& GetFrame(unsigned framesAgo) const
+	{
+		assert(m_frameCount > 0);
+		framesAgo = std::min(framesAgo, m_frameCount - 1);
+		return m_frames[(m_newestFrame - framesAgo) & s_mask];
+	}
+
+	// Returns zero until something was recorded
+	XMVECTOR GetValue(size_t stream, unsigned framesAgo = 0) const
+	{
+		if (m_frameCount == 0 || stream >= StreamCount)
+			return XMVectorZero();
+
+		const Frame& frame = GetFrame(framesAgo);
+		if constexpr (ComponentCount == 4)
+			return XMVectorSet(frame.components[0][stream], frame.components[1][stream], frame.components[2][stream], frame.components[3][stream]);
+		else
+			return XMVectorSet(frame.components[0][stream], frame.components[1][stream], frame.components[2][stream], 1.0f);
+	}
+
+private:
+
+	static const unsigned s_mask = (unsigned)Capacity - 1;
+
+	Frame m_frames[Capacity];
+	unsigned m_newestFrame;
+	unsigned m_frameCount;
+};
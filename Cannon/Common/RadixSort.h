@@ -0,0 +1,72 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+struct RadixSortEntry
+{
+	uint64_t key;
+	uint32_t value;
+};
+
+// Stable least significant digit radix sort of 64 bit keys, ascending, a byte per pass.
+// The histograms of all eight digits are built in one read of the keys, and a pass whose digit is the same for every
+//  key is skipped, so keys that only use some of their bits (as sort keys built from small ids do) take fewer passes.
+// scratch is resized as needed, keep it around between calls to avoid reallocating.
+inline void RadixSort(std::vector<RadixSortEntry>& entries, std::vector<RadixSortEntry>& scratch)
+{
+	const size_t count = entries.size();
+	if (count < 2)
+		return;
+
+	uint32_t histograms[8][256] = {};
+	for (const RadixSortEntry& entry : entries)
+	{
+		for (unsigned digit = 0; digit < 8; ++digit)
+			++histograms[digit][(entry.key >> (digit * 8)) & 0xff];
+	}
+
+	scratch.resize(count);
+	std::vector<RadixSortEntry>* source = &entries;
+	std::vector<RadixSortEntry>* destination = &scratch;
+
+	for (unsigned digit = 0; digit < 8; ++digit)
+	{
+		uint32_t* histogram = histograms[digit];
+		unsigned shift = digit * 8;
+
+		if (histogram[((*source)[0].key >> shift) & 0xff] == count)
+			continue;
+
+		// Counts to starting offsets
+		uint32_t offset = 0;
+		for (unsigned bucket = 0; bucket < 256; ++bucket)
+		{
+			uint32_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+
+		for (const RadixSortEntry& entry : *source)
+			(*destination)[histogram[(entry.key >> shift) & 0xff]++] = entry;
+
+		std::swap(source, destination);
+	}
+
+	if (source != &entries)
+		entries.swap(scratch);
+}
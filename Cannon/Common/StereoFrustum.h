@@ -0,0 +1,237 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <DirectXMath.h>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+// View frustum of both eyes, in world space, for culling.
+// Built from the view projection matrix of each eye. Where a plane of one eye also bounds the other eye, as the
+//  outer side planes and, for parallel eyes, the near, far, top and bottom planes do, the two frusta merge into a
+//  single one of six planes. Otherwise both frusta are kept and a volume is visible if it is in either.
+// Planes are stored four at a time, x, y, z and w of each in their own vector, so a test takes a plane per lane.
+class StereoFrustum
+{
+public:
+
+	StereoFrustum()
+	{
+		m_frustumCount = 1;
+		for (auto& group : m_planeGroups)
+			group = { XMVectorZero(), XMVectorZero(), XMVectorZero(), XMVectorSplatOne() };	// Everything is inside
+	}
+
+	void Build(FXMMATRIX leftViewProjection, CXMMATRIX rightViewProjection)
+	{
+		XMVECTOR planes[2][6];
+		ExtractPlanes(leftViewProjection, planes[0]);
+		ExtractPlanes(rightViewProjection, planes[1]);
+
+		bool isMono = memcmp(&leftViewProjection, &rightViewProjection, sizeof(XMMATRIX)) == 0;
+		if (isMono)
+		{
+			SetPlanes(0, planes[0]);
+			m_frustumCount = 1;
+			return;
+		}
+
+		XMVECTOR corners[2][8];
+		if (GetCorners(leftViewProjection, corners[0]) && GetCorners(rightViewProjection, corners[1]))
+		{
+			XMVECTOR combined[6];
+			bool isCombined = true;
+			for (unsigned planeIndex = 0; planeIndex < 6 && isCombined; ++planeIndex)
+			{
+				if (ContainsCorners(planes[0][planeIndex], corners[1]))
+					combined[planeIndex] = planes[0][planeIndex];
+				else if (ContainsCorners(planes[1][planeIndex], corners[0]))
+					combined[planeIndex] = planes[1][planeIndex];
+				else
+					isCombined = false;
+			}
+
+			if (isCombined)
+			{
+				SetPlanes(0, combined);
+				m_frustumCount = 1;
+				return;
+			}
+		}
+
+		SetPlanes(0, planes[0]);
+		SetPlanes(1, planes[1]);
+		m_frustumCount = 2;
+	}
+
+	bool IsCombined() const { return m_frustumCount == 1; }
+
+	// Box given by its center and extents in the space transform takes to world space, e.g. a mesh bounding box
+	bool IntersectsBox(FXMVECTOR center, FXMVECTOR extents, CXMMATRIX transform) const
+	{
+		XMVECTOR worldCenter = XMVector3Transform(center, transform);
+		XMVECTOR axes[3] =
+		{
+			XMVectorScale(transform.r[0], XMVectorGetX(extents)),
+			XMVectorScale(transform.r[1], XMVectorGetY(extents)),
+			XMVectorScale(transform.r[2], XMVectorGetZ(extents)),
+		};
+
+		XMVECTOR centerX = XMVectorSplatX(worldCenter);
+		XMVECTOR centerY = XMVectorSplatY(worldCenter);
+		XMVECTOR centerZ = XMVectorSplatZ(worldCenter);
+
+		for (unsigned frustumIndex = 0; frustumIndex < m_frustumCount; ++frustumIndex)
+		{
+			bool isOutside = false;
+			for (unsigned groupIndex = frustumIndex * 2; groupIndex < frustumIndex * 2 + 2 && !isOutside; ++groupIndex)
+			{
+				const PlaneGroup& group = m_planeGroups[groupIndex];
+				XMVECTOR distance = XMVectorMultiplyAdd(group.x, centerX, XMVectorMultiplyAdd(group.y, centerY, XMVectorMultiplyAdd(group.z, centerZ, group.w)));
+
+				// Projection of the box on each plane normal
+				XMVECTOR radius = XMVectorZero();
+				for (const XMVECTOR& axis : axes)
+				{
+					XMVECTOR projected = XMVectorMultiplyAdd(group.x, XMVectorSplatX(axis), XMVectorMultiplyAdd(group.y, XMVectorSplatY(axis), XMVectorMultiply(group.z, XMVectorSplatZ(axis))));
+					radius = XMVectorAdd(radius, XMVectorAbs(projected));
+				}
+
+				isOutside = XMComparisonAnyTrue(XMVector4GreaterR(XMVectorZero(), XMVectorAdd(distance, radius)));
+			}
+
+			if (!isOutside)
+				return true;
+		}
+
+		return false;
+	}
+
+	bool IntersectsSphere(FXMVECTOR center, float radius) const
+	{
+		XMVECTOR centerX = XMVectorSplatX(center);
+		XMVECTOR centerY = XMVectorSplatY(center);
+		XMVECTOR centerZ = XMVectorSplatZ(center);
+		XMVECTOR radiusVector = XMVectorReplicate(radius);
+
+		for (unsigned frustumIndex = 0; frustumIndex < m_frustumCount; ++frustumIndex)
+		{
+			bool isOutside = false;
+			for (unsigned groupIndex = frustumIndex * 2; groupIndex < frustumIndex * 2 + 2 && !isOutside; ++groupIndex)
+			{
+				const PlaneGroup& group = m_planeGroups[groupIndex];
+				XMVECTOR distance = XMVectorMultiplyAdd(group.x, centerX, XMVectorMultiplyAdd(group.y, centerY, XMVectorMultiplyAdd(group.z, centerZ, group.w)));
+				isOutside = XMComparisonAnyTrue(XMVector4GreaterR(XMVectorZero(), XMVectorAdd(distance, radiusVector)));
+			}
+
+			if (!isOutside)
+				return true;
+		}
+
+		return false;
+	}
+
+private:
+
+	struct PlaneGroup
+	{
+		XMVECTOR x;
+		XMVECTOR y;
+		XMVECTOR z;
+		XMVECTOR w;
+	};
+
+	PlaneGroup m_planeGroups[4];	// Two per frustum, six planes and two that everything is inside
+	unsigned m_frustumCount;
+
+	// Left, right, bottom, top, near, far, normals pointing inwards (Gribb and Hartmann).
+	// A plane that does not exist, like the far plane of an infinite projection, is one everything is inside.
+	static void ExtractPlanes(FXMMATRIX viewProjection, XMVECTOR planes[6])
+	{
+		XMMATRIX columns = XMMatrixTranspose(viewProjection);
+		planes[0] = XMVectorAdd(columns.r[3], columns.r[0]);
+		planes[1] = XMVectorSubtract(columns.r[3], columns.r[0]);
+		planes[2] = XMVectorAdd(columns.r[3], columns.r[1]);
+		planes[3] = XMVectorSubtract(columns.r[3], columns.r[1]);
+		planes[4] = columns.r[2];
+		planes[5] = XMVectorSubtract(columns.r[3], columns.r[2]);
+
+		for (unsigned planeIndex = 0; planeIndex < 6; ++planeIndex)
+		{
+			float length = XMVectorGetX(XMVector3Length(planes[planeIndex]));
+			if (length > 1e-6f)
+				planes[planeIndex] = XMVectorScale(planes[planeIndex], 1.0f / length);
+			else
+				planes[planeIndex] = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+	}
+
+	// False when the frustum has no finite corners, e.g. with an infinite far plane
+	static bool GetCorners(FXMMATRIX viewProjection, XMVECTOR corners[8])
+	{
+		XMVECTOR determinant;
+		XMMATRIX inverse = XMMatrixInverse(&determinant, viewProjection);
+		if (XMVectorGetX(XMVectorAbs(determinant)) < 1e-12f)
+			return false;
+
+		for (unsigned cornerIndex = 0; cornerIndex < 8; ++cornerIndex)
+		{
+			XMVECTOR clip = XMVectorSet(
+				(cornerIndex & 1) ? 1.0f : -1.0f,
+				(cornerIndex & 2) ? 1.0f : -1.0f,
+				(cornerIndex & 4) ? 1.0f : 0.0f,
+				1.0f);
+
+			XMVECTOR corner = XMVector4Transform(clip, inverse);
+			float w = XMVectorGetW(corner);
+			if (fabsf(w) < 1e-6f)
+				return false;
+
+			corners[cornerIndex] = XMVectorScale(corner, 1.0f / w);
+		}
+
+		return true;
+	}
+
+	static bool ContainsCorners(FXMVECTOR plane, const XMVECTOR corners[8])
+	{
+		const float tolerance = 1e-3f;	// Meters, corners come out of an inverse and are not exact far away
+
+		for (unsigned cornerIndex = 0; cornerIndex < 8; ++cornerIndex)
+		{
+			if (XMVectorGetX(XMPlaneDotCoord(plane, corners[cornerIndex])) < -tolerance)
+				return false;
+		}
+
+		return true;
+	}
+
+	void SetPlanes(unsigned frustumIndex, const XMVECTOR planes[6])
+	{
+		for (unsigned groupIndex = 0; groupIndex < 2; ++groupIndex)
+		{
+			XMVECTOR groupPlanes[4];
+			for (unsigned lane = 0; lane < 4; ++lane)
+			{
+				unsigned planeIndex = groupIndex * 4 + lane;
+				groupPlanes[lane] = planeIndex < 6 ? planes[planeIndex] : XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+			}
+
+			// Transpose four planes into x, y, z and w vectors
+			XMMATRIX transposed = XMMatrixTranspose(XMMATRIX(groupPlanes[0], groupPlanes[1], groupPlanes[2], groupPlanes[3]));
+			m_planeGroups[frustumIndex * 2 + groupIndex] = { transposed.r[0], transposed.r[1], transposed.r[2], transposed.r[3] };
+		}
+	}
+};
@@ -0,0 +1,114 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads that stay alive between jobs, for work that is split across threads every update.
+// Start hands job(1) to job(workerCount) to the workers and returns, so the calling thread can run its own share
+//  as job(0) before it Waits. Start and Wait are called from one thread at a time.
+// Only depends on the standard library, like TsdfVolume which uses it.
+class WorkerPool
+{
+public:
+
+	WorkerPool() = default;
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	~WorkerPool()
+	{
+		m_mutex.lock();
+		m_stopping = true;
+		m_mutex.unlock();
+		m_startCondition.notify_all();
+
+		for (auto& worker : m_workers)
+			worker.join();
+	}
+
+	// Starts more workers if needed, and returns without waiting for them
+	void Start(unsigned workerCount, const std::function<void(unsigned)>& job)
+	{
+		m_mutex.lock();
+
+		// A new worker skips the generations before its own, or it would run the previous job
+		while (m_workers.size() < workerCount)
+			m_workers.emplace_back(&WorkerPool::WorkerFunction, this, (unsigned)m_workers.size() + 1, m_generation);
+
+		m_job = job;
+		m_activeWorkerCount = workerCount;
+		m_pendingWorkerCount = workerCount;
+		++m_generation;
+		m_mutex.unlock();
+		m_startCondition.notify_all();
+	}
+
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, [this]() { return m_pendingWorkerCount == 0; });
+	}
+
+	// Runs job(0) to job(threadCount - 1), job(0) on the calling thread, and returns once all of them are done
+	void Run(unsigned threadCount, const std::function<void(unsigned)>& job)
+	{
+		if (threadCount > 1)
+			Start(threadCount - 1, job);
+
+		job(0);
+
+		if (threadCount > 1)
+			Wait();
+	}
+
+private:
+
+	void WorkerFunction(unsigned workerIndex, uint64_t generation)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_startCondition.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+			if (m_stopping)
+				return;
+
+			generation = m_generation;
+			if (workerIndex > m_activeWorkerCount)
+				continue;
+
+			// The job is only replaced by the next Start, which comes after Wait
+			lock.unlock();
+			m_job(workerIndex);
+			lock.lock();
+
+			if (--m_pendingWorkerCount == 0)
+				m_doneCondition.notify_one();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_startCondition;
+	std::condition_variable m_doneCondition;
+	std::function<void(unsigned)> m_job;
+	uint64_t m_generation = 0;
+	unsigned m_activeWorkerCount = 0;
+	unsigned m_pendingWorkerCount = 0;
+	bool m_stopping = false;
+};
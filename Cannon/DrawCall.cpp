@@ -30,6 +30,7 @@ using namespace DirectX;
 
 Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
 Microsoft::WRL::ComPtr<ID3D11DeviceContext> g_d3dContext;
+std::unique_ptr<RenderContext> g_renderContext;		// Where commands go, forwarding to g_d3dContext unless the backend is null
 
 Microsoft::WRL::ComPtr<ID2D1Factory1> g_d2dFactory;
 Microsoft::WRL::ComPtr<ID2D1Device> g_d2dDevice;
@@ -54,13 +55,17 @@ const float DrawCall::DefaultFontSize = 64.0f;
 
 XMMATRIX DrawCall::m_mtxLightViewProj;
 XMMATRIX DrawCall::m_mtxCameraView;
+UploadRing DrawCall::m_uploadRing;
 DrawCall::Projection DrawCall::m_cameraProj;
+bool DrawCall::m_shaderConstantTimingEnabled = false;
 
 XMVECTOR DrawCall::vAmbient;
 DrawCall::Light DrawCall::vLights[kMaxLights];
 unsigned DrawCall::uLightCount = 0;
 unsigned DrawCall::uActiveLightIdx = 0;
 
+RenderBackend DrawCall::m_renderBackend = RenderBackend::D3D11;
+
 bool DrawCall::m_singlePassStereoSupported = false;
 bool DrawCall::m_singlePassStereoEnabled = false;
 
@@ -74,25 +79,20 @@ shared_ptr<Texture2D> DrawCall::m_backBuffer;
 std::map<intptr_t, std::shared_ptr<Texture2D>> DrawCall::m_cachedBackBuffers;
 stack<vector<shared_ptr<Texture2D>>> DrawCall::m_renderTargetStack;
 
-stack<unsigned> DrawCall::m_renderPassIndexStack;
+FixedStack<unsigned, DrawCall::kMaxStateDepth> DrawCall::m_renderPassIndexStack;
 unsigned DrawCall::m_activeRenderPassIndex = 0;
 
-stack<DrawCall::BlendState> DrawCall::m_sAlphaBlendStates;
-stack<bool> DrawCall::m_sDepthTestStates;
-stack<bool> DrawCall::m_sBackfaceCullingStates;
+FixedStack<DrawCall::BlendState, DrawCall::kMaxStateDepth> DrawCall::m_sAlphaBlendStates;
+FixedStack<bool, DrawCall::kMaxStateDepth> DrawCall::m_sDepthTestStates;
+FixedStack<bool, DrawCall::kMaxStateDepth> DrawCall::m_sBackfaceCullingStates;
 
-stack<bool> DrawCall::m_sRightEyePassStates;
-stack<bool> DrawCall::m_sFullscreenPassStates;
+FixedStack<bool, DrawCall::kMaxStateDepth> DrawCall::m_sRightEyePassStates;
+FixedStack<bool, DrawCall::kMaxStateDepth> DrawCall::m_sFullscreenPassStates;
 
 vector<DrawCall::RenderPassDesc> DrawCall::m_vGlobalRenderPasses;
 
 map<string, shared_ptr<Shader>> DrawCall::m_shaderStore;
 
-Microsoft::WRL::ComPtr<ID3D11BlendState> DrawCall::m_d3dAlphaBlendEnabledState;
-Microsoft::WRL::ComPtr<ID3D11BlendState> DrawCall::m_d3dAdditiveBlendEnabledState;
-Microsoft::WRL::ComPtr<ID3D11BlendState> DrawCall::m_d3dColorWriteDisabledState;
-Microsoft::WRL::ComPtr<ID3D11DepthStencilState> DrawCall::m_d3dDepthTestDisabledState;
-Microsoft::WRL::ComPtr<ID3D11RasterizerState> DrawCall::m_d3dBackfaceCullingDisabledState;
 
 vector<D3D11_INPUT_ELEMENT_DESC> g_instancedElements =
 {
@@ -192,12 +192,13 @@ bool DrawCall::InitializeSwapChain(unsigned width, unsigned height, HWND hWnd, b
 
 bool DrawCall::ResizeSwapChain(unsigned newWidth, unsigned newHeight)
 {
-	if (!g_d3dSwapChain || !m_backBuffer || !g_d3dContext)
+	if (!g_d3dSwapChain || !m_backBuffer || !g_renderContext)
 		return false;
 
 	m_backBuffer->Reset();
-	g_d3dContext->OMSetRenderTargets(0, nullptr, nullptr);
-	g_d2dContext->SetTarget(nullptr);
+	g_renderContext->OMSetRenderTargets(0, nullptr, nullptr);
+	if (g_d2dContext)
+		g_d2dContext->SetTarget(nullptr);
 	
 	g_d3dSwapChain->ResizeBuffers(0, newWidth, newHeight, DXGI_FORMAT_UNKNOWN, 0);
 	
@@ -215,11 +216,10 @@ void DrawCall::Uninitialize()
 	m_backBuffer.reset();
 	m_cachedBackBuffers.clear();
 
-	m_d3dAlphaBlendEnabledState.Reset();
-	m_d3dDepthTestDisabledState.Reset();
-	m_d3dAdditiveBlendEnabledState.Reset();
-	m_d3dColorWriteDisabledState.Reset();
-	m_d3dBackfaceCullingDisabledState.Reset();
+	m_pipelineStateCache.clear();
+	ReleaseDeferredRecorders();
+	m_immediateRecorder = Recorder();
+	m_immediateRecorder.appliedPipelineStateKey = kInvalidPipelineStateKey;
 
 	g_d2dFactory.Reset();
 	g_d2dDevice.Reset();
@@ -229,6 +229,7 @@ void DrawCall::Uninitialize()
 	g_textFormats.clear();
 	g_whiteBrush.Reset();
 
+	g_renderContext.reset();
 	g_d3dContext.Reset();
 	g_d3dDevice.Reset();
 	g_d3dSwapChain.Reset();
@@ -244,6 +245,24 @@ ID3D11DeviceContext* DrawCall::GetD3DDeviceContext()
 	return g_d3dContext.Get();
 }
 
+RenderBackend DrawCall::GetRenderBackend()
+{
+	return m_renderBackend;
+}
+
+RenderContext* DrawCall::GetRenderContext()
+{
+	return g_renderContext.get();
+}
+
+NullRenderContext* DrawCall::GetNullRenderContext()
+{
+	if (m_renderBackend != RenderBackend::Null)
+		return nullptr;
+
+	return static_cast<NullRenderContext*>(g_renderContext.get());
+}
+
 IDXGISwapChain1* DrawCall::GetD3DSwapChain()
 {
 	return g_d3dSwapChain.Get();
@@ -360,6 +379,8 @@ shared_ptr<Texture2D> DrawCall::GetBackBuffer()
 
 void DrawCall::SetBackBuffer(shared_ptr<Texture2D> backBuffer)
 {
+	FlushRenderQueue();
+
 	if (m_renderPassIndexStack.empty())
 		m_activeRenderPassIndex = 0;
 
@@ -436,6 +457,8 @@ void DrawCall::PushRenderPass(unsigned renderPassIndex, shared_ptr<Texture2D> re
 
 void DrawCall::PushRenderPass(unsigned renderPassIndex, vector<shared_ptr<Texture2D>> renderTargets)
 {
+	FlushRenderQueue();
+
 	m_renderPassIndexStack.push(renderPassIndex);
 	m_activeRenderPassIndex = renderPassIndex;
 
@@ -448,6 +471,8 @@ void DrawCall::PushRenderPass(unsigned renderPassIndex, vector<shared_ptr<Textur
 
 void DrawCall::PopRenderPass()
 {
+	FlushRenderQueue();
+
 	m_renderPassIndexStack.pop();
 	if (m_renderPassIndexStack.empty())
 		m_activeRenderPassIndex = 0;
@@ -460,11 +485,19 @@ void DrawCall::PopRenderPass()
 	// Clear the shader resource views
 	ID3D11ShaderResourceView* vNullShaderResourceViews[16];
 	memset(vNullShaderResourceViews, 0, sizeof(vNullShaderResourceViews));
-	g_d3dContext->VSSetShaderResources(0, 16, vNullShaderResourceViews);
-	g_d3dContext->PSSetShaderResources(0, 16, vNullShaderResourceViews);
+	g_renderContext->VSSetShaderResources(0, 16, vNullShaderResourceViews);
+	g_renderContext->PSSetShaderResources(0, 16, vNullShaderResourceViews);
+	m_queuedTextures = {};
 }
 
 void DrawCall::SetCurrentRenderTargetsOnD3DDevice()
+{
+	SetCurrentRenderTargetsOnContext(g_renderContext.get());
+	if (g_d2dContext)
+		g_d2dContext->SetTarget(GetCurrentRenderTarget()->GetD2DTargetBitmap());
+}
+
+void DrawCall::SetCurrentRenderTargetsOnContext(RenderContext* context)
 {
 	vector<shared_ptr<Texture2D>> renderTargets;
 
@@ -487,9 +520,8 @@ void DrawCall::SetCurrentRenderTargetsOnD3DDevice()
 	if (renderTargets[0]->IsStereo() && IsRightEyePassActive())
 		pDepthStencilView = renderTargets[0]->GetDepthStencilViewRight();
 
-	g_d3dContext->OMSetRenderTargets((UINT) renderTargetViews.size(), renderTargetViews.data(), pDepthStencilView);
-	g_d3dContext->RSSetViewports(1, &renderTargets[0]->GetViewport());
-	g_d2dContext->SetTarget(renderTargets[0]->GetD2DTargetBitmap());
+	context->OMSetRenderTargets((UINT) renderTargetViews.size(), renderTargetViews.data(), pDepthStencilView);
+	context->RSSetViewports(1, &renderTargets[0]->GetViewport());
 }
 
 bool DrawCall::IsRightEyePassActive()
@@ -499,12 +531,14 @@ bool DrawCall::IsRightEyePassActive()
 
 void DrawCall::PushRightEyePass(unsigned renderPassIndex, shared_ptr<Texture2D> renderTarget)
 {
+	FlushRenderQueue();
 	m_sRightEyePassStates.push(true);
 	PushRenderPass(renderPassIndex, renderTarget);
 }
 
 void DrawCall::PopRightEyePass()
 {
+	FlushRenderQueue();
 	m_sRightEyePassStates.pop();
 	PopRenderPass();
 }
@@ -564,18 +598,11 @@ void DrawCall::PopFullscreenPass()
 	m_sFullscreenPassStates.pop();
 }
 
+// The state stacks only record what later draws want, each draw binds it through ApplyPipelineState,
+//  so a push and pop around draws that are queued or skipped costs nothing on the device
 void DrawCall::PushAlphaBlendState(BlendState blendState)
 {
 	m_sAlphaBlendStates.push(blendState);
-
-	if (m_sAlphaBlendStates.top() == BLEND_ALPHA)
-		g_d3dContext->OMSetBlendState(m_d3dAlphaBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if (m_sAlphaBlendStates.top() == BLEND_ADDITIVE)
-		g_d3dContext->OMSetBlendState(m_d3dAdditiveBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if(m_sAlphaBlendStates.top() == BLEND_COLOR_DISABLED)
-		g_d3dContext->OMSetBlendState(m_d3dColorWriteDisabledState.Get(), nullptr, 0xffffffff);
-	else
-		g_d3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
 }
 
 void DrawCall::PopAlphaBlendState()
@@ -584,25 +611,11 @@ void DrawCall::PopAlphaBlendState()
 		return;
 
 	m_sAlphaBlendStates.pop();
-
-	if (m_sAlphaBlendStates.top() == BLEND_ALPHA)
-		g_d3dContext->OMSetBlendState(m_d3dAlphaBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if (m_sAlphaBlendStates.top() == BLEND_ADDITIVE)
-		g_d3dContext->OMSetBlendState(m_d3dAdditiveBlendEnabledState.Get(), nullptr, 0xffffffff);
-	else if (m_sAlphaBlendStates.top() == BLEND_COLOR_DISABLED)
-		g_d3dContext->OMSetBlendState(m_d3dColorWriteDisabledState.Get(), nullptr, 0xffffffff);
-	else
-		g_d3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
 }
 
 void DrawCall::PushDepthTestState(bool bEnabled)
 {
 	m_sDepthTestStates.push(bEnabled);
-
-	if (!m_sDepthTestStates.top())
-		g_d3dContext->OMSetDepthStencilState(m_d3dDepthTestDisabledState.Get(), 0);
-	else
-		g_d3dContext->OMSetDepthStencilState(nullptr, 0);
 }
 
 void DrawCall::PopDepthTestState()
@@ -611,21 +624,11 @@ void DrawCall::PopDepthTestState()
 		return;
 
 	m_sDepthTestStates.pop();
-
-	if (!m_sDepthTestStates.top())
-		g_d3dContext->OMSetDepthStencilState(m_d3dDepthTestDisabledState.Get(), 0);
-	else
-		g_d3dContext->OMSetDepthStencilState(nullptr, 0);
 }
 
 void DrawCall::PushBackfaceCullingState(bool bEnabled)
 {
 	m_sBackfaceCullingStates.push(bEnabled);
-
-	if (!m_sBackfaceCullingStates.top())
-		g_d3dContext->RSSetState(m_d3dBackfaceCullingDisabledState.Get());
-	else
-		g_d3dContext->RSSetState(nullptr);
 }
 
 void DrawCall::PopBackfaceCullingState()
@@ -634,11 +637,6 @@ void DrawCall::PopBackfaceCullingState()
 		return;
 
 	m_sBackfaceCullingStates.pop();
-
-	if (!m_sBackfaceCullingStates.top())
-		g_d3dContext->RSSetState(m_d3dBackfaceCullingDisabledState.Get());
-	else
-		g_d3dContext->RSSetState(nullptr);
 }
 
 void DrawCall::AddGlobalRenderPass(const string& vertexShaderFilename, const string& pixelShaderFilename, const unsigned renderPassIndex)
@@ -670,12 +668,24 @@ shared_ptr<Shader> DrawCall::LoadShaderUsingShaderStore(Shader::ShaderType type,
 
 void DrawCall::Present()
 {
+	FlushRenderQueue();
+
 	if (g_d3dSwapChain)
 		g_d3dSwapChain->Present(0, 0);
 }
 
+UploadRing& DrawCall::GetUploadRing()
+{
+	return m_uploadRing;
+}
+
 void DrawCall::DrawText(const std::wstring& text, const D2D_RECT_F& layoutRect, float fontSize, HorizontalAlignment horizontalAlignment, VerticalAlignment verticalAlignment, TextColor textColor)
 {
+	FlushRenderQueue();	// Text goes straight to the target, so it has to come after what was drawn before it
+
+	if (!g_d2dContext)	// Null backend
+		return;
+
 	g_d2dContext->BeginDraw();
 
 	const wstring& wideText = text;//StringToWideString(text);
@@ -821,6 +831,11 @@ DrawCall::DrawCall(const string& vertexShaderFilename, const string& pixelShader
 	this->LoadMesh(vertexShaderFilename, pixelShaderFilename, mesh, geometryShaderFilename);
 };
 
+DrawCall::~DrawCall()
+{
+	FlushQueuedPackets();
+}
+
 DrawCall::DrawCall(const std::string& vertexShaderFilename, const std::string& pixelShaderFilename, Mesh::MeshType meshType, const std::string& geometryShaderFilename):
 	DrawCall(vertexShaderFilename, pixelShaderFilename, make_shared<Mesh>(meshType), geometryShaderFilename)
 {}
@@ -859,10 +874,14 @@ unsigned DrawCall::GetInstanceCapacity()
 
 void DrawCall::SetInstanceCapacity(unsigned instanceCapacity, bool enableParticleInstancing)
 {
+	// Queued packets of this draw call are submitted with its input layout, which may be about to be replaced
+	FlushQueuedPackets();
+
 	if (enableParticleInstancing != m_particleInstancingEnabled)
 	{
 		m_instancingLayout.Reset();
 		m_instancingLayoutSPS.Reset();
+		m_externalLayouts.clear();
 
 		m_instances.clear();
 		m_particleInstances.clear();
@@ -893,17 +912,8 @@ void DrawCall::SetInstanceCapacity(unsigned instanceCapacity, bool enableParticl
 		g_d3dDevice->CreateInputLayout(elements.data(), (UINT) elements.size(), GetVertexShaderSPS()->GetBytecode(), GetVertexShaderSPS()->GetBytecodeSize(), &m_instancingLayoutSPS);
 	}
 
-	D3D11_BUFFER_DESC d3dBufferDesc;
-	memset(&d3dBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
-	d3dBufferDesc.ByteWidth = instanceCapacity * instanceSize;
-
-	d3dBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	d3dBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	d3dBufferDesc.StructureByteStride = instanceSize;
-
-	g_d3dDevice->CreateBuffer(&d3dBufferDesc, nullptr, &m_instanceBuffer);
-	assert(m_instanceBuffer);
-
+	// Instances are written to the upload ring as they are drawn, so there is no buffer to size
+	m_instanceAllocation = UploadRing::Allocation();
 	m_instanceBufferNeedsUpdate = true;
 	m_particleInstancingEnabled = enableParticleInstancing;
 }
@@ -979,6 +989,14 @@ bool DrawCall::TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const
 	return TestRayIntersection(rayOriginInWorldSpace, rayDirectionInWorldSpace, distance, normal, instanceIndex);
 }
 
+bool DrawCall::TestCapsuleIntersection(const XMVECTOR& capsuleStartInWorldSpace, const XMVECTOR& capsuleEndInWorldSpace, float capsuleRadius, const unsigned instanceIndex)
+{
+	if (instanceIndex < m_instances.size())
+		return m_mesh->TestCapsuleIntersection(capsuleStartInWorldSpace, capsuleEndInWorldSpace, capsuleRadius, m_instances[instanceIndex].worldTransform);
+	else
+		return false;
+}
+
 
 shared_ptr<Shader> DrawCall::GetVertexShader(unsigned renderPassIndex)
 {
@@ -1006,12 +1024,77 @@ shared_ptr<Shader> DrawCall::GetVertexShaderSPS(unsigned renderPassIndex)
 /// <param name="instancesToDraw"></param>
 void DrawCall::Draw(unsigned instancesToDraw)
 {
+	// Fullscreen passes scale the quad to the target as they draw, so they stay immediate
+	if (m_renderQueueEnabled && (m_sFullscreenPassStates.empty() || !m_sFullscreenPassStates.top()))
+	{
+		QueueDraw(nullptr, instancesToDraw);
+		return;
+	}
+
 	SetupDraw(instancesToDraw);
 
 	if (GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled())
 		instancesToDraw *= 2;
 
-	g_d3dContext->DrawIndexedInstanced(m_mesh->GetIndexCount(), instancesToDraw, 0, 0, 0);
+	g_renderContext->DrawIndexedInstanced(m_mesh->GetIndexCount(), instancesToDraw, 0, 0, 0);
+}
+
+void DrawCall::DrawExternal(const ExternalGeometry& geometry, unsigned instancesToDraw)
+{
+	if (!geometry.vertexBuffer || !geometry.indexBuffer || !geometry.vertexElements || geometry.indexCount == 0)
+		return;
+
+	// Stays immediate in fullscreen passes, as Draw does
+	if (m_renderQueueEnabled && (m_sFullscreenPassStates.empty() || !m_sFullscreenPassStates.top()))
+	{
+		QueueDraw(&geometry, instancesToDraw);
+		return;
+	}
+
+	bool isSinglePassStereo = GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled();
+	ID3D11InputLayout* layout = GetExternalLayout(geometry, isSinglePassStereo);
+	if (!layout)
+		return;
+
+	SetupDraw(instancesToDraw);
+
+	// Replace the mesh geometry bound by SetupDraw, the instance buffer in slot 1 stays
+	UINT offset = 0;
+	g_renderContext->IASetInputLayout(layout);
+	g_renderContext->IASetVertexBuffers(0, 1, &geometry.vertexBuffer, &geometry.vertexStride, &offset);
+	g_renderContext->IASetIndexBuffer(geometry.indexBuffer, geometry.indexFormat, 0);
+	g_renderContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+	if (isSinglePassStereo)
+		instancesToDraw *= 2;
+
+	g_renderContext->DrawIndexedInstanced(geometry.indexCount, instancesToDraw, 0, 0, 0);
+}
+
+ID3D11InputLayout* DrawCall::GetExternalLayout(const ExternalGeometry& geometry, bool isSinglePassStereo)
+{
+	auto& layout = m_externalLayouts[ExternalLayoutKey(geometry.vertexElements, m_activeRenderPassIndex, isSinglePassStereo, m_particleInstancingEnabled)];
+	if (!layout)
+	{
+		shared_ptr<Shader> vertexShader = isSinglePassStereo ? GetVertexShaderSPS(m_activeRenderPassIndex) : GetVertexShader(m_activeRenderPassIndex);
+		if (!vertexShader)
+			return nullptr;
+
+		vector<D3D11_INPUT_ELEMENT_DESC> elements = *geometry.vertexElements;
+		for (auto& element : (m_particleInstancingEnabled ? g_instancedParticleElements : g_instancedElements))
+		{
+			if (element.InputSlotClass != D3D11_INPUT_PER_INSTANCE_DATA)
+				continue;
+
+			elements.push_back(element);
+			if (isSinglePassStereo)
+				elements.back().InstanceDataStepRate = 2;
+		}
+
+		g_d3dDevice->CreateInputLayout(elements.data(), (UINT) elements.size(), vertexShader->GetBytecode(), vertexShader->GetBytecodeSize(), &layout);
+	}
+
+	return layout.Get();
 }
 
 /// <summary>
@@ -1020,10 +1103,14 @@ void DrawCall::Draw(unsigned instancesToDraw)
 /// <param name="instancesToDraw"></param>
 void DrawCall::SetupDraw(unsigned instancesToDraw)
 {
+	ApplyPipelineState();
+	if (m_renderQueueEnabled)
+		RestoreImmediateState();
+
 	if (GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled())
-		g_d3dContext->IASetInputLayout(m_instancingLayoutSPS.Get());
+		g_renderContext->IASetInputLayout(m_instancingLayoutSPS.Get());
 	else
-		g_d3dContext->IASetInputLayout(m_instancingLayout.Get());
+		g_renderContext->IASetInputLayout(m_instancingLayout.Get());
 
 	// Auto-scale quad to fullscreen if in fullscreen pass
 	if(!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top())
@@ -1037,21 +1124,21 @@ void DrawCall::SetupDraw(unsigned instancesToDraw)
 	if (GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled())//VOpXXeI_[^[Qbgł邩H
 	{
 		shaderSet.vertexShaderSPS->Bind();
-		UpdateShaderConstants(shaderSet.vertexShaderSPS);//SPS̓XeIp
+		UpdateShaderConstants(shaderSet.vertexShaderSPS.get(), allInstanceWorldTransform);//SPS̓XeIp
 	}
 	else
 	{
 		shaderSet.vertexShader->Bind();//`IuWFNgɌтꂽ_VF[_[̃oCh
-		UpdateShaderConstants(shaderSet.vertexShader);
+		UpdateShaderConstants(shaderSet.vertexShader.get(), allInstanceWorldTransform);
 	}
 
 	shaderSet.pixelShader->Bind();//`IuWFNgɌтꂽsNZVF[_[̃oCh
-	UpdateShaderConstants(shaderSet.pixelShader);
+	UpdateShaderConstants(shaderSet.pixelShader.get(), allInstanceWorldTransform);
 
 	if (shaderSet.geometryShader)
 	{
 		shaderSet.geometryShader->Bind();
-		UpdateShaderConstants(shaderSet.geometryShader);
+		UpdateShaderConstants(shaderSet.geometryShader.get(), allInstanceWorldTransform);
 	}
 
 	unsigned instanceSize = sizeof(Instance);
@@ -1064,201 +1151,239 @@ void DrawCall::SetupDraw(unsigned instancesToDraw)
 		instanceData = m_particleInstances.data();
 	}
 
-	if (m_instanceBufferNeedsUpdate)
-	{
-		if (instancesToDraw > instanceCapacity)
-			instancesToDraw = instanceCapacity;
+	// Instances are written again when they changed, when more are drawn than were written, or when the ring has come
+	//  around to them. They and a streamed mesh are reserved together, so writing one cannot discard the other.
+	// The reserve comes first, as a discard it makes takes what was written before.
+	UINT instanceBytes = min(instancesToDraw, instanceCapacity) * instanceSize;
+	m_uploadRing.Reserve(UploadRing::Align(instanceBytes) + (m_mesh ? m_mesh->GetPendingUploadSize() : 0));
+	bool instancesNeedUpload = m_instanceBufferNeedsUpdate || m_instanceAllocation.size < instanceBytes || !m_uploadRing.IsValid(m_instanceAllocation);
+
+	ID3D11Buffer* buffers[2];
+	buffers[0] = m_mesh ? m_mesh->GetVertexBuffer() : nullptr;//_obt@̐ݒ
 
-		g_d3dContext->UpdateSubresource(m_instanceBuffer.Get(), 0, nullptr, instanceData, instancesToDraw * instanceSize, 0);
+	if (instancesNeedUpload)
+	{
+		m_uploadRing.Upload(instanceData, instanceBytes, m_instanceAllocation);
 		m_instanceBufferNeedsUpdate = false;
 	}
 
-	ID3D11Buffer* buffers[2];
-	buffers[0] = m_mesh->GetVertexBuffer();//_obt@̐ݒ
-	buffers[1] = m_instanceBuffer.Get();
+	buffers[1] = m_instanceAllocation.buffer;
 
 	UINT strides[2];
 	strides[0] = sizeof(Mesh::Vertex);
 	strides[1] = instanceSize;
 
 	UINT offsets[2];
-	offsets[0] = 0;
-	offsets[1] = 0;
+	offsets[0] = m_mesh ? m_mesh->GetVertexBufferOffset() : 0;
+	offsets[1] = m_instanceAllocation.offset;
 
-	g_d3dContext->IASetVertexBuffers(0, 2, buffers, strides, offsets);
-	g_d3dContext->IASetIndexBuffer(m_mesh->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
+	g_renderContext->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+	g_renderContext->IASetIndexBuffer(m_mesh ? m_mesh->GetIndexBuffer() : nullptr, DXGI_FORMAT_R32_UINT, m_mesh ? m_mesh->GetIndexBufferOffset() : 0);
 
-	if (m_mesh->GetDrawStyle() == Mesh::DS_LINELIST)
-		g_d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+	if (m_mesh && m_mesh->GetDrawStyle() == Mesh::DS_LINELIST)
+		g_renderContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
 	else
-		g_d3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		g_renderContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
 
 /// <summary>
 /// SetupDraw֐Ă΂
 /// </summary>
 /// <param name="shader"></param>
-void DrawCall::UpdateShaderConstants(shared_ptr<Shader> shader)
+const DrawCall::ShaderConstantStats& DrawCall::GetShaderConstantStats()
+{
+	return m_immediateRecorder.shaderConstantStats;
+}
+
+void DrawCall::ResetShaderConstantStats()
+{
+	m_immediateRecorder.shaderConstantStats = ShaderConstantStats();
+}
+
+void DrawCall::EnableShaderConstantTiming(bool enabled)
+{
+	m_shaderConstantTimingEnabled = enabled;
+}
+
+bool DrawCall::IsShaderConstantTimingEnabled()
+{
+	return m_shaderConstantTimingEnabled;
+}
+
+const DrawCall::ViewConstantCache& DrawCall::UpdateViewConstantCache(Recorder& recorder, const View& view, const Projection& projection)
 {
+	ViewConstantSources sources;
+	sources.view[0] = view.mtx;
+	sources.view[1] = view.mtxRight;
+	sources.projection[0] = projection.mtx;
+	sources.projection[1] = projection.mtxRight;
+	sources.cameraView = view.mtx;
+	if (!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top() == true)	// For fullscreen pass, use the camera view matrix instead of the view matrix
+		sources.cameraView = m_mtxCameraView;
+	sources.lightViewProj = m_mtxLightViewProj;
+	sources.lightPosW = vLights[uActiveLightIdx].vLightPosW;
+
+	ViewConstantCache& cache = recorder.viewConstantCache;
+	if (cache.isValid && memcmp(&cache.sources, &sources, sizeof(ViewConstantSources)) == 0)
+	{
+		++recorder.shaderConstantStats.viewConstantsReused;
+		return cache;
+	}
+
+	cache.sources = sources;
+	for (unsigned eye = 0; eye < 2; ++eye)
+	{
+		cache.viewProj[eye] = XMMatrixTranspose(XMMatrixMultiply(sources.view[eye], sources.projection[eye]));
+		cache.view[eye] = XMMatrixTranspose(sources.view[eye]);
+		cache.invView[eye] = XMMatrixTranspose(XMMatrixInverse(nullptr, sources.view[eye]));
+	}
+
+	cache.lightViewProj = XMMatrixTranspose(sources.lightViewProj);
+	cache.lightPosV = XMVector4Transform(sources.lightPosW, sources.cameraView);
+	cache.invViewLightViewProj = XMMatrixTranspose(XMMatrixMultiply(XMMatrixInverse(nullptr, sources.cameraView), sources.lightViewProj));
+	cache.isValid = true;
+
+	++recorder.shaderConstantStats.viewConstantsComputed;
+	return cache;
+}
+
+// Copies a constant into the staging copy of its buffer, returns whether that changed the buffer
+static bool WriteConstant(ConstantBuffer& buffer, unsigned offset, const void* data, unsigned size)
+{
+	unsigned char* destination = buffer.staging.get() + offset;
+	if (memcmp(destination, data, size) == 0)
+		return false;
+
+	memcpy(destination, data, size);
+	return true;
+}
+
+void DrawCall::UpdateShaderConstants(Shader* shader, const XMMATRIX& worldTransform)
+{
+	UpdateShaderConstants(m_immediateRecorder, shader, worldTransform, m_activeView, m_activeProjection);
+}
+
+// The copy of a shader's constant buffer a deferred recorder uploads to, created the first time the recorder needs it
+ConstantBuffer* DrawCall::GetRecorderConstantBuffer(Recorder& recorder, ConstantBuffer& buffer)
+{
+	if (!recorder.deferredContext)
+		return &buffer;
+
+	ConstantBuffer& copy = recorder.constantBuffers[&buffer];
+	if (!copy.d3dBuffer || copy.size != buffer.size)	// Or a buffer of a destroyed shader was at the same address
+	{
+		copy.slot = buffer.slot;
+		copy.size = buffer.size;
+		copy.staging.reset(new unsigned char[copy.size]);
+		memset(copy.staging.get(), 0, copy.size);
+		copy.isUploaded = false;
+
+		D3D11_BUFFER_DESC desc = {copy.size, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, 0, copy.size};
+		copy.d3dBuffer.Reset();
+		if (FAILED(g_d3dDevice->CreateBuffer(&desc, nullptr, &copy.d3dBuffer)))
+			return nullptr;
+	}
+
+	return &copy;
+}
+
+void DrawCall::UpdateShaderConstants(Recorder& recorder, Shader* shader, const XMMATRIX& worldTransform, const View& view, const Projection& projection)
+{
+	LARGE_INTEGER startTime = {};
+	if (m_shaderConstantTimingEnabled)
+		QueryPerformanceCounter(&startTime);
+
+	const ViewConstantCache& viewConstants = UpdateViewConstantCache(recorder, view, projection);
+	unsigned eye = IsRightEyePassActive() ? 1 : 0;
+
+	// Grab the camera proj settings (which may be different from active proj if this is a fullscreen pass)
+	const Projection& cameraProj = (!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top() == true) ? m_cameraProj : projection;
+
+	// The world dependent values are the only ones computed per draw, and only if the shader reads them.
+	// (world * viewProj)^T is viewProj^T * world^T, so the cached transposed matrices are used as they are.
+	const uint32_t worldViewProjMask = (1u << CS_WORLDVIEWPROJ_MATRIX) | (1u << CS_WORLDVIEWPROJ_MATRIX_LEFT) | (1u << CS_WORLDVIEWPROJ_MATRIX_RIGHT);
+	uint32_t sourceMask = shader->GetConstantSourceMask();
+
+	XMMATRIX world = XMMatrixIdentity();
+	XMMATRIX worldViewProj[2] = { XMMatrixIdentity(), XMMatrixIdentity() };
+	if (sourceMask & ((1u << CS_WORLD_MATRIX) | worldViewProjMask))
+		world = XMMatrixTranspose(worldTransform);
+
+	if (sourceMask & worldViewProjMask)
+	{
+		for (unsigned i = 0; i < 2; ++i)
+			worldViewProj[i] = XMMatrixMultiply(viewConstants.viewProj[i], world);
+	}
+
+	const void* sources[CS_COUNT];
+	sources[CS_WORLD_MATRIX] = &world;
+	sources[CS_WORLDVIEWPROJ_MATRIX] = &worldViewProj[eye];
+	sources[CS_WORLDVIEWPROJ_MATRIX_LEFT] = &worldViewProj[0];
+	sources[CS_WORLDVIEWPROJ_MATRIX_RIGHT] = &worldViewProj[1];
+	sources[CS_VIEWPROJ_MATRIX] = &viewConstants.viewProj[eye];
+	sources[CS_VIEWPROJ_MATRIX_LEFT] = &viewConstants.viewProj[0];
+	sources[CS_VIEWPROJ_MATRIX_RIGHT] = &viewConstants.viewProj[1];
+	sources[CS_VIEW_MATRIX] = &viewConstants.view[eye];
+	sources[CS_VIEW_MATRIX_LEFT] = &viewConstants.view[0];
+	sources[CS_VIEW_MATRIX_RIGHT] = &viewConstants.view[1];
+	sources[CS_INVVIEW_MATRIX] = &viewConstants.invView[eye];
+	sources[CS_INVVIEW_MATRIX_LEFT] = &viewConstants.invView[0];
+	sources[CS_INVVIEW_MATRIX_RIGHT] = &viewConstants.invView[1];
+	sources[CS_LIGHTVIEWPROJ_MATRIX] = &viewConstants.lightViewProj;
+	sources[CS_LIGHTPOSV] = &viewConstants.lightPosV;
+	sources[CS_INVVIEWLIGHTVIEWPROJ_MATRIX] = &viewConstants.invViewLightViewProj;
+	sources[CS_LIGHT_AMBIENT] = &vAmbient;
+	sources[CS_NEARPLANEHEIGHT] = &cameraProj.fNearPlaneHeight;
+	sources[CS_NEARPLANEWIDTH] = &cameraProj.fNearPlaneWidth;
+	sources[CS_NEARPLANEDIST] = &cameraProj.fNear;
+	sources[CS_FARPLANEDIST] = &cameraProj.fFar;
+	sources[CS_PROJECTIONRANGE] = &cameraProj.fRange;
+
 	unsigned N_constant_buffer_count = shader->GetContantBufferCount();
 	for(unsigned i = 0 ; i < N_constant_buffer_count ; ++i)
 	{
-		ConstantBuffer& buffer = shader->GetConstantBuffer(i);
+		ConstantBuffer& shaderBuffer = shader->GetConstantBuffer(i);
+		ConstantBuffer* recorderBuffer = GetRecorderConstantBuffer(recorder, shaderBuffer);
+		if (!recorderBuffer)
+			continue;
+
+		ConstantBuffer& buffer = *recorderBuffer;
+		bool bufferChanged = !buffer.isUploaded;
 
-		// Grab the camera view and proj settings (which may be different from active view and proj if this is a fullscreen pass)
-		XMMATRIX mtxCameraView = m_activeView.mtx;
-		Projection cameraProj = m_activeProjection;
-		if(!m_sFullscreenPassStates.empty() && m_sFullscreenPassStates.top() == true)	// For fullscreen pass, use the camera view matrix instead of the view matrix
+		for (const ConstantWriteOp& writeOp : shaderBuffer.writeOps)
+			bufferChanged |= WriteConstant(buffer, writeOp.offset, sources[writeOp.source], writeOp.size);
+
+		// Nothing to upload when the buffer already holds these constants, from this draw or an earlier one
+		if (bufferChanged)
 		{
-			mtxCameraView = m_mtxCameraView;
-			cameraProj = m_cameraProj;
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			recorder.context->Map(buffer.d3dBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+			memcpy(mapped.pData, buffer.staging.get(), buffer.size);
+			recorder.context->Unmap(buffer.d3dBuffer.Get(), 0);
+
+			buffer.isUploaded = true;
+			++recorder.shaderConstantStats.bufferUploads;
+			recorder.shaderConstantStats.bytesUploaded += buffer.size;
 		}
-
-		unsigned buffer_constants_size = buffer.constants.size();
-		for(unsigned j = 0 ; j < buffer_constants_size ; ++j)
+		else
 		{
-			Constant& constant = buffer.constants[j];
-
-			XMMATRIX mtx;
-			XMVECTOR v;
-
-			switch(constant.id)
-			{
-			case CONST_WORLD_MATRIX:
-				mtx = XMMatrixTranspose(allInstanceWorldTransform);
-				memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				break;
-			case CONST_WORLDVIEWPROJ_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = m_activeView.mtx;
-					XMMATRIX proj = m_activeProjection.mtx;
-					if (IsRightEyePassActive())
-					{
-						view = m_activeView.mtxRight;
-						proj = m_activeProjection.mtxRight;
-					}
-
-					mtx = XMMatrixTranspose(XMMatrixMultiply(allInstanceWorldTransform, XMMatrixMultiply(view, proj)));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(XMMatrixMultiply(allInstanceWorldTransform, XMMatrixMultiply(m_activeView.mtx, m_activeProjection.mtx)));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size / 2);
-
-					mtx = XMMatrixTranspose(XMMatrixMultiply(allInstanceWorldTransform, XMMatrixMultiply(m_activeView.mtxRight, m_activeProjection.mtxRight)));
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_VIEWPROJ_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = m_activeView.mtx;
-					XMMATRIX proj = m_activeProjection.mtx;
-					if (IsRightEyePassActive())
-					{
-						view = m_activeView.mtxRight;
-						proj = m_activeProjection.mtxRight;
-					}
-
-					mtx = XMMatrixTranspose(XMMatrixMultiply(view, proj));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(XMMatrixMultiply(m_activeView.mtx, m_activeProjection.mtx));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size/2);
-
-					mtx = XMMatrixTranspose(XMMatrixMultiply(m_activeView.mtxRight, m_activeProjection.mtxRight));
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_VIEW_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = m_activeView.mtx;
-					XMMATRIX proj = m_activeProjection.mtx;
-					if (IsRightEyePassActive())
-					{
-						view = m_activeView.mtxRight;
-						proj = m_activeProjection.mtxRight;
-					}
-
-					mtx = XMMatrixTranspose(view);
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(m_activeView.mtx);
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size/2);
-
-					mtx = XMMatrixTranspose(m_activeView.mtxRight);
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_INVVIEW_MATRIX:
-				if (constant.elementCount == 0)
-				{
-					XMMATRIX view = XMMatrixInverse(nullptr, m_activeView.mtx);
-					if (IsRightEyePassActive())
-						view = XMMatrixInverse(nullptr, m_activeView.mtxRight);
-
-					mtx = XMMatrixTranspose(view);
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				}
-				else if (constant.elementCount == 2)
-				{
-					mtx = XMMatrixTranspose(XMMatrixInverse(nullptr, m_activeView.mtx));
-					memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size / 2);
-
-					mtx = XMMatrixTranspose(XMMatrixInverse(nullptr, m_activeView.mtxRight));
-					memcpy(buffer.staging.get() + constant.startOffset + constant.size / 2, &mtx, constant.size / 2);
-				}
-				break;
-			case CONST_LIGHTVIEWPROJ_MATRIX:
-				mtx = XMMatrixTranspose(m_mtxLightViewProj);
-				memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				break;
-			case CONST_LIGHTPOSV:
-				v = XMVector4Transform(vLights[uActiveLightIdx].vLightPosW, mtxCameraView);
-				memcpy(buffer.staging.get() + constant.startOffset, &v, constant.size);
-				break;
-			case CONST_INVVIEWLIGHTVIEWPROJ_MATRIX:
-				mtx = XMMatrixTranspose(XMMatrixMultiply(XMMatrixInverse(&v, mtxCameraView), m_mtxLightViewProj));
-				memcpy(buffer.staging.get() + constant.startOffset, &mtx, constant.size);
-				break;
-			case CONST_LIGHT_AMBIENT:
-				memcpy(buffer.staging.get() + constant.startOffset, &vAmbient, constant.size);
-				break;
-			case CONST_NEARPLANEHEIGHT:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fNearPlaneHeight, constant.size);
-				break;
-			case CONST_NEARPLANEWIDTH:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fNearPlaneWidth, constant.size);
-				break;
-			case CONST_NEARPLANEDIST:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fNear, constant.size);
-				break;
-			case CONST_FARPLANEDIST:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fFar, constant.size);
-				break;
-			case CONST_PROJECTIONRANGE:
-				memcpy(buffer.staging.get() + constant.startOffset, &cameraProj.fRange, constant.size);
-				break;
-			}
+			++recorder.shaderConstantStats.bufferUploadsSkipped;
+			recorder.shaderConstantStats.bytesSkipped += buffer.size;
 		}
 
-		D3D11_MAPPED_SUBRESOURCE mapped;
-		g_d3dContext->Map(buffer.d3dBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-		memcpy(mapped.pData, buffer.staging.get(), mapped.RowPitch);
-		g_d3dContext->Unmap(buffer.d3dBuffer.Get(), 0);
-
 		if(shader->GetType() == Shader::ST_VERTEX || shader->GetType() == Shader::ST_VERTEX_SPS)
-			g_d3dContext->VSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
+			recorder.context->VSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
 		else if (shader->GetType() == Shader::ST_PIXEL)
-			g_d3dContext->PSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
+			recorder.context->PSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
 		else if (shader->GetType() == Shader::ST_GEOMETRY)
-			g_d3dContext->GSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
+			recorder.context->GSSetConstantBuffers(buffer.slot, 1, buffer.d3dBuffer.GetAddressOf());
+	}
+
+	if (m_shaderConstantTimingEnabled)
+	{
+		LARGE_INTEGER endTime, frequency;
+		QueryPerformanceCounter(&endTime);
+		QueryPerformanceFrequency(&frequency);
+		recorder.shaderConstantStats.updateTime += (endTime.QuadPart - startTime.QuadPart) / (double) frequency.QuadPart;
 	}
 }
@@ -15,8 +15,18 @@
 #ifndef _DRAWCALL
 #define _DRAWCALL
 
+#include "Common/FixedStack.h"
+#include "Common/StereoFrustum.h"
+#include "RenderContext.h"
+#include "UploadRing.h"
+
+#include <tuple>
+#include <unordered_map>
+
 #define RENDER_TARGET_COUNT 8
 
+struct RadixSortEntry;
+
 enum RenderPass
 {
 	RENDERPASS_COLOR = 0,
@@ -60,6 +70,12 @@ enum class MapType
 	ReadWrite
 };
 
+enum class RenderBackend
+{
+	D3D11,
+	Null,		// Records and checks commands without rendering, see NullRenderContext
+};
+
 struct Image
 {
 	std::vector<std::unique_ptr<unsigned char>> mips;
@@ -220,6 +236,45 @@ struct Constant
 	unsigned elementCount;	// Number of elements if array variable. 0 if not an array.
 };
 
+// Values a constant can be written from. Matrices are stored transposed, ready to copy.
+// The per eye matrices have a source for the eye being rendered, used by single values, and one for each eye,
+//  used by the two elements of arrays in single-pass stereo shaders.
+enum ConstantSource
+{
+	CS_WORLD_MATRIX,
+	CS_WORLDVIEWPROJ_MATRIX,
+	CS_WORLDVIEWPROJ_MATRIX_LEFT,
+	CS_WORLDVIEWPROJ_MATRIX_RIGHT,
+	CS_VIEWPROJ_MATRIX,
+	CS_VIEWPROJ_MATRIX_LEFT,
+	CS_VIEWPROJ_MATRIX_RIGHT,
+	CS_VIEW_MATRIX,
+	CS_VIEW_MATRIX_LEFT,
+	CS_VIEW_MATRIX_RIGHT,
+	CS_INVVIEW_MATRIX,
+	CS_INVVIEW_MATRIX_LEFT,
+	CS_INVVIEW_MATRIX_RIGHT,
+	CS_LIGHTVIEWPROJ_MATRIX,
+	CS_LIGHTPOSV,
+	CS_INVVIEWLIGHTVIEWPROJ_MATRIX,
+	CS_LIGHT_AMBIENT,
+	CS_NEARPLANEHEIGHT,
+	CS_NEARPLANEWIDTH,
+	CS_NEARPLANEDIST,
+	CS_FARPLANEDIST,
+	CS_PROJECTIONRANGE,
+	CS_COUNT,
+};
+
+// Copies one source into the staging copy of a constant buffer. Compiled from the reflected constants when a shader
+//  loads, so updating a buffer is a plain loop over its ops.
+struct ConstantWriteOp
+{
+	ConstantSource source;
+	unsigned offset;
+	unsigned size;			// Never more than the size of the source
+};
+
 class ConstantBuffer
 {
 public:
@@ -229,8 +284,9 @@ public:
 
 	std::unique_ptr<unsigned char> staging;
 	::Microsoft::WRL::ComPtr<ID3D11Buffer> d3dBuffer;
+	bool isUploaded;		// Whether d3dBuffer holds what is in staging
 
-	std::vector<Constant> constants;
+	std::vector<ConstantWriteOp> writeOps;
 };
 
 class Shader
@@ -248,6 +304,7 @@ public:
 	Shader(ShaderType type, std::string filename);
 
 	void Bind();
+	void Bind(RenderContext* context);
 
 	ShaderType GetType(){return m_type;}
 
@@ -256,6 +313,10 @@ public:
 
 	unsigned GetContantBufferCount();
 	ConstantBuffer& GetConstantBuffer(unsigned uIdx);
+	uint32_t GetConstantSourceMask() { return m_constantSourceMask; }	// Bit n set when a buffer reads ConstantSource n
+
+	// Constants the engine does not know how to fill, they are left zero. Also reported to the debugger output on load.
+	const std::vector<std::string>& GetUnknownConstants() { return m_unknownConstants; }
 
 private:
 
@@ -271,6 +332,10 @@ private:
 	::Microsoft::WRL::ComPtr<ID3D11VertexShader> m_vertexShaderSPS;
 
 	std::vector<ConstantBuffer> m_vConstantBuffers;
+	uint32_t m_constantSourceMask;
+	std::vector<std::string> m_unknownConstants;
+
+	bool CompileConstant(const Constant& constant, std::vector<ConstantWriteOp>& writeOps);
 };
 
 class Mesh
@@ -330,6 +395,7 @@ public:
 
 		void GenerateChildNodes(const std::vector<Mesh::Vertex>& vertices, const std::vector<unsigned>& indices, unsigned currentDepth);
 		bool TestRayIntersection(const std::vector<Vertex>& vertices, const DirectX::XMVECTOR& rayOriginInWorldSpace, const DirectX::XMVECTOR& rayDirectionInWorldSpace, const DirectX::XMMATRIX& worldTransform, float &distance, DirectX::XMVECTOR& normalInLocalSpace, float maxDistance = std::numeric_limits<float>::max(), bool returnFurthest = false);
+		bool TestCapsuleIntersection(const std::vector<Vertex>& vertices, const DirectX::XMVECTOR& capsuleStartInWorldSpace, const DirectX::XMVECTOR& capsuleEndInWorldSpace, float capsuleRadius, const DirectX::XMMATRIX& worldTransform);
 	};
 
 	struct Disc
@@ -367,6 +433,7 @@ public:
 	bool TestRayIntersection(const DirectX::XMVECTOR& rayOriginInWorldSpace, const DirectX::XMVECTOR& rayDirectionInWorldSpace, const DirectX::XMMATRIX& worldTransform, float &distance, DirectX::XMVECTOR &normal, float maxDistance = std::numeric_limits<float>::max(), bool returnFurthest = false);
 	bool TestRayIntersection(const DirectX::XMVECTOR& rayOriginInWorldSpace, const DirectX::XMVECTOR& rayDirectionInWorldSpace, const DirectX::XMMATRIX& worldTransform, float& distance);
 	bool TestPointInside(const DirectX::XMVECTOR& pointInWorldSpace, const DirectX::XMMATRIX& worldTransform);	// This currently only tests against the bounding box
+	bool TestCapsuleIntersection(const DirectX::XMVECTOR& capsuleStartInWorldSpace, const DirectX::XMVECTOR& capsuleEndInWorldSpace, float capsuleRadius, const DirectX::XMMATRIX& worldTransform);	// True if any triangle is within capsuleRadius of the segment
 	const DirectX::BoundingBox& GetBoundingBox();
 
 	void SetDrawStyle(DrawStyle drawStyle){m_drawStyle = drawStyle;}
@@ -387,6 +454,19 @@ public:
 
 	ID3D11Buffer* GetVertexBuffer();
 	ID3D11Buffer* GetIndexBuffer();
+	UINT GetVertexBufferOffset();	// In bytes, only streamed meshes share their buffer and start past zero
+	UINT GetIndexBufferOffset();
+
+	// Streamed meshes keep no buffers of their own. Their vertices and indices are written to the upload ring when they
+	//  change, and again when the ring has come around to them, which suits meshes that change most frames.
+	// A mesh whose buffers are updated on kStreamAfterFrames frames in a row is switched to streaming on its own, and
+	//  goes back to buffers of its own the first frame it is drawn without having changed.
+	static const unsigned kStreamAfterFrames = 3;
+	void SetStreamed(bool streamed);
+	bool IsStreamed() { return m_isStreamed; }
+	// Most bytes the next use of the buffers can write to the upload ring, including writing them again should a discard
+	//  of the ring take them first. For UploadRing::Reserve, which has to come before the check of what to write.
+	UINT GetPendingUploadSize();
 
 	void UpdateBoundingBox();
 	void UpdateD3DBuffers();
@@ -405,6 +485,14 @@ private:
 	bool m_d3dBuffersNeedUpdate;
 	bool m_boundingBoxNeedsUpdate;
 
+	bool m_isStreamed;
+	UploadRing::Allocation m_streamAllocation;		// Vertices, then indices from the next aligned offset
+	uint64_t m_lastUpdateFrame;
+	unsigned m_updateFrameCount;					// Consecutive frames the buffers were updated on
+
+	bool NeedsD3DBufferUpdate();
+	unsigned CountUpdateFrame(uint64_t frameIndex);
+
 	D3D11_BUFFER_DESC m_d3dVertexBufferDesc;
 	::Microsoft::WRL::ComPtr<ID3D11Buffer> m_d3dVertexBuffer;
 
@@ -508,7 +596,9 @@ public:
 	// You can set a swap chain later with one of two options:
 	//	-Calling InitializeSwapChain
 	//	-Creating it elsewhere and then setting it via SetBackBuffer
-	static bool Initialize();
+	// The null backend needs no GPU and no window: resources are created on a device that does not render, and
+	//  commands go to a NullRenderContext. There is no text, swap chain or mixed reality with it.
+	static bool Initialize(RenderBackend backend = RenderBackend::D3D11);
 
 #ifdef USE_WINRT_D3D
 	static bool InitializeSwapChain(unsigned width, unsigned height, winrt::Windows::UI::Core::CoreWindow const& window);
@@ -524,6 +614,10 @@ public:
 	static ID3D11DeviceContext* GetD3DDeviceContext();
 	static IDXGISwapChain1* GetD3DSwapChain();
 
+	static RenderBackend GetRenderBackend();
+	static RenderContext* GetRenderContext();			// Immediate context commands are sent to
+	static NullRenderContext* GetNullRenderContext();	// Null unless initialized with RenderBackend::Null
+
 	static bool IsSinglePassSteroSupported();			// Whether or not the hardware supports single pass stereo
 	static bool IsSinglePassSteroEnabled();				// Whether or not single pass stero is currently enabled
 	static void EnableSinglePassStereo(bool enabled);
@@ -581,6 +675,75 @@ public:
 
 	static void Present();
 
+	// Transient vertex, index and instance data of every draw call and streamed mesh. Call EndFrame on it once a frame.
+	static UploadRing& GetUploadRing();
+
+	// Render queue. While enabled, Draw and DrawExternal record a packet instead of drawing, and each render pass is
+	//  submitted in one go when it ends: on any push or pop of a pass, DrawText, Present or FlushRenderQueue.
+	// Packets are radix sorted by a 64 bit key: opaque ones by state, shaders, textures and mesh and then front to back,
+	//  alpha blended ones back to front. Binds that match what the previous packet left bound are skipped.
+	// Blend, depth and culling state, pixel shader textures, view and projection are captured when a packet is recorded.
+	// Consecutive packets that only differ in their instances, i.e. same mesh, shaders, textures, state and all instance
+	//  world transform, are merged into a single instanced draw. Their instances are written with one map of the upload
+	//  ring per flush.
+	// Draw calls must outlive the packets they queue, a draw call that is destroyed with packets queued flushes them.
+	// Instances are culled against the frustum of both eyes when recorded, only the visible ones are copied into the
+	//  packet. Meshes are tested by their bounding box, particles by a sphere around it, external geometry is not culled.
+	struct RenderQueueStats
+	{
+		unsigned packetCount = 0;
+		unsigned flushCount = 0;
+		unsigned drawCount = 0;				// Instanced draws issued, one per batch of merged packets
+		unsigned mergedPacketCount = 0;		// Packets drawn as instances of an earlier packet's draw
+		unsigned instancesVisible = 0;
+		unsigned instancesCulled = 0;
+		unsigned stateChanges = 0;			// Binds issued when submitting packets
+		unsigned stateChangesSaved = 0;		// Binds skipped because they matched what was bound
+		unsigned parallelFlushCount = 0;	// Flushes recorded on more than one thread
+	};
+
+	static void EnableRenderQueue(bool enabled);
+	static bool IsRenderQueueEnabled();
+	static void EnableFrustumCulling(bool enabled);		// On by default
+	static bool IsFrustumCullingEnabled();
+	static void FlushRenderQueue();
+	static const RenderQueueStats& GetRenderQueueStats();	// Accumulates until ResetRenderQueueStats, e.g. once per frame
+	static void ResetRenderQueueStats();
+
+	// Parallel recording. A flush with enough batches is split into runs, in sorted order, recorded at the same time:
+	//  the first on the calling thread straight into the immediate context, each other one on a worker thread into a
+	//  deferred context, whose command lists are then executed in order. Every pass drawn through the queue, each eye
+	//  of multi-pass stereo included, ends in a flush and so can be recorded this way.
+	// Workers only read what the calling thread prepared before they start: instances and streamed meshes are
+	//  uploaded and every state object of the flush is created. Each worker uploads constants to its own buffers.
+	// A deferred context starts out with nothing bound, so it gets the render targets and what packets capture, any
+	//  other binding made directly on the immediate context is not seen by the draws recorded by the workers.
+	static void SetRecordingThreadCount(unsigned threadCount);	// 1, the default, records on the calling thread only
+	static unsigned GetRecordingThreadCount();
+
+	// Called by Texture2D::BindAsPixelShaderResource while the queue is enabled, so the binding goes with the packets
+	static void QueuePixelShaderResource(unsigned slot, ID3D11ShaderResourceView* view, ID3D11SamplerState* sampler);
+
+	// Shader constants. Values derived from the view, projection and light are computed once and reused until what they
+	//  derive from changes, and a constant buffer is only mapped when its contents differ from its last upload.
+	// The shaders keep the per-view matrices (g_cbView) apart from the world transform (g_cbObject), so most draws
+	//  within a pass upload nothing or just the latter.
+	struct ShaderConstantStats
+	{
+		unsigned bufferUploads = 0;
+		unsigned bufferUploadsSkipped = 0;		// Buffers left as they were, their contents had not changed
+		size_t bytesUploaded = 0;
+		size_t bytesSkipped = 0;
+		unsigned viewConstantsComputed = 0;		// Updates that had to recompute the view derived values
+		unsigned viewConstantsReused = 0;		// Updates that reused them, each saving the matrix products and inverses
+		double updateTime = 0.0;				// Seconds spent updating constants, cache hits included. Only with timing enabled.
+	};
+
+	static const ShaderConstantStats& GetShaderConstantStats();		// Accumulates until ResetShaderConstantStats
+	static void ResetShaderConstantStats();
+	static void EnableShaderConstantTiming(bool enabled);		// Off by default, it reads the clock twice per draw
+	static bool IsShaderConstantTimingEnabled();
+
 	// Draw text using the current redertarget
 	static void DrawText(const std::wstring& text, const D2D_RECT_F& layoutRect, float fontSize, HorizontalAlignment horizontalAlignment, VerticalAlignment verticalAlignment, TextColor textColor = TextColor::White);
 	static void DrawText(const std::string& text, const D2D_RECT_F& layoutRect, float fontSize, HorizontalAlignment horizontalAlignment, VerticalAlignment verticalAlignment, TextColor textColor = TextColor::White);
@@ -591,10 +754,43 @@ public:
 	static DirectX::XMMATRIX DrawCall::CalculateWorldTransformForLine(const DirectX::XMVECTOR& startPosition, const DirectX::XMVECTOR& endPosition, const float radius);
 
 private:
+	// What the view derived constants are computed from, compared as a whole to tell whether they are still valid
+	struct ViewConstantSources
+	{
+		DirectX::XMMATRIX view[2];			// Left, right eye
+		DirectX::XMMATRIX projection[2];
+		DirectX::XMMATRIX cameraView;
+		DirectX::XMMATRIX lightViewProj;
+		DirectX::XMVECTOR lightPosW;
+	};
+
+	// Matrices are transposed, as they are written to the constant buffers
+	struct ViewConstantCache
+	{
+		ViewConstantSources sources;
+		bool isValid;
+
+		DirectX::XMMATRIX viewProj[2];
+		DirectX::XMMATRIX view[2];
+		DirectX::XMMATRIX invView[2];
+		DirectX::XMMATRIX lightViewProj;
+		DirectX::XMVECTOR lightPosV;
+		DirectX::XMMATRIX invViewLightViewProj;
+	};
+
+	struct Recorder;
+
+	static const ViewConstantCache& UpdateViewConstantCache(Recorder& recorder, const View& view, const Projection& projection);
+	static bool m_shaderConstantTimingEnabled;
+
 	static DirectX::XMMATRIX m_mtxLightViewProj;
 	static DirectX::XMMATRIX m_mtxCameraView;	// Used during fullscreen passes when the original camera view is needed
 	static Projection m_cameraProj;		// Used during fullscreen passes when the original camera projection is needed
 
+	static UploadRing m_uploadRing;
+
+	static RenderBackend m_renderBackend;
+
 	static bool m_singlePassStereoSupported;
 	static bool m_singlePassStereoEnabled;
 
@@ -608,15 +804,17 @@ private:
 	static std::map<intptr_t, std::shared_ptr<Texture2D>> m_cachedBackBuffers;
 	static std::stack<std::vector<std::shared_ptr<Texture2D>>> m_renderTargetStack;
 
-	static std::stack<unsigned> m_renderPassIndexStack;
+	static const unsigned kMaxStateDepth = 32;		// Of each of the render pass and state stacks below
+
+	static FixedStack<unsigned, kMaxStateDepth> m_renderPassIndexStack;
 	static unsigned m_activeRenderPassIndex;
 
-	static std::stack<BlendState> m_sAlphaBlendStates;
-	static std::stack<bool> m_sDepthTestStates;
-	static std::stack<bool> m_sBackfaceCullingStates;
+	static FixedStack<BlendState, kMaxStateDepth> m_sAlphaBlendStates;
+	static FixedStack<bool, kMaxStateDepth> m_sDepthTestStates;
+	static FixedStack<bool, kMaxStateDepth> m_sBackfaceCullingStates;
 
-	static std::stack<bool> m_sRightEyePassStates;
-	static std::stack<bool> m_sFullscreenPassStates;
+	static FixedStack<bool, kMaxStateDepth> m_sRightEyePassStates;
+	static FixedStack<bool, kMaxStateDepth> m_sFullscreenPassStates;
 
 	// Global render passes, which are automatically added to every draw call at creation time
 	static std::vector<RenderPassDesc> m_vGlobalRenderPasses;
@@ -624,14 +822,29 @@ private:
 	// Global store of all shaders, so we don't load a shader more than once.
 	static std::map<std::string, std::shared_ptr<Shader>> m_shaderStore;
 
-	// Pre-made states for various tasks
-	static ::Microsoft::WRL::ComPtr<ID3D11BlendState> m_d3dAlphaBlendEnabledState;
-	static ::Microsoft::WRL::ComPtr<ID3D11BlendState> m_d3dAdditiveBlendEnabledState;
-	static ::Microsoft::WRL::ComPtr<ID3D11BlendState> m_d3dColorWriteDisabledState;
-	static ::Microsoft::WRL::ComPtr<ID3D11DepthStencilState> m_d3dDepthTestDisabledState;
-	static ::Microsoft::WRL::ComPtr<ID3D11RasterizerState> m_d3dBackfaceCullingDisabledState;
+	// Blend, depth and rasterizer state as one value, a byte each: blend state, depth test, backface culling.
+	// The stacks only change what the next draw wants, ApplyPipelineState binds it when it differs from what is bound.
+	typedef uint32_t PipelineStateKey;
+	static const PipelineStateKey kInvalidPipelineStateKey = 0xffffffff;
+
+	struct PipelineStateObjects
+	{
+		::Microsoft::WRL::ComPtr<ID3D11BlendState> blendState;
+		::Microsoft::WRL::ComPtr<ID3D11DepthStencilState> depthStencilState;
+		::Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizerState;
+	};
+
+	static PipelineStateKey MakePipelineStateKey(BlendState blendState, bool depthTestEnabled, bool backfaceCullingEnabled);
+	static PipelineStateKey GetPipelineStateKey();		// Of the states on top of the stacks
+	static const PipelineStateObjects& GetPipelineStateObjects(PipelineStateKey key);
+	static bool ApplyPipelineState(Recorder& recorder, PipelineStateKey key);	// True when it had to bind, false when key was already bound
+	static void ApplyPipelineState();		// The states on top of the stacks, on the immediate context
+
+	// Immutable state objects, created the first time a combination of states is drawn with
+	static std::unordered_map<PipelineStateKey, PipelineStateObjects> m_pipelineStateCache;
 
 	static void SetCurrentRenderTargetsOnD3DDevice();
+	static void SetCurrentRenderTargetsOnContext(RenderContext* context);	// Without the Direct2D target
 	static bool IsRightEyePassActive();
 
 	//
@@ -643,6 +856,7 @@ public:
 	DrawCall(const std::string& vertexShaderFilename, const std::string& pixelShaderFilename, std::shared_ptr<Mesh> mesh = nullptr, const std::string& geometryShaderFilename = "");
 	DrawCall(const std::string& vertexShaderFilename, const std::string& pixelShaderFilename, Mesh::MeshType meshType, const std::string& geometryShaderFilename = "");
 	DrawCall(const std::string& vertexShaderFilename, const std::string& pixelShaderFilename, const std::string& modelFilename, const std::string& geometryShaderFilename = "");
+	~DrawCall();
 
 	void LoadMesh(const std::string& vertexShaderFilename, const std::string& pixelShaderFilename, std::shared_ptr<Mesh> mesh, const std::string& geometryShaderFilename = "");
 
@@ -659,6 +873,7 @@ public:
 	bool TestPointInside(const DirectX::XMVECTOR& pointInWorldSpace, const unsigned instanceIndex = 0);
 	bool TestRayIntersection(const DirectX::XMVECTOR& rayOriginInWorldSpace, const DirectX::XMVECTOR& rayDirectionInWorldSpace, float &distance, DirectX::XMVECTOR &normal, const unsigned instanceIndex = 0);
 	bool TestRayIntersection(const DirectX::XMVECTOR& rayOriginInWorldSpace, const DirectX::XMVECTOR& rayDirectionInWorldSpace, float& distance, const unsigned instanceIndex = 0);
+	bool TestCapsuleIntersection(const DirectX::XMVECTOR& capsuleStartInWorldSpace, const DirectX::XMVECTOR& capsuleEndInWorldSpace, float capsuleRadius, const unsigned instanceIndex = 0);
 
 	std::shared_ptr<Shader> GetVertexShader(unsigned renderPassIndex = 0);
 	std::shared_ptr<Shader> GetPixelShader(unsigned renderPassIndex = 0);
@@ -668,20 +883,204 @@ public:
 	std::shared_ptr<Mesh> GetMesh() { return m_mesh; }
 	void SetMesh(std::shared_ptr<Mesh> mesh) { m_mesh = mesh; }
 
+	// Turn off for shaders that move vertices beyond the mesh bounding box, as culling would drop visible instances
+	void SetCullingEnabled(bool enabled) { m_cullingEnabled = enabled; }
+
 	void Draw(unsigned instancesToDraw = 1);
 
+	// Geometry owned outside of a Mesh, e.g. buffers the CPU streams into every frame (see HandMeshStream).
+	// vertexElements describe slot 0 only, this draw call appends its instance elements. They are used as the
+	//  key of a cached input layout, so they must outlive the draw call.
+	struct ExternalGeometry
+	{
+		ID3D11Buffer* vertexBuffer = nullptr;
+		unsigned vertexStride = 0;
+		ID3D11Buffer* indexBuffer = nullptr;
+		DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
+		unsigned indexCount = 0;
+		const std::vector<D3D11_INPUT_ELEMENT_DESC>* vertexElements = nullptr;
+	};
+
+	// Draws external geometry with this draw call's shaders, constants and instances instead of its mesh
+	void DrawExternal(const ExternalGeometry& geometry, unsigned instancesToDraw = 1);
+
+	// Draw resolved once for an object that does not change, e.g. a static model. For every render pass, with and without
+	//  single pass stereo, it holds the shaders whose constants are written, the input layout, the vertex, index and
+	//  instance buffer bindings and the topology, so drawing it is a fixed run of binds with no lookups or selection.
+	// Instances go into an immutable buffer of their own. Compile again after changing the mesh, shaders, instances or
+	//  all instance world transform, the packet keeps drawing what was there when it was compiled.
+	// While the render queue is on, compiled packets are queued and sorted with the other draws but never merged with
+	//  them, and the packet has to stay alive until the queue is flushed. Otherwise, and in fullscreen passes, they are
+	//  drawn immediately, after flushing the queue. They are not scaled to the target in fullscreen passes.
+	struct CompiledPacket
+	{
+		struct Variant
+		{
+			Shader* shaders[3];						// Vertex, pixel, geometry, in the order their constants are written
+			unsigned shaderCount;					// 0 when the pass has no shaders for this variant
+			ID3D11InputLayout* inputLayout;
+		};
+
+		struct Pass
+		{
+			unsigned renderPassIndex;
+			Variant variants[2];					// Without, with single pass stereo
+		};
+
+		std::vector<Pass> passes;
+		ID3D11Buffer* vertexBuffers[2];				// Mesh, instances
+		UINT vertexStrides[2];
+		UINT vertexOffsets[2];
+		ID3D11Buffer* indexBuffer;
+		D3D11_PRIMITIVE_TOPOLOGY topology;
+		unsigned indexCount;
+		unsigned instanceCount;
+		DirectX::XMMATRIX allInstanceWorldTransform;
+		DirectX::XMVECTOR firstInstancePosition;	// Before the all instance world transform, for the queue's depth order
+
+		// What the raw pointers above point to, kept alive for as long as the packet
+		std::vector<std::shared_ptr<Shader>> shaderReferences;
+		std::vector<::Microsoft::WRL::ComPtr<ID3D11InputLayout>> layoutReferences;
+		::Microsoft::WRL::ComPtr<ID3D11Buffer> meshBuffers[2];
+		::Microsoft::WRL::ComPtr<ID3D11Buffer> instanceBuffer;
+	};
+
+	// False, leaving packet empty, when there is nothing to draw or the mesh is streamed and so has no fixed buffers
+	bool Compile(CompiledPacket& packet, unsigned instancesToDraw = 1);
+	static void DrawCompiled(const CompiledPacket& packet);
+
 	DirectX::XMMATRIX allInstanceWorldTransform;	// Global world transform that will be applied to all instances
 
 private:
 
+	static const unsigned kQueuedTextureSlots = 4;
+
+	struct QueuedTextures
+	{
+		ID3D11ShaderResourceView* views[kQueuedTextureSlots];
+		ID3D11SamplerState* samplers[kQueuedTextureSlots];
+	};
+
+	struct QueuedViewProjection
+	{
+		View view;
+		Projection projection;
+		StereoFrustum frustum;				// Of both eyes when stereo, in world space
+	};
+
+	struct RenderPacket
+	{
+		DrawCall* drawCall;
+		DirectX::XMMATRIX allInstanceWorldTransform;
+		unsigned instanceCount;
+		size_t instanceDataOffset;			// Into m_queueInstanceData, instances are copied when recorded
+		bool particleInstancing;
+		unsigned viewProjectionIndex;		// Into m_queueViewProjections
+		BlendState blendState;
+		bool depthTestEnabled;
+		bool backfaceCullingEnabled;
+		QueuedTextures textures;
+		bool isExternal;
+		ExternalGeometry geometry;			// Only when isExternal
+		ID3D11InputLayout* externalLayout;
+		const CompiledPacket* compiled;		// Set by DrawCompiled, which queues no draw call and no instances
+	};
+
+	// Run of sorted packets drawn with one instanced draw, the first packet supplies everything but the instances
+	struct RenderBatch
+	{
+		unsigned firstEntry;				// Into m_queueSortEntries
+		unsigned packetCount;
+		unsigned instanceCount;
+		UINT instanceBufferOffset;			// From the start of m_queueInstanceAllocation, in bytes
+	};
+
+	// What the last submitted packet left bound, so the next one only binds what differs
+	struct BoundState
+	{
+		QueuedTextures textures;
+		Shader* shaders[3];					// Vertex, pixel, geometry
+		ID3D11InputLayout* inputLayout;
+		ID3D11Buffer* vertexBuffers[2];
+		UINT vertexStrides[2];
+		UINT vertexOffsets[2];
+		ID3D11Buffer* indexBuffer;
+		UINT indexOffset;
+		D3D11_PRIMITIVE_TOPOLOGY topology;
+	};
+
+	// Where draws are recorded: the immediate context, or the deferred context of a thread recording part of a flush.
+	// Everything a recorder writes is its own, so recorders on different threads never share what they write.
+	// A deferred recorder uploads constants to its own copy of each constant buffer, as the staging copy of a buffer
+	//  and whether it was uploaded only hold for one context.
+	struct Recorder
+	{
+		RenderContext* context;
+		std::unique_ptr<RenderContext> deferredContext;		// Null for the immediate context
+		std::unordered_map<const ConstantBuffer*, ConstantBuffer> constantBuffers;	// Keyed by the shader's buffer
+		ViewConstantCache viewConstantCache;
+		PipelineStateKey appliedPipelineStateKey;
+		BoundState boundState;
+		ShaderConstantStats shaderConstantStats;		// The totals for the immediate recorder
+		RenderQueueStats renderQueueStats;				// Binds and draws, added to the totals after each flush
+	};
+
+	// Threads recording the deferred runs of a parallel flush, one per deferred recorder. They are started as needed
+	//  and kept from flush to flush, so a flush only wakes them and waits for them to finish.
+	class RecordingWorkerPool;
+
+	static Recorder m_immediateRecorder;
+	static std::vector<std::unique_ptr<Recorder>> m_deferredRecorders;
+	static std::unique_ptr<RecordingWorkerPool> m_recordingWorkers;
+	static unsigned m_recordingThreadCount;
+
+	static bool m_renderQueueEnabled;
+	static bool m_frustumCullingEnabled;
+	static std::vector<RenderPacket> m_queuePackets;
+	static std::vector<RadixSortEntry> m_queueSortEntries;
+	static std::vector<RadixSortEntry> m_queueSortScratch;
+	static std::vector<unsigned char> m_queueInstanceData;
+	static std::vector<QueuedViewProjection> m_queueViewProjections;
+	static std::vector<RenderBatch> m_queueBatches;
+	static UploadRing::Allocation m_queueInstanceAllocation;	// Instances of every packet of the flush
+	static QueuedTextures m_queuedTextures;		// Bound by Texture2D since the last flush, and sticky like real bindings
+	static RenderQueueStats m_renderQueueStats;
+
+	static uint64_t CalculateSortKey(const RenderPacket& packet, uint32_t packetIndex);
+	static bool CanInstanceTogether(const RenderPacket& first, const RenderPacket& packet);
+	static void BuildQueueBatches();
+	static void UploadQueueInstances();
+	static void RecordQueueBatches(Recorder& recorder, unsigned firstBatch, unsigned endBatch);
+	static bool RecordQueueInParallel(unsigned recorderCount);
+	static void ReleaseDeferredRecorders();	// Stops the workers first
+	static void CollectRecorderStats(Recorder& recorder);
+	static void SubmitQueuedState(Recorder& recorder, const RenderPacket& packet);
+	static void RestoreImmediateState();
+	template<typename T> static bool BindIfChanged(Recorder& recorder, T& bound, const T& value);
+
 	void SetupDraw(unsigned instancesToDraw);
-	void UpdateShaderConstants(std::shared_ptr<Shader> pShader);
+	ID3D11InputLayout* GetExternalLayout(const ExternalGeometry& geometry, bool isSinglePassStereo);
+	void QueueDraw(const ExternalGeometry* geometry, unsigned instancesToDraw);
+	static unsigned QueueViewProjection();	// Index of the active view and projection in m_queueViewProjections
+	static void QueueCompiled(const CompiledPacket& compiled);
+	static void SubmitCompiled(Recorder& recorder, const RenderPacket& packet);
+	static const CompiledPacket::Variant* GetCompiledVariant(const CompiledPacket& packet, bool isSinglePassStereo);	// For the active pass
+	void FlushQueuedPackets();			// Only if this draw call has packets queued
+	void SubmitBatch(Recorder& recorder, const RenderPacket& packet, const RenderBatch& batch);
+	static void UpdateShaderConstants(Shader* shader, const DirectX::XMMATRIX& worldTransform);	// On the immediate context
+	static void UpdateShaderConstants(Recorder& recorder, Shader* shader, const DirectX::XMMATRIX& worldTransform, const View& view, const Projection& projection);
+	static ConstantBuffer* GetRecorderConstantBuffer(Recorder& recorder, ConstantBuffer& buffer);
 
 	::Microsoft::WRL::ComPtr<ID3D11InputLayout> m_instancingLayout;
 	::Microsoft::WRL::ComPtr<ID3D11InputLayout> m_instancingLayoutSPS;
-	::Microsoft::WRL::ComPtr<ID3D11Buffer> m_instanceBuffer;
+	// Keyed by vertex elements, render pass index, single pass stereo and particle instancing, as each pass has its
+	//  own vertex shader to validate the layout against and the instance elements follow the instancing mode
+	typedef std::tuple<const std::vector<D3D11_INPUT_ELEMENT_DESC>*, unsigned, bool, bool> ExternalLayoutKey;
+	std::map<ExternalLayoutKey, ::Microsoft::WRL::ComPtr<ID3D11InputLayout>> m_externalLayouts;
+	UploadRing::Allocation m_instanceAllocation;	// Instances of the last immediate draw
 	bool m_instanceBufferNeedsUpdate;
 	bool m_particleInstancingEnabled;
+	bool m_cullingEnabled = true;
 
 	std::vector<Instance> m_instances;
 	std::vector<ParticleInstance> m_particleInstances;
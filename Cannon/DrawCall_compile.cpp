@@ -0,0 +1,160 @@
+#include "pch.h"
+
+#include "DrawCall.h"
+
+using namespace std;
+using namespace DirectX;
+
+extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
+extern std::unique_ptr<RenderContext> g_renderContext;
+
+bool DrawCall::Compile(CompiledPacket& packet, unsigned instancesToDraw)
+{
+	packet = CompiledPacket();
+
+	unsigned instanceCapacity = m_particleInstancingEnabled ? (unsigned) m_particleInstances.size() : (unsigned) m_instances.size();
+	if (instancesToDraw > instanceCapacity)
+		instancesToDraw = instanceCapacity;
+
+	if (instancesToDraw == 0 || !m_mesh || m_mesh->IsEmpty())
+		return false;
+
+	// Brings the mesh buffers up to date, which may also switch a mesh that keeps changing to streaming
+	ID3D11Buffer* vertexBuffer = m_mesh->GetVertexBuffer();
+	ID3D11Buffer* indexBuffer = m_mesh->GetIndexBuffer();
+	if (m_mesh->IsStreamed() || !vertexBuffer || !indexBuffer)
+		return false;
+
+	unsigned instanceSize = m_particleInstancingEnabled ? sizeof(ParticleInstance) : sizeof(Instance);
+	const void* instanceData = m_particleInstancingEnabled ? (const void*) m_particleInstances.data() : (const void*) m_instances.data();
+
+	D3D11_BUFFER_DESC d3dBufferDesc;
+	memset(&d3dBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
+	d3dBufferDesc.ByteWidth = instancesToDraw * instanceSize;
+	d3dBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	d3dBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	d3dBufferDesc.StructureByteStride = instanceSize;
+
+	D3D11_SUBRESOURCE_DATA data;
+	memset(&data, 0, sizeof(data));
+	data.pSysMem = instanceData;
+
+	if (FAILED(g_d3dDevice->CreateBuffer(&d3dBufferDesc, &data, &packet.instanceBuffer)))
+		return false;
+
+	for (auto& shaderSetRecord : m_shaderSets)
+	{
+		const ShaderSet& shaderSet = shaderSetRecord.second;
+		if (!shaderSet.pixelShader)
+			continue;
+
+		CompiledPacket::Pass pass;
+		pass.renderPassIndex = shaderSetRecord.first;
+
+		for (unsigned variantIndex = 0; variantIndex < 2; ++variantIndex)
+		{
+			CompiledPacket::Variant& variant = pass.variants[variantIndex];
+			memset(&variant, 0, sizeof(variant));
+
+			bool isSinglePassStereo = variantIndex == 1;
+			const shared_ptr<Shader>& vertexShader = isSinglePassStereo ? shaderSet.vertexShaderSPS : shaderSet.vertexShader;
+			ID3D11InputLayout* inputLayout = isSinglePassStereo ? m_instancingLayoutSPS.Get() : m_instancingLayout.Get();
+			if (!vertexShader || !inputLayout)
+				continue;
+
+			variant.shaders[variant.shaderCount++] = vertexShader.get();
+			variant.shaders[variant.shaderCount++] = shaderSet.pixelShader.get();
+			if (shaderSet.geometryShader)
+				variant.shaders[variant.shaderCount++] = shaderSet.geometryShader.get();
+			variant.inputLayout = inputLayout;
+
+			packet.shaderReferences.push_back(vertexShader);
+			packet.shaderReferences.push_back(shaderSet.pixelShader);
+			if (shaderSet.geometryShader)
+				packet.shaderReferences.push_back(shaderSet.geometryShader);
+			packet.layoutReferences.push_back(inputLayout);
+		}
+
+		packet.passes.push_back(pass);
+	}
+
+	if (packet.passes.empty())
+	{
+		packet = CompiledPacket();
+		return false;
+	}
+
+	packet.meshBuffers[0] = vertexBuffer;
+	packet.meshBuffers[1] = indexBuffer;
+
+	packet.vertexBuffers[0] = vertexBuffer;
+	packet.vertexBuffers[1] = packet.instanceBuffer.Get();
+	packet.vertexStrides[0] = sizeof(Mesh::Vertex);
+	packet.vertexStrides[1] = instanceSize;
+	packet.vertexOffsets[0] = 0;
+	packet.vertexOffsets[1] = 0;
+	packet.indexBuffer = indexBuffer;
+	packet.topology = m_mesh->GetDrawStyle() == Mesh::DS_LINELIST ? D3D11_PRIMITIVE_TOPOLOGY_LINELIST : D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	packet.indexCount = m_mesh->GetIndexCount();
+	packet.instanceCount = instancesToDraw;
+	packet.allInstanceWorldTransform = allInstanceWorldTransform;
+	packet.firstInstancePosition = m_particleInstancingEnabled ? XMVectorSetW(m_particleInstances[0].translationScale, 1.0f) : m_instances[0].worldTransform.r[3];
+
+	return true;
+}
+
+const DrawCall::CompiledPacket::Variant* DrawCall::GetCompiledVariant(const CompiledPacket& packet, bool isSinglePassStereo)
+{
+	for (const CompiledPacket::Pass& pass : packet.passes)
+	{
+		if (pass.renderPassIndex == m_activeRenderPassIndex)
+		{
+			const CompiledPacket::Variant& variant = pass.variants[isSinglePassStereo ? 1 : 0];
+			return variant.shaderCount ? &variant : nullptr;
+		}
+	}
+
+	return nullptr;
+}
+
+void DrawCall::DrawCompiled(const CompiledPacket& packet)
+{
+	// Fullscreen passes stay immediate, like Draw
+	if (m_renderQueueEnabled && (m_sFullscreenPassStates.empty() || !m_sFullscreenPassStates.top()))
+	{
+		QueueCompiled(packet);
+		return;
+	}
+
+	// Queued packets were recorded first, so they are drawn first
+	FlushRenderQueue();
+
+	bool isSinglePassStereo = GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled();
+	const CompiledPacket::Variant* variant = GetCompiledVariant(packet, isSinglePassStereo);
+	if (!variant)
+		return;
+
+	ApplyPipelineState();
+	if (m_renderQueueEnabled)
+		RestoreImmediateState();
+
+	for (unsigned shaderIndex = 0; shaderIndex < variant->shaderCount; ++shaderIndex)
+	{
+		variant->shaders[shaderIndex]->Bind();
+		UpdateShaderConstants(variant->shaders[shaderIndex], packet.allInstanceWorldTransform);
+	}
+
+	if (variant->shaderCount < 3)
+		g_renderContext->GSSetShader(nullptr, nullptr, 0);
+
+	g_renderContext->IASetInputLayout(variant->inputLayout);
+	g_renderContext->IASetVertexBuffers(0, 2, packet.vertexBuffers, packet.vertexStrides, packet.vertexOffsets);
+	g_renderContext->IASetIndexBuffer(packet.indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	g_renderContext->IASetPrimitiveTopology(packet.topology);
+
+	unsigned instancesToDraw = packet.instanceCount;
+	if (isSinglePassStereo)
+		instancesToDraw *= 2;
+
+	g_renderContext->DrawIndexedInstanced(packet.indexCount, instancesToDraw, 0, 0, 0);
+}
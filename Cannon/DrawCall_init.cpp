@@ -22,6 +22,7 @@ Microsoft::WRL::ComPtr<ID3D11Device4>  g_d3dDevice4;
 
 extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
 extern Microsoft::WRL::ComPtr<ID3D11DeviceContext> g_d3dContext;
+extern std::unique_ptr<RenderContext> g_renderContext;
 
 extern Microsoft::WRL::ComPtr<ID2D1Factory1> g_d2dFactory;
 extern Microsoft::WRL::ComPtr<ID2D1Device> g_d2dDevice;
@@ -40,7 +41,7 @@ extern Microsoft::WRL::ComPtr<ID2D1SolidColorBrush> g_blackBrush;
 /// DirectXŜ̏Ȃ
 /// </summary>
 /// <returns></returns>
-bool DrawCall::Initialize()
+bool DrawCall::Initialize(RenderBackend backend)
 {
 	//
 	// Create device
@@ -48,6 +49,7 @@ bool DrawCall::Initialize()
 
 	if(g_initialized) return true;
 	g_initialized = true;
+	m_renderBackend = backend;
 
 	unsigned createDeviceFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;	// Required for D2D to work
 #ifdef _DEBUG
@@ -57,7 +59,22 @@ bool DrawCall::Initialize()
 	D3D_FEATURE_LEVEL selectedFeatureLevel;
 
 //#if 0
-	if (!MixedReality::IsAvailable())
+	if (backend == RenderBackend::Null)
+	{
+		// Shaders, buffers and textures are still created, on a device that does not render, so the engine runs as it
+		//  would on a GPU. The null driver is not always installed, WARP is.
+		D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0 };
+		HRESULT hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_NULL, 0, createDeviceFlags, featureLevels, ARRAYSIZE(featureLevels), D3D11_SDK_VERSION, &g_d3dDevice, &selectedFeatureLevel, &g_d3dContext);
+		if (FAILED(hr))
+			hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, 0, createDeviceFlags, featureLevels, ARRAYSIZE(featureLevels), D3D11_SDK_VERSION, &g_d3dDevice, &selectedFeatureLevel, &g_d3dContext);
+
+		if (FAILED(hr))
+		{
+			g_initialized = false;
+			return false;
+		}
+	}
+	else if (!MixedReality::IsAvailable())
 	{
 		D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0 };
 		D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, 0, createDeviceFlags, featureLevels, ARRAYSIZE(featureLevels), D3D11_SDK_VERSION, &g_d3dDevice, &selectedFeatureLevel, nullptr);
@@ -178,6 +195,12 @@ bool DrawCall::Initialize()
 		winrt::check_hresult(g_d3dDevice.As(&g_d3dDevice4));
 		winrt::check_hresult(context.As(&g_d3dContext));
 	}
+
+	if (backend == RenderBackend::Null)
+		g_renderContext = make_unique<NullRenderContext>();
+	else
+		g_renderContext = make_unique<D3D11RenderContext>(g_d3dContext.Get());
+
 	// Check for device support for the optional feature that allows setting the render target array index from the vertex shader
 	m_singlePassStereoSupported = false;
 	m_singlePassStereoEnabled = false;
@@ -193,33 +216,38 @@ bool DrawCall::Initialize()
 	// Create D2D and DWrite stuff
 	//
 
-	D2D1_FACTORY_OPTIONS options;
-	ZeroMemory(&options, sizeof(D2D1_FACTORY_OPTIONS));
+	// Text is drawn with Direct2D, which the null backend goes without
+	if (backend == RenderBackend::D3D11)
+	{
+		D2D1_FACTORY_OPTIONS options;
+		ZeroMemory(&options, sizeof(D2D1_FACTORY_OPTIONS));
 
 #if defined(_DEBUG)
-	// If the project is in a debug build, enable Direct2D debugging via SDK Layers.
-	//options.debugLevel = D2D1_DEBUG_LEVEL_INFORMATION;
+		// If the project is in a debug build, enable Direct2D debugging via SDK Layers.
+		//options.debugLevel = D2D1_DEBUG_LEVEL_INFORMATION;
 #endif
 
-	D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory1), &options, &g_d2dFactory);
+		D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory1), &options, &g_d2dFactory);
 	
-	DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), &g_dwriteFactory);
+		DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), &g_dwriteFactory);
 
-	Microsoft::WRL::ComPtr<IDXGIDevice> dxgiDevice;
-	g_d3dDevice.As(&dxgiDevice);
-	g_d2dFactory->CreateDevice(dxgiDevice.Get(), &g_d2dDevice);
-	g_d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &g_d2dContext);
+		Microsoft::WRL::ComPtr<IDXGIDevice> dxgiDevice;
+		g_d3dDevice.As(&dxgiDevice);
+		g_d2dFactory->CreateDevice(dxgiDevice.Get(), &g_d2dDevice);
+		g_d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &g_d2dContext);
 	
-	g_d2dContext->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+		g_d2dContext->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
 	
-	g_d2dContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White), &g_whiteBrush);
-	g_d2dContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Gray), &g_grayBrush);
-	g_d2dContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Black), &g_blackBrush);
+		g_d2dContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White), &g_whiteBrush);
+		g_d2dContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Gray), &g_grayBrush);
+		g_d2dContext->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Black), &g_blackBrush);
+	}
 
 	//
 	// Setup static objects (and set their values to reasonable defaults)
 	//
 
+	m_immediateRecorder.context = g_renderContext.get();
 	m_activeRenderPassIndex = 0;
 	SetBackBuffer(make_shared<Texture2D>(512, 512, DXGI_FORMAT_B8G8R8A8_UNORM));
 
@@ -235,61 +263,10 @@ bool DrawCall::Initialize()
 	m_mtxLightViewProj = XMMatrixIdentity();
 	m_mtxCameraView = XMMatrixIdentity();
 
-	// Create the alpha blend state
-	D3D11_BLEND_DESC blendDesc;
-	memset(&blendDesc, 0, sizeof(blendDesc));
-	blendDesc.AlphaToCoverageEnable = FALSE;
-	blendDesc.IndependentBlendEnable = FALSE;
-	blendDesc.RenderTarget[0].BlendEnable = TRUE;
-	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
-	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
-	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_SRC_ALPHA;
-	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
-	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-	g_d3dDevice->CreateBlendState(&blendDesc, &m_d3dAlphaBlendEnabledState);
+	// Blend, depth and rasterizer state objects are created the first time a draw needs them
+	m_immediateRecorder.appliedPipelineStateKey = kInvalidPipelineStateKey;
 	DrawCall::PushAlphaBlendState(BLEND_NONE);
-
-	// Create the additive blend state
-	memset(&blendDesc, 0, sizeof(blendDesc));
-	blendDesc.AlphaToCoverageEnable = FALSE;
-	blendDesc.IndependentBlendEnable = FALSE;
-	blendDesc.RenderTarget[0].BlendEnable = TRUE;
-	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
-	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-	g_d3dDevice->CreateBlendState(&blendDesc, &m_d3dAdditiveBlendEnabledState);
-
-	// Create the color write disabled state
-	memset(&blendDesc, 0, sizeof(blendDesc));
-	g_d3dDevice->CreateBlendState(&blendDesc, &m_d3dColorWriteDisabledState);
-
-	// Create the depth test disabled state
-	D3D11_DEPTH_STENCIL_DESC depthStencilDesc;
-	memset(&depthStencilDesc, 0, sizeof(depthStencilDesc));
-	depthStencilDesc.DepthEnable = FALSE;
-	g_d3dDevice->CreateDepthStencilState(&depthStencilDesc, &m_d3dDepthTestDisabledState);
 	DrawCall::PushDepthTestState(true);
-
-	// Create the backface culling disabled state
-	D3D11_RASTERIZER_DESC rasterizerDesc;
-	memset(&rasterizerDesc, 0, sizeof(rasterizerDesc));
-	rasterizerDesc.FillMode = D3D11_FILL_SOLID;
-	rasterizerDesc.CullMode = D3D11_CULL_NONE;
-	rasterizerDesc.FrontCounterClockwise = FALSE;
-	rasterizerDesc.DepthBias = 0;
-	rasterizerDesc.SlopeScaledDepthBias = 0.f;
-	rasterizerDesc.DepthBiasClamp = 0.f;
-	rasterizerDesc.DepthClipEnable = TRUE;
-	rasterizerDesc.ScissorEnable = FALSE;
-	rasterizerDesc.MultisampleEnable = FALSE;
-	rasterizerDesc.AntialiasedLineEnable = FALSE;
-	g_d3dDevice->CreateRasterizerState(&rasterizerDesc, &m_d3dBackfaceCullingDisabledState);
 	DrawCall::PushBackfaceCullingState(true);
 
 	return true;
@@ -2,6 +2,7 @@
 
 #include "DrawCall.h"
 #include "Common/FileUtilities.h"
+#include "Common/CapsuleTests.h"
 
 #include <iostream>
 #include <fstream>
@@ -15,7 +16,7 @@ using namespace std;
 using namespace DirectX;
 
 extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
-extern Microsoft::WRL::ComPtr<ID3D11DeviceContext> g_d3dContext;
+extern std::unique_ptr<RenderContext> g_renderContext;
 
 extern Microsoft::WRL::ComPtr<ID2D1Factory1> g_d2dFactory;
 extern Microsoft::WRL::ComPtr<ID2D1Device> g_d2dDevice;
@@ -36,7 +37,7 @@ extern Microsoft::WRL::ComPtr<ID2D1SolidColorBrush> g_blackBrush;
 //
 
 Mesh::Mesh(MeshType type)
-	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true)
+	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true), m_isStreamed(false), m_lastUpdateFrame(0), m_updateFrameCount(0)
 {
 	if(type == MT_PLANE || type == MT_UIPLANE || type == MT_ZERO_ONE_PLANE_XY_NEGATIVE_Z_NORMAL)
 		LoadPlane(type, 1.5, 0.85);
@@ -51,19 +52,19 @@ Mesh::Mesh(MeshType type)
 }
 
 Mesh::Mesh(Mesh::Vertex* pVertices, unsigned vertexCount)
-	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true)
+	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true), m_isStreamed(false), m_lastUpdateFrame(0), m_updateFrameCount(0)
 {
 	UpdateVertices(pVertices, vertexCount);
 }
 
 Mesh::Mesh(Mesh::Vertex* pVertices, unsigned vertexCount, unsigned* pIndices, unsigned indexCount)
-	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true)
+	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true), m_isStreamed(false), m_lastUpdateFrame(0), m_updateFrameCount(0)
 {
 	UpdateVertices(pVertices, vertexCount, pIndices, indexCount);
 }
 
 Mesh::Mesh(string filename)
-	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true)
+	: m_drawStyle(DS_TRILIST), m_d3dBuffersNeedUpdate(true), m_boundingBoxNeedsUpdate(true), m_isStreamed(false), m_lastUpdateFrame(0), m_updateFrameCount(0)
 {
 	if (!FileExists(filename))
 		filename = string("Media/Meshes/") + filename;
@@ -855,18 +856,79 @@ std::vector<unsigned>& Mesh::GetIndices()
 
 ID3D11Buffer* Mesh::GetVertexBuffer()
 {
-	if (m_d3dBuffersNeedUpdate)
+	if (NeedsD3DBufferUpdate())
 		UpdateD3DBuffers();
 
-	return m_d3dVertexBuffer.Get();
+	return m_isStreamed ? m_streamAllocation.buffer : m_d3dVertexBuffer.Get();
 }
 
 ID3D11Buffer* Mesh::GetIndexBuffer()
 {
-	if (m_d3dBuffersNeedUpdate)
+	if (NeedsD3DBufferUpdate())
+		UpdateD3DBuffers();
+
+	return m_isStreamed ? m_streamAllocation.buffer : m_d3dIndexBuffer.Get();
+}
+
+UINT Mesh::GetVertexBufferOffset()
+{
+	if (NeedsD3DBufferUpdate())
 		UpdateD3DBuffers();
 
-	return m_d3dIndexBuffer.Get();
+	return m_isStreamed ? m_streamAllocation.offset : 0;
+}
+
+UINT Mesh::GetIndexBufferOffset()
+{
+	if (NeedsD3DBufferUpdate())
+		UpdateD3DBuffers();
+
+	return m_isStreamed ? m_streamAllocation.offset + UploadRing::Align((UINT) m_vertices.size() * sizeof(Vertex)) : 0;
+}
+
+void Mesh::SetStreamed(bool streamed)
+{
+	if (streamed == m_isStreamed)
+		return;
+
+	m_isStreamed = streamed;
+	m_d3dBuffersNeedUpdate = true;
+}
+
+UINT Mesh::GetPendingUploadSize()
+{
+	if (IsEmpty())
+		return 0;
+
+	// Unchanged data is only streamed again when it was streamed this frame, see UpdateD3DBuffers
+	uint64_t frameIndex = DrawCall::GetUploadRing().GetFrameIndex();
+	bool mayStream;
+	if (m_d3dBuffersNeedUpdate)
+		mayStream = m_isStreamed || CountUpdateFrame(frameIndex) >= kStreamAfterFrames;
+	else
+		mayStream = m_isStreamed && m_streamAllocation.frameIndex == frameIndex;
+
+	if (!mayStream)
+		return 0;
+
+	return UploadRing::Align((UINT) m_vertices.size() * sizeof(Vertex)) + UploadRing::Align((UINT) m_indices.size() * sizeof(unsigned));
+}
+
+// Streamed meshes also need writing again once the upload ring has come around to them
+bool Mesh::NeedsD3DBufferUpdate()
+{
+	return m_d3dBuffersNeedUpdate || (m_isStreamed && !IsEmpty() && !DrawCall::GetUploadRing().IsValid(m_streamAllocation));
+}
+
+// How many frames in a row the buffers will have been updated on, if they are updated on frameIndex
+unsigned Mesh::CountUpdateFrame(uint64_t frameIndex)
+{
+	if (m_updateFrameCount > 0 && frameIndex == m_lastUpdateFrame)
+		return m_updateFrameCount;
+	else if (m_updateFrameCount > 0 && frameIndex == m_lastUpdateFrame + 1)
+		return m_updateFrameCount + 1;
+	else
+		return 1;
 }
 
 bool Mesh::BoundingBoxNode::TestRayIntersection(const vector<Vertex>& vertices, const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace,
@@ -962,6 +1024,40 @@ bool Mesh::BoundingBoxNode::TestRayIntersection(const vector<Vertex>& vertices,
 	return hit;
 }
 
+bool Mesh::BoundingBoxNode::TestCapsuleIntersection(const vector<Vertex>& vertices, const XMVECTOR& capsuleStartInWorldSpace, const XMVECTOR& capsuleEndInWorldSpace,
+	float capsuleRadius, const XMMATRIX& worldTransform)
+{
+	// Same conservative world space box as the ray test, so any transform works
+	BoundingBox boundingBoxInWorldSpace;
+	boundingBox.Transform(boundingBoxInWorldSpace, worldTransform);
+	if (!CapsuleTests::IntersectsAlignedBox(capsuleStartInWorldSpace, capsuleEndInWorldSpace, capsuleRadius,
+		XMLoadFloat3(&boundingBoxInWorldSpace.Center), XMLoadFloat3(&boundingBoxInWorldSpace.Extents)))
+		return false;
+
+	if (!children.empty())
+	{
+		for (auto& node : children)
+		{
+			if (node.TestCapsuleIntersection(vertices, capsuleStartInWorldSpace, capsuleEndInWorldSpace, capsuleRadius, worldTransform))
+				return true;
+		}
+
+		return false;
+	}
+
+	for (size_t i = 0; i < indicesContained.size(); i += 3)
+	{
+		XMVECTOR v1 = XMVector3Transform(vertices[indicesContained[i + 0]].position, worldTransform);
+		XMVECTOR v2 = XMVector3Transform(vertices[indicesContained[i + 1]].position, worldTransform);
+		XMVECTOR v3 = XMVector3Transform(vertices[indicesContained[i + 2]].position, worldTransform);
+
+		if (CapsuleTests::IntersectsTriangle(capsuleStartInWorldSpace, capsuleEndInWorldSpace, capsuleRadius, v1, v2, v3))
+			return true;
+	}
+
+	return false;
+}
+
 bool Mesh::TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, const XMMATRIX& worldTransform, float &distance, XMVECTOR &normal, float maxDistance, bool returnFurthest)
 {
 	if (IsEmpty())
@@ -982,6 +1078,20 @@ bool Mesh::TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVE
 	return TestRayIntersection(rayOriginInWorldSpace, rayDirectionInWorldSpace, worldTransform, distance, normal);
 }
 
+bool Mesh::TestCapsuleIntersection(const XMVECTOR& capsuleStartInWorldSpace, const XMVECTOR& capsuleEndInWorldSpace, float capsuleRadius, const XMMATRIX& worldTransform)
+{
+	if (IsEmpty())
+		return false;
+
+	if (m_boundingBoxNeedsUpdate)
+		UpdateBoundingBox();
+
+	if (m_drawStyle != Mesh::DS_TRILIST)
+		return false;
+
+	return m_boundingBoxNode.TestCapsuleIntersection(m_vertices, capsuleStartInWorldSpace, capsuleEndInWorldSpace, capsuleRadius, worldTransform);
+}
+
 bool Mesh::TestPointInside(const XMVECTOR& pointInWorldSpace, const XMMATRIX& worldTransform)
 {
 	if (IsEmpty())
@@ -1109,56 +1219,96 @@ void Mesh::UpdateBoundingBox()
 	m_boundingBoxNode.GenerateChildNodes(m_vertices, m_indices, 1);
 }
 
-// Updates the vertex/index buffers if they already exists and is large enough, otherwise recreates them
-void Mesh::UpdateD3DBuffers()
+// Writes data into buffer if it is large enough, otherwise recreates it. A buffer that has to grow gets half again what
+//  it needs, so a mesh that keeps growing is not recreated on every update.
+static void UpdateD3DBuffer(Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer, D3D11_BUFFER_DESC& desc, UINT bindFlags, UINT stride, const void* data, UINT size)
 {
-	m_d3dBuffersNeedUpdate = false;
-
-	if (IsEmpty())
+	if (buffer && desc.ByteWidth >= size)
 	{
-		m_d3dVertexBuffer.Reset();
-		m_d3dIndexBuffer.Reset();
+		D3D11_BOX box = { 0, 0, 0, size, 1, 1 };
+		g_renderContext->UpdateSubresource(buffer.Get(), 0, &box, data, size, 1);
 		return;
 	}
 
-	if (m_d3dVertexBuffer && m_d3dVertexBufferDesc.ByteWidth / m_d3dVertexBufferDesc.StructureByteStride >= m_vertices.size())
+	bool isGrowing = buffer.Get() != nullptr;
+
+	memset(&desc, 0, sizeof(D3D11_BUFFER_DESC));
+	desc.ByteWidth = isGrowing ? (size + size / 2 + stride - 1) / stride * stride : size;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = bindFlags;
+	desc.StructureByteStride = stride;
+
+	buffer.Reset();
+	if (isGrowing)
 	{
-		g_d3dContext->UpdateSubresource(m_d3dVertexBuffer.Get(), 0, nullptr, m_vertices.data(), (UINT) m_vertices.size() * sizeof(Vertex), 1);
+		g_d3dDevice->CreateBuffer(&desc, nullptr, &buffer);
+		assert(buffer);
+
+		D3D11_BOX box = { 0, 0, 0, size, 1, 1 };
+		if (buffer)
+			g_renderContext->UpdateSubresource(buffer.Get(), 0, &box, data, size, 1);
 	}
 	else
 	{
-		memset(&m_d3dVertexBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
-		m_d3dVertexBufferDesc.ByteWidth = (UINT) m_vertices.size() * sizeof(Vertex);
-		m_d3dVertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-		m_d3dVertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		m_d3dVertexBufferDesc.StructureByteStride = sizeof(Vertex);
-
-		D3D11_SUBRESOURCE_DATA data;
-		memset(&data, 0, sizeof(data));
-		data.pSysMem = m_vertices.data();
-
-		g_d3dDevice->CreateBuffer(&m_d3dVertexBufferDesc, &data, &m_d3dVertexBuffer);
-		assert(m_d3dVertexBuffer);
+		D3D11_SUBRESOURCE_DATA initialData;
+		memset(&initialData, 0, sizeof(initialData));
+		initialData.pSysMem = data;
+
+		g_d3dDevice->CreateBuffer(&desc, &initialData, &buffer);
+		assert(buffer);
 	}
+}
+
+// Updates the vertex/index buffers, or writes a streamed mesh to the upload ring
+void Mesh::UpdateD3DBuffers()
+{
+	bool isChanged = m_d3dBuffersNeedUpdate;
+	m_d3dBuffersNeedUpdate = false;
 
-	if (m_d3dIndexBuffer && m_d3dIndexBufferDesc.ByteWidth / m_d3dIndexBufferDesc.StructureByteStride >= m_indices.size())
+	uint64_t frameIndex = DrawCall::GetUploadRing().GetFrameIndex();
+	if (isChanged)
 	{
-		g_d3dContext->UpdateSubresource(m_d3dIndexBuffer.Get(), 0, nullptr, m_indices.data(), (UINT) m_indices.size() * sizeof(unsigned), 1);
+		m_updateFrameCount = CountUpdateFrame(frameIndex);
+		m_lastUpdateFrame = frameIndex;
+		if (m_updateFrameCount >= kStreamAfterFrames)
+			m_isStreamed = true;
 	}
-	else
+	else if (m_streamAllocation.frameIndex != frameIndex)
+	{
+		// Streamed data is only good for the frame that wrote it. Unchanged since, the mesh stopped changing.
+		m_isStreamed = false;
+		m_updateFrameCount = 0;
+	}
+
+	if (IsEmpty())
+	{
+		m_d3dVertexBuffer.Reset();
+		m_d3dIndexBuffer.Reset();
+		m_streamAllocation = UploadRing::Allocation();
+		return;
+	}
+
+	UINT vertexBytes = (UINT) m_vertices.size() * sizeof(Vertex);
+	UINT indexBytes = (UINT) m_indices.size() * sizeof(unsigned);
+
+	if (m_isStreamed)
 	{
-		memset(&m_d3dIndexBufferDesc, 0, sizeof(D3D11_BUFFER_DESC));
-		m_d3dIndexBufferDesc.ByteWidth = (UINT) m_indices.size() * sizeof(unsigned);
-		m_d3dIndexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-		m_d3dIndexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		m_d3dIndexBufferDesc.StructureByteStride = sizeof(unsigned);
-
-		D3D11_SUBRESOURCE_DATA data;
-		memset(&data, 0, sizeof(data));
-		data.pSysMem = m_indices.data();
-
-		g_d3dDevice->CreateBuffer(&m_d3dIndexBufferDesc, &data, &m_d3dIndexBuffer);
-		assert(m_d3dIndexBuffer);
+		m_d3dVertexBuffer.Reset();
+		m_d3dIndexBuffer.Reset();
+
+		UploadRing& uploadRing = DrawCall::GetUploadRing();
+		unsigned char* destination = static_cast<unsigned char*>(uploadRing.Map(UploadRing::Align(vertexBytes) + indexBytes, m_streamAllocation));
+		if (!destination)
+			return;
+
+		memcpy(destination, m_vertices.data(), vertexBytes);
+		memcpy(destination + UploadRing::Align(vertexBytes), m_indices.data(), indexBytes);
+		uploadRing.Unmap();
+		return;
 	}
+
+	m_streamAllocation = UploadRing::Allocation();
+	UpdateD3DBuffer(m_d3dVertexBuffer, m_d3dVertexBufferDesc, D3D11_BIND_VERTEX_BUFFER, sizeof(Vertex), m_vertices.data(), vertexBytes);
+	UpdateD3DBuffer(m_d3dIndexBuffer, m_d3dIndexBufferDesc, D3D11_BIND_INDEX_BUFFER, sizeof(unsigned), m_indices.data(), indexBytes);
 }
 
@@ -0,0 +1,952 @@
+#include "pch.h"
+
+#include "DrawCall.h"
+#include "Common/RadixSort.h"
+
+#include <array>
+#include <cassert>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+using namespace std;
+using namespace DirectX;
+
+extern std::unique_ptr<RenderContext> g_renderContext;
+
+bool DrawCall::m_renderQueueEnabled = false;
+bool DrawCall::m_frustumCullingEnabled = true;
+vector<DrawCall::RenderPacket> DrawCall::m_queuePackets;
+vector<RadixSortEntry> DrawCall::m_queueSortEntries;
+vector<RadixSortEntry> DrawCall::m_queueSortScratch;
+vector<unsigned char> DrawCall::m_queueInstanceData;
+vector<DrawCall::QueuedViewProjection> DrawCall::m_queueViewProjections;
+vector<DrawCall::RenderBatch> DrawCall::m_queueBatches;
+UploadRing::Allocation DrawCall::m_queueInstanceAllocation;
+DrawCall::QueuedTextures DrawCall::m_queuedTextures = {};
+DrawCall::RenderQueueStats DrawCall::m_renderQueueStats;
+DrawCall::Recorder DrawCall::m_immediateRecorder = {};
+vector<unique_ptr<DrawCall::Recorder>> DrawCall::m_deferredRecorders;
+unique_ptr<DrawCall::RecordingWorkerPool> DrawCall::m_recordingWorkers;
+unsigned DrawCall::m_recordingThreadCount = 1;
+
+// The sub-pass field of the sort key is 4 bits, the queue is flushed early if a pass changes view more often than that
+static const unsigned kMaxQueuedViewProjections = 16;
+
+// Fewer batches per thread take longer to hand out than to record on the calling thread
+static const unsigned kMinBatchesPerRecorder = 32;
+
+static size_t HashQueueKey(const void* key)
+{
+	uint64_t bits = (uint64_t) (uintptr_t) key;
+	return (size_t) ((bits >> 4) * 0x9e3779b97f4a7c15ull >> 32);
+}
+
+template<size_t Count>
+static size_t HashQueueKey(const array<const void*, Count>& key)
+{
+	size_t hash = 0;
+	for (const void* pointer : key)
+		hash = hash * 31 + HashQueueKey(pointer);
+
+	return hash;
+}
+
+// Ids of the shaders, textures or meshes in the queue, dense so they fit in a few bits of the sort key.
+// An open addressed table kept from flush to flush. Clearing it only starts a new generation, so once it has grown to
+//  the keys of a flush, handing out ids allocates nothing.
+template<typename Key>
+class QueueIdTable
+{
+public:
+
+	uint64_t GetId(const Key& key)
+	{
+		if ((m_count + 1) * 2 > m_slots.size())
+			Grow();
+
+		Slot& slot = FindSlot(key);
+		if (slot.generation != m_generation)
+			slot = { key, m_generation, m_count++ };
+
+		return slot.id;
+	}
+
+	void Clear()
+	{
+		m_count = 0;
+		if (++m_generation == 0)
+		{
+			// Slots left from generation zero would look current again
+			for (Slot& slot : m_slots)
+				slot.generation = 0;
+			m_generation = 1;
+		}
+	}
+
+private:
+
+	struct Slot
+	{
+		Key key;
+		uint32_t generation;	// Zero is never current, so new slots start empty
+		uint32_t id;
+	};
+
+	vector<Slot> m_slots;
+	uint32_t m_generation = 1;
+	uint32_t m_count = 0;
+
+	// The slot of key, or the empty one it goes in
+	Slot& FindSlot(const Key& key)
+	{
+		size_t mask = m_slots.size() - 1;
+		for (size_t index = HashQueueKey(key) & mask; ; index = (index + 1) & mask)
+		{
+			Slot& slot = m_slots[index];
+			if (slot.generation != m_generation || slot.key == key)
+				return slot;
+		}
+	}
+
+	void Grow()
+	{
+		vector<Slot> slots(max<size_t>(m_slots.size() * 2, 64));
+		slots.swap(m_slots);
+
+		for (const Slot& slot : slots)
+		{
+			if (slot.generation == m_generation)
+				FindSlot(slot.key) = slot;
+		}
+	}
+};
+
+static QueueIdTable<array<const void*, 3>> s_shaderIds;
+static QueueIdTable<array<const void*, 4>> s_textureIds;
+static QueueIdTable<const void*> s_meshIds;
+
+// Positive floats compare like their bit patterns, so the top bits of the pattern are a depth that sorts correctly
+//  with a resolution relative to the depth itself
+static uint64_t QuantizeDepth(float depth, unsigned bitCount)
+{
+	depth = max(depth, 0.0f);
+
+	uint32_t depthBits;
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+	return depthBits >> (31 - bitCount);
+}
+
+void DrawCall::EnableRenderQueue(bool enabled)
+{
+	if (!enabled)
+		FlushRenderQueue();
+
+	m_renderQueueEnabled = enabled;
+}
+
+bool DrawCall::IsRenderQueueEnabled()
+{
+	return m_renderQueueEnabled;
+}
+
+void DrawCall::EnableFrustumCulling(bool enabled)
+{
+	m_frustumCullingEnabled = enabled;
+}
+
+bool DrawCall::IsFrustumCullingEnabled()
+{
+	return m_frustumCullingEnabled;
+}
+
+const DrawCall::RenderQueueStats& DrawCall::GetRenderQueueStats()
+{
+	return m_renderQueueStats;
+}
+
+void DrawCall::ResetRenderQueueStats()
+{
+	m_renderQueueStats = RenderQueueStats();
+}
+
+void DrawCall::SetRecordingThreadCount(unsigned threadCount)
+{
+	m_recordingThreadCount = max(threadCount, 1u);
+}
+
+unsigned DrawCall::GetRecordingThreadCount()
+{
+	return m_recordingThreadCount;
+}
+
+void DrawCall::QueuePixelShaderResource(unsigned slot, ID3D11ShaderResourceView* view, ID3D11SamplerState* sampler)
+{
+	// Slots beyond the ones packets carry cannot be deferred, so they are bound right away
+	if (slot >= kQueuedTextureSlots)
+	{
+		g_renderContext->PSSetShaderResources(slot, 1, &view);
+		g_renderContext->PSSetSamplers(slot, 1, &sampler);
+		return;
+	}
+
+	m_queuedTextures.views[slot] = view;
+	m_queuedTextures.samplers[slot] = sampler;
+}
+
+void DrawCall::FlushQueuedPackets()
+{
+	for (const RenderPacket& packet : m_queuePackets)
+	{
+		if (packet.drawCall == this)
+		{
+			FlushRenderQueue();
+			break;
+		}
+	}
+}
+
+void DrawCall::QueueDraw(const ExternalGeometry* geometry, unsigned instancesToDraw)
+{
+	unsigned instanceSize = m_particleInstancingEnabled ? sizeof(ParticleInstance) : sizeof(Instance);
+	unsigned instanceCapacity = (unsigned) (m_particleInstancingEnabled ? m_particleInstances.size() : m_instances.size());
+	const void* instanceData = m_particleInstancingEnabled ? (const void*) m_particleInstances.data() : (const void*) m_instances.data();
+
+	instancesToDraw = min(instancesToDraw, instanceCapacity);
+	if (instancesToDraw == 0 || (!geometry && (!m_mesh || m_mesh->IsEmpty())))
+		return;
+
+	ID3D11InputLayout* externalLayout = nullptr;
+	if (geometry)
+	{
+		externalLayout = GetExternalLayout(*geometry, GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled());
+		if (!externalLayout)
+			return;
+	}
+
+	unsigned viewProjectionIndex = QueueViewProjection();
+
+	// Instances are copied, as the draw call may change them and draw again before the queue is flushed.
+	// Only the visible ones are, packed together.
+	size_t instanceDataOffset = m_queueInstanceData.size();
+	const unsigned char* instanceBytes = static_cast<const unsigned char*>(instanceData);
+	unsigned visibleCount = instancesToDraw;
+
+	if (m_frustumCullingEnabled && m_cullingEnabled && !geometry)
+	{
+		const StereoFrustum& frustum = m_queueViewProjections[viewProjectionIndex].frustum;
+		const BoundingBox& bounds = m_mesh->GetBoundingBox();
+		XMVECTOR center = XMLoadFloat3(&bounds.Center);
+		XMVECTOR extents = XMLoadFloat3(&bounds.Extents);
+
+		// Particles face the camera, their mesh turns around its origin and is scaled by the particle alone
+		float particleRadius = XMVectorGetX(XMVector3Length(center)) + XMVectorGetX(XMVector3Length(extents));
+
+		visibleCount = 0;
+		for (unsigned instanceIndex = 0; instanceIndex < instancesToDraw; ++instanceIndex)
+		{
+			const unsigned char* instance = instanceBytes + instanceIndex * instanceSize;
+
+			bool isVisible;
+			if (m_particleInstancingEnabled)
+			{
+				const ParticleInstance& particle = *reinterpret_cast<const ParticleInstance*>(instance);
+				XMVECTOR position = XMVector3Transform(XMVectorSetW(particle.translationScale, 1.0f), allInstanceWorldTransform);
+				isVisible = frustum.IntersectsSphere(position, particleRadius * fabsf(XMVectorGetW(particle.translationScale)));
+			}
+			else
+			{
+				const Instance& meshInstance = *reinterpret_cast<const Instance*>(instance);
+				isVisible = frustum.IntersectsBox(center, extents, XMMatrixMultiply(meshInstance.worldTransform, allInstanceWorldTransform));
+			}
+
+			if (isVisible)
+			{
+				m_queueInstanceData.insert(m_queueInstanceData.end(), instance, instance + instanceSize);
+				++visibleCount;
+			}
+		}
+
+		m_renderQueueStats.instancesCulled += instancesToDraw - visibleCount;
+		if (visibleCount == 0)
+			return;
+	}
+	else
+	{
+		m_queueInstanceData.insert(m_queueInstanceData.end(), instanceBytes, instanceBytes + instancesToDraw * instanceSize);
+	}
+
+	m_renderQueueStats.instancesVisible += visibleCount;
+
+	RenderPacket packet;
+	packet.drawCall = this;
+	packet.allInstanceWorldTransform = allInstanceWorldTransform;
+	packet.instanceCount = visibleCount;
+	packet.instanceDataOffset = instanceDataOffset;
+	packet.particleInstancing = m_particleInstancingEnabled;
+	packet.viewProjectionIndex = viewProjectionIndex;
+	packet.blendState = m_sAlphaBlendStates.empty() ? BLEND_NONE : m_sAlphaBlendStates.top();
+	packet.depthTestEnabled = m_sDepthTestStates.empty() || m_sDepthTestStates.top();
+	packet.backfaceCullingEnabled = m_sBackfaceCullingStates.empty() || m_sBackfaceCullingStates.top();
+	packet.textures = m_queuedTextures;
+	packet.isExternal = geometry != nullptr;
+	packet.geometry = geometry ? *geometry : ExternalGeometry();
+	packet.externalLayout = externalLayout;
+	packet.compiled = nullptr;
+
+	m_queuePackets.push_back(packet);
+	++m_renderQueueStats.packetCount;
+}
+
+// A new view or projection starts a new sub-pass, which is submitted after the ones before it
+unsigned DrawCall::QueueViewProjection()
+{
+	bool viewProjectionChanged = m_queueViewProjections.empty();
+	if (!viewProjectionChanged)
+	{
+		const QueuedViewProjection& last = m_queueViewProjections.back();
+		viewProjectionChanged = memcmp(&last.view, &m_activeView, sizeof(View)) != 0 ||
+			memcmp(&last.projection.mtx, &m_activeProjection.mtx, sizeof(XMMATRIX)) != 0 ||
+			memcmp(&last.projection.mtxRight, &m_activeProjection.mtxRight, sizeof(XMMATRIX)) != 0 ||
+			last.projection.fNear != m_activeProjection.fNear || last.projection.fFar != m_activeProjection.fFar;
+	}
+
+	if (viewProjectionChanged)
+	{
+		if (m_queueViewProjections.size() == kMaxQueuedViewProjections)
+			FlushRenderQueue();
+
+		QueuedViewProjection viewProjection = { m_activeView, m_activeProjection };
+
+		// Mono targets can have a stale right eye projection, so only stereo rendering takes the right eye into account
+		XMMATRIX leftViewProjection = XMMatrixMultiply(m_activeView.mtx, m_activeProjection.mtx);
+		if (GetCurrentRenderTarget()->IsStereo() || IsRightEyePassActive())
+			viewProjection.frustum.Build(leftViewProjection, XMMatrixMultiply(m_activeView.mtxRight, m_activeProjection.mtxRight));
+		else
+			viewProjection.frustum.Build(leftViewProjection, leftViewProjection);
+
+		m_queueViewProjections.push_back(viewProjection);
+	}
+
+	return (unsigned) m_queueViewProjections.size() - 1;
+}
+
+// A compiled packet brings its own instance buffer, so nothing is copied and it takes no room in the upload ring
+void DrawCall::QueueCompiled(const CompiledPacket& compiled)
+{
+	if (compiled.instanceCount == 0 || compiled.passes.empty())
+		return;
+
+	RenderPacket packet;
+	packet.drawCall = nullptr;
+	packet.allInstanceWorldTransform = compiled.allInstanceWorldTransform;
+	packet.instanceCount = 0;
+	packet.instanceDataOffset = m_queueInstanceData.size();
+	packet.particleInstancing = false;
+	packet.viewProjectionIndex = QueueViewProjection();
+	packet.blendState = m_sAlphaBlendStates.empty() ? BLEND_NONE : m_sAlphaBlendStates.top();
+	packet.depthTestEnabled = m_sDepthTestStates.empty() || m_sDepthTestStates.top();
+	packet.backfaceCullingEnabled = m_sBackfaceCullingStates.empty() || m_sBackfaceCullingStates.top();
+	packet.textures = m_queuedTextures;
+	packet.isExternal = false;
+	packet.geometry = ExternalGeometry();
+	packet.externalLayout = nullptr;
+	packet.compiled = &compiled;
+
+	m_queuePackets.push_back(packet);
+	++m_renderQueueStats.packetCount;
+	m_renderQueueStats.instancesVisible += compiled.instanceCount;
+}
+
+// Opaque:      sub-pass 4 | 0 | state 4 | shaders 12 | textures 12 | mesh 12 | depth 18, front to back
+// Transparent: sub-pass 4 | 1 | inverted depth 22, back to front | state 4 | shaders 10 | textures 10 | mesh 12
+// Depth off:   sub-pass 4 | 2 | 26 unused | submission order 32
+// Draws without depth testing, like overlays, rely on the order they were made in, so they keep it
+uint64_t DrawCall::CalculateSortKey(const RenderPacket& packet, uint32_t packetIndex)
+{
+	uint64_t key = (uint64_t) packet.viewProjectionIndex << 60;
+	if (!packet.depthTestEnabled)
+		return key | (2ull << 58) | packetIndex;
+
+	array<const void*, 3> shaders = { nullptr, nullptr, nullptr };
+	const void* mesh = nullptr;
+
+	if (packet.compiled)
+	{
+		// Keyed on the shaders without single pass stereo, like the other packets
+		const CompiledPacket::Variant* variant = GetCompiledVariant(*packet.compiled, false);
+		if (variant)
+			shaders = { variant->shaders[0], variant->shaders[1], variant->shaderCount > 2 ? variant->shaders[2] : nullptr };
+		mesh = packet.compiled->vertexBuffers[0];
+	}
+	else
+	{
+		const DrawCall& drawCall = *packet.drawCall;
+		auto shaderSetRecord = drawCall.m_shaderSets.find(m_activeRenderPassIndex);
+		if (shaderSetRecord != drawCall.m_shaderSets.end())
+		{
+			const ShaderSet& shaderSet = shaderSetRecord->second;
+			shaders = { shaderSet.vertexShader.get(), shaderSet.pixelShader.get(), shaderSet.geometryShader.get() };
+		}
+		mesh = packet.isExternal ? (const void*) packet.geometry.vertexBuffer : (const void*) drawCall.m_mesh.get();
+	}
+
+	array<const void*, 4> textures;
+	static_assert(kQueuedTextureSlots == 4, "Texture ids are keyed on every queued slot");
+	for (unsigned slot = 0; slot < kQueuedTextureSlots; ++slot)
+		textures[slot] = packet.textures.views[slot];
+
+	uint64_t shaderId = s_shaderIds.GetId(shaders);
+	uint64_t textureId = s_textureIds.GetId(textures);
+	uint64_t meshId = s_meshIds.GetId(mesh);
+
+	// Color writes off goes first, as it only lays down depth for what follows
+	static const uint64_t s_blendOrder[] = { 1, 2, 3, 0 };	// BLEND_NONE, BLEND_ALPHA, BLEND_ADDITIVE, BLEND_COLOR_DISABLED
+	uint64_t state = (s_blendOrder[packet.blendState] << 2) | ((uint64_t) packet.depthTestEnabled << 1) | (uint64_t) packet.backfaceCullingEnabled;
+
+	// Depth of the first instance along the view direction
+	const unsigned char* instanceData = m_queueInstanceData.data() + packet.instanceDataOffset;
+	XMVECTOR position;
+	if (packet.compiled)
+	{
+		position = packet.compiled->firstInstancePosition;
+	}
+	else if (packet.particleInstancing)
+	{
+		ParticleInstance instance;
+		memcpy(&instance, instanceData, sizeof(instance));
+		position = XMVectorSetW(instance.translationScale, 1.0f);
+	}
+	else
+	{
+		Instance instance;
+		memcpy(&instance, instanceData, sizeof(instance));
+		position = instance.worldTransform.r[3];
+	}
+
+	position = XMVector3Transform(position, packet.allInstanceWorldTransform);
+	float depth = -XMVectorGetZ(XMVector3Transform(position, m_queueViewProjections[packet.viewProjectionIndex].view.mtx));
+
+	bool isTransparent = packet.blendState == BLEND_ALPHA || packet.blendState == BLEND_ADDITIVE;
+	if (!isTransparent)
+	{
+		key |= state << 54;
+		key |= (shaderId & 0xfff) << 42;
+		key |= (textureId & 0xfff) << 30;
+		key |= (meshId & 0xfff) << 18;
+		key |= QuantizeDepth(depth, 18);
+	}
+	else
+	{
+		key |= 1ull << 58;
+		key |= (~QuantizeDepth(depth, 22) & 0x3fffff) << 36;
+		key |= state << 32;
+		key |= (shaderId & 0x3ff) << 22;
+		key |= (textureId & 0x3ff) << 12;
+		key |= meshId & 0xfff;
+	}
+
+	return key;
+}
+
+void DrawCall::FlushRenderQueue()
+{
+	if (m_queuePackets.empty())
+		return;
+
+	m_queueSortEntries.resize(m_queuePackets.size());
+	for (size_t packetIndex = 0; packetIndex < m_queuePackets.size(); ++packetIndex)
+		m_queueSortEntries[packetIndex] = { CalculateSortKey(m_queuePackets[packetIndex], (uint32_t) packetIndex), (uint32_t) packetIndex };
+
+	RadixSort(m_queueSortEntries, m_queueSortScratch);
+
+	BuildQueueBatches();
+	UploadQueueInstances();
+
+	unsigned recorderCount = min(m_recordingThreadCount, (unsigned) m_queueBatches.size() / kMinBatchesPerRecorder);
+	if (recorderCount <= 1 || !RecordQueueInParallel(recorderCount))
+		RecordQueueBatches(m_immediateRecorder, 0, (unsigned) m_queueBatches.size());
+
+	CollectRecorderStats(m_immediateRecorder);
+	RestoreImmediateState();
+
+	m_queuePackets.clear();
+	m_queueInstanceData.clear();
+	m_queueViewProjections.clear();
+	m_queueBatches.clear();
+	s_shaderIds.Clear();
+	s_textureIds.Clear();
+	s_meshIds.Clear();
+
+	++m_renderQueueStats.flushCount;
+}
+
+// Everything a draw takes from its first packet, apart from the instances, must match
+bool DrawCall::CanInstanceTogether(const RenderPacket& first, const RenderPacket& packet)
+{
+	if (packet.viewProjectionIndex != first.viewProjectionIndex || packet.blendState != first.blendState ||
+		packet.depthTestEnabled != first.depthTestEnabled || packet.backfaceCullingEnabled != first.backfaceCullingEnabled ||
+		packet.particleInstancing != first.particleInstancing || packet.isExternal != first.isExternal)
+		return false;
+
+	// Instances of a compiled packet are in a buffer of its own
+	if (packet.compiled || first.compiled)
+		return false;
+
+	if (memcmp(&packet.textures, &first.textures, sizeof(QueuedTextures)) != 0)
+		return false;
+
+	// The shaders see a single all instance world transform per draw
+	if (memcmp(&packet.allInstanceWorldTransform, &first.allInstanceWorldTransform, sizeof(XMMATRIX)) != 0)
+		return false;
+
+	const DrawCall& firstDrawCall = *first.drawCall;
+	const DrawCall& drawCall = *packet.drawCall;
+
+	if (packet.isExternal)
+	{
+		const ExternalGeometry& a = first.geometry;
+		const ExternalGeometry& b = packet.geometry;
+		if (a.vertexBuffer != b.vertexBuffer || a.vertexStride != b.vertexStride || a.indexBuffer != b.indexBuffer ||
+			a.indexFormat != b.indexFormat || a.indexCount != b.indexCount || first.externalLayout != packet.externalLayout)
+			return false;
+	}
+	else if (drawCall.m_mesh != firstDrawCall.m_mesh)
+	{
+		return false;
+	}
+
+	if (&drawCall == &firstDrawCall)
+		return true;
+
+	auto firstShaderSet = firstDrawCall.m_shaderSets.find(m_activeRenderPassIndex);
+	auto shaderSet = drawCall.m_shaderSets.find(m_activeRenderPassIndex);
+	if (firstShaderSet == firstDrawCall.m_shaderSets.end() || shaderSet == drawCall.m_shaderSets.end())
+		return false;
+
+	return shaderSet->second.vertexShader == firstShaderSet->second.vertexShader &&
+		shaderSet->second.vertexShaderSPS == firstShaderSet->second.vertexShaderSPS &&
+		shaderSet->second.pixelShader == firstShaderSet->second.pixelShader &&
+		shaderSet->second.geometryShader == firstShaderSet->second.geometryShader;
+}
+
+// Merges runs of sorted packets into batches. The sort keeps packets that can be merged next to each other,
+//  except alpha blended ones of different meshes in between, whose back to front order is kept.
+void DrawCall::BuildQueueBatches()
+{
+	m_queueBatches.clear();
+
+	UINT instanceBufferOffset = 0;
+	for (unsigned entryIndex = 0; entryIndex < (unsigned) m_queueSortEntries.size(); ++entryIndex)
+	{
+		const RenderPacket& packet = m_queuePackets[m_queueSortEntries[entryIndex].value];
+
+		if (!m_queueBatches.empty())
+		{
+			RenderBatch& batch = m_queueBatches.back();
+			const RenderPacket& first = m_queuePackets[m_queueSortEntries[batch.firstEntry].value];
+			if (CanInstanceTogether(first, packet))
+			{
+				++batch.packetCount;
+				batch.instanceCount += packet.instanceCount;
+				instanceBufferOffset += packet.instanceCount * (packet.particleInstancing ? sizeof(ParticleInstance) : sizeof(Instance));
+				++m_renderQueueStats.mergedPacketCount;
+				continue;
+			}
+		}
+
+		m_queueBatches.push_back({ entryIndex, 1, packet.instanceCount, instanceBufferOffset });
+		instanceBufferOffset += packet.instanceCount * (packet.particleInstancing ? sizeof(ParticleInstance) : sizeof(Instance));
+	}
+}
+
+// Copies the instances of every packet, in sorted order, into the upload ring with a single map.
+// The batch offsets from BuildQueueBatches count in that same order, so a batch's instances are contiguous.
+// Streamed meshes are written first and reserved along with the instances, so no write of the flush discards another.
+// Meshes are reserved at the most they can write, which covers writing again the ones the reserve itself discards.
+void DrawCall::UploadQueueInstances()
+{
+	UINT uploadSize = UploadRing::Align((UINT) m_queueInstanceData.size());
+	for (const RenderBatch& batch : m_queueBatches)
+	{
+		const RenderPacket& packet = m_queuePackets[m_queueSortEntries[batch.firstEntry].value];
+		if (packet.drawCall && !packet.isExternal)
+			uploadSize += packet.drawCall->m_mesh->GetPendingUploadSize();
+	}
+
+	m_uploadRing.Reserve(uploadSize);
+
+	for (const RenderBatch& batch : m_queueBatches)
+	{
+		const RenderPacket& packet = m_queuePackets[m_queueSortEntries[batch.firstEntry].value];
+		if (packet.drawCall && !packet.isExternal)
+			packet.drawCall->m_mesh->GetVertexBuffer();
+	}
+
+	unsigned char* destination = static_cast<unsigned char*>(m_uploadRing.Map((UINT) m_queueInstanceData.size(), m_queueInstanceAllocation));
+	if (!destination)
+		return;
+
+	for (const RadixSortEntry& entry : m_queueSortEntries)
+	{
+		const RenderPacket& packet = m_queuePackets[entry.value];
+		size_t size = packet.instanceCount * (packet.particleInstancing ? sizeof(ParticleInstance) : sizeof(Instance));
+		memcpy(destination, m_queueInstanceData.data() + packet.instanceDataOffset, size);
+		destination += size;
+	}
+
+	m_uploadRing.Unmap();
+}
+
+// Submits the batches from firstBatch up to endBatch, in order, to the context of recorder
+void DrawCall::RecordQueueBatches(Recorder& recorder, unsigned firstBatch, unsigned endBatch)
+{
+	// Nothing is known to be bound, so the first packet binds everything
+	memset(&recorder.boundState, 0xff, sizeof(recorder.boundState));
+
+	for (unsigned batchIndex = firstBatch; batchIndex < endBatch; ++batchIndex)
+	{
+		const RenderBatch& batch = m_queueBatches[batchIndex];
+		const RenderPacket& packet = m_queuePackets[m_queueSortEntries[batch.firstEntry].value];
+
+		SubmitQueuedState(recorder, packet);
+		if (packet.compiled)
+			SubmitCompiled(recorder, packet);
+		else
+			packet.drawCall->SubmitBatch(recorder, packet, batch);
+	}
+}
+
+class DrawCall::RecordingWorkerPool
+{
+public:
+
+	~RecordingWorkerPool()
+	{
+		m_mutex.lock();
+		m_stopping = true;
+		m_mutex.unlock();
+		m_startCondition.notify_all();
+
+		for (auto& worker : m_workers)
+			worker.join();
+	}
+
+	// Runs job(1) to job(workerCount) on the workers, starting more if needed. Returns without waiting for them.
+	void Start(unsigned workerCount, const function<void(unsigned)>& job)
+	{
+		m_mutex.lock();
+
+		// A new worker skips the generations before its own, or it would run the previous flush's job
+		while (m_workers.size() < workerCount)
+			m_workers.emplace_back(&RecordingWorkerPool::WorkerFunction, this, (unsigned) m_workers.size() + 1, m_generation);
+
+		m_job = job;
+		m_activeWorkerCount = workerCount;
+		m_pendingWorkerCount = workerCount;
+		++m_generation;
+		m_mutex.unlock();
+		m_startCondition.notify_all();
+	}
+
+	void Wait()
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, [this]() { return m_pendingWorkerCount == 0; });
+	}
+
+private:
+
+	void WorkerFunction(unsigned workerIndex, uint64_t generation)
+	{
+		unique_lock<mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_startCondition.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+			if (m_stopping)
+				return;
+
+			generation = m_generation;
+			if (workerIndex > m_activeWorkerCount)
+				continue;
+
+			// The job is only replaced by the next Start, which comes after Wait
+			lock.unlock();
+			m_job(workerIndex);
+			lock.lock();
+
+			if (--m_pendingWorkerCount == 0)
+				m_doneCondition.notify_one();
+		}
+	}
+
+	vector<thread> m_workers;
+	mutex m_mutex;
+	condition_variable m_startCondition;
+	condition_variable m_doneCondition;
+	function<void(unsigned)> m_job;
+	uint64_t m_generation = 0;
+	unsigned m_activeWorkerCount = 0;
+	unsigned m_pendingWorkerCount = 0;
+	bool m_stopping = false;
+};
+
+// Records the batches in recorderCount contiguous runs, the first on this thread into the immediate context and the
+//  others on worker threads into deferred contexts. Returns false, having recorded nothing, if a deferred context
+//  could not be created.
+bool DrawCall::RecordQueueInParallel(unsigned recorderCount)
+{
+	while (m_deferredRecorders.size() < recorderCount - 1)
+	{
+		unique_ptr<Recorder> recorder(new Recorder());
+		recorder->deferredContext = g_renderContext->CreateDeferredContext();
+		if (!recorder->deferredContext)
+			return false;
+
+		recorder->context = recorder->deferredContext.get();
+		m_deferredRecorders.push_back(move(recorder));
+	}
+
+	// Workers only look states up, so every one the flush draws with is created here
+	for (const RenderBatch& batch : m_queueBatches)
+	{
+		const RenderPacket& packet = m_queuePackets[m_queueSortEntries[batch.firstEntry].value];
+		GetPipelineStateObjects(MakePipelineStateKey(packet.blendState, packet.depthTestEnabled, packet.backfaceCullingEnabled));
+	}
+
+	unsigned batchCount = (unsigned) m_queueBatches.size();
+	auto getRunStart = [&](unsigned recorderIndex) { return (unsigned) ((uint64_t) batchCount * recorderIndex / recorderCount); };
+
+	auto workerFunction = [&](unsigned recorderIndex)
+	{
+		Recorder& recorder = *m_deferredRecorders[recorderIndex - 1];
+
+		// A command list starts with nothing bound, and has to map a dynamic buffer before drawing with it
+		recorder.appliedPipelineStateKey = kInvalidPipelineStateKey;
+		for (auto& buffer : recorder.constantBuffers)
+			buffer.second.isUploaded = false;
+
+		SetCurrentRenderTargetsOnContext(recorder.context);
+		RecordQueueBatches(recorder, getRunStart(recorderIndex), getRunStart(recorderIndex + 1));
+		recorder.context->FinishCommandList();
+	};
+
+	if (!m_recordingWorkers)
+		m_recordingWorkers.reset(new RecordingWorkerPool());
+
+	m_recordingWorkers->Start(recorderCount - 1, workerFunction);
+	RecordQueueBatches(m_immediateRecorder, 0, getRunStart(1));
+	m_recordingWorkers->Wait();
+
+	// The immediate context gets its own state back after each list, so what it has bound stays known
+	for (unsigned recorderIndex = 1; recorderIndex < recorderCount; ++recorderIndex)
+	{
+		Recorder& recorder = *m_deferredRecorders[recorderIndex - 1];
+		g_renderContext->ExecuteCommandList(*recorder.deferredContext);
+		CollectRecorderStats(recorder);
+	}
+
+	++m_renderQueueStats.parallelFlushCount;
+	return true;
+}
+
+void DrawCall::ReleaseDeferredRecorders()
+{
+	m_recordingWorkers.reset();
+	m_deferredRecorders.clear();
+}
+
+// Adds what a recorder counted during a flush to the totals
+void DrawCall::CollectRecorderStats(Recorder& recorder)
+{
+	m_renderQueueStats.drawCount += recorder.renderQueueStats.drawCount;
+	m_renderQueueStats.stateChanges += recorder.renderQueueStats.stateChanges;
+	m_renderQueueStats.stateChangesSaved += recorder.renderQueueStats.stateChangesSaved;
+	recorder.renderQueueStats = RenderQueueStats();
+
+	if (&recorder == &m_immediateRecorder)
+		return;
+
+	ShaderConstantStats& totals = m_immediateRecorder.shaderConstantStats;
+	const ShaderConstantStats& stats = recorder.shaderConstantStats;
+	totals.bufferUploads += stats.bufferUploads;
+	totals.bufferUploadsSkipped += stats.bufferUploadsSkipped;
+	totals.bytesUploaded += stats.bytesUploaded;
+	totals.bytesSkipped += stats.bytesSkipped;
+	totals.viewConstantsComputed += stats.viewConstantsComputed;
+	totals.viewConstantsReused += stats.viewConstantsReused;
+	totals.updateTime += stats.updateTime;
+	recorder.shaderConstantStats = ShaderConstantStats();
+}
+
+template<typename T>
+bool DrawCall::BindIfChanged(Recorder& recorder, T& bound, const T& value)
+{
+	if (memcmp(&bound, &value, sizeof(T)) == 0)
+	{
+		++recorder.renderQueueStats.stateChangesSaved;
+		return false;
+	}
+
+	memcpy(&bound, &value, sizeof(T));
+	++recorder.renderQueueStats.stateChanges;
+	return true;
+}
+
+void DrawCall::SubmitQueuedState(Recorder& recorder, const RenderPacket& packet)
+{
+	if (ApplyPipelineState(recorder, MakePipelineStateKey(packet.blendState, packet.depthTestEnabled, packet.backfaceCullingEnabled)))
+		++recorder.renderQueueStats.stateChanges;
+	else
+		++recorder.renderQueueStats.stateChangesSaved;
+
+	if (BindIfChanged(recorder, recorder.boundState.textures, packet.textures))
+	{
+		recorder.context->PSSetShaderResources(0, kQueuedTextureSlots, packet.textures.views);
+		recorder.context->PSSetSamplers(0, kQueuedTextureSlots, packet.textures.samplers);
+	}
+}
+
+void DrawCall::SubmitBatch(Recorder& recorder, const RenderPacket& packet, const RenderBatch& batch)
+{
+	auto shaderSetRecord = m_shaderSets.find(m_activeRenderPassIndex);
+	if (shaderSetRecord == m_shaderSets.end())
+		return;
+
+	ShaderSet& shaderSet = shaderSetRecord->second;
+	bool isSinglePassStereo = GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled();
+	shared_ptr<Shader> vertexShader = isSinglePassStereo ? shaderSet.vertexShaderSPS : shaderSet.vertexShader;
+	if (!vertexShader || !shaderSet.pixelShader)
+		return;
+
+	ID3D11InputLayout* inputLayout = packet.externalLayout;
+	if (!packet.isExternal)
+		inputLayout = isSinglePassStereo ? m_instancingLayoutSPS.Get() : m_instancingLayout.Get();
+
+	if (BindIfChanged(recorder, recorder.boundState.inputLayout, inputLayout))
+		recorder.context->IASetInputLayout(inputLayout);
+
+	if (BindIfChanged(recorder, recorder.boundState.shaders[0], vertexShader.get()))
+		vertexShader->Bind(recorder.context);
+
+	if (BindIfChanged(recorder, recorder.boundState.shaders[1], shaderSet.pixelShader.get()))
+		shaderSet.pixelShader->Bind(recorder.context);
+
+	if (BindIfChanged(recorder, recorder.boundState.shaders[2], shaderSet.geometryShader.get()))
+	{
+		if (shaderSet.geometryShader)
+			shaderSet.geometryShader->Bind(recorder.context);
+		else
+			recorder.context->GSSetShader(nullptr, nullptr, 0);
+	}
+
+	// Constants depend on the draw call as well as the shaders, so they are always written
+	const QueuedViewProjection& viewProjection = m_queueViewProjections[packet.viewProjectionIndex];
+	UpdateShaderConstants(recorder, vertexShader.get(), packet.allInstanceWorldTransform, viewProjection.view, viewProjection.projection);
+	UpdateShaderConstants(recorder, shaderSet.pixelShader.get(), packet.allInstanceWorldTransform, viewProjection.view, viewProjection.projection);
+	if (shaderSet.geometryShader)
+		UpdateShaderConstants(recorder, shaderSet.geometryShader.get(), packet.allInstanceWorldTransform, viewProjection.view, viewProjection.projection);
+
+	unsigned instanceSize = packet.particleInstancing ? sizeof(ParticleInstance) : sizeof(Instance);
+	ID3D11Buffer* vertexBuffers[2] = { nullptr, m_queueInstanceAllocation.buffer };
+	UINT vertexStrides[2] = { sizeof(Mesh::Vertex), instanceSize };
+	UINT vertexOffsets[2] = { 0, m_queueInstanceAllocation.offset + batch.instanceBufferOffset };
+	ID3D11Buffer* indexBuffer = nullptr;
+	UINT indexOffset = 0;
+	DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
+	unsigned indexCount = 0;
+	D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	if (packet.isExternal)
+	{
+		vertexBuffers[0] = packet.geometry.vertexBuffer;
+		vertexStrides[0] = packet.geometry.vertexStride;
+		indexBuffer = packet.geometry.indexBuffer;
+		indexFormat = packet.geometry.indexFormat;
+		indexCount = packet.geometry.indexCount;
+	}
+	else
+	{
+		vertexBuffers[0] = m_mesh->GetVertexBuffer();
+		vertexOffsets[0] = m_mesh->GetVertexBufferOffset();
+		indexBuffer = m_mesh->GetIndexBuffer();
+		indexOffset = m_mesh->GetIndexBufferOffset();
+		indexCount = m_mesh->GetIndexCount();
+		if (m_mesh->GetDrawStyle() == Mesh::DS_LINELIST)
+			topology = D3D11_PRIMITIVE_TOPOLOGY_LINELIST;
+	}
+
+	if (BindIfChanged(recorder, recorder.boundState.vertexBuffers, vertexBuffers) | BindIfChanged(recorder, recorder.boundState.vertexStrides, vertexStrides) |
+		BindIfChanged(recorder, recorder.boundState.vertexOffsets, vertexOffsets))
+		recorder.context->IASetVertexBuffers(0, 2, vertexBuffers, vertexStrides, vertexOffsets);
+
+	// An index buffer always has the same format, so the buffer and offset alone tell whether to bind
+	if (BindIfChanged(recorder, recorder.boundState.indexBuffer, indexBuffer) | BindIfChanged(recorder, recorder.boundState.indexOffset, indexOffset))
+		recorder.context->IASetIndexBuffer(indexBuffer, indexFormat, indexOffset);
+
+	if (BindIfChanged(recorder, recorder.boundState.topology, topology))
+		recorder.context->IASetPrimitiveTopology(topology);
+
+	unsigned instancesToDraw = batch.instanceCount;
+	if (isSinglePassStereo)
+		instancesToDraw *= 2;
+
+	recorder.context->DrawIndexedInstanced(indexCount, instancesToDraw, 0, 0, 0);
+	++recorder.renderQueueStats.drawCount;
+}
+
+// The binds of DrawCompiled, skipping the ones that match what is bound
+void DrawCall::SubmitCompiled(Recorder& recorder, const RenderPacket& packet)
+{
+	const CompiledPacket& compiled = *packet.compiled;
+	bool isSinglePassStereo = GetCurrentRenderTarget()->IsStereo() && IsSinglePassSteroEnabled();
+	const CompiledPacket::Variant* variant = GetCompiledVariant(compiled, isSinglePassStereo);
+	if (!variant)
+		return;
+
+	if (BindIfChanged(recorder, recorder.boundState.inputLayout, variant->inputLayout))
+		recorder.context->IASetInputLayout(variant->inputLayout);
+
+	Shader* shaders[3] = { variant->shaders[0], variant->shaders[1], variant->shaderCount > 2 ? variant->shaders[2] : nullptr };
+	for (unsigned shaderIndex = 0; shaderIndex < 3; ++shaderIndex)
+	{
+		if (!BindIfChanged(recorder, recorder.boundState.shaders[shaderIndex], shaders[shaderIndex]))
+			continue;
+
+		if (shaders[shaderIndex])
+			shaders[shaderIndex]->Bind(recorder.context);
+		else
+			recorder.context->GSSetShader(nullptr, nullptr, 0);
+	}
+
+	const QueuedViewProjection& viewProjection = m_queueViewProjections[packet.viewProjectionIndex];
+	for (unsigned shaderIndex = 0; shaderIndex < variant->shaderCount; ++shaderIndex)
+		UpdateShaderConstants(recorder, variant->shaders[shaderIndex], compiled.allInstanceWorldTransform, viewProjection.view, viewProjection.projection);
+
+	if (BindIfChanged(recorder, recorder.boundState.vertexBuffers, compiled.vertexBuffers) | BindIfChanged(recorder, recorder.boundState.vertexStrides, compiled.vertexStrides) |
+		BindIfChanged(recorder, recorder.boundState.vertexOffsets, compiled.vertexOffsets))
+		recorder.context->IASetVertexBuffers(0, 2, compiled.vertexBuffers, compiled.vertexStrides, compiled.vertexOffsets);
+
+	const UINT indexOffset = 0;
+	if (BindIfChanged(recorder, recorder.boundState.indexBuffer, compiled.indexBuffer) | BindIfChanged(recorder, recorder.boundState.indexOffset, indexOffset))
+		recorder.context->IASetIndexBuffer(compiled.indexBuffer, DXGI_FORMAT_R32_UINT, indexOffset);
+
+	if (BindIfChanged(recorder, recorder.boundState.topology, compiled.topology))
+		recorder.context->IASetPrimitiveTopology(compiled.topology);
+
+	unsigned instancesToDraw = compiled.instanceCount;
+	if (isSinglePassStereo)
+		instancesToDraw *= 2;
+
+	recorder.context->DrawIndexedInstanced(compiled.indexCount, instancesToDraw, 0, 0, 0);
+	++recorder.renderQueueStats.drawCount;
+}
+
+// Puts back what immediate draws expect after a flush: the textures bound so far.
+// The blend, depth and rasterizer states need nothing, the next immediate draw applies its own key.
+// While the queue is on, Texture2D only records its bindings, so immediate draws also call this before drawing.
+void DrawCall::RestoreImmediateState()
+{
+	g_renderContext->PSSetShaderResources(0, kQueuedTextureSlots, m_queuedTextures.views);
+	g_renderContext->PSSetSamplers(0, kQueuedTextureSlots, m_queuedTextures.samplers);
+}
@@ -15,7 +15,7 @@ using namespace std;
 using namespace DirectX;
 
 extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
-extern Microsoft::WRL::ComPtr<ID3D11DeviceContext> g_d3dContext;
+extern std::unique_ptr<RenderContext> g_renderContext;
 
 extern Microsoft::WRL::ComPtr<ID2D1Factory1> g_d2dFactory;
 extern Microsoft::WRL::ComPtr<ID2D1Device> g_d2dDevice;
@@ -34,9 +34,73 @@ extern Microsoft::WRL::ComPtr<ID2D1SolidColorBrush> g_blackBrush;
 // Shader
 //
 
+// Sources of each constant ID: for single values, and for each element of per eye arrays where those are supported
+struct ConstantSources
+{
+	ConstantSource single;
+	ConstantSource left;
+	ConstantSource right;
+};
+
+static const ConstantSources s_constantSources[CONST_COUNT] =
+{
+	{ CS_WORLD_MATRIX, CS_COUNT, CS_COUNT },
+	{ CS_WORLDVIEWPROJ_MATRIX, CS_WORLDVIEWPROJ_MATRIX_LEFT, CS_WORLDVIEWPROJ_MATRIX_RIGHT },
+	{ CS_VIEWPROJ_MATRIX, CS_VIEWPROJ_MATRIX_LEFT, CS_VIEWPROJ_MATRIX_RIGHT },
+	{ CS_VIEW_MATRIX, CS_VIEW_MATRIX_LEFT, CS_VIEW_MATRIX_RIGHT },
+	{ CS_INVVIEW_MATRIX, CS_INVVIEW_MATRIX_LEFT, CS_INVVIEW_MATRIX_RIGHT },
+	{ CS_LIGHTVIEWPROJ_MATRIX, CS_COUNT, CS_COUNT },
+	{ CS_LIGHTPOSV, CS_COUNT, CS_COUNT },
+	{ CS_INVVIEWLIGHTVIEWPROJ_MATRIX, CS_COUNT, CS_COUNT },
+	{ CS_LIGHT_AMBIENT, CS_COUNT, CS_COUNT },
+	{ CS_NEARPLANEHEIGHT, CS_COUNT, CS_COUNT },
+	{ CS_NEARPLANEWIDTH, CS_COUNT, CS_COUNT },
+	{ CS_NEARPLANEDIST, CS_COUNT, CS_COUNT },
+	{ CS_FARPLANEDIST, CS_COUNT, CS_COUNT },
+	{ CS_PROJECTIONRANGE, CS_COUNT, CS_COUNT },
+};
+
+static_assert(CS_COUNT <= 32, "Constant source masks are 32 bits");
+
+static unsigned GetConstantSourceSize(ConstantSource source)
+{
+	if (source == CS_LIGHTPOSV || source == CS_LIGHT_AMBIENT)
+		return sizeof(XMVECTOR);
+	else if (source >= CS_NEARPLANEHEIGHT)
+		return sizeof(float);
+	else
+		return sizeof(XMMATRIX);
+}
+
+// Adds the ops that write a constant, returns false if the constant can't be written
+bool Shader::CompileConstant(const Constant& constant, vector<ConstantWriteOp>& writeOps)
+{
+	if (constant.id >= CONST_COUNT)
+		return false;
+
+	const ConstantSources& sources = s_constantSources[constant.id];
+	if (constant.elementCount == 0)
+	{
+		writeOps.push_back({ sources.single, constant.startOffset, min(constant.size, GetConstantSourceSize(sources.single)) });
+	}
+	else if (constant.elementCount == 2 && sources.left != CS_COUNT)
+	{
+		unsigned elementSize = constant.size / 2;
+		writeOps.push_back({ sources.left, constant.startOffset, min(elementSize, GetConstantSourceSize(sources.left)) });
+		writeOps.push_back({ sources.right, constant.startOffset + elementSize, min(elementSize, GetConstantSourceSize(sources.right)) });
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
 Shader::Shader(ShaderType type, string filename)
 {
 	m_type = type;
+	m_constantSourceMask = 0;
 
 	FILE* pFile = OpenFile(filename, "rb");
 	assert(pFile);
@@ -86,6 +150,8 @@ Shader::Shader(ShaderType type, string filename)
 		buffer.slot = i;		// Assuming slot is equal to index. This is always true as long as registers aren't manually specified in the shader.
 		buffer.size = bufferDesc.Size;
 		buffer.staging.reset(new unsigned char[buffer.size]);
+		memset(buffer.staging.get(), 0, buffer.size);
+		buffer.isUploaded = false;
 
 		D3D11_BUFFER_DESC desc = {buffer.size, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, 0, buffer.size};
 		g_d3dDevice->CreateBuffer(&desc, nullptr, &buffer.d3dBuffer);
@@ -115,24 +181,38 @@ Shader::Shader(ShaderType type, string filename)
 				}
 			}
 
-			assert(constant.id != CONST_COUNT);
-			buffer.constants.push_back(constant);
+			// Unknown constants are left zero, a shader with one still runs
+			if (!CompileConstant(constant, buffer.writeOps))
+			{
+				m_unknownConstants.push_back(variableDesc.Name);
+
+				string message = "Shader " + filename + ": no value for constant " + variableDesc.Name + "\n";
+				OutputDebugStringA(message.c_str());
+			}
 		}
 
+		for (const ConstantWriteOp& writeOp : buffer.writeOps)
+			m_constantSourceMask |= 1u << writeOp.source;
+
 		m_vConstantBuffers.push_back(move(buffer));
 	}
 }
 
 void Shader::Bind()
+{
+	Bind(g_renderContext.get());
+}
+
+void Shader::Bind(RenderContext* context)
 {
 	if(m_type == ST_VERTEX)
-		g_d3dContext->VSSetShader(m_vertexShader.Get(), nullptr, 0);
+		context->VSSetShader(m_vertexShader.Get(), nullptr, 0);
 	else if(m_type == ST_PIXEL)
-		g_d3dContext->PSSetShader(m_pixelShader.Get(), nullptr, 0);
+		context->PSSetShader(m_pixelShader.Get(), nullptr, 0);
 	else if (m_type == ST_GEOMETRY)
-		g_d3dContext->GSSetShader(m_geometryShader.Get(), nullptr, 0);
+		context->GSSetShader(m_geometryShader.Get(), nullptr, 0);
 	else if (m_type == ST_VERTEX_SPS)
-		g_d3dContext->VSSetShader(m_vertexShaderSPS.Get(), nullptr, 0);
+		context->VSSetShader(m_vertexShaderSPS.Get(), nullptr, 0);
 }
 
 void* Shader::GetBytecode()
@@ -0,0 +1,144 @@
+#include "pch.h"
+
+#include "DrawCall.h"
+
+#include <cassert>
+
+using namespace std;
+
+extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
+extern std::unique_ptr<RenderContext> g_renderContext;
+
+unordered_map<DrawCall::PipelineStateKey, DrawCall::PipelineStateObjects> DrawCall::m_pipelineStateCache;
+
+DrawCall::PipelineStateKey DrawCall::MakePipelineStateKey(BlendState blendState, bool depthTestEnabled, bool backfaceCullingEnabled)
+{
+	return (PipelineStateKey) blendState | ((PipelineStateKey) depthTestEnabled << 8) | ((PipelineStateKey) backfaceCullingEnabled << 16);
+}
+
+DrawCall::PipelineStateKey DrawCall::GetPipelineStateKey()
+{
+	BlendState blendState = m_sAlphaBlendStates.empty() ? BLEND_NONE : m_sAlphaBlendStates.top();
+	bool depthTestEnabled = m_sDepthTestStates.empty() || m_sDepthTestStates.top();
+	bool backfaceCullingEnabled = m_sBackfaceCullingStates.empty() || m_sBackfaceCullingStates.top();
+
+	return MakePipelineStateKey(blendState, depthTestEnabled, backfaceCullingEnabled);
+}
+
+const DrawCall::PipelineStateObjects& DrawCall::GetPipelineStateObjects(PipelineStateKey key)
+{
+	auto it = m_pipelineStateCache.find(key);
+	if (it != m_pipelineStateCache.end())
+		return it->second;
+
+	BlendState blendState = (BlendState) (key & 0xff);
+	bool depthTestEnabled = (key >> 8) & 0xff;
+	bool backfaceCullingEnabled = (key >> 16) & 0xff;
+
+	PipelineStateObjects& objects = m_pipelineStateCache[key];
+
+	D3D11_BLEND_DESC blendDesc;
+	memset(&blendDesc, 0, sizeof(blendDesc));
+	blendDesc.AlphaToCoverageEnable = FALSE;
+	blendDesc.IndependentBlendEnable = FALSE;
+	if (blendState == BLEND_ALPHA)
+	{
+		blendDesc.RenderTarget[0].BlendEnable = TRUE;
+		blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+		blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+		blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+		blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_SRC_ALPHA;
+		blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+		blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+		blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	}
+	else if (blendState == BLEND_ADDITIVE)
+	{
+		blendDesc.RenderTarget[0].BlendEnable = TRUE;
+		blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+		blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_ONE;
+		blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+		blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+		blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
+		blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+		blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	}
+	else if (blendState == BLEND_NONE)
+	{
+		// The D3D default, blending off and all channels written
+		blendDesc.RenderTarget[0].BlendEnable = FALSE;
+		blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+		blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_ZERO;
+		blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+		blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+		blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
+		blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+		blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	}
+	// BLEND_COLOR_DISABLED leaves the write mask at zero
+
+	D3D11_DEPTH_STENCIL_DESC depthStencilDesc;
+	memset(&depthStencilDesc, 0, sizeof(depthStencilDesc));
+	depthStencilDesc.DepthEnable = depthTestEnabled ? TRUE : FALSE;
+	depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+	depthStencilDesc.DepthFunc = D3D11_COMPARISON_LESS;
+	depthStencilDesc.StencilEnable = FALSE;
+	depthStencilDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+	depthStencilDesc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+	depthStencilDesc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilDesc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilDesc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilDesc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+	depthStencilDesc.BackFace = depthStencilDesc.FrontFace;
+
+	D3D11_RASTERIZER_DESC rasterizerDesc;
+	memset(&rasterizerDesc, 0, sizeof(rasterizerDesc));
+	rasterizerDesc.FillMode = D3D11_FILL_SOLID;
+	rasterizerDesc.CullMode = backfaceCullingEnabled ? D3D11_CULL_BACK : D3D11_CULL_NONE;
+	rasterizerDesc.FrontCounterClockwise = FALSE;
+	rasterizerDesc.DepthBias = 0;
+	rasterizerDesc.SlopeScaledDepthBias = 0.f;
+	rasterizerDesc.DepthBiasClamp = 0.f;
+	rasterizerDesc.DepthClipEnable = TRUE;
+	rasterizerDesc.ScissorEnable = FALSE;
+	rasterizerDesc.MultisampleEnable = FALSE;
+	rasterizerDesc.AntialiasedLineEnable = FALSE;
+
+	// An object that fails to create stays null, which binds the D3D default in its place
+	HRESULT hr = g_d3dDevice->CreateBlendState(&blendDesc, &objects.blendState);
+	assert(SUCCEEDED(hr));
+	hr = g_d3dDevice->CreateDepthStencilState(&depthStencilDesc, &objects.depthStencilState);
+	assert(SUCCEEDED(hr));
+	hr = g_d3dDevice->CreateRasterizerState(&rasterizerDesc, &objects.rasterizerState);
+	assert(SUCCEEDED(hr));
+
+	return objects;
+}
+
+void DrawCall::ApplyPipelineState()
+{
+	ApplyPipelineState(m_immediateRecorder, GetPipelineStateKey());
+}
+
+// Workers recording in parallel only find keys here, the flush creates the objects of all its keys before they start
+bool DrawCall::ApplyPipelineState(Recorder& recorder, PipelineStateKey key)
+{
+	if (key == recorder.appliedPipelineStateKey)
+		return false;
+
+	const PipelineStateObjects& objects = GetPipelineStateObjects(key);
+	const PipelineStateObjects* applied = nullptr;
+	if (recorder.appliedPipelineStateKey != kInvalidPipelineStateKey)
+		applied = &GetPipelineStateObjects(recorder.appliedPipelineStateKey);
+
+	// D3D hands back the same object for the same description, so only the parts that changed are bound
+	if (!applied || applied->blendState.Get() != objects.blendState.Get())
+		recorder.context->OMSetBlendState(objects.blendState.Get(), nullptr, 0xffffffff);
+	if (!applied || applied->depthStencilState.Get() != objects.depthStencilState.Get())
+		recorder.context->OMSetDepthStencilState(objects.depthStencilState.Get(), 0);
+	if (!applied || applied->rasterizerState.Get() != objects.rasterizerState.Get())
+		recorder.context->RSSetState(objects.rasterizerState.Get());
+
+	recorder.appliedPipelineStateKey = key;
+	return true;
+}
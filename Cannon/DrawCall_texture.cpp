@@ -15,7 +15,7 @@ using namespace std;
 using namespace DirectX;
 
 extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
-extern Microsoft::WRL::ComPtr<ID3D11DeviceContext> g_d3dContext;
+extern std::unique_ptr<RenderContext> g_renderContext;
 
 extern Microsoft::WRL::ComPtr<ID2D1Factory1> g_d2dFactory;
 extern Microsoft::WRL::ComPtr<ID2D1Device> g_d2dDevice;
@@ -389,7 +389,7 @@ void Texture2D::SetD3DTexture(ID3D11Texture2D* pD3DTexture)
 
 		Microsoft::WRL::ComPtr<IDXGISurface2> dxgiSurface;
 		m_texture.As(&dxgiSurface);
-		if (dxgiSurface && (textureDesc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || textureDesc.Format == DXGI_FORMAT_R8G8B8A8_UNORM || textureDesc.Format == DXGI_FORMAT_A8_UNORM))
+		if (g_d2dContext && dxgiSurface && (textureDesc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || textureDesc.Format == DXGI_FORMAT_R8G8B8A8_UNORM || textureDesc.Format == DXGI_FORMAT_A8_UNORM))
 		{
 			D2D1_PIXEL_FORMAT pixelFormat;
 			pixelFormat.format = textureDesc.Format;
@@ -522,25 +522,33 @@ void Texture2D::SaveToFile(string filename)
 
 void Texture2D::BindAsVertexShaderResource(unsigned slot)
 {
-	g_d3dContext->VSSetShaderResources(slot, 1, m_shaderResourceView.GetAddressOf());
-	g_d3dContext->VSSetSamplers(slot, 1, m_samplerState.GetAddressOf());
+	g_renderContext->VSSetShaderResources(slot, 1, m_shaderResourceView.GetAddressOf());
+	g_renderContext->VSSetSamplers(slot, 1, m_samplerState.GetAddressOf());
 }
 
 void Texture2D::BindAsPixelShaderResource(unsigned slot)
 {
-	g_d3dContext->PSSetShaderResources(slot, 1, m_shaderResourceView.GetAddressOf());
-	g_d3dContext->PSSetSamplers(slot, 1, m_samplerState.GetAddressOf());
+	if (DrawCall::IsRenderQueueEnabled())
+	{
+		DrawCall::QueuePixelShaderResource(slot, m_shaderResourceView.Get(), m_samplerState.Get());
+		return;
+	}
+
+	g_renderContext->PSSetShaderResources(slot, 1, m_shaderResourceView.GetAddressOf());
+	g_renderContext->PSSetSamplers(slot, 1, m_samplerState.GetAddressOf());
 }
 
 void Texture2D::Clear(float r, float g, float b, float a)
 {
+	DrawCall::FlushRenderQueue();	// Queued draws may target this texture
+
 	float vColor[4] = { r, g, b, a };
 
 	if(m_renderTargetView)
-		g_d3dContext->ClearRenderTargetView(m_renderTargetView.Get(), vColor);
+		g_renderContext->ClearRenderTargetView(m_renderTargetView.Get(), vColor);
 
 	if (m_depthStencilTexture)
-		g_d3dContext->ClearDepthStencilView(m_depthStencilView.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+		g_renderContext->ClearDepthStencilView(m_depthStencilView.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
 }
 
 void Texture2D::Clear(const XMVECTOR& color)
@@ -562,12 +570,12 @@ void* Texture2D::Map(MapType mapType)
 
 	if (mapType == MapType::Read || mapType == MapType::ReadWrite)
 	{
-		g_d3dContext->CopySubresourceRegion(m_stagingTexture.Get(), 0, 0, 0, 0, m_texture.Get(), 0, nullptr);
-		g_d3dContext->Map(m_stagingTexture.Get(), 0, D3D11_MAP_READ, 0, &m_mapped);
+		g_renderContext->CopySubresourceRegion(m_stagingTexture.Get(), 0, 0, 0, 0, m_texture.Get(), 0, nullptr);
+		g_renderContext->Map(m_stagingTexture.Get(), 0, D3D11_MAP_READ, 0, &m_mapped);
 	}
 	else if (mapType == MapType::Write)
 	{
-		g_d3dContext->Map(m_stagingTexture.Get(), 0, D3D11_MAP_READ_WRITE, 0, &m_mapped);
+		g_renderContext->Map(m_stagingTexture.Get(), 0, D3D11_MAP_READ_WRITE, 0, &m_mapped);
 	}
 
 	if(m_mapped.pData)
@@ -594,10 +602,10 @@ void Texture2D::Unmap()
 
 	if(m_mappedCount == 0)
 	{
-		g_d3dContext->Unmap(m_stagingTexture.Get(), 0);
+		g_renderContext->Unmap(m_stagingTexture.Get(), 0);
 
 		if (m_currentMapType == MapType::Write || m_currentMapType == MapType::ReadWrite)
-			g_d3dContext->CopySubresourceRegion(m_texture.Get(), 0, 0, 0, 0, m_stagingTexture.Get(), 0, nullptr);
+			g_renderContext->CopySubresourceRegion(m_texture.Get(), 0, 0, 0, 0, m_stagingTexture.Get(), 0, nullptr);
 	}
 }
 
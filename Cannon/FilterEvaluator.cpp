@@ -0,0 +1,192 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+// No precompiled header on purpose, see FilterEvaluator.h
+
+#include "FilterEvaluator.h"
+
+#include <cassert>
+#include <cmath>
+
+using namespace DirectX;
+using namespace std;
+
+static const long long s_velocityHalfWindow = 500000;	// 50 ms in ticks
+
+// Gives every filter the same Update / Predict shape for Evaluate
+namespace
+{
+	struct RawPredictor
+	{
+		XMVECTOR position = XMVectorZero();
+
+		void Update(const XMVECTOR& newPosition, long long) { position = newPosition; }
+		XMVECTOR Predict(long long) const { return position; }
+	};
+
+	struct DoubleExponentialPredictor
+	{
+		FilterDoubleExponential filter;
+
+		void Update(const XMVECTOR& newPosition, long long) { filter.Update(newPosition); }
+		XMVECTOR Predict(long long) { return filter.GetFilteredValue(); }
+	};
+
+	template<typename Filter>
+	struct TimedPredictor
+	{
+		Filter filter;
+
+		void Update(const XMVECTOR& newPosition, long long timestamp) { filter.Update(newPosition, timestamp); }
+		XMVECTOR Predict(long long timestamp) const { return filter.GetPredictedValue(timestamp); }
+	};
+}
+
+FilterEvaluator::FilterEvaluator() :
+	m_stillSpeedThreshold(0.05f)
+{
+}
+
+void FilterEvaluator::Clear()
+{
+	m_samples.clear();
+}
+
+void FilterEvaluator::AddSample(const XMVECTOR& position, long long timestamp)
+{
+	assert(m_samples.empty() || timestamp > m_samples.back().timestamp);
+	m_samples.push_back({ XMVectorSetW(position, 1.0f), timestamp });
+}
+
+bool FilterEvaluator::GetRecordedState(long long timestamp, size_t& searchStart, XMVECTOR& position, XMVECTOR& velocity) const
+{
+	while (searchStart + 2 < m_samples.size() && m_samples[searchStart + 1].timestamp <= timestamp)
+		++searchStart;
+
+	if (searchStart + 1 >= m_samples.size())
+		return false;
+
+	const Sample& before = m_samples[searchStart];
+	const Sample& after = m_samples[searchStart + 1];
+	if (timestamp < before.timestamp || timestamp > after.timestamp)
+		return false;
+
+	// Untracked samples are zero, there is nothing to compare against across them
+	if (XMVector3Equal(before.position, XMVectorZero()) || XMVector3Equal(after.position, XMVectorZero()))
+		return false;
+
+	float t = (float)(timestamp - before.timestamp) / (float)(after.timestamp - before.timestamp);
+	position = XMVectorLerp(before.position, after.position, t);
+
+	// Velocity over a few frames either side, a single frame difference is mostly sensor noise
+	size_t first = searchStart, last = searchStart + 1;
+	while (first > 0 && before.timestamp - m_samples[first].timestamp < s_velocityHalfWindow && !XMVector3Equal(m_samples[first - 1].position, XMVectorZero()))
+		--first;
+	while (last + 1 < m_samples.size() && m_samples[last].timestamp - after.timestamp < s_velocityHalfWindow && !XMVector3Equal(m_samples[last + 1].position, XMVectorZero()))
+		++last;
+
+	float interval = (float)(m_samples[last].timestamp - m_samples[first].timestamp) * 1e-7f;
+	velocity = XMVectorSetW((m_samples[last].position - m_samples[first].position) / interval, 0.0f);
+	return true;
+}
+
+template<typename Predictor>
+FilterScore FilterEvaluator::Evaluate(long long predictionTime, Predictor& predictor) const
+{
+	FilterScore score;
+	if (m_samples.size() < 2)
+		return score;
+
+	double errorSum = 0.0, lagSum = 0.0, speedSquaredSum = 0.0, jitterSum = 0.0;
+	unsigned jitterCount = 0;
+
+	XMVECTOR previousOutputs[2] = { XMVectorZero(), XMVectorZero() };
+	unsigned outputCount = 0;
+	size_t searchStart = 0;
+
+	for (const Sample& sample : m_samples)
+	{
+		predictor.Update(sample.position, sample.timestamp);
+
+		long long targetTime = sample.timestamp + predictionTime;
+		if (targetTime > m_samples.back().timestamp)
+			break;
+
+		XMVECTOR output = predictor.Predict(targetTime);
+
+		XMVECTOR recordedPosition, recordedVelocity;
+		if (XMVector3Equal(sample.position, XMVectorZero()) || !GetRecordedState(targetTime, searchStart, recordedPosition, recordedVelocity))
+		{
+			outputCount = 0;
+			continue;
+		}
+
+		XMVECTOR error = recordedPosition - output;
+		errorSum += XMVectorGetX(XMVector3LengthSq(error));
+		++score.sampleCount;
+
+		float speedSquared = XMVectorGetX(XMVector3LengthSq(recordedVelocity));
+		if (speedSquared > m_stillSpeedThreshold * m_stillSpeedThreshold)
+		{
+			// Error along the direction of motion divided by speed is how far behind in time the output is.
+			// Summed weighted by speed squared, so slow samples where the direction is mostly noise barely count.
+			lagSum += XMVectorGetX(XMVector3Dot(error, recordedVelocity));
+			speedSquaredSum += speedSquared;
+		}
+		else if (outputCount >= 2)
+		{
+			XMVECTOR acceleration = output - previousOutputs[0] * 2.0f + previousOutputs[1];
+			jitterSum += XMVectorGetX(XMVector3LengthSq(acceleration));
+			++jitterCount;
+		}
+
+		previousOutputs[1] = previousOutputs[0];
+		previousOutputs[0] = output;
+		++outputCount;
+	}
+
+	if (score.sampleCount > 0)
+		score.predictionError = (float)sqrt(errorSum / score.sampleCount);
+	if (speedSquaredSum > 0.0)
+		score.lag = (float)(lagSum / speedSquaredSum);
+	if (jitterCount > 0)
+		score.jitter = (float)sqrt(jitterSum / jitterCount);
+
+	return score;
+}
+
+FilterScore FilterEvaluator::EvaluateDoubleExponential(long long predictionTime, float smoothing, float correction, float prediction, float jitterRadius, float maxDeviationRadius) const
+{
+	DoubleExponentialPredictor predictor;
+	predictor.filter.SetParameters(smoothing, correction, prediction, jitterRadius, maxDeviationRadius);
+	return Evaluate(predictionTime, predictor);
+}
+
+FilterScore FilterEvaluator::EvaluateOneEuro(long long predictionTime, float minCutoff, float beta, float derivativeCutoff, float maxPredictionTime) const
+{
+	TimedPredictor<FilterOneEuro> predictor;
+	predictor.filter.SetParameters(minCutoff, beta, derivativeCutoff, maxPredictionTime);
+	return Evaluate(predictionTime, predictor);
+}
+
+FilterScore FilterEvaluator::EvaluateKalman(long long predictionTime, float processNoise, float measurementNoise, float maxPredictionTime) const
+{
+	TimedPredictor<FilterKalmanConstantVelocity> predictor;
+	predictor.filter.SetParameters(processNoise, measurementNoise, maxPredictionTime);
+	return Evaluate(predictionTime, predictor);
+}
+
+FilterScore FilterEvaluator::EvaluateRaw(long long predictionTime) const
+{
+	RawPredictor predictor;
+	return Evaluate(predictionTime, predictor);
+}
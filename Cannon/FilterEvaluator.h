@@ -0,0 +1,78 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+// Like SurfaceRecording, this file and FilterEvaluator.cpp only depend on the standard library and DirectXMath,
+//  so filter settings can be tuned off-device on recorded hand data.
+
+#include "RecordedValue.h"
+
+#include <vector>
+
+// How a filter did on a recorded trajectory, when asked to predict predictionTime ahead of every sample
+struct FilterScore
+{
+	float lag = 0.0f;				// Mean time in seconds the output trails the recording along the direction of motion
+	float jitter = 0.0f;			// RMS frame to frame acceleration of the output in meters, measured while not moving
+	float predictionError = 0.0f;	// RMS distance in meters between the output and where the recording actually was
+	unsigned sampleCount = 0;		// Samples that contributed to predictionError
+};
+
+// Replays one recorded joint trajectory through each kind of RecordedValue filter and scores lag against jitter.
+// The recording serves as the reference: there is no ground truth, so lag and prediction error are measured against
+//  the raw samples, and jitter only on the still parts of the recording where raw motion is below the speed threshold.
+class FilterEvaluator
+{
+public:
+
+	FilterEvaluator();
+
+	void Clear();
+	void AddSample(const DirectX::XMVECTOR& position, long long timestamp);	// Timestamps in 100 ns ticks, increasing
+
+	// Adds every frame of one stream of a JointHistory, oldest first
+	template<typename History>
+	void AddSamples(const History& history, size_t stream)
+	{
+		for (unsigned framesAgo = history.GetFrameCount(); framesAgo-- > 0;)
+			AddSample(history.GetValue(stream, framesAgo), history.GetFrame(framesAgo).timestamp);
+	}
+
+	size_t GetSampleCount() const { return m_samples.size(); }
+	void SetStillSpeedThreshold(float metersPerSecond) { m_stillSpeedThreshold = metersPerSecond; }
+
+	// predictionTime is how far past each sample's timestamp the filter output is compared, in ticks.
+	// Use the usual gap between hand timestamp and display time to score prediction, 0 to score smoothing alone.
+	FilterScore EvaluateDoubleExponential(long long predictionTime, float smoothing = 0.25f, float correction = 0.0f, float prediction = 0.0f, float jitterRadius = 0.05f, float maxDeviationRadius = 0.05f) const;
+	FilterScore EvaluateOneEuro(long long predictionTime, float minCutoff = 1.0f, float beta = 5.0f, float derivativeCutoff = 1.0f, float maxPredictionTime = 0.05f) const;
+	FilterScore EvaluateKalman(long long predictionTime, float processNoise = 2.0f, float measurementNoise = 0.006f, float maxPredictionTime = 0.05f) const;
+
+	// Scores the unfiltered recording held still for predictionTime, the baseline every filter should beat
+	FilterScore EvaluateRaw(long long predictionTime) const;
+
+private:
+
+	struct Sample
+	{
+		DirectX::XMVECTOR position;
+		long long timestamp;
+	};
+
+	template<typename Predictor>
+	FilterScore Evaluate(long long predictionTime, Predictor& predictor) const;
+
+	bool GetRecordedState(long long timestamp, size_t& searchStart, DirectX::XMVECTOR& position, DirectX::XMVECTOR& velocity) const;
+
+	std::vector<Sample> m_samples;
+	float m_stillSpeedThreshold;
+};
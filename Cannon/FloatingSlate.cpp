@@ -13,10 +13,39 @@
 #include "pch.h"
 
 #include "FloatingSlate.h"
+#include "GestureRecognizer.h"
+#include "Common/CapsuleTests.h"
 
+#include <map>
 #include <memory>
+#include <tuple>
 using namespace std;
 
+// Buttons of the same shape and size share their meshes, and buttons without text share an empty texture,
+//  so the render queue can merge their draws into one instanced draw
+struct SharedButtonMeshes
+{
+	weak_ptr<Mesh> mesh;
+	weak_ptr<Mesh> outlineMesh;
+};
+
+static map<tuple<Mesh::MeshType, float, float, float>, SharedButtonMeshes> s_sharedButtonMeshes;
+static weak_ptr<Texture2D> s_blankButtonTexture;
+
+FingertipSweep FingertipSweep::Create(const XMVECTOR& start, const XMVECTOR& end, float radius)
+{
+	FingertipSweep sweep;
+	sweep.start = start;
+	sweep.end = end;
+	sweep.radius = radius;
+
+	XMVECTOR radiusVector = XMVectorReplicate(radius);
+	BoundingBox::CreateFromPoints(sweep.bounds, XMVectorMin(start, end) - radiusVector, XMVectorMax(start, end) + radiusVector);
+	sweep.isValid = true;
+
+	return sweep;
+}
+
 float FloatingSlateButton::m_defaultFontSize = 36.0f;
 void FloatingSlateButton::SetDefaultFontSize(const float fontSize)
 {
@@ -125,6 +154,22 @@ void FloatingSlateButton::SetSize(const XMVECTOR& size)
 }
 
 void FloatingSlateButton::Update(float timeDeltaInSeconds, XMMATRIX& parentTransform, TrackedHands& hands, float offsetToSlateSurface, bool suspendInteractions)
+{
+	FingertipSweep sweeps[HAND_COUNT];
+	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+	{
+		if (hands.IsHandTracked(handIndex))
+		{
+			XMVECTOR pokePosition = hands.GetGestures().GetPokePosition(handIndex);
+			XMVECTOR lastPokePosition = hands.GetGestures().GetPokePosition(handIndex, 1);
+			sweeps[handIndex] = FingertipSweep::Create(lastPokePosition, pokePosition, 0.0f);
+		}
+	}
+
+	Update(timeDeltaInSeconds, parentTransform, sweeps, offsetToSlateSurface, suspendInteractions);
+}
+
+void FloatingSlateButton::Update(float timeDeltaInSeconds, XMMATRIX& parentTransform, const FingertipSweep (&sweeps)[HAND_COUNT], float offsetToSlateSurface, bool suspendInteractions)
 {
 	if (m_hidden)
 		return;
@@ -157,37 +202,55 @@ void FloatingSlateButton::Update(float timeDeltaInSeconds, XMMATRIX& parentTrans
 	zeroPushPosition = XMVector3TransformCoord(zeroPushPosition, parentTransform);
 	XMVECTOR pushDirection = XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f), parentTransform));
 
-	// Check if a finger broke the front plane of the button this frame
+	XMVECTOR pushVolumeCenter = XMLoadFloat3(&worldPushVolume.Center);
+	XMVECTOR pushVolumeExtents = XMLoadFloat3(&worldPushVolume.Extents);
+	XMVECTOR pushVolumeOrientation = XMLoadFloat4(&worldPushVolume.Orientation);
+
+	// Push distance of the front of a fingertip sphere
+	auto calculatePushDistance = [&](const XMVECTOR& fingertip, float radius)
+	{
+		return XMVectorGetX(XMVector3Dot(fingertip - zeroPushPosition, pushDirection)) + radius;
+	};
+
+	auto sweepTouchesPushVolume = [&](const FingertipSweep& sweep)
+	{
+		return sweep.isValid && sweep.bounds.Intersects(worldPushVolume) &&
+			CapsuleTests::IntersectsOrientedBox(sweep.start, sweep.end, sweep.radius, pushVolumeCenter, pushVolumeExtents, pushVolumeOrientation);
+	};
+
+	// Check if a finger broke the front plane of the button since the last update
 	if (m_activePushingHandIndex == -1)
 	{
 		for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
 		{
-			if (hands.IsHandTracked(handIndex))
+			const FingertipSweep& sweep = sweeps[handIndex];
+			if (sweepTouchesPushVolume(sweep) && calculatePushDistance(sweep.start, sweep.radius) <= 0.0f)
 			{
-				XMVECTOR indexTip = hands.GetIndexTipSurfacePosition(handIndex);
-				if (worldPushVolume.Contains(indexTip) == CONTAINS)
-				{					
-					XMVECTOR lastIndexTip = hands.GetIndexTipSurfacePosition(handIndex, 1);
-					float lastFingerPushDistance = XMVectorGetX(XMVector3Dot(lastIndexTip - zeroPushPosition, pushDirection));
-
-					if (lastFingerPushDistance <= 0.0f)
-					{
-						m_activePushingHandIndex = (int) handIndex;
-						break;
-					}
-				}
+				m_activePushingHandIndex = (int) handIndex;
+				break;
 			}
 		}
 	}
 	
-	// Calculate push distance if button is being actively pressed and index tip is still in push volume
+	// Calculate push distance if button is being actively pressed and the fingertip is still in push volume.
+	// The push is taken where the sweep last touched the volume, so a finger that went all the way through
+	//  between two updates still presses the button before it is released.
 	float fingerPushDistance = 0.0f;
 	if(m_activePushingHandIndex != -1 && !suspendInteractions && !m_disabled && !m_pushedIn && !m_spacer)
 	{
-		XMVECTOR indexTip = hands.GetIndexTipSurfacePosition(m_activePushingHandIndex);
-		if (hands.IsHandTracked(m_activePushingHandIndex) && worldPushVolume.Contains(indexTip) == CONTAINS)
+		const FingertipSweep& sweep = sweeps[m_activePushingHandIndex];
+		if (sweepTouchesPushVolume(sweep))
 		{
-			fingerPushDistance = XMVectorGetX(XMVector3Dot(indexTip - zeroPushPosition, pushDirection));
+			// Clipped against the volume grown by the radius, which only differs from the exact test around its edges
+			XMVECTOR localStart = XMVector3InverseRotate(sweep.start - pushVolumeCenter, pushVolumeOrientation);
+			XMVECTOR localEnd = XMVector3InverseRotate(sweep.end - pushVolumeCenter, pushVolumeOrientation);
+			XMVECTOR grownExtents = pushVolumeExtents + XMVectorReplicate(sweep.radius);
+
+			float enter, exit;
+			if (!CapsuleTests::ClipSegmentToBox(localStart, localEnd, -grownExtents, grownExtents, enter, exit))
+				exit = 1.0f;
+
+			fingerPushDistance = calculatePushDistance(XMVectorLerp(sweep.start, sweep.end, exit), sweep.radius);
 		}
 		else
 		{
@@ -257,15 +320,53 @@ bool FloatingSlateButton::TestRayIntersection(const XMVECTOR& rayOriginInWorldSp
 }
 
 void FloatingSlateButton::UpdateGeometry()
+{
+	auto key = make_tuple(m_buttonShape, XMVectorGetX(m_size), XMVectorGetY(m_size), XMVectorGetZ(m_size));
+	shared_ptr<Mesh> mesh, outlineMesh;
+
+	auto sharedMeshesIterator = s_sharedButtonMeshes.find(key);
+	if (sharedMeshesIterator != s_sharedButtonMeshes.end())
+	{
+		mesh = sharedMeshesIterator->second.mesh.lock();
+		outlineMesh = sharedMeshesIterator->second.outlineMesh.lock();
+	}
+
+	if (!mesh || !outlineMesh)
+	{
+		// Entries expire when the last button of their shape and size goes away, drop them whenever one is added
+		for (auto iterator = s_sharedButtonMeshes.begin(); iterator != s_sharedButtonMeshes.end();)
+		{
+			if (iterator->second.mesh.expired() || iterator->second.outlineMesh.expired())
+				iterator = s_sharedButtonMeshes.erase(iterator);
+			else
+				++iterator;
+		}
+
+		mesh = make_shared<Mesh>();
+		outlineMesh = make_shared<Mesh>();
+		BuildGeometry(*mesh, *outlineMesh);
+
+		SharedButtonMeshes& sharedMeshes = s_sharedButtonMeshes[key];
+		sharedMeshes.mesh = mesh;
+		sharedMeshes.outlineMesh = outlineMesh;
+	}
+
+	m_drawCall.SetMesh(mesh);
+	m_outlineDrawCall.SetMesh(outlineMesh);
+
+	m_geometryNeedsUpdate = false;
+}
+
+void FloatingSlateButton::BuildGeometry(Mesh& mesh, Mesh& outlineMesh)
 {
 	Mesh::DiscMode discMode = Mesh::DiscMode::Circle;
 	unsigned segmentCount = 32;
 
 	if (m_buttonShape == Mesh::MT_BOX)
 	{
-		m_drawCall.GetMesh()->LoadBox(XMVectorGetX(m_size), XMVectorGetZ(m_size), XMVectorGetY(m_size));
+		mesh.LoadBox(XMVectorGetX(m_size), XMVectorGetZ(m_size), XMVectorGetY(m_size));
 
-		auto& vertices = m_drawCall.GetMesh()->GetVertices();
+		auto& vertices = mesh.GetVertices();
 		for (size_t i = 0; i < vertices.size(); ++i)
 		{
 			// Kill all texcoords on the box except the front face so that texture will only appear on the front of the button
@@ -281,19 +382,18 @@ void FloatingSlateButton::UpdateGeometry()
 	}
 	else if (m_buttonShape == Mesh::MT_ROUNDEDBOX)
 	{
-		m_drawCall.GetMesh()->LoadRoundedBox(XMVectorGetX(m_size), XMVectorGetZ(m_size), XMVectorGetY(m_size));
+		mesh.LoadRoundedBox(XMVectorGetX(m_size), XMVectorGetZ(m_size), XMVectorGetY(m_size));
 		discMode = Mesh::DiscMode::RoundedSquare;
 	}
 	else if (m_buttonShape == Mesh::MT_CYLINDER)
 	{
-		m_drawCall.GetMesh()->LoadCylinder(XMVectorGetX(m_size) / 2.0f, XMVectorGetZ(m_size));
+		mesh.LoadCylinder(XMVectorGetX(m_size) / 2.0f, XMVectorGetZ(m_size));
 		discMode = Mesh::DiscMode::Circle;
 	}
 
 	// Create the outline mesh for this button
-	auto outlineMesh = m_outlineDrawCall.GetMesh();
-	outlineMesh->GetVertices().clear();
-	outlineMesh->GetIndices().clear();
+	outlineMesh.GetVertices().clear();
+	outlineMesh.GetIndices().clear();
 	XMVECTOR upDir = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 	XMVECTOR rightDir = XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
 	float rightRadius = XMVectorGetX(m_size) / 2.0f;
@@ -301,20 +401,36 @@ void FloatingSlateButton::UpdateGeometry()
 	vector<Mesh::Disc> discs;
 	discs.push_back({ XMVectorSet(0.0f, 0.00f, 0.0f, 1.0f), upDir, rightDir, rightRadius + 0.001f, backRadius + 0.001f });
 	discs.push_back({ XMVectorSet(0.0f, 0.00f, 0.0f, 1.0f), upDir, rightDir, rightRadius + 0.0f, backRadius + 0.0f });
-	outlineMesh->AppendGeometryForDiscs(discs, segmentCount, discMode);
-	outlineMesh->GenerateSmoothNormals();
+	outlineMesh.AppendGeometryForDiscs(discs, segmentCount, discMode);
+	outlineMesh.GenerateSmoothNormals();
 
 	// Rotate the button such that +Y is facing forward
 	XMMATRIX rotationToYFront = XMMatrixRotationAxis(XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f), XM_PIDIV2);
-	m_drawCall.GetMesh()->BakeTransform(rotationToYFront);
-	m_outlineDrawCall.GetMesh()->BakeTransform(rotationToYFront);
-
-	m_geometryNeedsUpdate = false;
+	mesh.BakeTransform(rotationToYFront);
+	outlineMesh.BakeTransform(rotationToYFront);
 }
 
 void FloatingSlateButton::UpdateTexture()
 {
-	if (!m_texture)
+	bool hasText = (m_buttonTextw.has_value() && !m_buttonTextw.value().empty()) || (m_buttonText.has_value() && !m_buttonText.value().empty());
+	shared_ptr<Texture2D> blankTexture = s_blankButtonTexture.lock();
+
+	if (!hasText && (!m_texture || m_texture->IsRenderTarget()))
+	{
+		if (!blankTexture)
+		{
+			blankTexture = make_shared<Texture2D>(2, 2);
+			blankTexture->Clear(0.0f, 0.0f, 0.0f, 0.0f);
+			s_blankButtonTexture = blankTexture;
+		}
+
+		m_texture = blankTexture;
+		m_textureNeedsUpdate = false;
+		return;
+	}
+
+	// Text is never drawn into the shared empty texture
+	if (!m_texture || m_texture == blankTexture)
 	{
 		const float dpi = 96.0f * 2.0f;
 		float dpm = dpi * 0.393f * 100.0f;
@@ -575,28 +691,28 @@ void FloatingSlate::CalculateFollowHandPositionAndRotation(TrackedHands& hands,
 	{
 	case FollowHandMode::LeftIndex: // get the slate flying on the left of the left hand index 
 	{
-		targetPosition = hands.GetJoint(0, HandJointIndex::IndexTip) + headRight * scale * 0.045f;
+		targetPosition = hands.GetPredictedJoint(0, HandJointIndex::IndexTip) + headRight * scale * 0.045f;
 		targetForwardDirection = XMVector3Normalize(headPosition - targetPosition);
 		targetUpDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 		break;
 	}
 	case FollowHandMode::LeftPalm:// get the slate flying on the slighlty left of the mid point between the left hand middle  and ring finger's intermediate joins(using two fingers to reduc jitter)
 	{
-		targetPosition = 0.5 * (hands.GetJoint(0, HandJointIndex::MiddleIntermediate) + hands.GetJoint(0, HandJointIndex::RingIntermediate)) - headForward * 0.025f;
+		targetPosition = 0.5 * (hands.GetPredictedJoint(0, HandJointIndex::MiddleIntermediate) + hands.GetPredictedJoint(0, HandJointIndex::RingIntermediate)) - headForward * 0.025f;
 		targetForwardDirection = XMVector3Normalize(headPosition - targetPosition);
 		targetUpDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 		break;
 	}
 	case FollowHandMode::RightIndex: // get the slate flying on the right of the mid point between the right hand index and thumb tips(using two fingers to reduce jitter)
 	{
-		targetPosition = hands.GetJoint(1, HandJointIndex::IndexTip) - headRight * scale * 0.045f;
+		targetPosition = hands.GetPredictedJoint(1, HandJointIndex::IndexTip) - headRight * scale * 0.045f;
 		targetForwardDirection = XMVector3Normalize(headPosition - targetPosition);
 		targetUpDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 		break;
 	}
 	case FollowHandMode::RightPalm:// get the slate flying on the slighlty right of the mid point between the right hand middle  and ring finger's intermediate joins(using two fingers to reduc jitter)
 	{
-		targetPosition = 0.5 * (hands.GetJoint(1, HandJointIndex::MiddleIntermediate) + hands.GetJoint(1, HandJointIndex::RingIntermediate)) - headForward * 0.025f;
+		targetPosition = 0.5 * (hands.GetPredictedJoint(1, HandJointIndex::MiddleIntermediate) + hands.GetPredictedJoint(1, HandJointIndex::RingIntermediate)) - headForward * 0.025f;
 		targetForwardDirection = XMVector3Normalize(headPosition - targetPosition);
 		targetUpDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 		break;
@@ -639,6 +755,37 @@ void FloatingSlate::Update(float timeDeltaInSeconds, TrackedHands& hands)
 }
 
 void FloatingSlate::Update(float timeDeltaInSeconds, const XMMATRIX& parentTransform, TrackedHands& hands, bool suspendInteractions)
+{
+	FingertipSweep sweeps[HAND_COUNT];
+	UpdateFingertipSweeps(hands, sweeps);
+
+	Update(timeDeltaInSeconds, parentTransform, hands, sweeps, suspendInteractions);
+}
+
+// Sweeps run from the poke positions at this slate's last update rather than the last hand frame,
+//  so they stay continuous when slates update less often than hands are tracked
+void FloatingSlate::UpdateFingertipSweeps(TrackedHands& hands, FingertipSweep (&sweeps)[HAND_COUNT])
+{
+	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+	{
+		if (hands.IsHandTracked(handIndex))
+		{
+			XMVECTOR fingertip = hands.GetGestures().GetPokePosition(handIndex);
+			XMVECTOR lastFingertip = m_hasLastFingertips[handIndex] ? m_lastFingertips[handIndex] : hands.GetGestures().GetPokePosition(handIndex, 1);
+			sweeps[handIndex] = FingertipSweep::Create(lastFingertip, fingertip, 0.0f);
+
+			m_lastFingertips[handIndex] = fingertip;
+			m_hasLastFingertips[handIndex] = true;
+		}
+		else
+		{
+			sweeps[handIndex] = FingertipSweep();
+			m_hasLastFingertips[handIndex] = false;
+		}
+	}
+}
+
+void FloatingSlate::Update(float timeDeltaInSeconds, const XMMATRIX& parentTransform, TrackedHands& hands, const FingertipSweep (&sweeps)[HAND_COUNT], bool suspendInteractions)
 {
 	if (m_hidden)
 		return;
@@ -731,16 +878,16 @@ void FloatingSlate::Update(float timeDeltaInSeconds, const XMMATRIX& parentTrans
 		for (auto& button : m_titleBarButtons)
 		{
 			button->SetColor(m_titleBarColor);
-			button->Update(timeDeltaInSeconds, titleBarTranslation * worldTransform, hands, XMVectorGetZ(m_size) / 4.0f, suspendInteractions);
+			button->Update(timeDeltaInSeconds, titleBarTranslation * worldTransform, sweeps, XMVectorGetZ(m_size) / 4.0f, suspendInteractions);
 		}
 
 		m_titleBarSpacerButton->SetColor(m_titleBarColor);
-		m_titleBarSpacerButton->Update(timeDeltaInSeconds, titleBarTranslation * worldTransform, hands, XMVectorGetZ(m_size) / 4.0f, suspendInteractions);
+		m_titleBarSpacerButton->Update(timeDeltaInSeconds, titleBarTranslation * worldTransform, sweeps, XMVectorGetZ(m_size) / 4.0f, suspendInteractions);
 	}
 
 	for (auto& button : m_buttons)
 	{
-		button->Update(timeDeltaInSeconds, worldTransform, hands, XMVectorGetZ(m_size) / 2.0f, suspendInteractions);
+		button->Update(timeDeltaInSeconds, worldTransform, sweeps, XMVectorGetZ(m_size) / 2.0f, suspendInteractions);
 	}
 
 	// If there is an active modal child slate, suspend interactions on all other child slates,
@@ -748,12 +895,12 @@ void FloatingSlate::Update(float timeDeltaInSeconds, const XMMATRIX& parentTrans
 	if (m_activeModalChildSlate)
 	{
 		for (auto& slate : m_childSlates)
-			slate->Update(timeDeltaInSeconds, worldTransform, hands, slate != m_activeModalChildSlate);
+			slate->Update(timeDeltaInSeconds, worldTransform, hands, sweeps, slate != m_activeModalChildSlate);
 	}
 	else
 	{
 		for (auto& slate : m_childSlates)
-			slate->Update(timeDeltaInSeconds, worldTransform, hands, suspendInteractions);
+			slate->Update(timeDeltaInSeconds, worldTransform, hands, sweeps, suspendInteractions);
 	}
 }
 
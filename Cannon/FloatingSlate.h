@@ -40,6 +40,21 @@ public:
 	virtual void OnButtonUnPressed(class FloatingSlateButton* pButton) = 0;
 };
 
+// Movement of a fingertip since the last UI update, its sphere swept from start to end.
+// Slates sweep the poke position of GestureRecognizer, which is on the fingertip surface already, with no radius.
+// Gathered once per update of a slate hierarchy and tested against the push volume of every button in it,
+//  so a fast finger cannot skip through a button between samples, however low the update rate.
+struct FingertipSweep
+{
+	XMVECTOR start;
+	XMVECTOR end;
+	float radius = 0.0f;
+	BoundingBox bounds;		// Encloses the whole sweep, rejects most buttons before the exact test
+	bool isValid = false;
+
+	static FingertipSweep Create(const XMVECTOR& start, const XMVECTOR& end, float radius);
+};
+
 class FloatingSlateButton
 {
 public:
@@ -62,7 +77,8 @@ public:
 	XMVECTOR GetSize();
 	void SetSize(const XMVECTOR& size);
 
-	void Update(float timeDeltaInSeconds, XMMATRIX& parentTransform, TrackedHands& hands, float offsetToSlateSurface, bool suspendInteractions = false);
+	void Update(float timeDeltaInSeconds, XMMATRIX& parentTransform, TrackedHands& hands, float offsetToSlateSurface, bool suspendInteractions = false);	// Sweeps the poke positions from the previous hand frame
+	void Update(float timeDeltaInSeconds, XMMATRIX& parentTransform, const FingertipSweep (&sweeps)[HAND_COUNT], float offsetToSlateSurface, bool suspendInteractions = false);
 
 	bool TestRayIntersection(const XMVECTOR& rayOriginInWorldSpace, const XMVECTOR& rayDirectionInWorldSpace, float& distance);
 
@@ -139,6 +155,7 @@ private:
 	std::vector<std::shared_ptr<FloatingSlateButton>> m_mutuallyExclusiveButtons;
 	
 	void UpdateGeometry();
+	void BuildGeometry(Mesh& mesh, Mesh& outlineMesh);
 	void UpdateTexture();
 };
 
@@ -329,6 +346,13 @@ private:
 	std::shared_ptr<FloatingSlate> m_activeModalChildSlate;			// Only set when there is currently an active modal child slate - causes this slate and all other children to suspend interactions
 	std::vector<std::shared_ptr<FloatingSlate>> m_childSlates;
 
+	// Fingertip positions at the last update, where the sweeps of this update start
+	XMVECTOR m_lastFingertips[HAND_COUNT];
+	bool m_hasLastFingertips[HAND_COUNT] = {};
+
+	void UpdateFingertipSweeps(TrackedHands& hands, FingertipSweep (&sweeps)[HAND_COUNT]);
+	void Update(float timeDeltaInSeconds, const XMMATRIX& parentTransform, TrackedHands& hands, const FingertipSweep (&sweeps)[HAND_COUNT], bool suspendInteractions);
+
 	void ReflowButtons();
 	void ReflowTitleBarButtons();
 
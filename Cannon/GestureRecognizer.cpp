@@ -0,0 +1,182 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "GestureRecognizer.h"
+
+using namespace DirectX;
+using namespace std;
+
+GestureRecognizer::GestureRecognizer() :
+	GestureRecognizer(Settings())
+{
+}
+
+GestureRecognizer::GestureRecognizer(const Settings& settings) :
+	m_settings(settings)
+{
+	for (auto& hand : m_hands)
+	{
+		hand.pokePositions[0] = XMVectorZero();
+		hand.pokePositions[1] = XMVectorZero();
+		hand.pinchPosition = XMVectorZero();
+		hand.palmDirection = XMVectorZero();
+		hand.hasPokePosition = false;
+	}
+}
+
+float GestureRecognizer::Ramp(float value, float zeroAt, float oneAt)
+{
+	float t = (value - zeroAt) / (oneAt - zeroAt);
+	return min(max(t, 0.0f), 1.0f);
+}
+
+void GestureRecognizer::SetStrength(GestureState& gesture, float strength)
+{
+	gesture.strength = strength;
+
+	if (!gesture.isActive && strength >= m_settings.enterStrength)
+	{
+		gesture.isActive = true;
+		gesture.wasStarted = true;
+	}
+	else if (gesture.isActive && strength <= m_settings.exitStrength)
+	{
+		gesture.isActive = false;
+		gesture.wasEnded = true;
+	}
+}
+
+void GestureRecognizer::ClearEvents()
+{
+	for (auto& hand : m_hands)
+	{
+		for (auto& gesture : hand.gestures)
+		{
+			gesture.wasStarted = false;
+			gesture.wasEnded = false;
+		}
+	}
+}
+
+void GestureRecognizer::UpdateHand(size_t handIndex, TrackedHands& hands)
+{
+	if (handIndex >= HAND_COUNT)
+		return;
+
+	const HandPositionHistory& history = hands.GetJointHistory(handIndex);
+	if (history.GetFrameCount() == 0)
+		return;
+
+	auto joint = [&history](HandJointIndex jointIndex) { return history.GetValue((size_t)jointIndex); };
+	HandState& hand = m_hands[handIndex];
+
+	XMVECTOR palm = joint(HandJointIndex::Palm);
+	XMVECTOR wrist = joint(HandJointIndex::Wrist);
+	XMVECTOR thumbTip = joint(HandJointIndex::ThumbTip);
+	XMVECTOR indexTip = joint(HandJointIndex::IndexTip);
+	XMVECTOR indexDistal = joint(HandJointIndex::IndexDistal);
+
+	float thumbTipRadius = hands.GetJointRadius(handIndex, HandJointIndex::ThumbTip);
+	float indexTipRadius = hands.GetJointRadius(handIndex, HandJointIndex::IndexTip);
+
+	// Curl of each finger is its tip's distance from the palm, relative to hand size so it works for any hand
+	float handSize = max(XMVectorGetX(XMVector3Length(joint(HandJointIndex::MiddleProximal) - wrist)), 0.01f);
+	const HandJointIndex fingerTips[4] = { HandJointIndex::IndexTip, HandJointIndex::MiddleTip, HandJointIndex::RingTip, HandJointIndex::PinkyTip };
+	float curls[4];
+	for (size_t finger = 0; finger < 4; ++finger)
+	{
+		float ratio = XMVectorGetX(XMVector3Length(joint(fingerTips[finger]) - palm)) / handSize;
+		curls[finger] = Ramp(ratio, m_settings.curlOpenRatio, m_settings.curlClosedRatio);
+	}
+	float otherFingersCurl = (curls[1] + curls[2] + curls[3]) / 3.0f;
+
+	float pinchGap = XMVectorGetX(XMVector3Length(thumbTip - indexTip)) - thumbTipRadius - indexTipRadius;
+	SetStrength(hand.gestures[(size_t)HandGesture::Pinch], Ramp(pinchGap, m_settings.pinchOpenDistance, m_settings.pinchClosedDistance));
+	SetStrength(hand.gestures[(size_t)HandGesture::Poke], min(1.0f - curls[0], otherFingersCurl));
+	SetStrength(hand.gestures[(size_t)HandGesture::Grab], min(curls[0], otherFingersCurl));	// Not a plain average, so pointing is not three quarters of a grab
+
+	hand.palmDirection = TrackedHands::CalculatePalmDirection(handIndex, wrist, joint(HandJointIndex::IndexProximal), joint(HandJointIndex::PinkyProximal));
+	float palmUpDot = XMVectorGetY(hand.palmDirection);
+	SetStrength(hand.gestures[(size_t)HandGesture::PalmUp], Ramp(palmUpDot, m_settings.palmUpMinDot, m_settings.palmUpMaxDot));
+
+	hand.pinchPosition = XMVectorSetW((thumbTip + indexTip) * 0.5f, 1.0f);
+
+	XMVECTOR pokePosition = XMVectorSetW(indexTip + XMVector3Normalize(indexTip - indexDistal) * indexTipRadius * 1.5f, 1.0f);
+	hand.pokePositions[1] = hand.hasPokePosition ? hand.pokePositions[0] : pokePosition;
+	hand.pokePositions[0] = pokePosition;
+	hand.hasPokePosition = true;
+}
+
+void GestureRecognizer::LoseHand(size_t handIndex)
+{
+	if (handIndex >= HAND_COUNT)
+		return;
+
+	for (auto& gesture : m_hands[handIndex].gestures)
+		SetStrength(gesture, 0.0f);
+}
+
+bool GestureRecognizer::IsGestureActive(size_t handIndex, HandGesture gesture) const
+{
+	if (handIndex < HAND_COUNT && (size_t)gesture < s_gestureCount)
+		return m_hands[handIndex].gestures[(size_t)gesture].isActive;
+	else
+		return false;
+}
+
+bool GestureRecognizer::WasGestureStarted(size_t handIndex, HandGesture gesture) const
+{
+	if (handIndex < HAND_COUNT && (size_t)gesture < s_gestureCount)
+		return m_hands[handIndex].gestures[(size_t)gesture].wasStarted;
+	else
+		return false;
+}
+
+bool GestureRecognizer::WasGestureEnded(size_t handIndex, HandGesture gesture) const
+{
+	if (handIndex < HAND_COUNT && (size_t)gesture < s_gestureCount)
+		return m_hands[handIndex].gestures[(size_t)gesture].wasEnded;
+	else
+		return false;
+}
+
+float GestureRecognizer::GetGestureStrength(size_t handIndex, HandGesture gesture) const
+{
+	if (handIndex < HAND_COUNT && (size_t)gesture < s_gestureCount)
+		return m_hands[handIndex].gestures[(size_t)gesture].strength;
+	else
+		return 0.0f;
+}
+
+XMVECTOR GestureRecognizer::GetPokePosition(size_t handIndex, unsigned framesAgo) const
+{
+	if (handIndex < HAND_COUNT)
+		return m_hands[handIndex].pokePositions[min(framesAgo, 1u)];
+	else
+		return XMVectorZero();
+}
+
+XMVECTOR GestureRecognizer::GetPinchPosition(size_t handIndex) const
+{
+	if (handIndex < HAND_COUNT)
+		return m_hands[handIndex].pinchPosition;
+	else
+		return XMVectorZero();
+}
+
+XMVECTOR GestureRecognizer::GetPalmDirection(size_t handIndex) const
+{
+	if (handIndex < HAND_COUNT)
+		return m_hands[handIndex].palmDirection;
+	else
+		return XMVectorZero();
+}
@@ -0,0 +1,93 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "TrackedHands.h"
+
+enum class HandGesture
+{
+	Pinch,		// Thumb and index tips touching
+	Poke,		// Index extended, other fingers curled
+	Grab,		// All fingers curled
+	PalmUp,		// Palm facing the sky
+	Count,
+};
+
+// Recognizes hand gestures once per hand tracking frame, so widgets read the result instead of redoing joint math.
+// Each gesture has a continuous strength from 0 to 1 and an active state with hysteresis: it starts when the strength
+//  rises to enterStrength and only ends when it falls to exitStrength, so it does not flicker around a single threshold.
+// Owned and updated by TrackedHands, see TrackedHands::GetGestures.
+class GestureRecognizer
+{
+public:
+
+	struct Settings
+	{
+		float pinchClosedDistance = 0.01f;	// Gap between thumb and index tip surfaces at full pinch strength, in meters
+		float pinchOpenDistance = 0.05f;	// Gap at zero pinch strength
+		float curlClosedRatio = 0.55f;		// Fingertip to palm distance over hand size at full curl
+		float curlOpenRatio = 0.95f;		// Same at zero curl
+		float palmUpMinDot = 0.3f;			// Dot of palm direction with world up at zero palm up strength
+		float palmUpMaxDot = 0.8f;			// Same at full strength
+		float enterStrength = 0.8f;			// Strength a gesture must reach to start
+		float exitStrength = 0.5f;			// Strength a gesture must fall to before it ends
+	};
+
+	GestureRecognizer();
+	GestureRecognizer(const Settings& settings);
+
+	void SetSettings(const Settings& settings) { m_settings = settings; }
+	const Settings& GetSettings() const { return m_settings; }
+
+	// Called by TrackedHands: ClearEvents once per update, then UpdateHand for every hand with a new frame and LoseHand for every untracked one
+	void ClearEvents();
+	void UpdateHand(size_t handIndex, TrackedHands& hands);
+	void LoseHand(size_t handIndex);
+
+	bool IsGestureActive(size_t handIndex, HandGesture gesture) const;
+	bool WasGestureStarted(size_t handIndex, HandGesture gesture) const;	// Only during the update it started
+	bool WasGestureEnded(size_t handIndex, HandGesture gesture) const;		// Only during the update it ended
+	float GetGestureStrength(size_t handIndex, HandGesture gesture) const;
+
+	// Values derived along the way that widgets need as well
+	XMVECTOR GetPokePosition(size_t handIndex, unsigned framesAgo = 0) const;	// Index tip surface, as TrackedHands::GetIndexTipSurfacePosition. framesAgo is 0 or 1
+	XMVECTOR GetPinchPosition(size_t handIndex) const;							// Midway between thumb and index tips
+	XMVECTOR GetPalmDirection(size_t handIndex) const;							// As TrackedHands::CalculatePalmDirection
+
+private:
+
+	static const size_t s_gestureCount = (size_t)HandGesture::Count;
+
+	struct GestureState
+	{
+		float strength = 0.0f;
+		bool isActive = false;
+		bool wasStarted = false;
+		bool wasEnded = false;
+	};
+
+	struct HandState
+	{
+		GestureState gestures[s_gestureCount];
+		XMVECTOR pokePositions[2];	// This frame and the one before
+		XMVECTOR pinchPosition;
+		XMVECTOR palmDirection;
+		bool hasPokePosition;
+	};
+
+	void SetStrength(GestureState& gesture, float strength);
+	static float Ramp(float value, float zeroAt, float oneAt);
+
+	Settings m_settings;
+	HandState m_hands[HAND_COUNT];
+};
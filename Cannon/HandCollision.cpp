@@ -0,0 +1,282 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "HandCollision.h"
+#include "Common/CapsuleTests.h"
+
+#include <cassert>
+
+using namespace DirectX;
+using namespace std;
+
+struct CapsuleBone
+{
+	HandJointIndex start;
+	HandJointIndex end;
+	HandPart part;
+};
+
+// The finger metacarpals run through the palm, so they count as palm along with the line across the knuckles
+static const CapsuleBone s_capsuleBones[HandCollision::kCapsuleCount] =
+{
+	{ HandJointIndex::ThumbMetacarpal, HandJointIndex::ThumbProximal, HandPart::Thumb },
+	{ HandJointIndex::ThumbProximal, HandJointIndex::ThumbDistal, HandPart::Thumb },
+	{ HandJointIndex::ThumbDistal, HandJointIndex::ThumbTip, HandPart::Thumb },
+
+	{ HandJointIndex::IndexProximal, HandJointIndex::IndexIntermediate, HandPart::Index },
+	{ HandJointIndex::IndexIntermediate, HandJointIndex::IndexDistal, HandPart::Index },
+	{ HandJointIndex::IndexDistal, HandJointIndex::IndexTip, HandPart::Index },
+
+	{ HandJointIndex::MiddleProximal, HandJointIndex::MiddleIntermediate, HandPart::Middle },
+	{ HandJointIndex::MiddleIntermediate, HandJointIndex::MiddleDistal, HandPart::Middle },
+	{ HandJointIndex::MiddleDistal, HandJointIndex::MiddleTip, HandPart::Middle },
+
+	{ HandJointIndex::RingProximal, HandJointIndex::RingIntermediate, HandPart::Ring },
+	{ HandJointIndex::RingIntermediate, HandJointIndex::RingDistal, HandPart::Ring },
+	{ HandJointIndex::RingDistal, HandJointIndex::RingTip, HandPart::Ring },
+
+	{ HandJointIndex::PinkyProximal, HandJointIndex::PinkyIntermediate, HandPart::Pinky },
+	{ HandJointIndex::PinkyIntermediate, HandJointIndex::PinkyDistal, HandPart::Pinky },
+	{ HandJointIndex::PinkyDistal, HandJointIndex::PinkyTip, HandPart::Pinky },
+
+	{ HandJointIndex::IndexMetacarpal, HandJointIndex::IndexProximal, HandPart::Palm },
+	{ HandJointIndex::MiddleMetacarpal, HandJointIndex::MiddleProximal, HandPart::Palm },
+	{ HandJointIndex::RingMetacarpal, HandJointIndex::RingProximal, HandPart::Palm },
+	{ HandJointIndex::PinkyMetacarpal, HandJointIndex::PinkyProximal, HandPart::Palm },
+	{ HandJointIndex::IndexProximal, HandJointIndex::PinkyProximal, HandPart::Palm },
+};
+
+static_assert(HandCollision::kCapsuleCount <= 32, "Capsule masks are 32 bits");
+
+HandCollision::HandCollision()
+{
+	for (auto& hand : m_hands)
+	{
+		for (auto& capsule : hand.capsules)
+		{
+			capsule.start = XMVectorZero();
+			capsule.end = XMVectorZero();
+			capsule.radius = 0.0f;
+		}
+
+		for (size_t group = 0; group < kCapsuleGroupCount; ++group)
+		{
+			for (size_t axis = 0; axis < 3; ++axis)
+			{
+				hand.groupStarts[group][axis] = XMVectorZero();
+				hand.groupEnds[group][axis] = XMVectorZero();
+			}
+
+			hand.groupRadii[group] = XMVectorZero();
+		}
+
+		hand.bounds = BoundingBox();
+		hand.isValid = false;
+	}
+}
+
+void HandCollision::UpdateHand(size_t handIndex, TrackedHands& hands)
+{
+	if (handIndex >= HAND_COUNT)
+		return;
+
+	const HandPositionHistory& history = hands.GetJointHistory(handIndex);
+	if (history.GetFrameCount() == 0)
+		return;
+
+	HandState& hand = m_hands[handIndex];
+	XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+
+	for (size_t capsuleIndex = 0; capsuleIndex < kCapsuleCount; ++capsuleIndex)
+	{
+		const CapsuleBone& bone = s_capsuleBones[capsuleIndex];
+		Capsule& capsule = hand.capsules[capsuleIndex];
+
+		capsule.start = history.GetValue((size_t)bone.start);
+		capsule.end = history.GetValue((size_t)bone.end);
+
+		// The larger of the two joints, so the proxy does not fall inside the real hand around the thicker end
+		capsule.radius = max(hands.GetJointRadius(handIndex, bone.start), hands.GetJointRadius(handIndex, bone.end));
+
+		XMVECTOR radius = XMVectorReplicate(capsule.radius);
+		boundsMin = XMVectorMin(boundsMin, XMVectorMin(capsule.start, capsule.end) - radius);
+		boundsMax = XMVectorMax(boundsMax, XMVectorMax(capsule.start, capsule.end) + radius);
+	}
+
+	// Transposing four starts gives their x, y and z as rows. Past the last capsule, lanes are zero and masked off in the tests.
+	for (size_t group = 0; group < kCapsuleGroupCount; ++group)
+	{
+		XMMATRIX starts, ends;
+		float radii[4];
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			size_t capsuleIndex = group * 4 + lane;
+			bool isCapsule = capsuleIndex < kCapsuleCount;
+			starts.r[lane] = isCapsule ? hand.capsules[capsuleIndex].start : XMVectorZero();
+			ends.r[lane] = isCapsule ? hand.capsules[capsuleIndex].end : XMVectorZero();
+			radii[lane] = isCapsule ? hand.capsules[capsuleIndex].radius : 0.0f;
+		}
+
+		starts = XMMatrixTranspose(starts);
+		ends = XMMatrixTranspose(ends);
+		for (size_t axis = 0; axis < 3; ++axis)
+		{
+			hand.groupStarts[group][axis] = starts.r[axis];
+			hand.groupEnds[group][axis] = ends.r[axis];
+		}
+
+		hand.groupRadii[group] = XMLoadFloat4((const XMFLOAT4*)radii);
+	}
+
+	BoundingBox::CreateFromPoints(hand.bounds, boundsMin, boundsMax);
+	hand.isValid = true;
+}
+
+void HandCollision::LoseHand(size_t handIndex)
+{
+	if (handIndex < HAND_COUNT)
+		m_hands[handIndex].isValid = false;
+}
+
+bool HandCollision::IsHandValid(size_t handIndex) const
+{
+	if (handIndex < HAND_COUNT)
+		return m_hands[handIndex].isValid;
+	else
+		return false;
+}
+
+const HandCollision::Capsule& HandCollision::GetCapsule(size_t handIndex, size_t capsuleIndex) const
+{
+	assert(handIndex < HAND_COUNT && capsuleIndex < kCapsuleCount);
+	return m_hands[handIndex].capsules[capsuleIndex];
+}
+
+const BoundingBox& HandCollision::GetHandBounds(size_t handIndex) const
+{
+	assert(handIndex < HAND_COUNT);
+	return m_hands[handIndex].bounds;
+}
+
+HandPart HandCollision::GetCapsulePart(size_t capsuleIndex)
+{
+	if (capsuleIndex < kCapsuleCount)
+		return s_capsuleBones[capsuleIndex].part;
+	else
+		return HandPart::Count;
+}
+
+uint32_t HandCollision::GetPartMask(HandPart part)
+{
+	uint32_t mask = 0;
+	for (size_t capsuleIndex = 0; capsuleIndex < kCapsuleCount; ++capsuleIndex)
+	{
+		if (s_capsuleBones[capsuleIndex].part == part)
+			mask |= 1u << capsuleIndex;
+	}
+
+	return mask;
+}
+
+uint32_t HandCollision::TestOrientedBox(size_t handIndex, const BoundingOrientedBox& box) const
+{
+	if (!IsHandValid(handIndex))
+		return 0;
+
+	const HandState& hand = m_hands[handIndex];
+	if (!hand.bounds.Intersects(box))
+		return 0;
+
+	XMVECTOR center = XMLoadFloat3(&box.Center);
+	XMVECTOR extents = XMLoadFloat3(&box.Extents);
+	XMVECTOR orientation = XMLoadFloat4(&box.Orientation);
+
+	uint32_t candidates = RejectGroupsAgainstBox(hand, center, extents, orientation);
+
+	uint32_t mask = 0;
+	for (size_t capsuleIndex = 0; capsuleIndex < kCapsuleCount; ++capsuleIndex)
+	{
+		if (!(candidates & (1u << capsuleIndex)))
+			continue;
+
+		const Capsule& capsule = hand.capsules[capsuleIndex];
+		if (CapsuleTests::IntersectsOrientedBox(capsule.start, capsule.end, capsule.radius, center, extents, orientation))
+			mask |= 1u << capsuleIndex;
+	}
+
+	return mask;
+}
+
+uint32_t HandCollision::TestBox(size_t handIndex, const BoundingBox& box) const
+{
+	if (!IsHandValid(handIndex))
+		return 0;
+
+	const HandState& hand = m_hands[handIndex];
+	if (!hand.bounds.Intersects(box))
+		return 0;
+
+	XMVECTOR center = XMLoadFloat3(&box.Center);
+	XMVECTOR extents = XMLoadFloat3(&box.Extents);
+
+	uint32_t candidates = RejectGroupsAgainstBox(hand, center, extents, XMQuaternionIdentity());
+
+	uint32_t mask = 0;
+	for (size_t capsuleIndex = 0; capsuleIndex < kCapsuleCount; ++capsuleIndex)
+	{
+		if (!(candidates & (1u << capsuleIndex)))
+			continue;
+
+		const Capsule& capsule = hand.capsules[capsuleIndex];
+		if (CapsuleTests::IntersectsAlignedBox(capsule.start, capsule.end, capsule.radius, center, extents))
+			mask |= 1u << capsuleIndex;
+	}
+
+	return mask;
+}
+
+uint32_t HandCollision::RejectGroupsAgainstBox(const HandState& hand, FXMVECTOR boxCenter, FXMVECTOR boxExtents, FXMVECTOR boxOrientation) const
+{
+	// Into the box's space as in XMVector3InverseRotate: coordinate n of a point is its offset from the center dotted with row n of the rotation
+	XMMATRIX rotation = XMMatrixRotationQuaternion(boxOrientation);
+	XMVECTOR center[3] = { XMVectorSplatX(boxCenter), XMVectorSplatY(boxCenter), XMVectorSplatZ(boxCenter) };
+	XMVECTOR rows[3][3];
+	for (size_t row = 0; row < 3; ++row)
+	{
+		rows[row][0] = XMVectorSplatX(rotation.r[row]);
+		rows[row][1] = XMVectorSplatY(rotation.r[row]);
+		rows[row][2] = XMVectorSplatZ(rotation.r[row]);
+	}
+
+	uint32_t candidates = 0;
+	for (size_t group = 0; group < kCapsuleGroupCount; ++group)
+	{
+		XMVECTOR startOffset[3], endOffset[3];
+		for (size_t axis = 0; axis < 3; ++axis)
+		{
+			startOffset[axis] = hand.groupStarts[group][axis] - center[axis];
+			endOffset[axis] = hand.groupEnds[group][axis] - center[axis];
+		}
+
+		XMVECTOR localStart[3], localEnd[3];
+		for (size_t row = 0; row < 3; ++row)
+		{
+			localStart[row] = XMVectorMultiplyAdd(startOffset[2], rows[row][2], XMVectorMultiplyAdd(startOffset[1], rows[row][1], startOffset[0] * rows[row][0]));
+			localEnd[row] = XMVectorMultiplyAdd(endOffset[2], rows[row][2], XMVectorMultiplyAdd(endOffset[1], rows[row][1], endOffset[0] * rows[row][0]));
+		}
+
+		candidates |= CapsuleTests::IntersectsGrownLocalBox4(localStart, localEnd, hand.groupRadii[group], boxExtents) << (group * 4);
+	}
+
+	return candidates & (uint32_t)((1ull << kCapsuleCount) - 1);
+}
@@ -0,0 +1,91 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "TrackedHands.h"
+
+#include <DirectXCollision.h>
+
+class Mesh;
+class DrawCall;
+
+enum class HandPart
+{
+	Thumb,
+	Index,
+	Middle,
+	Ring,
+	Pinky,
+	Palm,
+	Count,
+};
+
+// Collision proxy of each hand: a capsule per bone, from consecutive joints and their radii, plus one across the knuckles.
+// Much cheaper to test than the articulated hand mesh, and unlike a single fingertip point it covers the whole hand,
+//  so grabbing with several fingers or pushing with the palm can be detected.
+// Tests return a mask with bit n set when capsule n touches, see GetPartMask to tell which parts of the hand did.
+// Owned and updated by TrackedHands, see TrackedHands::GetCollision.
+class HandCollision
+{
+public:
+
+	static const size_t kCapsuleCount = 20;
+	static const size_t kCapsuleGroupCount = (kCapsuleCount + 3) / 4;
+
+	struct Capsule
+	{
+		XMVECTOR start;
+		XMVECTOR end;
+		float radius;
+	};
+
+	HandCollision();
+
+	// Called by TrackedHands with every new hand frame, and LoseHand once a hand is no longer tracked
+	void UpdateHand(size_t handIndex, TrackedHands& hands);
+	void LoseHand(size_t handIndex);
+
+	bool IsHandValid(size_t handIndex) const;
+	const Capsule& GetCapsule(size_t handIndex, size_t capsuleIndex) const;
+	const BoundingBox& GetHandBounds(size_t handIndex) const;	// Encloses all capsules of the hand
+	static HandPart GetCapsulePart(size_t capsuleIndex);
+	static uint32_t GetPartMask(HandPart part);					// Capsules belonging to a part, to check against test results
+
+	// Zero when the hand is not valid
+	uint32_t TestOrientedBox(size_t handIndex, const BoundingOrientedBox& box) const;
+	uint32_t TestBox(size_t handIndex, const BoundingBox& box) const;
+
+	// In HandCollision_mesh.cpp, the rest of HandCollision and TrackedHands builds without the renderer
+	uint32_t TestMesh(size_t handIndex, Mesh& mesh, const XMMATRIX& worldTransform) const;	// Against the mesh triangles, through its bounding volume hierarchy
+	uint32_t TestDrawCall(size_t handIndex, DrawCall& drawCall, unsigned instanceIndex = 0) const;
+
+private:
+
+	struct HandState
+	{
+		Capsule capsules[kCapsuleCount];
+
+		// The same capsules four to a group, one coordinate of four capsules per vector, for the box tests to reject four at a time
+		XMVECTOR groupStarts[kCapsuleGroupCount][3];
+		XMVECTOR groupEnds[kCapsuleGroupCount][3];
+		XMVECTOR groupRadii[kCapsuleGroupCount];
+
+		BoundingBox bounds;
+		bool isValid;
+	};
+
+	// Capsules that touch the box grown by their radius, to be narrowed down by the exact test of each
+	uint32_t RejectGroupsAgainstBox(const HandState& hand, FXMVECTOR boxCenter, FXMVECTOR boxExtents, FXMVECTOR boxOrientation) const;
+
+	HandState m_hands[HAND_COUNT];
+};
@@ -0,0 +1,53 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "HandCollision.h"
+#include "DrawCall.h"
+
+using namespace DirectX;
+using namespace std;
+
+uint32_t HandCollision::TestMesh(size_t handIndex, Mesh& mesh, const XMMATRIX& worldTransform) const
+{
+	if (!IsHandValid(handIndex) || mesh.IsEmpty())
+		return 0;
+
+	// Whole hand against the whole mesh first, most meshes are nowhere near the hand
+	BoundingOrientedBox meshBounds;
+	BoundingOrientedBox::CreateFromBoundingBox(meshBounds, mesh.GetBoundingBox());
+	meshBounds.Transform(meshBounds, worldTransform);
+
+	const HandState& hand = m_hands[handIndex];
+	if (!hand.bounds.Intersects(meshBounds))
+		return 0;
+
+	uint32_t mask = 0;
+	for (size_t capsuleIndex = 0; capsuleIndex < kCapsuleCount; ++capsuleIndex)
+	{
+		const Capsule& capsule = hand.capsules[capsuleIndex];
+		if (mesh.TestCapsuleIntersection(capsule.start, capsule.end, capsule.radius, worldTransform))
+			mask |= 1u << capsuleIndex;
+	}
+
+	return mask;
+}
+
+uint32_t HandCollision::TestDrawCall(size_t handIndex, DrawCall& drawCall, unsigned instanceIndex) const
+{
+	auto mesh = drawCall.GetMesh();
+	if (!mesh || instanceIndex >= drawCall.GetInstanceCapacity())
+		return 0;
+
+	return TestMesh(handIndex, *mesh, drawCall.GetWorldTransform(instanceIndex));
+}
@@ -0,0 +1,74 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+// Only depends on DirectXMath, so TrackedHands and what it owns can be built without the holographic APIs.
+
+#include <DirectXMath.h>
+
+enum class HandJointIndex
+{
+	Palm,
+	Wrist,
+	ThumbMetacarpal,
+	ThumbProximal,
+	ThumbDistal,
+	ThumbTip,
+	IndexMetacarpal,
+	IndexProximal,
+	IndexIntermediate,
+	IndexDistal,
+	IndexTip,
+	MiddleMetacarpal,
+	MiddleProximal,
+	MiddleIntermediate,
+	MiddleDistal,
+	MiddleTip,
+	RingMetacarpal,
+	RingProximal,
+	RingIntermediate,
+	RingDistal,
+	RingTip,
+	PinkyMetacarpal,
+	PinkyProximal,
+	PinkyIntermediate,
+	PinkyDistal,
+	PinkyTip,
+	Count,
+};
+
+struct HandJoint
+{
+	DirectX::XMVECTOR position;
+	DirectX::XMVECTOR orientation;
+	float radius;
+	bool trackedState;
+};
+
+// What TrackedHands reads every update. MixedReality implements it for live and replayed hands.
+class HandInput
+{
+public:
+
+	virtual ~HandInput() {}
+
+	virtual long long GetPredictedDisplayTime() = 0;
+
+	// Joints of a hand (0 for left, 1 for right) and the time they were sampled, null while the hand is not tracked.
+	// Only guaranteed good until the input is updated again.
+	virtual const HandJoint* GetHandJoints(size_t handIndex, long long& timestamp) = 0;
+
+	virtual const DirectX::XMVECTOR& GetHeadPosition() = 0;
+	virtual const DirectX::XMVECTOR& GetHeadForwardDirection() = 0;
+	virtual const DirectX::XMVECTOR& GetHeadUpDirection() = 0;
+};
@@ -0,0 +1,146 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "HandMeshStream.h"
+
+using namespace DirectX;
+using namespace std;
+
+using winrt::Windows::Perception::People::HandMeshObserver;
+using winrt::Windows::Perception::People::HandMeshVertex;
+using winrt::Windows::Perception::People::HandPose;
+using winrt::Windows::Perception::Spatial::SpatialCoordinateSystem;
+
+extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
+extern std::unique_ptr<RenderContext> g_renderContext;
+
+static_assert(sizeof(HandMeshVertex) == 24, "HandMeshVertex is expected to be float3 position, float3 normal");
+
+// The standard vertex shaders expect a float4 position, which the input assembler completes with w = 1.
+// Hand meshes have no texture coordinates, so TEXCOORD reads the normal rather than widening every vertex for unused data.
+static const vector<D3D11_INPUT_ELEMENT_DESC> s_handMeshElements =
+{
+	{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+	{"NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+	{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+};
+
+HandMeshStream::HandMeshStream() :
+	m_vertexCapacity(0),
+	m_vertexCount(0)
+{
+	m_geometry.vertexStride = sizeof(HandMeshVertex);
+	m_geometry.indexFormat = DXGI_FORMAT_R16_UINT;
+	m_geometry.vertexElements = &s_handMeshElements;
+}
+
+bool HandMeshStream::Update(const HandMeshObserver& observer, const HandPose& handPose, const SpatialCoordinateSystem& worldCoordinateSystem, XMMATRIX& worldTransform)
+{
+	if (!observer)
+		return false;
+
+	if (observer != m_observer && !UpdateIndices(observer))
+		return false;
+
+	auto vertexState = observer.GetVertexStateForPose(handPose);
+	if (!vertexState.CoordinateSystem())	// WORKAROUND: We shouldn't have to check this.  It should never null, but sometimes it is.  It's a platform bug.
+		return false;
+
+	unsigned vertexCount = observer.VertexCount();
+	if (!ReserveVertices(vertexCount))
+		return false;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(g_renderContext->Map(m_vertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+
+	HandMeshVertex* vertices = reinterpret_cast<HandMeshVertex*>(mapped.pData);
+	vertexState.GetVertices(winrt::array_view<HandMeshVertex>(vertices, vertices + vertexCount));
+	g_renderContext->Unmap(m_vertexBuffer.Get(), 0);
+
+	m_vertexCount = vertexCount;
+
+	auto tryTransform = vertexState.CoordinateSystem().TryGetTransformTo(worldCoordinateSystem);
+	if (tryTransform)
+		worldTransform = XMLoadFloat4x4(&tryTransform.Value());
+
+	return true;
+}
+
+bool HandMeshStream::UpdateIndices(const HandMeshObserver& observer)
+{
+	m_observer = nullptr;
+	m_indexBuffer.Reset();
+	m_geometry.indexBuffer = nullptr;
+	m_geometry.indexCount = 0;
+
+	unsigned indexCount = observer.TriangleIndexCount();
+	if (indexCount == 0)
+		return false;
+
+	vector<unsigned short> indices(indexCount);
+	observer.GetTriangleIndices(indices);
+
+	D3D11_BUFFER_DESC desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = indexCount * sizeof(unsigned short);
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA data;
+	memset(&data, 0, sizeof(data));
+	data.pSysMem = indices.data();
+
+	if (FAILED(g_d3dDevice->CreateBuffer(&desc, &data, &m_indexBuffer)))
+		return false;
+
+	m_observer = observer;
+	m_geometry.indexBuffer = m_indexBuffer.Get();
+	m_geometry.indexCount = indexCount;
+	return true;
+}
+
+bool HandMeshStream::ReserveVertices(unsigned vertexCount)
+{
+	if (vertexCount == 0)
+		return false;
+
+	if (vertexCount <= m_vertexCapacity)
+		return true;
+
+	m_vertexBuffer.Reset();
+	m_geometry.vertexBuffer = nullptr;
+	m_vertexCapacity = 0;
+	m_vertexCount = 0;
+
+	D3D11_BUFFER_DESC desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = vertexCount * sizeof(HandMeshVertex);
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	if (FAILED(g_d3dDevice->CreateBuffer(&desc, nullptr, &m_vertexBuffer)))
+		return false;
+
+	m_vertexCapacity = vertexCount;
+	m_geometry.vertexBuffer = m_vertexBuffer.Get();
+	return true;
+}
+
+void HandMeshStream::Draw(DrawCall& drawCall, unsigned instancesToDraw)
+{
+	if (IsValid())
+		drawCall.DrawExternal(m_geometry, instancesToDraw);
+}
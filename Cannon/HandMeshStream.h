@@ -0,0 +1,54 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "DrawCall.h"
+
+// GPU copy of one hand's mesh, streamed from its HandMeshObserver.
+// Vertices go from the observer straight into a mapped dynamic vertex buffer in the observer's own compact layout
+//  (float3 position, float3 normal), so a frame costs one write by the platform and no CPU side copies or allocations.
+// Triangle indices never change for an observer, so they are uploaded once into an immutable 16 bit index buffer.
+class HandMeshStream
+{
+public:
+
+	HandMeshStream();
+
+	// Writes the mesh for handPose. Returns false and keeps the previous mesh if the platform gave no usable vertices.
+	// worldTransform takes the vertices from mesh space to world space.
+	bool Update(const winrt::Windows::Perception::People::HandMeshObserver& observer, const winrt::Windows::Perception::People::HandPose& handPose,
+				const winrt::Windows::Perception::Spatial::SpatialCoordinateSystem& worldCoordinateSystem, DirectX::XMMATRIX& worldTransform);
+
+	bool IsValid() const { return m_geometry.indexCount > 0 && m_vertexCount > 0; }
+	unsigned GetVertexCount() const { return m_vertexCount; }
+	unsigned GetIndexCount() const { return m_geometry.indexCount; }
+
+	// Draws with the shaders, constants and instances of drawCall. Set its world transform to the one returned by Update.
+	void Draw(DrawCall& drawCall, unsigned instancesToDraw = 1);
+
+	const DrawCall::ExternalGeometry& GetGeometry() const { return m_geometry; }
+
+private:
+
+	bool UpdateIndices(const winrt::Windows::Perception::People::HandMeshObserver& observer);
+	bool ReserveVertices(unsigned vertexCount);
+
+	winrt::Windows::Perception::People::HandMeshObserver m_observer{ nullptr };
+
+	::Microsoft::WRL::ComPtr<ID3D11Buffer> m_vertexBuffer;
+	::Microsoft::WRL::ComPtr<ID3D11Buffer> m_indexBuffer;
+	unsigned m_vertexCapacity;
+	unsigned m_vertexCount;
+
+	DrawCall::ExternalGeometry m_geometry;
+};
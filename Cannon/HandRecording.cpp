@@ -0,0 +1,163 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+// No precompiled header on purpose, see HandRecording.h
+
+#include "HandRecording.h"
+
+#include <cstring>
+
+using namespace std;
+
+// File layout, all little endian:
+//  uint32 magic, uint32 version, uint32 frame size, uint32 joint count
+//  then HandRecordFrame[], as many as fit in the rest of the file
+static const uint32_t s_recordingMagic = 0x52525448;	// "HTRR"
+static const uint32_t s_recordingVersion = 1;
+
+struct HandRecordHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frameSize;
+	uint32_t jointCount;
+};
+
+HandRecorder::HandRecorder() :
+	m_file(nullptr),
+	m_frameCount(0)
+{
+}
+
+HandRecorder::~HandRecorder()
+{
+	Close();
+}
+
+bool HandRecorder::Open(const string& filename)
+{
+	Close();
+
+	m_file = fopen(filename.c_str(), "wb");
+	m_frameCount = 0;
+
+	if (!m_file)
+		return false;
+
+	HandRecordHeader header = { s_recordingMagic, s_recordingVersion, (uint32_t)sizeof(HandRecordFrame), (uint32_t)kHandRecordJointCount };
+	fwrite(&header, sizeof(header), 1, m_file);
+	return true;
+}
+
+void HandRecorder::Close()
+{
+	if (m_file)
+	{
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+void HandRecorder::WriteFrame(const HandRecordFrame& frame)
+{
+	if (!m_file)
+		return;
+
+	fwrite(&frame, sizeof(frame), 1, m_file);
+	++m_frameCount;
+}
+
+HandReplay::HandReplay() :
+	m_nextFrame(0),
+	m_timeOffset(0),
+	m_loopDuration(0),
+	m_isLooping(false)
+{
+	memset(&m_currentFrame, 0, sizeof(m_currentFrame));
+}
+
+bool HandReplay::Open(const string& filename)
+{
+	m_frames.clear();
+	m_nextFrame = 0;
+	m_timeOffset = 0;
+	m_loopDuration = 0;
+
+	FILE* pFile = fopen(filename.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	HandRecordHeader header;
+	if (fread(&header, sizeof(header), 1, pFile) != 1 || header.magic != s_recordingMagic || header.version != s_recordingVersion ||
+		header.frameSize != sizeof(HandRecordFrame) || header.jointCount != kHandRecordJointCount)
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	// A recording cut short keeps every complete frame before the cut
+	fseek(pFile, 0, SEEK_END);
+	long fileSize = ftell(pFile);
+	fseek(pFile, sizeof(header), SEEK_SET);
+
+	size_t frameCount = (fileSize > (long)sizeof(header)) ? (fileSize - sizeof(header)) / sizeof(HandRecordFrame) : 0;
+	m_frames.resize(frameCount);
+	if (frameCount > 0)
+		m_frames.resize(fread(m_frames.data(), sizeof(HandRecordFrame), frameCount, pFile));
+
+	fclose(pFile);
+
+	// One average frame past the last, so a loop does not repeat a timestamp
+	if (m_frames.size() > 1)
+	{
+		long long span = m_frames.back().displayTime - m_frames.front().displayTime;
+		m_loopDuration = span + span / (long long)(m_frames.size() - 1);
+	}
+
+	return true;
+}
+
+void HandReplay::SetStartTime(long long startTime)
+{
+	if (!m_frames.empty())
+		m_timeOffset = startTime - m_frames.front().displayTime;
+}
+
+void HandReplay::Restart()
+{
+	m_nextFrame = 0;
+}
+
+const HandRecordFrame* HandReplay::GetNextFrame()
+{
+	if (m_frames.empty())
+		return nullptr;
+
+	if (m_nextFrame >= m_frames.size())
+	{
+		if (!m_isLooping)
+			return nullptr;
+
+		m_nextFrame = 0;
+		m_timeOffset += m_loopDuration;
+	}
+
+	m_currentFrame = m_frames[m_nextFrame++];
+	m_currentFrame.displayTime += m_timeOffset;
+	for (auto& hand : m_currentFrame.hands)
+	{
+		if (hand.isTracked)
+			hand.timestamp += m_timeOffset;
+	}
+
+	return &m_currentFrame;
+}
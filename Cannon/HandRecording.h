@@ -0,0 +1,117 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+// Like SurfaceRecording, this file and HandRecording.cpp only depend on the standard library, so recorded
+//  input can be replayed and benchmarked off-device.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+constexpr size_t kHandRecordJointCount = 26;	// HandJointIndex::Count
+constexpr size_t kHandRecordHandCount = 2;		// 0 for left, 1 for right
+
+// Plain data with no implicit padding, so a file is a small header followed by an array of frames
+//  that can be read in one go or memory mapped.
+struct HandRecordJoint
+{
+	float position[3];
+	float orientation[4];			// Quaternion
+	float radius;
+	uint32_t isTracked;				// HandJoint::trackedState
+};
+
+struct HandRecordHand
+{
+	int64_t timestamp;				// InputSource::lastTimestamp, 100ns ticks
+	uint32_t isTracked;				// Zero if the hand was not seen this frame, nothing else is valid then
+	uint32_t buttonStates;			// Bit n is SpatialButton n
+	float position[3];
+	float orientation[4];			// Quaternion
+	float rayPosition[3];
+	float rayDirection[3];
+	uint32_t reserved;
+	HandRecordJoint joints[kHandRecordJointCount];
+};
+
+struct HandRecordFrame
+{
+	int64_t displayTime;			// MixedReality::GetPredictedDisplayTime, 100ns ticks
+	float headPosition[3];
+	float headForward[3];
+	float headUp[3];
+	uint32_t reserved;
+	HandRecordHand hands[kHandRecordHandCount];
+};
+
+static_assert(sizeof(HandRecordHand) == 1008 && sizeof(HandRecordFrame) == 2064, "Hand recording layout must not change");
+
+// Appends one frame per call to a binary file.
+// Not thread safe, meant to be called from the thread that updates input.
+class HandRecorder
+{
+public:
+
+	HandRecorder();
+	~HandRecorder();
+
+	bool Open(const std::string& filename);
+	void Close();
+	bool IsOpen() const { return m_file != nullptr; }
+
+	void WriteFrame(const HandRecordFrame& frame);
+	unsigned GetFrameCount() const { return m_frameCount; }
+
+private:
+
+	FILE* m_file;
+	unsigned m_frameCount;
+};
+
+// Plays a recording back one frame per call, so a replayed session is the same sequence of frames every time
+//  regardless of how fast the caller runs.
+class HandReplay
+{
+public:
+
+	HandReplay();
+
+	bool Open(const std::string& filename);
+
+	// Shifts every timestamp so the first frame is displayed at startTime, e.g. the current display time
+	//  so consumers that only accept newer timestamps (like TrackedHands) keep working after live input.
+	void SetStartTime(long long startTime);
+
+	// When looping, timestamps keep increasing across the wrap
+	void SetLooping(bool isLooping) { m_isLooping = isLooping; }
+
+	void Restart();
+	bool IsFinished() const { return !m_isLooping && m_nextFrame >= m_frames.size(); }
+
+	size_t GetFrameCount() const { return m_frames.size(); }
+	const HandRecordFrame& GetRecordedFrame(size_t frameIndex) const { return m_frames[frameIndex]; }
+
+	// Returns nullptr once finished. The frame stays valid until the next call.
+	const HandRecordFrame* GetNextFrame();
+
+private:
+
+	std::vector<HandRecordFrame> m_frames;
+	HandRecordFrame m_currentFrame;
+	size_t m_nextFrame;
+	long long m_timeOffset;
+	long long m_loopDuration;
+	bool m_isLooping;
+};
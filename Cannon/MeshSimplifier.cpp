@@ -0,0 +1,477 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "MeshSimplifier.h"
+
+#include <cassert>
+
+using namespace DirectX;
+using namespace std;
+
+void MeshSimplifier::Quadric::Clear()
+{
+	memset(a, 0, sizeof(a));
+	weight = 0.0;
+}
+
+void MeshSimplifier::Quadric::AddPlane(double nx, double ny, double nz, double d, double planeWeight)
+{
+	a[0] += planeWeight * nx * nx;
+	a[1] += planeWeight * nx * ny;
+	a[2] += planeWeight * nx * nz;
+	a[3] += planeWeight * nx * d;
+	a[4] += planeWeight * ny * ny;
+	a[5] += planeWeight * ny * nz;
+	a[6] += planeWeight * ny * d;
+	a[7] += planeWeight * nz * nz;
+	a[8] += planeWeight * nz * d;
+	a[9] += planeWeight * d * d;
+	weight += planeWeight;
+}
+
+void MeshSimplifier::Quadric::Add(const Quadric& q)
+{
+	for (unsigned i = 0; i < 10; ++i)
+		a[i] += q.a[i];
+	weight += q.weight;
+}
+
+double MeshSimplifier::Quadric::Evaluate(const XMFLOAT3& p) const
+{
+	double x = p.x, y = p.y, z = p.z;
+	return x * x * a[0] + 2.0 * x * y * a[1] + 2.0 * x * z * a[2] + 2.0 * x * a[3]
+		+ y * y * a[4] + 2.0 * y * z * a[5] + 2.0 * y * a[6]
+		+ z * z * a[7] + 2.0 * z * a[8]
+		+ a[9];
+}
+
+// Finds the point with the least error by solving the 3x3 system with Cramer's rule.
+// Fails for (near) singular systems, which is the normal case inside flat regions.
+bool MeshSimplifier::Quadric::SolveMinimum(XMFLOAT3& p) const
+{
+	double det = a[0] * (a[4] * a[7] - a[5] * a[5]) - a[1] * (a[1] * a[7] - a[5] * a[2]) + a[2] * (a[1] * a[5] - a[4] * a[2]);
+
+	double trace = a[0] + a[4] + a[7];
+	if (fabs(det) <= 1e-6 * trace * trace * trace || trace <= 0.0)
+		return false;
+
+	double bx = -a[3], by = -a[6], bz = -a[8];
+	double detX = bx * (a[4] * a[7] - a[5] * a[5]) - a[1] * (by * a[7] - a[5] * bz) + a[2] * (by * a[5] - a[4] * bz);
+	double detY = a[0] * (by * a[7] - bz * a[5]) - bx * (a[1] * a[7] - a[5] * a[2]) + a[2] * (a[1] * bz - by * a[2]);
+	double detZ = a[0] * (a[4] * bz - a[5] * by) - a[1] * (a[1] * bz - by * a[2]) + bx * (a[1] * a[5] - a[4] * a[2]);
+
+	p.x = (float)(detX / det);
+	p.y = (float)(detY / det);
+	p.z = (float)(detZ / det);
+	return true;
+}
+
+MeshSimplifier::MeshSimplifier() :
+	m_liveTriangleCount(0)
+{
+}
+
+unsigned MeshSimplifier::Simplify(Mesh& mesh)
+{
+	if (mesh.GetDrawStyle() != Mesh::DS_TRILIST)
+		return 0;
+
+	return Simplify(mesh.GetVertices(), mesh.GetIndices());
+}
+
+unsigned MeshSimplifier::Simplify(vector<Mesh::Vertex>& vertices, vector<unsigned>& indices)
+{
+	const unsigned vertexCount = (unsigned)vertices.size();
+	const unsigned triangleCount = (unsigned)indices.size() / 3;
+	if (triangleCount < 4)
+		return 0;
+
+	m_positions.resize(vertexCount);
+	m_quadrics.resize(vertexCount);
+	m_versions.assign(vertexCount, 0);
+	m_vertexTriangles.resize(vertexCount);
+	for (unsigned i = 0; i < vertexCount; ++i)
+	{
+		XMStoreFloat3(&m_positions[i], vertices[i].position);
+		m_quadrics[i].Clear();
+		m_vertexTriangles[i].clear();
+	}
+
+	m_triangles.assign(indices.begin(), indices.begin() + triangleCount * 3);
+	m_triangleRemoved.assign(triangleCount, false);
+	m_liveTriangleCount = triangleCount;
+
+	// Accumulate the plane of every triangle into its corners, weighted by area
+	vector<pair<unsigned long long, unsigned>> edges;
+	edges.reserve(triangleCount * 3);
+	for (unsigned t = 0; t < triangleCount; ++t)
+	{
+		unsigned* triangle = &m_triangles[t * 3];
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			m_vertexTriangles[triangle[c]].push_back(t);
+
+			unsigned a = triangle[c], b = triangle[(c + 1) % 3];
+			unsigned long long key = ((unsigned long long)min(a, b) << 32) | max(a, b);
+			edges.push_back(make_pair(key, t));
+		}
+
+		XMVECTOR p0 = XMLoadFloat3(&m_positions[triangle[0]]);
+		XMVECTOR p1 = XMLoadFloat3(&m_positions[triangle[1]]);
+		XMVECTOR p2 = XMLoadFloat3(&m_positions[triangle[2]]);
+		XMVECTOR normal = XMVector3Cross(p1 - p0, p2 - p0);
+		float doubleArea = XMVectorGetX(XMVector3Length(normal));
+		if (doubleArea <= 0.0f)
+			continue;
+
+		normal /= doubleArea;
+		float d = -XMVectorGetX(XMVector3Dot(normal, p0));
+
+		Quadric q;
+		q.Clear();
+		q.AddPlane(XMVectorGetX(normal), XMVectorGetY(normal), XMVectorGetZ(normal), d, doubleArea * 0.5f);
+		for (unsigned c = 0; c < 3; ++c)
+			m_quadrics[triangle[c]].Add(q);
+	}
+
+	sort(edges.begin(), edges.end());
+
+	// Open edges (patch borders, holes) get a plane perpendicular to their triangle so they only slide along themselves
+	m_heap.clear();
+	for (size_t i = 0; i < edges.size();)
+	{
+		size_t runEnd = i + 1;
+		while (runEnd < edges.size() && edges[runEnd].first == edges[i].first)
+			++runEnd;
+
+		unsigned a = (unsigned)(edges[i].first >> 32);
+		unsigned b = (unsigned)(edges[i].first & 0xffffffff);
+
+		if (runEnd - i == 1 && m_settings.boundaryWeight > 0.0f)
+		{
+			unsigned* triangle = &m_triangles[edges[i].second * 3];
+			XMVECTOR p0 = XMLoadFloat3(&m_positions[triangle[0]]);
+			XMVECTOR p1 = XMLoadFloat3(&m_positions[triangle[1]]);
+			XMVECTOR p2 = XMLoadFloat3(&m_positions[triangle[2]]);
+			XMVECTOR faceNormal = XMVector3Normalize(XMVector3Cross(p1 - p0, p2 - p0));
+
+			XMVECTOR edgeStart = XMLoadFloat3(&m_positions[a]);
+			XMVECTOR edge = XMLoadFloat3(&m_positions[b]) - edgeStart;
+			float edgeLengthSq = XMVectorGetX(XMVector3LengthSq(edge));
+			XMVECTOR boundaryNormal = XMVector3Normalize(XMVector3Cross(edge, faceNormal));
+
+			if (edgeLengthSq > 0.0f && !XMVector3Equal(boundaryNormal, XMVectorZero()))
+			{
+				float d = -XMVectorGetX(XMVector3Dot(boundaryNormal, edgeStart));
+
+				Quadric q;
+				q.Clear();
+				q.AddPlane(XMVectorGetX(boundaryNormal), XMVectorGetY(boundaryNormal), XMVectorGetZ(boundaryNormal), d, m_settings.boundaryWeight * edgeLengthSq);
+				q.weight = 0.0;	// Constraint planes shouldn't dilute the error normalization
+				m_quadrics[a].Add(q);
+				m_quadrics[b].Add(q);
+			}
+		}
+
+		i = runEnd;
+	}
+
+	for (size_t i = 0; i < edges.size(); ++i)
+	{
+		if (i > 0 && edges[i].first == edges[i - 1].first)
+			continue;
+
+		CollapseCandidate candidate;
+		if (ComputeCollapse((unsigned)(edges[i].first >> 32), (unsigned)(edges[i].first & 0xffffffff), candidate))
+			m_heap.push_back(candidate);
+	}
+	make_heap(m_heap.begin(), m_heap.end());
+
+	const unsigned targetTriangleCount = (m_settings.targetRatio > 0.0f) ? max(4u, (unsigned)(triangleCount * m_settings.targetRatio)) : 0;
+	const float maxCost = m_settings.maxError * m_settings.maxError;
+
+	while (!m_heap.empty() && m_liveTriangleCount > targetTriangleCount)
+	{
+		pop_heap(m_heap.begin(), m_heap.end());
+		CollapseCandidate candidate = m_heap.back();
+		m_heap.pop_back();
+
+		if (candidate.version0 != m_versions[candidate.vertex0] || candidate.version1 != m_versions[candidate.vertex1])
+			continue;
+
+		if (candidate.cost > maxCost)
+			break;
+
+		if (!IsCollapseValid(candidate.vertex0, candidate.vertex1, candidate.position))
+			continue;
+
+		Collapse(candidate);
+	}
+
+	if (m_liveTriangleCount == triangleCount)
+		return 0;
+
+	// Compact the surviving vertices and triangles back into the caller's buffers
+	m_remap.assign(vertexCount, UINT_MAX);
+	unsigned newVertexCount = 0;
+	unsigned newIndexCount = 0;
+	for (unsigned t = 0; t < triangleCount; ++t)
+	{
+		if (m_triangleRemoved[t])
+			continue;
+
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			unsigned vertex = m_triangles[t * 3 + c];
+			if (m_remap[vertex] == UINT_MAX)
+			{
+				m_remap[vertex] = newVertexCount;
+
+				Mesh::Vertex v = vertices[vertex];
+				v.position = XMVectorSetW(XMLoadFloat3(&m_positions[vertex]), 1.0f);
+
+				// Vertices that moved get a fresh area weighted normal from the triangles that are left
+				if (m_versions[vertex] > 0)
+				{
+					XMVECTOR normal = XMVectorZero();
+					for (unsigned adjacentTriangle : m_vertexTriangles[vertex])
+					{
+						if (m_triangleRemoved[adjacentTriangle])
+							continue;
+
+						unsigned* triangle = &m_triangles[adjacentTriangle * 3];
+						XMVECTOR p0 = XMLoadFloat3(&m_positions[triangle[0]]);
+						XMVECTOR p1 = XMLoadFloat3(&m_positions[triangle[1]]);
+						XMVECTOR p2 = XMLoadFloat3(&m_positions[triangle[2]]);
+						normal += XMVector3Cross(p1 - p0, p2 - p0);
+					}
+
+					if (!XMVector3Equal(normal, XMVectorZero()))
+						v.normal = XMVectorSetW(XMVector3Normalize(normal), 0.0f);
+				}
+
+				vertices[newVertexCount++] = v;
+			}
+
+			indices[newIndexCount++] = m_remap[vertex];
+		}
+	}
+
+	vertices.resize(newVertexCount);
+	indices.resize(newIndexCount);
+
+	return triangleCount - m_liveTriangleCount;
+}
+
+bool MeshSimplifier::ComputeCollapse(unsigned vertex0, unsigned vertex1, CollapseCandidate& candidate)
+{
+	if (vertex0 == vertex1)
+		return false;
+
+	Quadric q = m_quadrics[vertex0];
+	q.Add(m_quadrics[vertex1]);
+
+	const XMFLOAT3& p0 = m_positions[vertex0];
+	const XMFLOAT3& p1 = m_positions[vertex1];
+	XMFLOAT3 midpoint((p0.x + p1.x) * 0.5f, (p0.y + p1.y) * 0.5f, (p0.z + p1.z) * 0.5f);
+
+	XMFLOAT3 position;
+	double cost = DBL_MAX;
+
+	// Only trust the optimal point if it stays near the edge, otherwise fall back to the endpoints and midpoint
+	if (q.SolveMinimum(position))
+	{
+		float edgeLengthSq = XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&p1) - XMLoadFloat3(&p0)));
+		float driftSq = XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&position) - XMLoadFloat3(&midpoint)));
+		if (driftSq <= edgeLengthSq)
+			cost = q.Evaluate(position);
+	}
+
+	const XMFLOAT3* fallbacks[3] = { &p0, &p1, &midpoint };
+	for (unsigned i = 0; i < 3; ++i)
+	{
+		double fallbackCost = q.Evaluate(*fallbacks[i]);
+		if (fallbackCost < cost)
+		{
+			cost = fallbackCost;
+			position = *fallbacks[i];
+		}
+	}
+
+	candidate.cost = (float)(max(cost, 0.0) / max(q.weight, 1e-12));
+	candidate.vertex0 = vertex0;
+	candidate.vertex1 = vertex1;
+	candidate.version0 = m_versions[vertex0];
+	candidate.version1 = m_versions[vertex1];
+	candidate.position = position;
+	return true;
+}
+
+bool MeshSimplifier::IsCollapseValid(unsigned vertex0, unsigned vertex1, const XMFLOAT3& position)
+{
+	// Link condition: an edge may only collapse if its endpoints share exactly the vertices opposite the edge,
+	//  anything more would pinch the surface into a non-manifold fan
+	m_scratchNeighbors.clear();
+	for (unsigned adjacentTriangle : m_vertexTriangles[vertex0])
+	{
+		if (m_triangleRemoved[adjacentTriangle])
+			continue;
+
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			unsigned vertex = m_triangles[adjacentTriangle * 3 + c];
+			if (vertex != vertex0)
+				m_scratchNeighbors.push_back(vertex);
+		}
+	}
+	sort(m_scratchNeighbors.begin(), m_scratchNeighbors.end());
+	m_scratchNeighbors.erase(unique(m_scratchNeighbors.begin(), m_scratchNeighbors.end()), m_scratchNeighbors.end());
+
+	unsigned sharedNeighborCount = 0;
+	unsigned sharedTriangleCount = 0;
+	size_t neighborCount0 = m_scratchNeighbors.size();
+	for (unsigned adjacentTriangle : m_vertexTriangles[vertex1])
+	{
+		if (m_triangleRemoved[adjacentTriangle])
+			continue;
+
+		const unsigned* triangle = &m_triangles[adjacentTriangle * 3];
+		if (triangle[0] == vertex0 || triangle[1] == vertex0 || triangle[2] == vertex0)
+			++sharedTriangleCount;
+
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			unsigned vertex = triangle[c];
+			if (vertex == vertex1 || vertex == vertex0)
+				continue;
+
+			if (binary_search(m_scratchNeighbors.begin(), m_scratchNeighbors.begin() + neighborCount0, vertex) &&
+				find(m_scratchNeighbors.begin() + neighborCount0, m_scratchNeighbors.end(), vertex) == m_scratchNeighbors.end())
+			{
+				m_scratchNeighbors.push_back(vertex);
+				++sharedNeighborCount;
+			}
+		}
+	}
+
+	if (sharedTriangleCount == 0 || sharedNeighborCount > sharedTriangleCount)
+		return false;
+
+	// Reject collapses that would flip or sharply fold any of the surviving triangles
+	XMVECTOR newPosition = XMLoadFloat3(&position);
+	const unsigned endpoints[2] = { vertex0, vertex1 };
+	for (unsigned endpoint : endpoints)
+	{
+		for (unsigned adjacentTriangle : m_vertexTriangles[endpoint])
+		{
+			if (m_triangleRemoved[adjacentTriangle])
+				continue;
+
+			const unsigned* triangle = &m_triangles[adjacentTriangle * 3];
+			bool containsVertex0 = (triangle[0] == vertex0 || triangle[1] == vertex0 || triangle[2] == vertex0);
+			bool containsVertex1 = (triangle[0] == vertex1 || triangle[1] == vertex1 || triangle[2] == vertex1);
+			if (containsVertex0 && containsVertex1)
+				continue;
+
+			XMVECTOR oldCorners[3];
+			XMVECTOR newCorners[3];
+			for (unsigned c = 0; c < 3; ++c)
+			{
+				oldCorners[c] = XMLoadFloat3(&m_positions[triangle[c]]);
+				newCorners[c] = (triangle[c] == endpoint) ? newPosition : oldCorners[c];
+			}
+
+			XMVECTOR oldNormal = XMVector3Cross(oldCorners[1] - oldCorners[0], oldCorners[2] - oldCorners[0]);
+			XMVECTOR newNormal = XMVector3Cross(newCorners[1] - newCorners[0], newCorners[2] - newCorners[0]);
+
+			float newLength = XMVectorGetX(XMVector3Length(newNormal));
+			float oldLength = XMVectorGetX(XMVector3Length(oldNormal));
+			if (newLength <= 1e-12f)
+				return false;
+			if (oldLength <= 1e-12f)
+				continue;
+
+			float normalDot = XMVectorGetX(XMVector3Dot(oldNormal, newNormal)) / (oldLength * newLength);
+			if (normalDot < m_settings.minNormalDot)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void MeshSimplifier::Collapse(const CollapseCandidate& candidate)
+{
+	const unsigned vertex0 = candidate.vertex0;
+	const unsigned vertex1 = candidate.vertex1;
+
+	m_positions[vertex0] = candidate.position;
+	m_quadrics[vertex0].Add(m_quadrics[vertex1]);
+
+	auto& triangles0 = m_vertexTriangles[vertex0];
+	for (unsigned adjacentTriangle : m_vertexTriangles[vertex1])
+	{
+		if (m_triangleRemoved[adjacentTriangle])
+			continue;
+
+		unsigned* triangle = &m_triangles[adjacentTriangle * 3];
+		if (triangle[0] == vertex0 || triangle[1] == vertex0 || triangle[2] == vertex0)
+		{
+			m_triangleRemoved[adjacentTriangle] = true;
+			--m_liveTriangleCount;
+			continue;
+		}
+
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			if (triangle[c] == vertex1)
+				triangle[c] = vertex0;
+		}
+		triangles0.push_back(adjacentTriangle);
+	}
+	m_vertexTriangles[vertex1].clear();
+
+	triangles0.erase(remove_if(triangles0.begin(), triangles0.end(), [this](unsigned t) { return m_triangleRemoved[t]; }), triangles0.end());
+
+	++m_versions[vertex0];
+	++m_versions[vertex1];
+
+	PushCandidatesForVertex(vertex0);
+}
+
+void MeshSimplifier::PushCandidatesForVertex(unsigned vertex)
+{
+	for (unsigned adjacentTriangle : m_vertexTriangles[vertex])
+	{
+		const unsigned* triangle = &m_triangles[adjacentTriangle * 3];
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			// Shared edges get queued twice, the lazy version check drops the spare
+			if (triangle[c] != vertex)
+				continue;
+
+			CollapseCandidate candidate;
+			if (ComputeCollapse(vertex, triangle[(c + 1) % 3], candidate))
+			{
+				m_heap.push_back(candidate);
+				push_heap(m_heap.begin(), m_heap.end());
+			}
+			if (ComputeCollapse(vertex, triangle[(c + 2) % 3], candidate))
+			{
+				m_heap.push_back(candidate);
+				push_heap(m_heap.begin(), m_heap.end());
+			}
+		}
+	}
+}
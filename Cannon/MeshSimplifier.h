@@ -0,0 +1,87 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "DrawCall.h"
+
+// Reduces the triangle count of a mesh with quadric error metric edge collapses.
+// Each vertex accumulates the area weighted planes of the triangles around it, so vertices inside planar
+//  regions (walls, floors, table tops) can be collapsed almost for free while creases and open boundaries are kept.
+// Meant to be run on a worker thread, on a surface patch before it is chunked or fused.
+class MeshSimplifier
+{
+public:
+
+	struct Settings
+	{
+		float maxError = 0.01f;			// Maximum RMS distance (in mesh units) a collapsed vertex may drift from the planes it replaced
+		float targetRatio = 0.1f;		// Stop collapsing once the triangle count reaches this fraction of the input, 0 to only stop on maxError
+		float minNormalDot = 0.5f;		// Collapses that rotate a neighboring triangle normal further than this are rejected
+		float boundaryWeight = 100.0f;	// Extra weight for the planes that pin open edges in place
+	};
+
+	MeshSimplifier();
+
+	void SetSettings(const Settings& settings) { m_settings = settings; }
+	const Settings& GetSettings() const { return m_settings; }
+
+	// Simplifies the mesh in place, returns the number of triangles removed
+	unsigned Simplify(Mesh& mesh);
+	unsigned Simplify(std::vector<Mesh::Vertex>& vertices, std::vector<unsigned>& indices);
+
+private:
+
+	// Symmetric 4x4 error quadric, stored as its upper triangle
+	struct Quadric
+	{
+		double a[10];
+		double weight;
+
+		void Clear();
+		void AddPlane(double nx, double ny, double nz, double d, double planeWeight);
+		void Add(const Quadric& q);
+		double Evaluate(const DirectX::XMFLOAT3& p) const;
+		bool SolveMinimum(DirectX::XMFLOAT3& p) const;
+	};
+
+	struct CollapseCandidate
+	{
+		float cost;
+		unsigned vertex0;
+		unsigned vertex1;
+		unsigned version0;
+		unsigned version1;
+		DirectX::XMFLOAT3 position;
+
+		bool operator<(const CollapseCandidate& b) const { return cost > b.cost; }	// Min-heap on cost
+	};
+
+	bool ComputeCollapse(unsigned vertex0, unsigned vertex1, CollapseCandidate& candidate);
+	bool IsCollapseValid(unsigned vertex0, unsigned vertex1, const DirectX::XMFLOAT3& position);
+	void Collapse(const CollapseCandidate& candidate);
+	void PushCandidatesForVertex(unsigned vertex);
+
+	Settings m_settings;
+
+	// Working set, reused between calls so repeated surface updates don't reallocate
+	std::vector<DirectX::XMFLOAT3> m_positions;
+	std::vector<Quadric> m_quadrics;
+	std::vector<unsigned> m_versions;
+	std::vector<unsigned> m_remap;
+	std::vector<unsigned> m_triangles;
+	std::vector<bool> m_triangleRemoved;
+	std::vector<std::vector<unsigned>> m_vertexTriangles;
+	std::vector<CollapseCandidate> m_heap;
+	std::vector<unsigned> m_scratchNeighbors;
+	unsigned m_liveTriangleCount;
+};
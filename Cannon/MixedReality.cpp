@@ -87,24 +87,36 @@ InputSource::InputSource() :
 	id(0),
 	lastTimestamp(0),
 	type(InputType::Other),
-	handedness(Handedness::None)
+	handedness(Handedness::None),
+	buttonStates(0),
+	buttonPresses(0),
+	buttonReleases(0),
+	hasHandJoints(false)
 {
-	buttonStates[SpatialButton::SELECT] = false;
-	buttonStates[SpatialButton::GRAB] = false;
-	buttonStates[SpatialButton::MENU] = false;
-
-	buttonPresses = buttonStates;
-	buttonReleases = buttonStates;
-
 	position = DirectX::XMVectorZero();
 	orientation = DirectX::XMVectorZero();
 
 	rayPosition = DirectX::XMVectorZero();
 	rayDirection = DirectX::XMVectorZero();
 
+	for (auto& joint : handJoints)
+	{
+		joint.position = DirectX::XMVectorZero();
+		joint.orientation = DirectX::XMQuaternionIdentity();
+		joint.radius = 0.0f;
+		joint.trackedState = false;
+	}
+
 	handMeshWorldTransform = DirectX::XMMatrixIdentity();
 }
 
+void InputSource::SetButtonStates(uint32_t newButtonStates)
+{
+	buttonPresses = newButtonStates & ~buttonStates;
+	buttonReleases = ~newButtonStates & buttonStates;
+	buttonStates = newButtonStates;
+}
+
 bool MixedReality::IsAvailable()
 {
 	return winrt::Windows::Graphics::Holographic::HolographicSpace::IsAvailable();
@@ -112,7 +124,8 @@ bool MixedReality::IsAvailable()
 
 MixedReality::MixedReality() :
 	m_mixedRealityEnabled(false),
-	m_inputWaitLastFrameTimestamp(0)
+	m_inputWaitLastFrameTimestamp(0),
+	m_handReplayDisplayTime(0)
 {
 	m_headPosition = DirectX::XMVectorZero();
 	m_headForwardDirection = DirectX::XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f);
@@ -306,7 +319,8 @@ bool MixedReality::IsEnabled()
 
 void MixedReality::EnableSurfaceMapping()
 {
-	if (m_referenceFrame && !m_surfaceMapping)
+	// The reference frame is null without a holographic space, then only replayed surfaces come in
+	if (!m_surfaceMapping)
 	{
 		m_surfaceMapping = make_shared<SurfaceMapping>(m_referenceFrame);
 	}
@@ -398,8 +412,22 @@ winrt::Windows::Perception::Spatial::SpatialCoordinateSystem MixedReality::GetWo
 
 void MixedReality::Update()
 {
+	// Replay needs no holographic space, so recorded hands also drive the sources when mixed reality is not enabled
+	if (m_handReplay)
+	{
+		const HandRecordFrame* pFrame = m_handReplay->GetNextFrame();
+		if (pFrame)
+			ApplyHandReplayFrame(*pFrame);
+		else
+			StopHandReplay();
+	}
+
 	if (!m_mixedRealityEnabled)
+	{
+		if (m_surfaceMapping)
+			m_surfaceMapping->Update(m_headPosition);
 		return;
+	}
 
 	m_holoFrame = hs().CreateNextFrame();
 
@@ -441,9 +469,13 @@ void MixedReality::Update()
 	winrt::Windows::UI::Input::Spatial::SpatialPointerPose pointerPose = winrt::Windows::UI::Input::Spatial::SpatialPointerPose::TryGetAtTimestamp(GetWorldCoordinateSystem(), prediction.Timestamp());
 	if (pointerPose)
 	{
-		m_headPosition = DirectX::XMVectorSetW(DirectX::XMLoadFloat3(&pointerPose.Head().Position()), 1.0f);
-		m_headForwardDirection = DirectX::XMLoadFloat3(&pointerPose.Head().ForwardDirection());
-		m_headUpDirection = DirectX::XMLoadFloat3(&pointerPose.Head().UpDirection());
+		// A replayed frame brings its own head pose
+		if (!m_handReplay)
+		{
+			m_headPosition = DirectX::XMVectorSetW(DirectX::XMLoadFloat3(&pointerPose.Head().Position()), 1.0f);
+			m_headForwardDirection = DirectX::XMLoadFloat3(&pointerPose.Head().ForwardDirection());
+			m_headUpDirection = DirectX::XMLoadFloat3(&pointerPose.Head().UpDirection());
+		}
 
 		if (m_isEyeTrackingEnabled)
 		{
@@ -482,36 +514,39 @@ void MixedReality::Update()
 		requestAccessThread.detach();
 	}
 
-	auto sourceStates = m_spatialInteractionManager.GetDetectedSourcesAtTimestamp(prediction.Timestamp());
-
-	set<unsigned> sourcesUpdated;
-	for (auto sourceState : sourceStates)
+	if (!m_handReplay)
 	{
-		UpdateInputSource(sourceState);
-		sourcesUpdated.insert(sourceState.Source().Id());
-	}
+		AllocationCounter inputAllocations;
 
-	set<unsigned> sourcesToRemove;
-	for (auto& sourceEntry : m_activeSources)
-	{
-		if (sourcesUpdated.find(sourceEntry.first) == sourcesUpdated.end())
-			sourcesToRemove.insert(sourceEntry.first);
-	}
-	for (auto id : sourcesToRemove)
-	{
-		if (id == m_primarySourceID)
-			m_primarySourceID = 0;
+		auto sourceStates = m_spatialInteractionManager.GetDetectedSourcesAtTimestamp(prediction.Timestamp());
+
+		for (auto& slot : m_sourceSlots)
+			slot.wasUpdated = false;
 
-		m_activeSources.erase(id);
-		m_activeHandMeshObservers.erase(id);
+		for (auto sourceState : sourceStates)
+			UpdateInputSource(sourceState);
+
+		for (auto& slot : m_sourceSlots)
+		{
+			if (slot.isActive && !slot.wasUpdated)
+				ReleaseSource(slot.source.id);
+		}
+
+		m_inputAllocationCount = inputAllocations.GetAllocationCount();
 	}
 
+	if (m_handRecorder.IsOpen())
+		RecordHandFrame();
+
 	if(m_surfaceMapping)
 		m_surfaceMapping->Update(m_headPosition);
 }
 
 long long MixedReality::GetPredictedDisplayTime()
 {
+	if (m_handReplay)
+		return m_handReplayDisplayTime;
+
 	if (m_holoFrame)
 		return m_holoFrame.CurrentPrediction().Timestamp().TargetTime().time_since_epoch().count();
 
@@ -570,53 +605,46 @@ const DirectX::XMVECTOR& MixedReality::GetEyeGazeDirection()
 
 bool MixedReality::IsButtonDown(SpatialButton button)
 {
-	bool buttonDown = false;
-	for (auto& source : m_activeSources)
+	for (auto& slot : m_sourceSlots)
 	{
-		if (source.second->buttonStates[button])
-			buttonDown = true;
+		if (slot.isActive && slot.source.IsButtonDown(button))
+			return true;
 	}
 
-	return buttonDown;
+	return false;
 }
 
 bool MixedReality::WasButtonPressed(SpatialButton button)
 {
-	bool buttonPressed = false;
-	for (auto& source : m_activeSources)
+	for (auto& slot : m_sourceSlots)
 	{
-		if (source.second->buttonPresses[button])
-			buttonPressed = true;
+		if (slot.isActive && slot.source.WasButtonPressed(button))
+			return true;
 	}
 
-	return buttonPressed;
+	return false;
 }
 
 bool MixedReality::WasButtonReleased(SpatialButton button)
 {
-	bool buttonReleased = false;
-	for (auto& source : m_activeSources)
+	for (auto& slot : m_sourceSlots)
 	{
-		if (source.second->buttonReleases[button])
-			buttonReleased = true;
+		if (slot.isActive && slot.source.WasButtonReleased(button))
+			return true;
 	}
 
-	return buttonReleased;
+	return false;
 }
 
 InputSource* MixedReality::GetPrimarySource()
 {
 	if (m_primarySourceID != 0)
+		return FindSource(m_primarySourceID);
+
+	for (auto& slot : m_sourceSlots)
 	{
-		auto it = m_activeSources.find(m_primarySourceID);
-		if (it != m_activeSources.end())
-		{
-			return it->second.get();
-		}
-	}
-	else if (!m_activeSources.empty())
-	{
-		return m_activeSources.begin()->second.get();
+		if (slot.isActive)
+			return &slot.source;
 	}
 
 	return nullptr;
@@ -625,15 +653,237 @@ InputSource* MixedReality::GetPrimarySource()
 InputSource* MixedReality::GetHand(size_t handIndex)
 {
 	Handedness targetHandedness = (handIndex == 0) ? Handedness::Left : Handedness::Right;
-	for (auto& source : m_activeSources)
+	for (auto& slot : m_sourceSlots)
+	{
+		if (slot.isActive && slot.source.type == InputType::Hand && slot.source.handedness == targetHandedness)
+			return &slot.source;
+	}
+
+	return nullptr;
+}
+
+const HandJoint* MixedReality::GetHandJoints(size_t handIndex, long long& timestamp)
+{
+	const InputSource* pSource = GetHand(handIndex);
+	if (!pSource)
+		return nullptr;
+
+	timestamp = pSource->lastTimestamp;
+	return pSource->handJoints;
+}
+
+MixedReality::InputSourceSlot* MixedReality::FindSlot(unsigned id)
+{
+	for (auto& slot : m_sourceSlots)
+	{
+		if (slot.isActive && slot.source.id == id)
+			return &slot;
+	}
+
+	return nullptr;
+}
+
+MixedReality::InputSourceSlot* MixedReality::AcquireSlot(unsigned id)
+{
+	InputSourceSlot* pSlot = FindSlot(id);
+	if (pSlot)
+		return pSlot;
+
+	for (auto& slot : m_sourceSlots)
 	{
-		if (source.second->type == InputType::Hand && source.second->handedness == targetHandedness)
-			return source.second.get();
+		if (!slot.isActive)
+		{
+			// Start from a clean source, but keep the hand mesh GPU buffers for whichever hand shows up next
+			auto handMesh = move(slot.source.handMesh);
+			slot.source = InputSource();
+			slot.source.id = id;
+			slot.source.handMesh = move(handMesh);
+
+			slot.isActive = true;
+			slot.wasUpdated = false;
+			return &slot;
+		}
 	}
 
 	return nullptr;
 }
 
+InputSource* MixedReality::FindSource(unsigned id)
+{
+	InputSourceSlot* pSlot = FindSlot(id);
+	return pSlot ? &pSlot->source : nullptr;
+}
+
+void MixedReality::ReleaseSource(unsigned id)
+{
+	InputSourceSlot* pSlot = FindSlot(id);
+	if (pSlot)
+		pSlot->isActive = false;
+
+	if (id == m_primarySourceID)
+		m_primarySourceID = 0;
+
+	m_activeHandMeshObservers.erase(id);
+}
+
+void MixedReality::ReleaseAllSources()
+{
+	for (auto& slot : m_sourceSlots)
+		slot.isActive = false;
+
+	m_activeHandMeshObservers.clear();
+	m_primarySourceID = 0;
+}
+
+bool MixedReality::StartHandRecording(const std::string& filename)
+{
+	return m_handRecorder.Open(filename);
+}
+
+void MixedReality::StopHandRecording()
+{
+	m_handRecorder.Close();
+}
+
+bool MixedReality::IsHandRecording()
+{
+	return m_handRecorder.IsOpen();
+}
+
+bool MixedReality::StartHandReplay(const std::string& filename, bool isLooping)
+{
+	auto handReplay = make_unique<HandReplay>();
+	if (!handReplay->Open(filename) || handReplay->GetFrameCount() == 0)
+		return false;
+
+	// Continue from the live display time, so consumers tracking the latest timestamp accept the replayed frames.
+	// Without a holographic frame there is no live time, and the recorded times are kept.
+	long long displayTime = GetPredictedDisplayTime();
+	if (displayTime != 0)
+		handReplay->SetStartTime(displayTime);
+	handReplay->SetLooping(isLooping);
+
+	m_handReplay = move(handReplay);
+	ReleaseAllSources();
+
+	return true;
+}
+
+void MixedReality::StopHandReplay()
+{
+	if (!m_handReplay)
+		return;
+
+	m_handReplay = nullptr;
+	ReleaseAllSources();
+}
+
+bool MixedReality::IsHandReplaying()
+{
+	return m_handReplay != nullptr;
+}
+
+static_assert(kHandRecordJointCount == (size_t)HandJointIndex::Count, "Hand recording joint count is out of date");
+
+void MixedReality::RecordHandFrame()
+{
+	HandRecordFrame frame;
+	memset(&frame, 0, sizeof(frame));
+
+	frame.displayTime = GetPredictedDisplayTime();
+	DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)frame.headPosition, m_headPosition);
+	DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)frame.headForward, m_headForwardDirection);
+	DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)frame.headUp, m_headUpDirection);
+
+	for (size_t handIndex = 0; handIndex < kHandRecordHandCount; ++handIndex)
+	{
+		const InputSource* pSource = GetHand(handIndex);
+		if (!pSource || !pSource->hasHandJoints)
+			continue;
+
+		HandRecordHand& hand = frame.hands[handIndex];
+		hand.timestamp = pSource->lastTimestamp;
+		hand.isTracked = 1;
+		hand.buttonStates = pSource->buttonStates;
+
+		DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)hand.position, pSource->position);
+		DirectX::XMStoreFloat4((DirectX::XMFLOAT4*)hand.orientation, pSource->orientation);
+		DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)hand.rayPosition, pSource->rayPosition);
+		DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)hand.rayDirection, pSource->rayDirection);
+
+		for (size_t jointIndex = 0; jointIndex < kHandRecordJointCount; ++jointIndex)
+		{
+			const HandJoint& sourceJoint = pSource->handJoints[jointIndex];
+			HandRecordJoint& joint = hand.joints[jointIndex];
+
+			DirectX::XMStoreFloat3((DirectX::XMFLOAT3*)joint.position, sourceJoint.position);
+			DirectX::XMStoreFloat4((DirectX::XMFLOAT4*)joint.orientation, sourceJoint.orientation);
+			joint.radius = sourceJoint.radius;
+			joint.isTracked = sourceJoint.trackedState ? 1 : 0;
+		}
+	}
+
+	m_handRecorder.WriteFrame(frame);
+}
+
+void MixedReality::ApplyHandReplayFrame(const HandRecordFrame& frame)
+{
+	// Replayed sources get IDs the system does not hand out
+	static const unsigned s_replaySourceIDBase = 0x80000000;
+
+	m_handReplayDisplayTime = frame.displayTime;
+	m_headPosition = DirectX::XMVectorSetW(DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)frame.headPosition), 1.0f);
+	m_headForwardDirection = DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)frame.headForward);
+	m_headUpDirection = DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)frame.headUp);
+
+	for (size_t handIndex = 0; handIndex < kHandRecordHandCount; ++handIndex)
+	{
+		const HandRecordHand& hand = frame.hands[handIndex];
+		unsigned sourceID = s_replaySourceIDBase + (unsigned)handIndex;
+
+		// Dropping the source when the hand is lost means a new one starts with no buttons held, like live input
+		if (!hand.isTracked)
+		{
+			ReleaseSource(sourceID);
+			continue;
+		}
+
+		InputSourceSlot* pSlot = AcquireSlot(sourceID);
+		if (!pSlot)
+			continue;
+
+		InputSource* replaySource = &pSlot->source;
+
+		replaySource->type = InputType::Hand;
+		replaySource->handedness = (handIndex == 0) ? Handedness::Left : Handedness::Right;
+		replaySource->lastTimestamp = hand.timestamp;
+		replaySource->hasHandJoints = true;
+
+		replaySource->SetButtonStates(hand.buttonStates & ((1u << (unsigned)SpatialButton::COUNT) - 1));
+		if (replaySource->buttonStates != 0)
+			m_primarySourceID = sourceID;
+
+		replaySource->position = DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)hand.position);
+		replaySource->orientation = DirectX::XMLoadFloat4((const DirectX::XMFLOAT4*)hand.orientation);
+		replaySource->rayPosition = DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)hand.rayPosition);
+		replaySource->rayDirection = DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)hand.rayDirection);
+
+		for (size_t jointIndex = 0; jointIndex < kHandRecordJointCount; ++jointIndex)
+		{
+			const HandRecordJoint& joint = hand.joints[jointIndex];
+			HandJoint& targetJoint = replaySource->handJoints[jointIndex];
+
+			targetJoint.position = DirectX::XMVectorSetW(DirectX::XMLoadFloat3((const DirectX::XMFLOAT3*)joint.position), 1.0f);
+			targetJoint.orientation = DirectX::XMLoadFloat4((const DirectX::XMFLOAT4*)joint.orientation);
+			targetJoint.radius = joint.radius;
+			targetJoint.trackedState = joint.isTracked != 0;
+		}
+	}
+
+	if (!FindSource(m_primarySourceID))
+		m_primarySourceID = 0;
+}
+
 size_t MixedReality::CreateAnchor(const DirectX::XMMATRIX& transform)
 {
 	if (!IsEnabled())
@@ -876,15 +1126,12 @@ void MixedReality::UpdateInputSource(winrt::Windows::UI::Input::Spatial::Spatial
 {
 	auto sourceID = currentState.Source().Id();
 
-	auto it = m_activeSources.find(sourceID);
-	if (it == m_activeSources.end())
+	InputSourceSlot* pSlot = FindSlot(sourceID);
+	if (!pSlot)
 	{
-		shared_ptr<InputSource> newSource = make_shared<InputSource>();
-		memset(newSource.get(), 0, sizeof(newSource));
-		newSource->id = sourceID;
-
-		m_activeSources[sourceID] = newSource;
-		it = m_activeSources.find(sourceID);
+		pSlot = AcquireSlot(sourceID);
+		if (!pSlot)
+			return;
 
 		if (m_isArticulatedHandTrackingAPIAvailable)
 		{
@@ -892,17 +1139,22 @@ void MixedReality::UpdateInputSource(winrt::Windows::UI::Input::Spatial::Spatial
 		}
 	}
 
-	if (it->second->lastTimestamp != currentState.Timestamp().TargetTime().time_since_epoch().count())
-	{
-		shared_ptr<InputSource> recordedSource = it->second;
+	pSlot->wasUpdated = true;
+	InputSource* recordedSource = &pSlot->source;
 
+	if (recordedSource->lastTimestamp != currentState.Timestamp().TargetTime().time_since_epoch().count())
+	{
 		recordedSource->lastTimestamp = currentState.Timestamp().TargetTime().time_since_epoch().count();
 
-		auto lastButtonStates = recordedSource->buttonStates;
+		uint32_t buttonStates = 0;
+		if (currentState.IsSelectPressed())
+			buttonStates |= InputSource::GetButtonBit(SpatialButton::SELECT);
+		if (currentState.IsGrasped())
+			buttonStates |= InputSource::GetButtonBit(SpatialButton::GRAB);
+		if (currentState.IsMenuPressed())
+			buttonStates |= InputSource::GetButtonBit(SpatialButton::MENU);
 
-		recordedSource->buttonStates[SpatialButton::SELECT] = currentState.IsSelectPressed();
-		recordedSource->buttonStates[SpatialButton::GRAB] = currentState.IsGrasped();
-		recordedSource->buttonStates[SpatialButton::MENU] = currentState.IsMenuPressed();
+		recordedSource->SetButtonStates(buttonStates);
 
 		auto type = currentState.Source().Kind();
 		switch (type)
@@ -940,22 +1192,25 @@ void MixedReality::UpdateInputSource(winrt::Windows::UI::Input::Spatial::Spatial
 
 		if (handPose)
 		{
-			static vector<winrt::Windows::Perception::People::HandJointKind> requestedJointIndices;
-			if (requestedJointIndices.empty())
+			const size_t jointCount = (size_t)HandJointIndex::Count;
+
+			static winrt::Windows::Perception::People::HandJointKind requestedJointIndices[jointCount];
+			static bool areRequestedJointIndicesSet = false;
+			if (!areRequestedJointIndicesSet)
 			{
-				requestedJointIndices.resize((size_t)HandJointIndex::Count);
-				for (int jointIndex = 0; jointIndex < (int)HandJointIndex::Count; ++jointIndex)
+				for (size_t jointIndex = 0; jointIndex < jointCount; ++jointIndex)
 					requestedJointIndices[jointIndex] = (winrt::Windows::Perception::People::HandJointKind)jointIndex;
+
+				areRequestedJointIndicesSet = true;
 			}
 
-			static vector<winrt::Windows::Perception::People::JointPose> jointPoses(requestedJointIndices.size());
+			winrt::Windows::Perception::People::JointPose jointPoses[jointCount];
 
 			if (handPose.TryGetJoints(GetWorldCoordinateSystem(), requestedJointIndices, jointPoses))
 			{
-				auto jointCount = requestedJointIndices.size();
-				recordedSource->handJoints.resize(jointCount);
+				recordedSource->hasHandJoints = true;
 
-				for (unsigned jointIndex = 0; jointIndex < jointCount; ++jointIndex)
+				for (size_t jointIndex = 0; jointIndex < jointCount; ++jointIndex)
 				{
 					HandJoint &currentHandJoint = recordedSource->handJoints[jointIndex];
 					currentHandJoint.position = DirectX::XMVectorSetW(DirectX::XMLoadFloat3(&jointPoses[jointIndex].Position), 1.0f);
@@ -968,59 +1223,18 @@ void MixedReality::UpdateInputSource(winrt::Windows::UI::Input::Spatial::Spatial
 			auto handMeshObserverRecord = m_activeHandMeshObservers.find(recordedSource->id);
 			if (handMeshObserverRecord != m_activeHandMeshObservers.end())
 			{
-				auto handMeshObserver = handMeshObserverRecord->second;
-
-				if (recordedSource->handMeshIndices.empty())
-				{
-					unsigned sourceIndexCount = handMeshObserver.TriangleIndexCount();
-					m_indexScratchBuffer.resize(sourceIndexCount);
-					handMeshObserver.GetTriangleIndices(m_indexScratchBuffer);
+				if (!recordedSource->handMesh)
+					recordedSource->handMesh = make_shared<HandMeshStream>();
 
-					recordedSource->handMeshIndices.resize(sourceIndexCount);
-					for (unsigned i = 0; i < sourceIndexCount; ++i)
-						recordedSource->handMeshIndices[i] = (unsigned int)m_indexScratchBuffer[i];
-				}
-
-				auto vertexState = handMeshObserver.GetVertexStateForPose(handPose);
-				unsigned int sourceVertexCount = handMeshObserver.VertexCount();
-				m_vertexScratchBuffer.resize(sourceVertexCount);
-				vertexState.GetVertices(m_vertexScratchBuffer);
-
-				if (vertexState.CoordinateSystem())	// WORKAROUND: We shouldn't have to check this.  It should never null, but sometimes it is.  It's a platform bug.
-				{
-					auto tryTransform = vertexState.CoordinateSystem().TryGetTransformTo(GetWorldCoordinateSystem());
-					if (tryTransform)
-						recordedSource->handMeshWorldTransform = DirectX::XMLoadFloat4x4(&tryTransform.Value());
-
-					recordedSource->handMeshVertices.resize(sourceVertexCount);
-					for (unsigned vertexIndex = 0; vertexIndex < sourceVertexCount; ++vertexIndex)
-					{
-						recordedSource->handMeshVertices[vertexIndex].position = DirectX::XMVectorSetW(DirectX::XMLoadFloat3(&m_vertexScratchBuffer[vertexIndex].Position), 1.0f);
-						recordedSource->handMeshVertices[vertexIndex].normal = DirectX::XMLoadFloat3(&m_vertexScratchBuffer[vertexIndex].Normal);
-						recordedSource->handMeshVertices[vertexIndex].texcoord = { 0.0f, 0.0f };
-					}
-				}
+				recordedSource->handMesh->Update(handMeshObserverRecord->second, handPose, GetWorldCoordinateSystem(), recordedSource->handMeshWorldTransform);
 			}
 		}
 
-		if (currentState.IsSelectPressed() || currentState.IsGrasped() || currentState.IsMenuPressed())
+		if (recordedSource->buttonStates != 0)
 		{
 			m_primarySourceID = sourceID;
 		}
 
-		for (auto& entry : recordedSource->buttonStates)
-		{
-			if (entry.second == true && lastButtonStates[entry.first] == false)
-				recordedSource->buttonPresses[entry.first] = true;
-			else
-				recordedSource->buttonPresses[entry.first] = false;
-
-			if (entry.second == false && lastButtonStates[entry.first] == true)
-				recordedSource->buttonReleases[entry.first] = true;
-			else
-				recordedSource->buttonReleases[entry.first] = false;
-		}
-
 		auto location = currentState.Properties().TryGetLocation(GetWorldCoordinateSystem());
 		if (location)
 		{
@@ -1072,8 +1286,19 @@ SurfaceMapping::SurfaceMapping(winrt::Windows::Perception::Spatial::SpatialStati
 	m_surfaceDrawMode(SurfaceDrawMode::None),
 	m_headPosition(DirectX::XMVectorZero()),
 	m_numberOfSurfacesInProcessingQueue(0),
-	m_surfaceObservationThread(new std::thread(&SurfaceMapping::SurfaceObservationThreadFunction, this))
+	m_stopObservationThread(false),
+	m_simplificationEnabled(false),
+	m_simplificationSourceTriangleCount(0),
+	m_simplificationResultTriangleCount(0),
+	m_replayStartTime(0)
 {
+	m_surfaceObservationThread.reset(new std::thread(&SurfaceMapping::SurfaceObservationThreadFunction, this));
+}
+
+SurfaceMapping::~SurfaceMapping()
+{
+	m_stopObservationThread = true;
+	m_surfaceObservationThread->join();
 }
 
 void SurfaceMapping::CreaterObserverIfNeeded()
@@ -1108,20 +1333,31 @@ void SurfaceMapping::GetLatestSurfacesToProcess(std::vector<TimestampSurfacePair
 		{
 			surfacesToProcess.push_back(pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>(0, surfaceInfo));
 		}
-		else if (surfaceInfo.UpdateTime().time_since_epoch().count() - meshRecordIterator->second.lastSurfaceUpdateTime > 5 * 10000000 || !meshRecordIterator->second.mesh)
+		else if (surfaceInfo.UpdateTime().time_since_epoch().count() - meshRecordIterator->second.lastSurfaceUpdateTime > 5 * 10000000)
 		{
 			surfacesToProcess.push_back(pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>(meshRecordIterator->second.lastMeshUpdateTime, surfaceInfo));
 		}
 	}
 
+	vector<winrt::guid> removedSurfaceIDs;
 	for (auto& meshRecordPair : m_meshRecords)
 	{
 		if (!observedSurfaces.HasKey(meshRecordPair.first))
+		{
 			m_meshRecordIDsToErase.push_back(meshRecordPair.first);
+			removedSurfaceIDs.push_back(meshRecordPair.first);
+		}
 	}
 
 	m_meshRecordsMutex.unlock();
 
+	long long now = (long long)Timer::GetSystemRelativeTime();
+	for (auto& id : removedSurfaceIDs)
+	{
+		m_chunkGrid.RemovePatch(id);
+		m_surfaceRecorder.WriteRemoval((const uint8_t*)&id, now);
+	}
+
 	sort(surfacesToProcess.begin(), surfacesToProcess.end(), [](const pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>& a, const pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo>& b)
 		{
 			return a.first > b.first;
@@ -1131,11 +1367,59 @@ void SurfaceMapping::GetLatestSurfacesToProcess(std::vector<TimestampSurfacePair
 void SurfaceMapping::SurfaceObservationThreadFunction()
 {
 	vector<TimestampSurfacePair> surfacesToProcess;
+	shared_ptr<SurfaceReplay> activeReplay;
+	shared_ptr<TsdfVolume> activeTsdfVolume;
 
-	for (;;)
+	while (!m_stopObservationThread)
 	{
+		m_surfaceReplayMutex.lock();
+		auto surfaceReplay = m_surfaceReplay;
+		m_surfaceReplayMutex.unlock();
+
+		m_tsdfVolumeMutex.lock();
+		auto tsdfVolume = m_tsdfVolume;
+		m_tsdfVolumeMutex.unlock();
+
+		// Switching between live and replayed surfaces starts over from an empty map.
+		// So does enabling fusion, otherwise the raw patches already in the chunk grid would be drawn on top of the fused surface.
+		if (surfaceReplay != activeReplay || tsdfVolume != activeTsdfVolume)
+		{
+			activeReplay = surfaceReplay;
+			activeTsdfVolume = tsdfVolume;
+			surfacesToProcess.clear();
+			ResetSurfaces();
+
+			if (activeReplay)
+			{
+				activeReplay->Restart();
+				m_replayStartTime = Timer::GetSystemRelativeTime();
+			}
+		}
+
+		if (activeReplay)
+		{
+			if (!ProcessReplayEvents(*activeReplay))
+			{
+				if (activeReplay->IsFinished())
+				{
+					m_surfaceReplayMutex.lock();
+					m_finishedSurfaceReplay = activeReplay;
+					m_surfaceReplayMutex.unlock();
+				}
+				Sleep(10);
+			}
+			continue;
+		}
+
+		// Without a holographic space there is nothing to observe, and no point asking for access
+		if (!m_referenceFrame)
+		{
+			Sleep(50);
+			continue;
+		}
+
 		CreaterObserverIfNeeded();
-		if (!m_surfaceObserver || !m_referenceFrame)
+		if (!m_surfaceObserver)
 		{
 			Sleep(50);
 			continue;
@@ -1153,7 +1437,7 @@ void SurfaceMapping::SurfaceObservationThreadFunction()
 			GetLatestSurfacesToProcess(surfacesToProcess);
 		}
 
-		while (!surfacesToProcess.empty())
+		while (!surfacesToProcess.empty() && !m_stopObservationThread)
 		{
 			Sleep(50);
 
@@ -1174,34 +1458,292 @@ void SurfaceMapping::SurfaceObservationThreadFunction()
 				newMeshRecord.sourceMesh = sourceMesh;
 				newMeshRecord.lastMeshUpdateTime = Timer::GetSystemRelativeTime();
 				newMeshRecord.lastSurfaceUpdateTime = sourceMesh.SurfaceInfo().UpdateTime().time_since_epoch().count();
-				newMeshRecord.color = DirectX::XMVectorSet(0.5f, 0.5f, 0.5f, 1.0f);
 
 				auto tryTransform = sourceMesh.CoordinateSystem().TryGetTransformTo(m_referenceFrame.CoordinateSystem());
 				if (tryTransform)
 					newMeshRecord.worldTransform = tryTransform.Value();
 
+				if (m_surfaceRecorder.IsOpen())
+					RecordSourceMesh(newMeshRecord, sourceMesh);
+
 				newMeshRecord.mesh = make_shared<Mesh>(nullptr, 0);
 				ConvertMesh(newMeshRecord.sourceMesh, newMeshRecord.mesh);
 				newMeshRecord.sourceMesh = nullptr;
-				newMeshRecord.mesh->UpdateBoundingBox();
 
-				if (m_surfaceDrawMode != SurfaceDrawMode::None)
-					newMeshRecord.InitDrawCall();
-
-				m_newMeshRecordsMutex.lock();
-				m_newMeshRecords.push_back(newMeshRecord);
-				m_newMeshRecordsMutex.unlock();
+				ProcessNewMeshRecord(newMeshRecord);
 			}
 		}
 	}
 }
 
+// Everything after conversion, identical for live and replayed surfaces
+void SurfaceMapping::ProcessNewMeshRecord(MeshRecord& newMeshRecord)
+{
+	SimplifyMeshIfEnabled(*newMeshRecord.mesh);
+
+	m_tsdfVolumeMutex.lock();
+	auto tsdfVolume = m_tsdfVolume;
+	m_tsdfVolumeMutex.unlock();
+
+	// The chunk grid or the fused volume takes the triangles, and builds its own bounds, so the record only keeps
+	//  what is needed to tell when the surface changes
+	if (tsdfVolume)
+		FuseMesh(*tsdfVolume, *newMeshRecord.mesh, DirectX::XMLoadFloat4x4(&newMeshRecord.worldTransform));
+	else
+		m_chunkGrid.UpdatePatch(newMeshRecord.id, *newMeshRecord.mesh, DirectX::XMLoadFloat4x4(&newMeshRecord.worldTransform));
+
+	newMeshRecord.mesh = nullptr;
+
+	m_newMeshRecordsMutex.lock();
+	m_newMeshRecords.push_back(newMeshRecord);
+	m_newMeshRecordsMutex.unlock();
+}
+
+// Returns false if no event was due
+bool SurfaceMapping::ProcessReplayEvents(SurfaceReplay& surfaceReplay)
+{
+	m_replayEventScratchList.clear();
+	surfaceReplay.GetDueEvents((long long)(Timer::GetSystemRelativeTime() - m_replayStartTime), m_replayEventScratchList);
+
+	for (auto pEvent : m_replayEventScratchList)
+	{
+		winrt::guid id;
+		memcpy(&id, pEvent->id, sizeof(id));
+
+		if (pEvent->type == SurfaceRecordEvent::Type::PatchRemoved)
+		{
+			m_meshRecordsMutex.lock();
+			m_meshRecordIDsToErase.push_back(id);
+			m_meshRecordsMutex.unlock();
+
+			m_chunkGrid.RemovePatch(id);
+			continue;
+		}
+
+		MeshRecord newMeshRecord;
+		newMeshRecord.id = id;
+		newMeshRecord.lastMeshUpdateTime = Timer::GetSystemRelativeTime();
+		newMeshRecord.lastSurfaceUpdateTime = pEvent->surfaceUpdateTime;
+		memcpy(&newMeshRecord.worldTransform, pEvent->worldTransform, sizeof(newMeshRecord.worldTransform));
+
+		newMeshRecord.mesh = make_shared<Mesh>(nullptr, 0);
+		ConvertMesh(pEvent->indices.data(), (unsigned)pEvent->indices.size(), pEvent->positions.data(), (const char*)pEvent->normals.data(), pEvent->GetVertexCount(),
+			DirectX::XMFLOAT3(pEvent->vertexScale[0], pEvent->vertexScale[1], pEvent->vertexScale[2]), newMeshRecord.mesh);
+
+		ProcessNewMeshRecord(newMeshRecord);
+	}
+
+	m_numberOfSurfacesInProcessingQueueMutex.lock();
+	m_numberOfSurfacesInProcessingQueue = 0;
+	m_numberOfSurfacesInProcessingQueueMutex.unlock();
+
+	return !m_replayEventScratchList.empty();
+}
+
+// Drops every surface, the render thread picks up the erasures on its next Update
+void SurfaceMapping::ResetSurfaces()
+{
+	m_newMeshRecordsMutex.lock();
+	m_newMeshRecords.clear();
+	m_newMeshRecordsMutex.unlock();
+
+	m_meshRecordsMutex.lock();
+	for (auto& meshRecordPair : m_meshRecords)
+		m_meshRecordIDsToErase.push_back(meshRecordPair.first);
+	m_meshRecordsMutex.unlock();
+
+	m_chunkGrid.Clear();
+
+	m_tsdfVolumeMutex.lock();
+	if (m_tsdfVolume)
+		m_tsdfVolume->Clear();
+	m_tsdfVolumeMutex.unlock();
+}
+
+bool SurfaceMapping::StartRecording(const std::string& filename)
+{
+	return m_surfaceRecorder.Open(filename);
+}
+
+void SurfaceMapping::StopRecording()
+{
+	m_surfaceRecorder.Close();
+}
+
+bool SurfaceMapping::IsRecording()
+{
+	return m_surfaceRecorder.IsOpen();
+}
+
+bool SurfaceMapping::StartReplay(const std::string& filename, float speed)
+{
+	auto surfaceReplay = make_shared<SurfaceReplay>();
+	if (!surfaceReplay->Open(filename))
+		return false;
+
+	surfaceReplay->SetSpeed(speed);
+
+	lock_guard<mutex> lock(m_surfaceReplayMutex);
+	m_surfaceReplay = surfaceReplay;
+	return true;
+}
+
+void SurfaceMapping::StopReplay()
+{
+	lock_guard<mutex> lock(m_surfaceReplayMutex);
+	m_surfaceReplay = nullptr;
+}
+
+bool SurfaceMapping::IsReplaying()
+{
+	lock_guard<mutex> lock(m_surfaceReplayMutex);
+	return m_surfaceReplay != nullptr;
+}
+
+bool SurfaceMapping::IsReplayFinished()
+{
+	lock_guard<mutex> lock(m_surfaceReplayMutex);
+	return m_surfaceReplay != nullptr && m_surfaceReplay == m_finishedSurfaceReplay;
+}
+
 unsigned SurfaceMapping::GetNumberOfSurfacesInProcessingQueue()
 {
 	lock_guard<mutex> lock(m_numberOfSurfacesInProcessingQueueMutex);
 	return m_numberOfSurfacesInProcessingQueue;
 }
 
+void SurfaceMapping::EnableSimplification(const MeshSimplifier::Settings& settings)
+{
+	lock_guard<mutex> lock(m_simplificationMutex);
+	m_simplificationSettings = settings;
+	m_simplificationEnabled = true;
+}
+
+void SurfaceMapping::DisableSimplification()
+{
+	lock_guard<mutex> lock(m_simplificationMutex);
+	m_simplificationEnabled = false;
+}
+
+bool SurfaceMapping::IsSimplificationEnabled()
+{
+	lock_guard<mutex> lock(m_simplificationMutex);
+	return m_simplificationEnabled;
+}
+
+void SurfaceMapping::GetSimplificationStats(size_t& sourceTriangleCount, size_t& simplifiedTriangleCount)
+{
+	lock_guard<mutex> lock(m_simplificationMutex);
+	sourceTriangleCount = m_simplificationSourceTriangleCount;
+	simplifiedTriangleCount = m_simplificationResultTriangleCount;
+}
+
+void SurfaceMapping::SimplifyMeshIfEnabled(Mesh& mesh)
+{
+	m_simplificationMutex.lock();
+	bool enabled = m_simplificationEnabled;
+	m_meshSimplifier.SetSettings(m_simplificationSettings);
+	m_simplificationMutex.unlock();
+
+	if (!enabled)
+		return;
+
+	size_t sourceTriangleCount = mesh.GetIndexCount() / 3;
+	m_meshSimplifier.Simplify(mesh);
+
+	lock_guard<mutex> lock(m_simplificationMutex);
+	m_simplificationSourceTriangleCount += sourceTriangleCount;
+	m_simplificationResultTriangleCount += mesh.GetIndexCount() / 3;
+}
+
+void SurfaceMapping::EnablePlaneDetection(const PlaneDetector::Settings& settings)
+{
+	if (!m_planeDetector)
+		m_planeDetector = make_unique<PlaneDetector>(m_chunkGrid, settings);
+}
+
+void SurfaceMapping::EnableVolumetricFusion(const TsdfVolume::Settings& settings)
+{
+	lock_guard<mutex> lock(m_tsdfVolumeMutex);
+	if (m_tsdfVolume)
+		return;
+
+	m_tsdfVolume = make_shared<TsdfVolume>(settings);
+	m_chunkGrid.SetDuplicateRemovalEnabled(false);
+}
+
+bool SurfaceMapping::IsVolumetricFusionEnabled()
+{
+	lock_guard<mutex> lock(m_tsdfVolumeMutex);
+	return m_tsdfVolume != nullptr;
+}
+
+bool SurfaceMapping::GetDistanceToSurface(const DirectX::XMVECTOR& position, float& distance)
+{
+	m_tsdfVolumeMutex.lock();
+	auto tsdfVolume = m_tsdfVolume;
+	m_tsdfVolumeMutex.unlock();
+
+	if (!tsdfVolume)
+		return false;
+
+	TsdfVolume::Vector3 queryPosition = { DirectX::XMVectorGetX(position), DirectX::XMVectorGetY(position), DirectX::XMVectorGetZ(position) };
+	return tsdfVolume->GetDistance(queryPosition, distance);
+}
+
+// Fused blocks are stored in the chunk grid like patches, under an ID derived from the block coordinate
+static winrt::guid GetTsdfBlockID(const TsdfVolume::BlockCoordinate& coordinate)
+{
+	winrt::guid id;
+	memset(&id, 0, sizeof(id));
+	id.Data1 = (uint32_t)coordinate.x;
+	id.Data2 = 0x7d5f;
+	memcpy(&id.Data4[0], &coordinate.y, sizeof(int32_t));
+	memcpy(&id.Data4[4], &coordinate.z, sizeof(int32_t));
+	return id;
+}
+
+void SurfaceMapping::FuseMesh(TsdfVolume& tsdfVolume, Mesh& mesh, const DirectX::XMMATRIX& worldTransform)
+{
+	auto& vertices = mesh.GetVertices();
+	auto& indices = mesh.GetIndices();
+
+	m_fusionPositionScratch.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		DirectX::XMFLOAT3 worldPosition;
+		DirectX::XMStoreFloat3(&worldPosition, DirectX::XMVector3Transform(vertices[i].position, worldTransform));
+		m_fusionPositionScratch[i] = { worldPosition.x, worldPosition.y, worldPosition.z };
+	}
+
+	tsdfVolume.IntegrateMesh(m_fusionPositionScratch.data(), m_fusionPositionScratch.size(), indices.data(), indices.size());
+
+	vector<TsdfVolume::BlockMesh> updatedBlocks;
+	vector<TsdfVolume::BlockCoordinate> removedBlocks;
+	tsdfVolume.ExtractDirtyBlocks(updatedBlocks, removedBlocks);
+
+	for (auto& coordinate : removedBlocks)
+		m_chunkGrid.RemovePatch(GetTsdfBlockID(coordinate));
+
+	Mesh blockMesh;
+	for (auto& updatedBlock : updatedBlocks)
+	{
+		auto& blockVertices = blockMesh.GetVertices();
+		blockVertices.resize(updatedBlock.positions.size());
+		for (size_t i = 0; i < blockVertices.size(); ++i)
+		{
+			const auto& position = updatedBlock.positions[i];
+			const auto& normal = updatedBlock.normals[i];
+			blockVertices[i].position = DirectX::XMVectorSet(position.x, position.y, position.z, 1.0f);
+			blockVertices[i].normal = DirectX::XMVectorSet(normal.x, normal.y, normal.z, 0.0f);
+			blockVertices[i].texcoord = DirectX::XMFLOAT2(0.0f, 0.0f);
+		}
+		blockMesh.GetIndices() = updatedBlock.indices;
+
+		m_chunkGrid.UpdatePatch(GetTsdfBlockID(updatedBlock.coordinate), blockMesh, DirectX::XMMatrixIdentity());
+	}
+}
+
 bool SurfaceMapping::IsActive()
 {
 	return m_isActive;
@@ -1243,6 +1785,18 @@ void SurfaceMapping::Update(const DirectX::XMVECTOR& headPosition)
 	m_meshRecordsMutex.unlock();
 }
 
+static unsigned char* GetBufferBytes(winrt::Windows::Storage::Streams::IBuffer const& buffer)
+{
+	Microsoft::WRL::ComPtr<IUnknown> unknown;
+	Microsoft::WRL::ComPtr<Windows::Storage::Streams::IBufferByteAccess> bufferByteAccess;
+
+	unknown = (IUnknown*)winrt::get_abi(buffer);
+	unknown.As(&bufferByteAccess);
+	unsigned char* pBytes = nullptr;
+	bufferByteAccess->Buffer(&pBytes);
+	return pBytes;
+}
+
 void SurfaceMapping::ConvertMesh(winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh sourceMesh, shared_ptr<Mesh> destinationMesh)
 {
 	if (!sourceMesh || !destinationMesh)
@@ -1257,34 +1811,28 @@ void SurfaceMapping::ConvertMesh(winrt::Windows::Perception::Spatial::Surfaces::
 	auto spatialNormalsFormat = sourceMesh.VertexNormals().Format();
 	assert((DXGI_FORMAT)spatialNormalsFormat == DXGI_FORMAT_R8G8B8A8_SNORM);
 
-	Microsoft::WRL::ComPtr<IUnknown> unknown;
-	Microsoft::WRL::ComPtr<Windows::Storage::Streams::IBufferByteAccess> bufferByteAccess;
+	unsigned short* pSourceIndexBuffer = (unsigned short*)GetBufferBytes(sourceMesh.TriangleIndices().Data());
+	short* pSourcePositionsBuffer = (short*)GetBufferBytes(sourceMesh.VertexPositions().Data());
+	char* pSourceNormalsBuffer = (char*)GetBufferBytes(sourceMesh.VertexNormals().Data());
 
-	unknown = (IUnknown*)winrt::get_abi(sourceMesh.TriangleIndices().Data());
-	unknown.As(&bufferByteAccess);
-	unsigned short* pSourceIndexBuffer = nullptr;
-	bufferByteAccess->Buffer((unsigned char**)& pSourceIndexBuffer);
-
-	unknown = (IUnknown*)winrt::get_abi(sourceMesh.VertexPositions().Data());
-	unknown.As(&bufferByteAccess);
-	short* pSourcePositionsBuffer = nullptr;
-	bufferByteAccess->Buffer((unsigned char**)& pSourcePositionsBuffer);
-
-	unknown = (IUnknown*)winrt::get_abi(sourceMesh.VertexNormals().Data());
-	unknown.As(&bufferByteAccess);
-	char* pSourceNormalsBuffer = nullptr;
-	bufferByteAccess->Buffer((unsigned char**)& pSourceNormalsBuffer);
+	assert(sourceMesh.VertexPositions().ElementCount() == sourceMesh.VertexNormals().ElementCount());
 
 	auto vertexScaleFactor = sourceMesh.VertexPositionScale();
+	ConvertMesh(pSourceIndexBuffer, sourceMesh.TriangleIndices().ElementCount(), pSourcePositionsBuffer, pSourceNormalsBuffer, sourceMesh.VertexPositions().ElementCount(),
+		DirectX::XMFLOAT3(vertexScaleFactor.x, vertexScaleFactor.y, vertexScaleFactor.z), destinationMesh);
+}
+
+// Raw buffer version, shared by live surfaces and replayed recordings
+void SurfaceMapping::ConvertMesh(const unsigned short* pSourceIndexBuffer, unsigned indexCount, const short* pSourcePositionsBuffer, const char* pSourceNormalsBuffer, unsigned vertexCount,
+	const DirectX::XMFLOAT3& vertexScaleFactor, shared_ptr<Mesh> destinationMesh)
+{
 	float short_max = pow(2.0f, 15.0f);
 	float char_max = pow(2.0f, 7.0f);
 
-	assert(sourceMesh.VertexPositions().ElementCount() == sourceMesh.VertexNormals().ElementCount());
-
 	auto& vertexBuffer = destinationMesh->GetVertices();
-	vertexBuffer.resize(sourceMesh.VertexPositions().ElementCount());
+	vertexBuffer.resize(vertexCount);
 	auto& indexBuffer = destinationMesh->GetIndices();
-	indexBuffer.resize(sourceMesh.TriangleIndices().ElementCount());
+	indexBuffer.resize(indexCount);
 
 	for (unsigned i = 0; i < indexBuffer.size(); ++i)
 	{
@@ -1310,25 +1858,51 @@ void SurfaceMapping::ConvertMesh(winrt::Windows::Perception::Spatial::Surfaces::
 	}
 }
 
+void SurfaceMapping::RecordSourceMesh(const MeshRecord& meshRecord, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh sourceMesh)
+{
+	auto vertexScaleFactor = sourceMesh.VertexPositionScale();
+	float vertexScale[3] = { vertexScaleFactor.x, vertexScaleFactor.y, vertexScaleFactor.z };
+
+	m_surfaceRecorder.WritePatch((const uint8_t*)&meshRecord.id, meshRecord.lastMeshUpdateTime, meshRecord.lastSurfaceUpdateTime, &meshRecord.worldTransform.m11, vertexScale,
+		(const uint16_t*)GetBufferBytes(sourceMesh.TriangleIndices().Data()), sourceMesh.TriangleIndices().ElementCount(),
+		(const int16_t*)GetBufferBytes(sourceMesh.VertexPositions().Data()), (const int8_t*)GetBufferBytes(sourceMesh.VertexNormals().Data()), sourceMesh.VertexPositions().ElementCount());
+}
+
 void SurfaceMapping::DrawMeshes()
 {
 	if (m_surfaceDrawMode == SurfaceDrawMode::None)
 		return;
 
-	if(m_surfaceDrawMode == SurfaceDrawMode::Occlusion)
-		DrawCall::PushAlphaBlendState(DrawCall::BLEND_COLOR_DISABLED);
+	// Sync draw calls with the latest chunk snapshots, rebuilt chunks come back as new objects
+	m_chunkGrid.GetChunks(m_chunkScratchList);
+	for (auto& chunk : m_chunkScratchList)
+	{
+		auto& drawRecord = m_chunkDrawRecords[chunk->coordinate];
+		if (drawRecord.chunk == chunk)
+			continue;
 
-	m_meshRecordsMutex.lock();
-	for (auto& pair : m_meshRecords)
+		drawRecord.chunk = chunk;
+		drawRecord.drawCall = make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", chunk->mesh);
+		drawRecord.drawCall->SetColor(DirectX::XMVectorSet(0.5f, 0.5f, 0.5f, 1.0f));
+	}
+
+	if (m_chunkDrawRecords.size() != m_chunkScratchList.size())
 	{
-		if (!pair.second.drawCall)
+		for (auto it = m_chunkDrawRecords.begin(); it != m_chunkDrawRecords.end();)
 		{
-			pair.second.InitDrawCall();
+			bool found = binary_search(m_chunkScratchList.begin(), m_chunkScratchList.end(), it->second.chunk,
+				[](const shared_ptr<const SurfaceChunkGrid::Chunk>& a, const shared_ptr<const SurfaceChunkGrid::Chunk>& b) { return a->coordinate < b->coordinate; });
+			it = found ? next(it) : m_chunkDrawRecords.erase(it);
 		}
+	}
+
+	if(m_surfaceDrawMode == SurfaceDrawMode::Occlusion)
+		DrawCall::PushAlphaBlendState(DrawCall::BLEND_COLOR_DISABLED);
 
+	for (auto& pair : m_chunkDrawRecords)
+	{
 		pair.second.drawCall->Draw();
 	}
-	m_meshRecordsMutex.unlock();
 
 	if (m_surfaceDrawMode == SurfaceDrawMode::Occlusion)
 		DrawCall::PopAlphaBlendState();
@@ -1336,32 +1910,7 @@ void SurfaceMapping::DrawMeshes()
 
 bool SurfaceMapping::TestRayIntersection(DirectX::XMVECTOR rayOrigin, DirectX::XMVECTOR rayDirection, float& distance, DirectX::XMVECTOR& normal)
 {
-	bool hit = false;
-	distance = FLT_MAX;
-
-	m_meshRecordsMutex.lock();
-	for (auto& meshRecordPair : m_meshRecords)
-	{
-		if (!meshRecordPair.second.mesh)
-			continue;
-
-		DirectX::XMMATRIX worldTransform = DirectX::XMLoadFloat4x4(&meshRecordPair.second.worldTransform);
-
-		float currentDistance;
-		DirectX::XMVECTOR currentNormal;
-
-		bool result = meshRecordPair.second.mesh->TestRayIntersection(rayOrigin, rayDirection, worldTransform, currentDistance, currentNormal);
-
-		if (result && currentDistance < distance)
-		{
-			hit = true;
-			distance = currentDistance;
-			normal = currentNormal;
-		}
-	}
-	m_meshRecordsMutex.unlock();
-
-	return hit;
+	return m_chunkGrid.TestRayIntersection(rayOrigin, rayDirection, distance, normal);
 }
 
 #ifdef ENABLE_QRCODE_API
@@ -50,44 +50,25 @@
 #endif
 
 #include "Common/Intersectable.h"
+#include "HandInput.h"
 #include "DrawCall.h"
+#include "MeshSimplifier.h"
+#include "SurfaceChunkGrid.h"
+#include "TsdfVolume.h"
+#include "SurfaceRecording.h"
+#include "HandRecording.h"
+#include "HandMeshStream.h"
+#include "AllocationCounter.h"
+#include "PlaneDetector.h"
+
+#include <atomic>
 
 enum class SpatialButton
 {
 	SELECT,
 	GRAB,
 	MENU,
-};
-
-enum class HandJointIndex
-{
-	Palm,
-	Wrist,
-	ThumbMetacarpal,
-	ThumbProximal,
-	ThumbDistal,
-	ThumbTip,
-	IndexMetacarpal,
-	IndexProximal,
-	IndexIntermediate,
-	IndexDistal,
-	IndexTip,
-	MiddleMetacarpal,
-	MiddleProximal,
-	MiddleIntermediate,
-	MiddleDistal,
-	MiddleTip,
-	RingMetacarpal,
-	RingProximal,
-	RingIntermediate,
-	RingDistal,
-	RingTip,
-	PinkyMetacarpal,
-	PinkyProximal,
-	PinkyIntermediate,
-	PinkyDistal,
-	PinkyTip,
-	Count,
+	COUNT,
 };
 
 enum class Handedness
@@ -104,14 +85,6 @@ enum class InputType
 	Other,
 };
 
-struct HandJoint
-{
-	DirectX::XMVECTOR position;
-	DirectX::XMVECTOR orientation;
-	float radius;
-	bool trackedState;
-};
-
 struct InputSource
 {
 	InputSource();
@@ -122,9 +95,16 @@ struct InputSource
 	InputType type;
 	Handedness handedness;
 
-	std::map<SpatialButton, bool> buttonStates;
-	std::map<SpatialButton, bool> buttonPresses;
-	std::map<SpatialButton, bool> buttonReleases;
+	// Bit n is SpatialButton n
+	uint32_t buttonStates;
+	uint32_t buttonPresses;		// Down this update, up the one before
+	uint32_t buttonReleases;	// Up this update, down the one before
+
+	static uint32_t GetButtonBit(SpatialButton button) { return 1u << (unsigned)button; }
+	bool IsButtonDown(SpatialButton button) const { return (buttonStates & GetButtonBit(button)) != 0; }
+	bool WasButtonPressed(SpatialButton button) const { return (buttonPresses & GetButtonBit(button)) != 0; }
+	bool WasButtonReleased(SpatialButton button) const { return (buttonReleases & GetButtonBit(button)) != 0; }
+	void SetButtonStates(uint32_t newButtonStates);	// Also updates presses and releases
 
 	DirectX::XMVECTOR position;
 	DirectX::XMVECTOR orientation;	// Quaternion
@@ -132,9 +112,9 @@ struct InputSource
 	DirectX::XMVECTOR rayPosition;
 	DirectX::XMVECTOR rayDirection;
 
-	std::vector<HandJoint> handJoints;
-	std::vector<unsigned> handMeshIndices;
-	std::vector<Mesh::Vertex> handMeshVertices;
+	HandJoint handJoints[(size_t)HandJointIndex::Count];
+	bool hasHandJoints;		// False until articulated hand tracking returns joints for this source
+	std::shared_ptr<HandMeshStream> handMesh;		// Null until the hand mesh observer is ready, draw it with handMeshWorldTransform
 	DirectX::XMMATRIX handMeshWorldTransform;
 };
 
@@ -148,7 +128,7 @@ struct QRCode
 	long long lastSeenTimestamp = 0;									// Timestamp of last detection by HeT in FILETIME ticks
 };
 
-class MixedReality
+class MixedReality : public HandInput
 {
 public:
 
@@ -158,7 +138,8 @@ public:
 	bool EnableMixedReality();
 	bool IsEnabled();
 
-	// In order to use Surface Mapping, you must first add the "spatialPerception" capability to your app manifest
+	// In order to use Surface Mapping, you must first add the "spatialPerception" capability to your app manifest.
+	// Without a holographic space there are no live surfaces, but surface mapping still plays recordings.
 	void EnableSurfaceMapping();
 	bool IsSurfaceMappingActive();
 	std::shared_ptr<class SurfaceMapping> GetSurfaceMappingInterface();
@@ -179,12 +160,12 @@ public:
 
 	void Update();
 
-	long long GetPredictedDisplayTime();
+	long long GetPredictedDisplayTime() override;
 	bool GetHeadPoseAtTimestamp(long long fileTimeTimestamp, DirectX::XMVECTOR& position, DirectX::XMVECTOR& direction, DirectX::XMVECTOR& up);	// timestamp is FILETIME
 
-	const DirectX::XMVECTOR& GetHeadPosition();
-	const DirectX::XMVECTOR& GetHeadForwardDirection();
-	const DirectX::XMVECTOR& GetHeadUpDirection();
+	const DirectX::XMVECTOR& GetHeadPosition() override;
+	const DirectX::XMVECTOR& GetHeadForwardDirection() override;
+	const DirectX::XMVECTOR& GetHeadUpDirection() override;
 	const DirectX::XMVECTOR& GetGravityDirection();
 
 	// In order to use ET, you must first add the "gazeInput" capability to your app manifest
@@ -201,8 +182,26 @@ public:
 	bool WasButtonReleased(SpatialButton button);
 
 	// The InputSource pointers returned are only guaranteed good until the next call to MixedReality::Update()
+	// Sources live in a fixed table of kMaxInputSourceCount slots, more than that at once are ignored.
 	InputSource* GetPrimarySource();	// Last source that had a button press
 	InputSource* GetHand(size_t handIndex);	// 0 for left, 1 for right
+	const HandJoint* GetHandJoints(size_t handIndex, long long& timestamp) override;	// Joints of GetHand, for TrackedHands
+
+	// Records hand joints, buttons and head pose once per Update (see HandRecording.h)
+	bool StartHandRecording(const std::string& filename);
+	void StopHandRecording();
+	bool IsHandRecording();
+
+	// Replaces live hand input, head pose and display time with a recording, one recorded frame per Update.
+	// Replay also runs when mixed reality is not enabled, with no holographic space the sources only come from the recording.
+	// Stopping (or reaching the end without looping) returns to live input.
+	bool StartHandReplay(const std::string& filename, bool isLooping = false);
+	void StopHandReplay();
+	bool IsHandReplaying();
+
+	// Heap allocations made on this thread by the input part of the last Update, which should be zero once sources
+	//  are being tracked. Always zero unless built with ENABLE_ALLOCATION_COUNTER, see AllocationCounter.h
+	size_t GetInputAllocationCount() { return m_inputAllocationCount; }
 
 	size_t CreateAnchor(const DirectX::XMMATRIX& transform);	// Returns the new anchor ID, or 0 if failed
 	void DeleteAnchor(size_t anchorID);
@@ -239,8 +238,6 @@ private:
 
 	winrt::Windows::UI::Input::Spatial::SpatialInteractionManager m_spatialInteractionManager{ nullptr };
 	std::map<unsigned, winrt::Windows::Perception::People::HandMeshObserver> m_activeHandMeshObservers;		// These are arranged by the ID of the corresponding input source
-	std::vector<unsigned short> m_indexScratchBuffer;
-	std::vector<winrt::Windows::Perception::People::HandMeshVertex> m_vertexScratchBuffer;
 
 	std::shared_ptr<SurfaceMapping> m_surfaceMapping;
 
@@ -261,7 +258,24 @@ private:
 	std::map<size_t, AnchorRecord> m_anchorRecords;
 	size_t m_nextAnchorID = 1;
 
+	static const size_t kMaxInputSourceCount = 8;
+
+	// Slots are reused in place, so tracking sources from frame to frame never touches the heap
+	struct InputSourceSlot
+	{
+		bool isActive = false;
+		bool wasUpdated = false;	// Seen by the current Update
+		InputSource source;
+	};
+
 	void UpdateInputSource(winrt::Windows::UI::Input::Spatial::SpatialInteractionSourceState currentState);
+	InputSourceSlot* FindSlot(unsigned id);
+	InputSourceSlot* AcquireSlot(unsigned id);	// Finds or claims a free slot, nullptr if all are taken
+	InputSource* FindSource(unsigned id);
+	void ReleaseSource(unsigned id);
+	void ReleaseAllSources();
+	void RecordHandFrame();
+	void ApplyHandReplayFrame(const HandRecordFrame& frame);
 	void OnLocatabilityChanged(winrt::Windows::Perception::Spatial::SpatialLocator const& locator, winrt::Windows::Foundation::IInspectable const&);
 
 	bool m_mixedRealityEnabled;
@@ -283,9 +297,14 @@ private:
 	DirectX::XMVECTOR m_eyeGazeDirection;
 
 	unsigned int m_primarySourceID = 0;
-	std::map<unsigned int, std::shared_ptr<InputSource>> m_activeSources;
+	InputSourceSlot m_sourceSlots[kMaxInputSourceCount];
+	size_t m_inputAllocationCount = 0;
 
 	long long m_inputWaitLastFrameTimestamp;
+
+	HandRecorder m_handRecorder;
+	std::unique_ptr<HandReplay> m_handReplay;
+	long long m_handReplayDisplayTime;
 };
 
 enum class SurfaceDrawMode
@@ -302,6 +321,7 @@ public:
 
 	// If mesh draw is enabled, this class will automatically create draw calls to go with each mesh for debug viz
 	SurfaceMapping(winrt::Windows::Perception::Spatial::SpatialStationaryFrameOfReference const& referenceFrame);
+	~SurfaceMapping();
 
 	// Returns true once at least one mesh has been processed
 	bool IsActive();
@@ -313,6 +333,39 @@ public:
 
 	unsigned GetNumberOfSurfacesInProcessingQueue();
 
+	// Optional decimation of each surface patch on the observation thread, before the patch is chunked or fused.
+	// Flat regions collapse to a few large triangles, which speeds up both occlusion rendering and ray tests.
+	void EnableSimplification(const MeshSimplifier::Settings& settings = MeshSimplifier::Settings());
+	void DisableSimplification();
+	bool IsSimplificationEnabled();
+	void GetSimplificationStats(size_t& sourceTriangleCount, size_t& simplifiedTriangleCount);	// Totals over all patches processed so far
+
+	// All patches are re-bucketed into a world space chunk grid, which is what gets drawn and ray tested
+	SurfaceChunkGrid& GetChunkGrid() { return m_chunkGrid; }
+
+	// Planes are detected from the chunk grid on their own thread, use GetPlaneDetector()->GetPlanes() or SnapToHorizontalPlane()
+	void EnablePlaneDetection(const PlaneDetector::Settings& settings = PlaneDetector::Settings());
+	PlaneDetector* GetPlaneDetector() { return m_planeDetector.get(); }	// nullptr until enabled
+
+	// With fusion enabled, patches are integrated into a TSDF volume and dropped, and the chunk grid holds the
+	//  re-meshed volume instead. Memory then follows the observed surface area rather than the patch count.
+	// Enabling it starts over from an empty map, patches observed before are fused as they come back in.
+	void EnableVolumetricFusion(const TsdfVolume::Settings& settings = TsdfVolume::Settings());
+	bool IsVolumetricFusionEnabled();
+	bool GetDistanceToSurface(const DirectX::XMVECTOR& position, float& distance);	// Signed, positive in free space. Requires fusion.
+
+	// Records the raw surface data handed out by the system (see SurfaceRecording.h)
+	bool StartRecording(const std::string& filename);
+	void StopRecording();
+	bool IsRecording();
+
+	// Replaces the live observer with a recording, fed through the same conversion and processing.
+	// Speed 1 keeps the original timing, 0 processes everything as fast as possible. Stopping returns to live surfaces.
+	bool StartReplay(const std::string& filename, float speed = 1.0f);
+	void StopReplay();
+	bool IsReplaying();
+	bool IsReplayFinished();	// True once every event of the current replay has been processed
+
 	void DrawMeshes();
 
 	virtual bool TestRayIntersection(DirectX::XMVECTOR rayOrigin, DirectX::XMVECTOR rayDirection, float& distance, DirectX::XMVECTOR& normal);
@@ -323,16 +376,13 @@ private:
 	{
 		winrt::guid id;
 
-		std::shared_ptr<Mesh> mesh;
+		std::shared_ptr<Mesh> mesh;		// Released once the patch is in the chunk grid or the fused volume
 		winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh sourceMesh{ nullptr };	// This will be nullptr unless update is in progresss
 
 		long long lastMeshUpdateTime;		// The time when this mesh was last updated with the last surface
 		long long lastSurfaceUpdateTime;	// The time when the last surface was last updated by the system
 
 		winrt::Windows::Foundation::Numerics::float4x4 worldTransform;
-		DirectX::XMVECTOR color;
-
-		std::shared_ptr<DrawCall> drawCall;	// For visualization
 
 		MeshRecord()
 		{
@@ -342,15 +392,14 @@ private:
 			lastSurfaceUpdateTime = 0;
 
 			DirectX::XMStoreFloat4x4(&worldTransform, DirectX::XMMatrixIdentity());
-			color = DirectX::XMVectorZero();
 		}
+	};
 
-		void InitDrawCall()
-		{
-			drawCall = std::make_shared<DrawCall>("Lit_VS.cso", "Lit_PS.cso", mesh);
-			drawCall->SetColor(color);
-			drawCall->SetWorldTransform(DirectX::XMLoadFloat4x4(&worldTransform));
-		}
+	// Draw calls for the chunk snapshots, only touched by the render thread
+	struct ChunkDrawRecord
+	{
+		std::shared_ptr<const SurfaceChunkGrid::Chunk> chunk;
+		std::shared_ptr<DrawCall> drawCall;
 	};
 	typedef std::pair<winrt::guid, MeshRecord> MeshRecordPair;
 
@@ -375,12 +424,44 @@ private:
 	std::mutex m_newMeshRecordsMutex;
 
 	std::unique_ptr<std::thread> m_surfaceObservationThread;
+	std::atomic<bool> m_stopObservationThread;
+
+	bool m_simplificationEnabled;
+	MeshSimplifier::Settings m_simplificationSettings;
+	size_t m_simplificationSourceTriangleCount;
+	size_t m_simplificationResultTriangleCount;
+	std::mutex m_simplificationMutex;
+	MeshSimplifier m_meshSimplifier;	// Only used on the observation thread
+
+	SurfaceChunkGrid m_chunkGrid;
+	std::map<SurfaceChunkGrid::ChunkCoordinate, ChunkDrawRecord> m_chunkDrawRecords;
+	std::vector<std::shared_ptr<const SurfaceChunkGrid::Chunk>> m_chunkScratchList;
+	std::unique_ptr<PlaneDetector> m_planeDetector;	// Declared after the chunk grid it reads from
+
+	std::shared_ptr<TsdfVolume> m_tsdfVolume;
+	std::mutex m_tsdfVolumeMutex;
+	std::vector<TsdfVolume::Vector3> m_fusionPositionScratch;	// Only used on the observation thread
+
+	SurfaceRecorder m_surfaceRecorder;
+	std::shared_ptr<SurfaceReplay> m_surfaceReplay;
+	std::shared_ptr<SurfaceReplay> m_finishedSurfaceReplay;	// Set by the observation thread, compared against m_surfaceReplay
+	std::mutex m_surfaceReplayMutex;
+	unsigned long long m_replayStartTime;								// Only used on the observation thread
+	std::vector<const SurfaceRecordEvent*> m_replayEventScratchList;	// Only used on the observation thread
 
 	typedef std::pair<long long, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo> TimestampSurfacePair;
 	void CreaterObserverIfNeeded();
 	void GetLatestSurfacesToProcess(std::vector<TimestampSurfacePair>& surfacesToProcess);
 	void SurfaceObservationThreadFunction();
 	void ConvertMesh(winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh sourceMesh, std::shared_ptr<Mesh> destinationMesh);
+	void ConvertMesh(const unsigned short* pSourceIndexBuffer, unsigned indexCount, const short* pSourcePositionsBuffer, const char* pSourceNormalsBuffer, unsigned vertexCount,
+		const DirectX::XMFLOAT3& vertexScaleFactor, std::shared_ptr<Mesh> destinationMesh);
+	void RecordSourceMesh(const MeshRecord& meshRecord, winrt::Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh sourceMesh);
+	void ProcessNewMeshRecord(MeshRecord& newMeshRecord);
+	bool ProcessReplayEvents(SurfaceReplay& surfaceReplay);
+	void ResetSurfaces();
+	void SimplifyMeshIfEnabled(Mesh& mesh);
+	void FuseMesh(TsdfVolume& tsdfVolume, Mesh& mesh, const DirectX::XMMATRIX& worldTransform);
 };
 
 // To use QR code tracking:
@@ -0,0 +1,708 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "PlaneDetector.h"
+
+#include <random>
+
+using namespace DirectX;
+using namespace std;
+
+PlaneDetector::PlaneDetector(SurfaceChunkGrid& chunkGrid) :
+	PlaneDetector(chunkGrid, Settings())
+{
+}
+
+PlaneDetector::PlaneDetector(SurfaceChunkGrid& chunkGrid, const Settings& settings) :
+	m_settings(settings),
+	m_chunkGrid(chunkGrid),
+	m_nextPlaneID(1),
+	m_planeSet(make_shared<PlaneSet>()),
+	m_stopThread(false)
+{
+	assert(settings.distanceThreshold > 0.0f && settings.snapCellSize > 0.0f);
+	m_thread.reset(new std::thread(&PlaneDetector::ThreadFunction, this));
+}
+
+PlaneDetector::~PlaneDetector()
+{
+	m_stopThread = true;
+	m_thread->join();
+}
+
+shared_ptr<const PlaneDetector::PlaneSet> PlaneDetector::GetPlanes()
+{
+	lock_guard<mutex> lock(m_planeSetMutex);
+	return m_planeSet;
+}
+
+bool PlaneDetector::SnapToHorizontalPlane(const XMVECTOR& position, float maxVerticalDistance, XMVECTOR& snappedPosition)
+{
+	return GetPlanes()->SnapToHorizontalPlane(position, maxVerticalDistance, snappedPosition);
+}
+
+uint64_t PlaneDetector::PlaneSet::PackCell(int x, int z)
+{
+	return ((uint64_t)(uint32_t)x << 32) | (uint64_t)(uint32_t)z;
+}
+
+bool PlaneDetector::PlaneSet::SnapToHorizontalPlane(const XMVECTOR& position, float maxVerticalDistance, XMVECTOR& snappedPosition, const Plane** ppPlane) const
+{
+	XMFLOAT3 p;
+	XMStoreFloat3(&p, position);
+
+	auto cellIterator = m_horizontalCells.find(PackCell((int)floorf(p.x / m_cellSize), (int)floorf(p.z / m_cellSize)));
+	if (cellIterator == m_horizontalCells.end())
+		return false;
+
+	const Plane* pBestPlane = nullptr;
+	float bestHeight = 0.0f;
+	float bestVerticalDistance = maxVerticalDistance;
+	for (unsigned planeIndex : cellIterator->second)
+	{
+		const Plane& plane = m_planes[planeIndex];
+
+		float height = (plane.distance - plane.normal.x * p.x - plane.normal.z * p.z) / plane.normal.y;
+		float verticalDistance = fabsf(height - p.y);
+		if (verticalDistance > bestVerticalDistance)
+			continue;
+
+		// Cells are coarse, so check the actual extents
+		XMVECTOR offset = XMVectorSet(p.x, height, p.z, 0.0f) - XMLoadFloat3(&plane.center);
+		if (fabsf(XMVectorGetX(XMVector3Dot(offset, XMLoadFloat3(&plane.axisU)))) > plane.halfExtents.x ||
+			fabsf(XMVectorGetX(XMVector3Dot(offset, XMLoadFloat3(&plane.axisV)))) > plane.halfExtents.y)
+			continue;
+
+		pBestPlane = &plane;
+		bestHeight = height;
+		bestVerticalDistance = verticalDistance;
+	}
+
+	if (!pBestPlane)
+		return false;
+
+	snappedPosition = XMVectorSet(p.x, bestHeight, p.z, 1.0f);
+	if (ppPlane)
+		*ppPlane = pBestPlane;
+	return true;
+}
+
+void PlaneDetector::GetPlaneAxes(const XMVECTOR& normal, XMVECTOR& axisU, XMVECTOR& axisV)
+{
+	// Horizontal planes get axes along world x and z, everything else gets a horizontal U axis
+	if (fabsf(XMVectorGetY(normal)) > 0.9f)
+		axisU = XMVector3Normalize(XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f) - normal * XMVectorGetX(normal));
+	else
+		axisU = XMVector3Normalize(XMVector3Cross(XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), normal));
+
+	axisV = XMVector3Cross(normal, axisU);
+}
+
+void PlaneDetector::ThreadFunction()
+{
+	while (!m_stopThread)
+	{
+		if (UpdateChangedChunks())
+		{
+			auto planeSet = make_shared<PlaneSet>();
+			MergeFragments(planeSet);
+			AssignPersistentIDs(planeSet->m_planes);
+			BuildHorizontalCells(*planeSet);
+
+			lock_guard<mutex> lock(m_planeSetMutex);
+			planeSet->m_version = m_planeSet->m_version + 1;
+			m_planeSet = planeSet;
+		}
+
+		Sleep(m_settings.updateIntervalMilliseconds);
+	}
+}
+
+// Re-fits every chunk that was rebuilt since the last pass, returns false if nothing changed
+bool PlaneDetector::UpdateChangedChunks()
+{
+	m_chunkGrid.GetChunks(m_chunkScratchList);
+
+	set<SurfaceChunkGrid::ChunkCoordinate> liveChunks;
+	vector<SurfaceChunkGrid::ChunkCoordinate> changedChunks;
+	vector<ChunkRecord*> work;
+	for (auto& chunk : m_chunkScratchList)
+	{
+		liveChunks.insert(chunk->coordinate);
+
+		// Chunk snapshots are immutable, a rebuilt chunk is a new object
+		ChunkRecord& record = m_chunkRecords[chunk->coordinate];
+		if (record.chunk != chunk)
+		{
+			RemoveFragmentLinks(chunk->coordinate, record);
+			record.chunk = chunk;
+			changedChunks.push_back(chunk->coordinate);
+			work.push_back(&record);
+		}
+	}
+
+	bool removedChunks = false;
+	for (auto recordIterator = m_chunkRecords.begin(); recordIterator != m_chunkRecords.end();)
+	{
+		if (liveChunks.find(recordIterator->first) == liveChunks.end())
+		{
+			RemoveFragmentLinks(recordIterator->first, recordIterator->second);
+			recordIterator = m_chunkRecords.erase(recordIterator);
+			removedChunks = true;
+		}
+		else
+		{
+			++recordIterator;
+		}
+	}
+
+	m_chunkScratchList.clear();
+
+	if (work.empty())
+		return removedChunks;
+
+	// Chunks are independent, so each worker takes whole chunks
+	unsigned threadCount = m_settings.workerThreadCount ? m_settings.workerThreadCount : max(1u, thread::hardware_concurrency());
+	threadCount = (unsigned)min((size_t)threadCount, work.size());
+
+	atomic<size_t> nextWork(0);
+	m_workers.Run(threadCount, [&](unsigned)
+	{
+		for (size_t workIndex = nextWork++; workIndex < work.size(); workIndex = nextWork++)
+		{
+			work[workIndex]->fragments.clear();
+			DetectFragments(*work[workIndex]->chunk, work[workIndex]->fragments);
+		}
+	});
+
+	LinkFragments(changedChunks);
+	return true;
+}
+
+// Drops every link to the fragments of a chunk that changed or went away, from the other chunks as well
+void PlaneDetector::RemoveFragmentLinks(const SurfaceChunkGrid::ChunkCoordinate& coordinate, ChunkRecord& record)
+{
+	for (auto& link : record.links)
+	{
+		if (link.otherChunk == coordinate)
+			continue;
+
+		auto otherIterator = m_chunkRecords.find(link.otherChunk);
+		if (otherIterator == m_chunkRecords.end())
+			continue;
+
+		auto& otherLinks = otherIterator->second.links;
+		otherLinks.erase(remove_if(otherLinks.begin(), otherLinks.end(),
+			[&](const FragmentLink& otherLink) { return otherLink.otherChunk == coordinate; }), otherLinks.end());
+	}
+
+	record.links.clear();
+}
+
+// Tests the fragments of the changed chunks against those of every chunk whose fragments come within the merge gap.
+// A pair of changed chunks is tested once, from the lower coordinate.
+void PlaneDetector::LinkFragments(const vector<SurfaceChunkGrid::ChunkCoordinate>& changedChunks)
+{
+	set<SurfaceChunkGrid::ChunkCoordinate> changedSet(changedChunks.begin(), changedChunks.end());
+
+	for (auto& coordinate : changedChunks)
+	{
+		ChunkRecord& record = m_chunkRecords[coordinate];
+		if (record.fragments.empty())
+			continue;
+
+		XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+		for (auto& fragment : record.fragments)
+		{
+			for (auto& corner : fragment.corners)
+			{
+				boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&corner));
+				boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&corner));
+			}
+		}
+
+		XMVECTOR gap = XMVectorReplicate(m_settings.mergeGap * 0.5f + m_settings.distanceThreshold);
+		BoundingBox::CreateFromPoints(record.fragmentBounds, boundsMin - gap, boundsMax + gap);
+	}
+
+	for (auto& coordinate : changedChunks)
+	{
+		ChunkRecord& record = m_chunkRecords[coordinate];
+		if (record.fragments.empty())
+			continue;
+
+		for (auto& otherPair : m_chunkRecords)
+		{
+			ChunkRecord& otherRecord = otherPair.second;
+			bool isSameChunk = (otherPair.first == coordinate);
+			if (otherRecord.fragments.empty() || (!isSameChunk && otherPair.first < coordinate && changedSet.count(otherPair.first)))
+				continue;
+
+			if (!isSameChunk && !record.fragmentBounds.Intersects(otherRecord.fragmentBounds))
+				continue;
+
+			for (unsigned i = 0; i < (unsigned)record.fragments.size(); ++i)
+			{
+				for (unsigned j = isSameChunk ? i + 1 : 0; j < (unsigned)otherRecord.fragments.size(); ++j)
+				{
+					if (!FragmentsTouch(record.fragments[i], otherRecord.fragments[j]))
+						continue;
+
+					record.links.push_back({ i, otherPair.first, j });
+					if (!isSameChunk)
+						otherRecord.links.push_back({ j, coordinate, i });
+				}
+			}
+		}
+	}
+}
+
+void PlaneDetector::DetectFragments(const SurfaceChunkGrid::Chunk& chunk, vector<Fragment>& fragments) const
+{
+	auto& vertices = chunk.mesh->GetVertices();
+	auto& indices = chunk.mesh->GetIndices();
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	struct Triangle
+	{
+		XMFLOAT3 centroid;
+		XMFLOAT3 normal;
+		float area;
+		unsigned weldedVertices[3];
+		bool used;
+	};
+	vector<Triangle> triangles(triangleCount);
+
+	// Adjacency comes from vertex positions snapped to a small grid. Chunk meshes only weld vertices with matching normals,
+	//  and triangles from different patches meet at nearby rather than identical positions.
+	float weldScale = 3.0f / m_settings.distanceThreshold;
+	unordered_map<uint64_t, unsigned> weldLookup;
+	vector<XMFLOAT3> weldedPositions;
+	vector<vector<unsigned>> vertexTriangles;
+
+	float remainingArea = 0.0f;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		Triangle& triangle = triangles[t];
+
+		XMVECTOR p[3];
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			p[c] = vertices[indices[t * 3 + c]].position;
+
+			XMFLOAT3 position;
+			XMStoreFloat3(&position, p[c]);
+			uint64_t weldKey = ((uint64_t)((int)floorf(position.x * weldScale + 0.5f) & 0x1fffff) << 42) |
+				((uint64_t)((int)floorf(position.y * weldScale + 0.5f) & 0x1fffff) << 21) |
+				(uint64_t)((int)floorf(position.z * weldScale + 0.5f) & 0x1fffff);
+			auto insertResult = weldLookup.insert(make_pair(weldKey, (unsigned)weldedPositions.size()));
+			if (insertResult.second)
+			{
+				weldedPositions.push_back(position);
+				vertexTriangles.emplace_back();
+			}
+			triangle.weldedVertices[c] = insertResult.first->second;
+			vertexTriangles[insertResult.first->second].push_back((unsigned)t);
+		}
+
+		XMVECTOR cross = XMVector3Cross(p[1] - p[0], p[2] - p[0]);
+		float crossLength = XMVectorGetX(XMVector3Length(cross));
+
+		XMStoreFloat3(&triangle.centroid, (p[0] + p[1] + p[2]) / 3.0f);
+		XMStoreFloat3(&triangle.normal, (crossLength > 0.0f) ? cross / crossLength : XMVectorZero());
+		triangle.area = crossLength * 0.5f;
+		triangle.used = (crossLength <= 0.0f);
+
+		if (!triangle.used)
+			remainingArea += triangle.area;
+	}
+
+	auto isInlier = [&](const Triangle& triangle, const XMVECTOR& normal, float distance)
+	{
+		XMVECTOR triangleNormal = XMLoadFloat3(&triangle.normal);
+		XMVECTOR centroid = XMLoadFloat3(&triangle.centroid);
+		return XMVectorGetX(XMVector3Dot(triangleNormal, normal)) >= m_settings.normalThreshold &&
+			fabsf(XMVectorGetX(XMVector3Dot(centroid, normal)) - distance) <= m_settings.distanceThreshold;
+	};
+
+	// Deterministic per chunk, so an unchanged chunk always yields the same fragments
+	const auto& coordinate = chunk.coordinate;
+	minstd_rand random((unsigned)(coordinate.x * 73856093) ^ (unsigned)(coordinate.y * 19349663) ^ (unsigned)(coordinate.z * 83492791) ^ (unsigned)triangleCount);
+
+	vector<unsigned> remaining;
+	vector<unsigned> region;
+	vector<unsigned> regionQueue;
+	vector<bool> visited(triangleCount);
+
+	const unsigned maxFailedAttempts = 8;
+	unsigned failedAttempts = 0;
+	while (remainingArea >= m_settings.minFragmentArea && failedAttempts < maxFailedAttempts)
+	{
+		remaining.clear();
+		for (unsigned t = 0; t < (unsigned)triangleCount; ++t)
+		{
+			if (!triangles[t].used)
+				remaining.push_back(t);
+		}
+		if (remaining.empty())
+			break;
+
+		// RANSAC, each hypothesis is the plane of one sampled triangle and is scored by inlier area
+		unsigned bestSeed = 0;
+		float bestScore = 0.0f;
+		for (unsigned iteration = 0; iteration < m_settings.ransacIterations; ++iteration)
+		{
+			unsigned seed = remaining[random() % remaining.size()];
+			XMVECTOR normal = XMLoadFloat3(&triangles[seed].normal);
+			float distance = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&triangles[seed].centroid), normal));
+
+			float score = 0.0f;
+			for (unsigned t : remaining)
+			{
+				if (isInlier(triangles[t], normal, distance))
+					score += triangles[t].area;
+			}
+
+			if (score > bestScore)
+			{
+				bestScore = score;
+				bestSeed = seed;
+			}
+		}
+
+		if (bestScore < m_settings.minFragmentArea)
+			break;
+
+		// Refine the hypothesis with an area weighted fit over all of its inliers
+		XMVECTOR normal = XMLoadFloat3(&triangles[bestSeed].normal);
+		float distance = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&triangles[bestSeed].centroid), normal));
+		{
+			XMVECTOR normalSum = XMVectorZero();
+			XMVECTOR centroidSum = XMVectorZero();
+			float areaSum = 0.0f;
+			for (unsigned t : remaining)
+			{
+				if (!isInlier(triangles[t], normal, distance))
+					continue;
+
+				normalSum += XMLoadFloat3(&triangles[t].normal) * triangles[t].area;
+				centroidSum += XMLoadFloat3(&triangles[t].centroid) * triangles[t].area;
+				areaSum += triangles[t].area;
+			}
+
+			normal = XMVector3Normalize(normalSum);
+			distance = XMVectorGetX(XMVector3Dot(centroidSum / areaSum, normal));
+		}
+
+		// Region growing from the seed keeps only the connected part, so two tables at the same height stay separate
+		region.clear();
+		regionQueue.clear();
+		fill(visited.begin(), visited.end(), false);
+		regionQueue.push_back(bestSeed);
+		visited[bestSeed] = true;
+		while (!regionQueue.empty())
+		{
+			unsigned t = regionQueue.back();
+			regionQueue.pop_back();
+			region.push_back(t);
+
+			for (unsigned c = 0; c < 3; ++c)
+			{
+				for (unsigned neighbor : vertexTriangles[triangles[t].weldedVertices[c]])
+				{
+					if (visited[neighbor] || triangles[neighbor].used || !isInlier(triangles[neighbor], normal, distance))
+						continue;
+
+					visited[neighbor] = true;
+					regionQueue.push_back(neighbor);
+				}
+			}
+		}
+
+		float regionArea = 0.0f;
+		XMVECTOR normalSum = XMVectorZero();
+		XMVECTOR centroidSum = XMVectorZero();
+		for (unsigned t : region)
+		{
+			triangles[t].used = true;
+			regionArea += triangles[t].area;
+			normalSum += XMLoadFloat3(&triangles[t].normal) * triangles[t].area;
+			centroidSum += XMLoadFloat3(&triangles[t].centroid) * triangles[t].area;
+		}
+		remainingArea -= regionArea;
+
+		if (regionArea < m_settings.minFragmentArea)
+		{
+			++failedAttempts;
+			continue;
+		}
+
+		normal = XMVector3Normalize(normalSum);
+		distance = XMVectorGetX(XMVector3Dot(centroidSum / regionArea, normal));
+
+		XMVECTOR axisU, axisV;
+		GetPlaneAxes(normal, axisU, axisV);
+
+		float minU = FLT_MAX, maxU = -FLT_MAX, minV = FLT_MAX, maxV = -FLT_MAX;
+		for (unsigned t : region)
+		{
+			for (unsigned c = 0; c < 3; ++c)
+			{
+				XMVECTOR position = XMLoadFloat3(&weldedPositions[triangles[t].weldedVertices[c]]);
+				float u = XMVectorGetX(XMVector3Dot(position, axisU));
+				float v = XMVectorGetX(XMVector3Dot(position, axisV));
+				minU = min(minU, u);
+				maxU = max(maxU, u);
+				minV = min(minV, v);
+				maxV = max(maxV, v);
+			}
+		}
+
+		Fragment fragment;
+		XMStoreFloat3(&fragment.normal, normal);
+		fragment.distance = distance;
+		XMVECTOR origin = normal * distance;
+		XMStoreFloat3(&fragment.corners[0], origin + axisU * minU + axisV * minV);
+		XMStoreFloat3(&fragment.corners[1], origin + axisU * maxU + axisV * minV);
+		XMStoreFloat3(&fragment.corners[2], origin + axisU * maxU + axisV * maxV);
+		XMStoreFloat3(&fragment.corners[3], origin + axisU * minU + axisV * maxV);
+		fragment.area = regionArea;
+		XMStoreFloat3(&fragment.weightedCentroid, centroidSum);
+		fragments.push_back(fragment);
+
+		failedAttempts = 0;
+	}
+}
+
+// Coplanar, and within the merge gap of each other in the plane of a
+bool PlaneDetector::FragmentsTouch(const Fragment& a, const Fragment& b) const
+{
+	XMVECTOR normalA = XMLoadFloat3(&a.normal);
+	XMVECTOR normalB = XMLoadFloat3(&b.normal);
+	if (XMVectorGetX(XMVector3Dot(normalA, normalB)) < m_settings.normalThreshold)
+		return false;
+
+	XMVECTOR centroidA = XMLoadFloat3(&a.weightedCentroid) / a.area;
+	XMVECTOR centroidB = XMLoadFloat3(&b.weightedCentroid) / b.area;
+	if (fabsf(XMVectorGetX(XMVector3Dot(centroidB, normalA)) - a.distance) > 2.0f * m_settings.distanceThreshold ||
+		fabsf(XMVectorGetX(XMVector3Dot(centroidA, normalB)) - b.distance) > 2.0f * m_settings.distanceThreshold)
+		return false;
+
+	XMVECTOR axisU, axisV;
+	GetPlaneAxes(normalA, axisU, axisV);
+
+	float minUA = FLT_MAX, maxUA = -FLT_MAX, minVA = FLT_MAX, maxVA = -FLT_MAX;
+	float minUB = FLT_MAX, maxUB = -FLT_MAX, minVB = FLT_MAX, maxVB = -FLT_MAX;
+	for (unsigned c = 0; c < 4; ++c)
+	{
+		float u = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&a.corners[c]), axisU));
+		float v = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&a.corners[c]), axisV));
+		minUA = min(minUA, u);
+		maxUA = max(maxUA, u);
+		minVA = min(minVA, v);
+		maxVA = max(maxVA, v);
+
+		u = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&b.corners[c]), axisU));
+		v = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&b.corners[c]), axisV));
+		minUB = min(minUB, u);
+		maxUB = max(maxUB, u);
+		minVB = min(minVB, v);
+		maxVB = max(maxVB, v);
+	}
+
+	return minUB <= maxUA + m_settings.mergeGap && maxUB >= minUA - m_settings.mergeGap &&
+		minVB <= maxVA + m_settings.mergeGap && maxVB >= minVA - m_settings.mergeGap;
+}
+
+void PlaneDetector::MergeFragments(shared_ptr<PlaneSet> planeSet)
+{
+	vector<const Fragment*> allFragments;
+	for (auto& recordPair : m_chunkRecords)
+	{
+		recordPair.second.firstFragment = (unsigned)allFragments.size();
+		for (auto& fragment : recordPair.second.fragments)
+			allFragments.push_back(&fragment);
+	}
+
+	// Union find over the links kept by the chunks, linear in the fragment and link count
+	vector<unsigned> parents(allFragments.size());
+	for (unsigned i = 0; i < (unsigned)parents.size(); ++i)
+		parents[i] = i;
+
+	auto findRoot = [&](unsigned i)
+	{
+		while (parents[i] != i)
+		{
+			parents[i] = parents[parents[i]];
+			i = parents[i];
+		}
+		return i;
+	};
+
+	for (auto& recordPair : m_chunkRecords)
+	{
+		for (auto& link : recordPair.second.links)
+		{
+			// Links between two chunks are held by both, one of them is enough
+			if (link.otherChunk < recordPair.first)
+				continue;
+
+			auto otherIterator = m_chunkRecords.find(link.otherChunk);
+			assert(otherIterator != m_chunkRecords.end());
+
+			unsigned i = recordPair.second.firstFragment + link.fragment;
+			unsigned j = otherIterator->second.firstFragment + link.otherFragment;
+			parents[findRoot(j)] = findRoot(i);
+		}
+	}
+
+	map<unsigned, vector<unsigned>> groups;
+	for (unsigned i = 0; i < (unsigned)allFragments.size(); ++i)
+		groups[findRoot(i)].push_back(i);
+
+	auto& planes = planeSet->m_planes;
+	for (auto& groupPair : groups)
+	{
+		XMVECTOR normalSum = XMVectorZero();
+		XMVECTOR centroidSum = XMVectorZero();
+		float area = 0.0f;
+		for (unsigned i : groupPair.second)
+		{
+			normalSum += XMLoadFloat3(&allFragments[i]->normal) * allFragments[i]->area;
+			centroidSum += XMLoadFloat3(&allFragments[i]->weightedCentroid);
+			area += allFragments[i]->area;
+		}
+
+		if (area < m_settings.minPlaneArea)
+			continue;
+
+		XMVECTOR normal = XMVector3Normalize(normalSum);
+		float distance = XMVectorGetX(XMVector3Dot(centroidSum / area, normal));
+
+		XMVECTOR axisU, axisV;
+		GetPlaneAxes(normal, axisU, axisV);
+
+		float minU = FLT_MAX, maxU = -FLT_MAX, minV = FLT_MAX, maxV = -FLT_MAX;
+		for (unsigned i : groupPair.second)
+		{
+			for (auto& corner : allFragments[i]->corners)
+			{
+				float u = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&corner), axisU));
+				float v = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&corner), axisV));
+				minU = min(minU, u);
+				maxU = max(maxU, u);
+				minV = min(minV, v);
+				maxV = max(maxV, v);
+			}
+		}
+
+		Plane plane;
+		plane.id = 0;
+		XMStoreFloat3(&plane.normal, normal);
+		plane.distance = distance;
+		XMStoreFloat3(&plane.center, normal * distance + axisU * ((minU + maxU) * 0.5f) + axisV * ((minV + maxV) * 0.5f));
+		XMStoreFloat3(&plane.axisU, axisU);
+		XMStoreFloat3(&plane.axisV, axisV);
+		plane.halfExtents = XMFLOAT2((maxU - minU) * 0.5f, (maxV - minV) * 0.5f);
+		plane.area = area;
+		plane.isHorizontal = fabsf(plane.normal.y) >= m_settings.horizontalThreshold;
+		plane.isFacingUp = plane.normal.y > 0.0f;
+		planes.push_back(plane);
+	}
+
+	sort(planes.begin(), planes.end(), [](const Plane& a, const Plane& b) { return a.area > b.area; });
+}
+
+// Planes are rebuilt from scratch every pass, so IDs are carried over from the previous pass by matching
+//  orientation, offset and overlapping extents. Larger planes pick first.
+void PlaneDetector::AssignPersistentIDs(vector<Plane>& planes)
+{
+	vector<bool> claimed(m_previousPlanes.size(), false);
+
+	for (auto& plane : planes)
+	{
+		XMVECTOR normal = XMLoadFloat3(&plane.normal);
+		XMVECTOR center = XMLoadFloat3(&plane.center);
+
+		int bestMatch = -1;
+		float bestArea = 0.0f;
+		for (size_t i = 0; i < m_previousPlanes.size(); ++i)
+		{
+			const Plane& previous = m_previousPlanes[i];
+			if (claimed[i] || XMVectorGetX(XMVector3Dot(normal, XMLoadFloat3(&previous.normal))) < m_settings.normalThreshold ||
+				fabsf(XMVectorGetX(XMVector3Dot(XMLoadFloat3(&previous.center), normal)) - plane.distance) > 2.0f * m_settings.distanceThreshold)
+				continue;
+
+			XMVECTOR offset = XMLoadFloat3(&previous.center) - center;
+			if (fabsf(XMVectorGetX(XMVector3Dot(offset, XMLoadFloat3(&plane.axisU)))) > plane.halfExtents.x + m_settings.mergeGap ||
+				fabsf(XMVectorGetX(XMVector3Dot(offset, XMLoadFloat3(&plane.axisV)))) > plane.halfExtents.y + m_settings.mergeGap)
+				continue;
+
+			if (previous.area > bestArea)
+			{
+				bestArea = previous.area;
+				bestMatch = (int)i;
+			}
+		}
+
+		if (bestMatch >= 0)
+		{
+			claimed[bestMatch] = true;
+			plane.id = m_previousPlanes[bestMatch].id;
+		}
+		else
+		{
+			plane.id = m_nextPlaneID++;
+		}
+	}
+
+	m_previousPlanes = planes;
+}
+
+void PlaneDetector::BuildHorizontalCells(PlaneSet& planeSet) const
+{
+	planeSet.m_cellSize = m_settings.snapCellSize;
+
+	for (unsigned planeIndex = 0; planeIndex < (unsigned)planeSet.m_planes.size(); ++planeIndex)
+	{
+		const Plane& plane = planeSet.m_planes[planeIndex];
+		if (!plane.isHorizontal || !plane.isFacingUp)
+			continue;
+
+		XMVECTOR center = XMLoadFloat3(&plane.center);
+		XMVECTOR halfU = XMLoadFloat3(&plane.axisU) * plane.halfExtents.x;
+		XMVECTOR halfV = XMLoadFloat3(&plane.axisV) * plane.halfExtents.y;
+
+		XMVECTOR extentsMin = center, extentsMax = center;
+		XMVECTOR corners[4] = { center - halfU - halfV, center + halfU - halfV, center + halfU + halfV, center - halfU + halfV };
+		for (auto& corner : corners)
+		{
+			extentsMin = XMVectorMin(extentsMin, corner);
+			extentsMax = XMVectorMax(extentsMax, corner);
+		}
+
+		int minX = (int)floorf(XMVectorGetX(extentsMin) / planeSet.m_cellSize);
+		int maxX = (int)floorf(XMVectorGetX(extentsMax) / planeSet.m_cellSize);
+		int minZ = (int)floorf(XMVectorGetZ(extentsMin) / planeSet.m_cellSize);
+		int maxZ = (int)floorf(XMVectorGetZ(extentsMax) / planeSet.m_cellSize);
+		for (int x = minX; x <= maxX; ++x)
+		{
+			for (int z = minZ; z <= maxZ; ++z)
+				planeSet.m_horizontalCells[PlaneSet::PackCell(x, z)].push_back(planeIndex);
+		}
+	}
+}
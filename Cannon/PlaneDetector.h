@@ -0,0 +1,149 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "SurfaceChunkGrid.h"
+#include "Common/WorkerPool.h"
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+// Extracts planes (floors, tables, walls) from the surface chunk grid on its own thread.
+// Only chunks that were rebuilt since the last pass are re-fit: RANSAC over the chunk's triangles followed by region growing
+//  gives per chunk fragments, which are then merged across chunks into a persistent set of planes with stable IDs.
+// Which fragments touch is kept between passes, so only the fragments of changed chunks are tested against their surroundings.
+// Results are published as immutable snapshots, so readers on the render thread never wait on detection.
+class PlaneDetector
+{
+public:
+
+	struct Settings
+	{
+		float distanceThreshold = 0.03f;		// Max distance of an inlier triangle from the plane, in meters
+		float normalThreshold = 0.95f;			// Min dot between an inlier triangle normal and the plane normal
+		float minFragmentArea = 0.04f;			// Smallest per chunk region worth keeping, in square meters
+		float minPlaneArea = 0.16f;				// Smallest merged plane that gets published
+		float mergeGap = 0.1f;					// Fragments closer than this (in the plane) are merged
+		float horizontalThreshold = 0.97f;		// Min dot with world up (or down) for a plane to count as horizontal
+		float snapCellSize = 0.25f;				// Cell size of the horizontal plane lookup grid
+		unsigned ransacIterations = 64;
+		unsigned workerThreadCount = 0;			// 0 to use the hardware concurrency
+		unsigned updateIntervalMilliseconds = 200;
+	};
+
+	struct Plane
+	{
+		unsigned id;						// Stays the same while the plane is refined
+		DirectX::XMFLOAT3 normal;			// Facing free space
+		float distance;						// dot(normal, p) == distance for points on the plane
+		DirectX::XMFLOAT3 center;			// Center of the extents, on the plane
+		DirectX::XMFLOAT3 axisU, axisV;		// In plane axes the extents are measured along
+		DirectX::XMFLOAT2 halfExtents;		// Along axisU and axisV
+		float area;							// Area of the triangles supporting the plane, not of the extents
+		bool isHorizontal;
+		bool isFacingUp;
+	};
+
+	// Immutable snapshot of the detected planes
+	class PlaneSet
+	{
+	public:
+
+		const std::vector<Plane>& GetPlanes() const { return m_planes; }
+		unsigned GetVersion() const { return m_version; }
+
+		// Finds the upward facing horizontal plane below or above position (within maxVerticalDistance) whose extents contain it.
+		// Constant time, a cell lookup followed by a handful of candidates.
+		bool SnapToHorizontalPlane(const DirectX::XMVECTOR& position, float maxVerticalDistance, DirectX::XMVECTOR& snappedPosition, const Plane** ppPlane = nullptr) const;
+
+	private:
+
+		friend class PlaneDetector;
+
+		static uint64_t PackCell(int x, int z);
+
+		std::vector<Plane> m_planes;
+		std::unordered_map<uint64_t, std::vector<unsigned>> m_horizontalCells;	// Plane indices overlapping each x/z cell
+		float m_cellSize = 0.25f;
+		unsigned m_version = 0;
+	};
+
+	PlaneDetector(SurfaceChunkGrid& chunkGrid);
+	PlaneDetector(SurfaceChunkGrid& chunkGrid, const Settings& settings);
+	~PlaneDetector();
+
+	const Settings& GetSettings() const { return m_settings; }
+
+	// Safe to call from any thread
+	std::shared_ptr<const PlaneSet> GetPlanes();
+	bool SnapToHorizontalPlane(const DirectX::XMVECTOR& position, float maxVerticalDistance, DirectX::XMVECTOR& snappedPosition);
+
+private:
+
+	// A planar region found inside a single chunk
+	struct Fragment
+	{
+		DirectX::XMFLOAT3 normal;
+		float distance;
+		DirectX::XMFLOAT3 corners[4];		// In plane rectangle around the region's vertices
+		float area;
+		DirectX::XMFLOAT3 weightedCentroid;	// Centroid times area, for merging
+	};
+
+	// Two fragments that touch, one in the chunk holding the link and one in otherChunk (which can be the same chunk).
+	// Links between different chunks are held by both, so either can drop them when it changes.
+	struct FragmentLink
+	{
+		unsigned fragment;
+		SurfaceChunkGrid::ChunkCoordinate otherChunk;
+		unsigned otherFragment;
+	};
+
+	struct ChunkRecord
+	{
+		std::shared_ptr<const SurfaceChunkGrid::Chunk> chunk;
+		std::vector<Fragment> fragments;
+		DirectX::BoundingBox fragmentBounds;	// Around the corners of all fragments, grown by the merge gap
+		std::vector<FragmentLink> links;		// Only re-tested when this chunk or the other one changes
+		unsigned firstFragment;					// Index of the first fragment within a merge pass
+	};
+
+	void ThreadFunction();
+	bool UpdateChangedChunks();
+	void DetectFragments(const SurfaceChunkGrid::Chunk& chunk, std::vector<Fragment>& fragments) const;
+	void RemoveFragmentLinks(const SurfaceChunkGrid::ChunkCoordinate& coordinate, ChunkRecord& record);
+	void LinkFragments(const std::vector<SurfaceChunkGrid::ChunkCoordinate>& changedChunks);
+	bool FragmentsTouch(const Fragment& a, const Fragment& b) const;
+	void MergeFragments(std::shared_ptr<PlaneSet> planeSet);
+	void AssignPersistentIDs(std::vector<Plane>& planes);
+	void BuildHorizontalCells(PlaneSet& planeSet) const;
+
+	static void GetPlaneAxes(const DirectX::XMVECTOR& normal, DirectX::XMVECTOR& axisU, DirectX::XMVECTOR& axisV);
+
+	Settings m_settings;
+	SurfaceChunkGrid& m_chunkGrid;
+
+	// Only touched by the detection thread
+	std::map<SurfaceChunkGrid::ChunkCoordinate, ChunkRecord> m_chunkRecords;
+	std::vector<std::shared_ptr<const SurfaceChunkGrid::Chunk>> m_chunkScratchList;
+	std::vector<Plane> m_previousPlanes;
+	unsigned m_nextPlaneID;
+	WorkerPool m_workers;
+
+	std::shared_ptr<const PlaneSet> m_planeSet;
+	std::mutex m_planeSetMutex;
+
+	std::atomic<bool> m_stopThread;
+	std::unique_ptr<std::thread> m_thread;
+};
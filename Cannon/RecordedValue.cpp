@@ -15,7 +15,11 @@
 #include "RecordedValue.h"
 
 
-RecordedValue::RecordedValue()
+// Frame interval assumed when values are recorded without a timestamp
+static const long long s_DefaultFrameTicks = 10000000 / 60;
+
+RecordedValue::RecordedValue() :
+	m_FilterType(FilterType::DoubleExponential)
 {
 	Reset();
 }
@@ -47,10 +51,18 @@ void RecordedValue::Reset()
 {
 	m_CurRecordedFrame = 0;
 	m_RecordedFrameCount = 0;
+	m_LastTimestamp = 0;
 	m_RecordedValueFilter.Reset();
+	m_OneEuroFilter.Reset();
+	m_KalmanFilter.Reset();
 }
 
 void RecordedValue::RecordValue(XMVECTOR Value)
+{
+	RecordValue(Value, m_LastTimestamp + s_DefaultFrameTicks);
+}
+
+void RecordedValue::RecordValue(XMVECTOR Value, long long Timestamp)
 {
     m_CurRecordedFrame = (m_CurRecordedFrame+1) %s_MaxFrames;
     if(m_RecordedFrameCount < s_MaxFrames)
@@ -58,8 +70,48 @@ void RecordedValue::RecordValue(XMVECTOR Value)
 
     m_RecordedValues[m_CurRecordedFrame] = Value;
 
-    m_RecordedValueFilter.Update(Value);
-    m_SmoothedRecordedValues[m_CurRecordedFrame] = m_RecordedValueFilter.GetFilteredValue();
+    m_LastTimestamp = Timestamp;
+
+    switch (m_FilterType)
+    {
+    case FilterType::OneEuro:
+        m_OneEuroFilter.Update(Value, Timestamp);
+        m_SmoothedRecordedValues[m_CurRecordedFrame] = m_OneEuroFilter.GetFilteredValue();
+        break;
+    case FilterType::KalmanConstantVelocity:
+        m_KalmanFilter.Update(Value, Timestamp);
+        m_SmoothedRecordedValues[m_CurRecordedFrame] = m_KalmanFilter.GetFilteredValue();
+        break;
+    default:
+        m_RecordedValueFilter.Update(Value);
+        m_SmoothedRecordedValues[m_CurRecordedFrame] = m_RecordedValueFilter.GetFilteredValue();
+        break;
+    }
+}
+
+XMVECTOR RecordedValue::GetPredictedValue(long long DisplayTimestamp) const
+{
+    if (m_RecordedFrameCount == 0)
+        return XMVectorZero();
+
+    // The double exponential filter predicts a fixed number of frames ahead instead, see SetSmoothingParameters
+    switch (m_FilterType)
+    {
+    case FilterType::OneEuro:
+        return m_OneEuroFilter.GetPredictedValue(DisplayTimestamp);
+    case FilterType::KalmanConstantVelocity:
+        return m_KalmanFilter.GetPredictedValue(DisplayTimestamp);
+    default:
+        return m_SmoothedRecordedValues[m_CurRecordedFrame];
+    }
+}
+
+void RecordedValue::SetFilterType(FilterType Type)
+{
+	m_FilterType = Type;
+	m_RecordedValueFilter.Reset();
+	m_OneEuroFilter.Reset();
+	m_KalmanFilter.Reset();
 }
 
 void RecordedValue::SetSmoothingParameters(float smoothing, float correction, float prediction, float jitterRadius, float maxDeviationRadius)
@@ -67,3 +119,12 @@ void RecordedValue::SetSmoothingParameters(float smoothing, float correction, fl
 	m_RecordedValueFilter.SetParameters(smoothing, correction, prediction, jitterRadius, maxDeviationRadius);
 }
 
+void RecordedValue::SetOneEuroParameters(float minCutoff, float beta, float derivativeCutoff, float maxPredictionTime)
+{
+	m_OneEuroFilter.SetParameters(minCutoff, beta, derivativeCutoff, maxPredictionTime);
+}
+
+void RecordedValue::SetKalmanParameters(float processNoise, float measurementNoise, float maxPredictionTime)
+{
+	m_KalmanFilter.SetParameters(processNoise, measurementNoise, maxPredictionTime);
+}
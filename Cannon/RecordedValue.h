@@ -13,6 +13,8 @@
 #pragma once
 
 #include "Common/FilterDoubleExponential.h"
+#include "Common/FilterOneEuro.h"
+#include "Common/FilterKalmanConstantVelocity.h"
 
 using namespace DirectX;
 
@@ -21,6 +23,13 @@ class RecordedValue
 {
 public:
 
+	enum class FilterType
+	{
+		DoubleExponential,
+		OneEuro,
+		KalmanConstantVelocity
+	};
+
 	RecordedValue();
 	void Reset();
 
@@ -28,7 +37,15 @@ public:
 	XMVECTOR GetValue(int FramesAgo) const;	
 	XMVECTOR GetSmoothedValue(int FramesAgo) const;
 	void RecordValue(XMVECTOR Value);	
+	void RecordValue(XMVECTOR Value, long long Timestamp);	// Timestamp in 100 ns ticks, e.g. the hand's lastTimestamp
+	XMVECTOR GetPredictedValue(long long DisplayTimestamp) const;	// Smoothed value extrapolated to DisplayTimestamp
+
+	// Changing the filter type resets the smoothed values
+	void SetFilterType(FilterType Type);
+	FilterType GetFilterType() const { return m_FilterType; }
 	void SetSmoothingParameters(float smoothing = 0.25f, float correction = 0.0f, float prediction = 0.0f, float jitterRadius = 0.05f, float maxDeviationRadius = 0.05f);
+	void SetOneEuroParameters(float minCutoff = 1.0f, float beta = 5.0f, float derivativeCutoff = 1.0f, float maxPredictionTime = 0.05f);
+	void SetKalmanParameters(float processNoise = 2.0f, float measurementNoise = 0.006f, float maxPredictionTime = 0.05f);
 
 private:
 	static const int s_MaxFrames = 60;
@@ -37,5 +54,9 @@ private:
 	XMVECTOR m_SmoothedRecordedValues[s_MaxFrames];
 	int m_CurRecordedFrame;
 	int m_RecordedFrameCount;
+	long long m_LastTimestamp;
+	FilterType m_FilterType;
 	FilterDoubleExponential m_RecordedValueFilter;
+	FilterOneEuro m_OneEuroFilter;
+	FilterKalmanConstantVelocity m_KalmanFilter;
 };
@@ -0,0 +1,674 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "RenderContext.h"
+
+#include <cassert>
+
+using namespace std;
+
+//
+// D3D11RenderContext
+//
+
+D3D11RenderContext::D3D11RenderContext(ID3D11DeviceContext* context) :
+	m_context(context)
+{
+	assert(context);
+}
+
+bool D3D11RenderContext::IsDeferred() const
+{
+	return m_context->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED;
+}
+
+unique_ptr<RenderContext> D3D11RenderContext::CreateDeferredContext()
+{
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	m_context->GetDevice(&device);
+
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> deferredContext;
+	if (!device || FAILED(device->CreateDeferredContext(0, &deferredContext)))
+		return nullptr;
+
+	return make_unique<D3D11RenderContext>(deferredContext.Get());
+}
+
+bool D3D11RenderContext::FinishCommandList()
+{
+	assert(IsDeferred());
+
+	m_commandList.Reset();
+	return SUCCEEDED(m_context->FinishCommandList(FALSE, &m_commandList));
+}
+
+void D3D11RenderContext::ExecuteCommandList(RenderContext& deferredContext)
+{
+	D3D11RenderContext& d3dDeferredContext = static_cast<D3D11RenderContext&>(deferredContext);
+	if (d3dDeferredContext.m_commandList)
+		m_context->ExecuteCommandList(d3dDeferredContext.m_commandList.Get(), TRUE);
+
+	d3dDeferredContext.m_commandList.Reset();
+}
+
+void D3D11RenderContext::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	m_context->IASetInputLayout(inputLayout);
+}
+
+void D3D11RenderContext::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	m_context->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+}
+
+void D3D11RenderContext::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	m_context->IASetIndexBuffer(buffer, format, offset);
+}
+
+void D3D11RenderContext::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	m_context->IASetPrimitiveTopology(topology);
+}
+
+void D3D11RenderContext::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	m_context->VSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void D3D11RenderContext::GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	m_context->GSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void D3D11RenderContext::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	m_context->PSSetShader(shader, classInstances, classInstanceCount);
+}
+
+void D3D11RenderContext::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	m_context->VSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void D3D11RenderContext::GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	m_context->GSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void D3D11RenderContext::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	m_context->PSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void D3D11RenderContext::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	m_context->VSSetShaderResources(startSlot, count, views);
+}
+
+void D3D11RenderContext::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	m_context->PSSetShaderResources(startSlot, count, views);
+}
+
+void D3D11RenderContext::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	m_context->VSSetSamplers(startSlot, count, samplers);
+}
+
+void D3D11RenderContext::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	m_context->PSSetSamplers(startSlot, count, samplers);
+}
+
+void D3D11RenderContext::OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView)
+{
+	m_context->OMSetRenderTargets(count, renderTargetViews, depthStencilView);
+}
+
+void D3D11RenderContext::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	m_context->OMSetBlendState(blendState, blendFactor, sampleMask);
+}
+
+void D3D11RenderContext::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+	m_context->OMSetDepthStencilState(depthStencilState, stencilRef);
+}
+
+void D3D11RenderContext::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+	m_context->RSSetState(rasterizerState);
+}
+
+void D3D11RenderContext::RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports)
+{
+	m_context->RSSetViewports(count, viewports);
+}
+
+void D3D11RenderContext::DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	m_context->DrawIndexedInstanced(indexCountPerInstance, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+void D3D11RenderContext::ClearRenderTargetView(ID3D11RenderTargetView* renderTargetView, const FLOAT color[4])
+{
+	m_context->ClearRenderTargetView(renderTargetView, color);
+}
+
+void D3D11RenderContext::ClearDepthStencilView(ID3D11DepthStencilView* depthStencilView, UINT clearFlags, FLOAT depth, UINT8 stencil)
+{
+	m_context->ClearDepthStencilView(depthStencilView, clearFlags, depth, stencil);
+}
+
+HRESULT D3D11RenderContext::Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT mapFlags, D3D11_MAPPED_SUBRESOURCE* mapped)
+{
+	return m_context->Map(resource, subresource, mapType, mapFlags, mapped);
+}
+
+void D3D11RenderContext::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+	m_context->Unmap(resource, subresource);
+}
+
+void D3D11RenderContext::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch)
+{
+	m_context->UpdateSubresource(resource, subresource, box, data, rowPitch, depthPitch);
+}
+
+void D3D11RenderContext::CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z, ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox)
+{
+	m_context->CopySubresourceRegion(destination, destinationSubresource, x, y, z, source, sourceSubresource, sourceBox);
+}
+
+void D3D11RenderContext::End(ID3D11Asynchronous* async)
+{
+	m_context->End(async);
+}
+
+HRESULT D3D11RenderContext::GetData(ID3D11Asynchronous* async, void* data, UINT size, UINT flags)
+{
+	return m_context->GetData(async, data, size, flags);
+}
+
+//
+// NullRenderContext
+//
+
+NullRenderContext::NullRenderContext() :
+	NullRenderContext(false)
+{
+}
+
+NullRenderContext::NullRenderContext(bool isDeferred) :
+	m_isDeferred(isDeferred),
+	m_isFinished(false)
+{
+}
+
+void NullRenderContext::ResetStats()
+{
+	m_commands.clear();
+	m_errors.clear();
+	m_stats = Stats();
+}
+
+const char* NullRenderContext::GetCommandName(CommandType type)
+{
+	static const char* names[COMMAND_TYPE_COUNT] =
+	{
+		"InputLayout",
+		"VertexBuffers",
+		"IndexBuffer",
+		"Topology",
+		"Shader",
+		"ConstantBuffers",
+		"ShaderResources",
+		"Samplers",
+		"RenderTargets",
+		"PipelineState",
+		"Viewports",
+		"Draw",
+		"Clear",
+		"Map",
+		"Unmap",
+		"UpdateSubresource",
+		"Copy",
+		"Query",
+		"ExecuteCommandList",
+	};
+
+	return type < COMMAND_TYPE_COUNT ? names[type] : "Unknown";
+}
+
+bool NullRenderContext::IsDeferred() const
+{
+	return m_isDeferred;
+}
+
+unique_ptr<RenderContext> NullRenderContext::CreateDeferredContext()
+{
+	assert(!m_isDeferred);
+	return make_unique<NullRenderContext>(true);
+}
+
+bool NullRenderContext::FinishCommandList()
+{
+	assert(m_isDeferred);
+
+	for (auto& memory : m_mappedMemory)
+	{
+		if (memory.second.isMapped)
+		{
+			Error("FinishCommandList with a resource still mapped");
+			memory.second.isMapped = false;
+		}
+	}
+
+	// Like D3D11, the next command list starts from default state
+	m_boundState = BoundState();
+	m_discardedResources.clear();
+	m_isFinished = true;
+	return true;
+}
+
+void NullRenderContext::ExecuteCommandList(RenderContext& deferredContext)
+{
+	assert(!m_isDeferred && deferredContext.IsDeferred());
+
+	NullRenderContext& nullDeferredContext = static_cast<NullRenderContext&>(deferredContext);
+	if (!nullDeferredContext.m_isFinished)
+	{
+		Error("ExecuteCommandList of a deferred context that has not finished its command list");
+		return;
+	}
+
+	for (const Command& command : nullDeferredContext.m_commands)
+	{
+		if (m_commands.size() < kMaxLoggedCommands)
+			m_commands.push_back(command);
+	}
+
+	for (const string& error : nullDeferredContext.m_errors)
+		Error(error);
+
+	const Stats& deferredStats = nullDeferredContext.m_stats;
+	for (unsigned type = 0; type < COMMAND_TYPE_COUNT; ++type)
+		m_stats.commandCounts[type] += deferredStats.commandCounts[type];
+
+	m_stats.draws += deferredStats.draws;
+	m_stats.indices += deferredStats.indices;
+	m_stats.instances += deferredStats.instances;
+	m_stats.bytesMapped += deferredStats.bytesMapped;
+	m_stats.bytesUpdated += deferredStats.bytesUpdated;
+	m_stats.bytesCopied += deferredStats.bytesCopied;
+	m_stats.errors += deferredStats.errors - (unsigned) nullDeferredContext.m_errors.size();	// The kept ones were counted by Error
+
+	nullDeferredContext.ResetStats();
+	nullDeferredContext.m_isFinished = false;
+
+	Record(COMMAND_EXECUTE_COMMAND_LIST);
+	++m_stats.commandListsExecuted;
+}
+
+void NullRenderContext::IASetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	m_boundState.inputLayout = inputLayout;
+	Record(COMMAND_INPUT_LAYOUT);
+}
+
+void NullRenderContext::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	for (UINT slot = startSlot; slot < startSlot + count && slot < kVertexBufferSlots; ++slot)
+		m_boundState.vertexBuffers[slot] = buffers[slot - startSlot];
+
+	Record(COMMAND_VERTEX_BUFFERS);
+}
+
+void NullRenderContext::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	m_boundState.indexBuffer = buffer;
+	Record(COMMAND_INDEX_BUFFER);
+}
+
+void NullRenderContext::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	Record(COMMAND_TOPOLOGY);
+}
+
+void NullRenderContext::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	m_boundState.vertexShader = shader;
+	Record(COMMAND_SHADER);
+}
+
+void NullRenderContext::GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	Record(COMMAND_SHADER);
+}
+
+void NullRenderContext::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount)
+{
+	m_boundState.pixelShader = shader;
+	Record(COMMAND_SHADER);
+}
+
+void NullRenderContext::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	BindConstantBuffers(0, startSlot, count, buffers);
+}
+
+void NullRenderContext::GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	BindConstantBuffers(1, startSlot, count, buffers);
+}
+
+void NullRenderContext::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	BindConstantBuffers(2, startSlot, count, buffers);
+}
+
+void NullRenderContext::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	Record(COMMAND_SHADER_RESOURCES);
+}
+
+void NullRenderContext::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	Record(COMMAND_SHADER_RESOURCES);
+}
+
+void NullRenderContext::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	Record(COMMAND_SAMPLERS);
+}
+
+void NullRenderContext::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	Record(COMMAND_SAMPLERS);
+}
+
+void NullRenderContext::OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView)
+{
+	m_boundState.renderTargetCount = 0;
+	for (UINT index = 0; index < count; ++index)
+	{
+		if (renderTargetViews[index])
+			++m_boundState.renderTargetCount;
+	}
+
+	m_boundState.depthStencilView = depthStencilView;
+	Record(COMMAND_RENDER_TARGETS);
+}
+
+void NullRenderContext::OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	Record(COMMAND_PIPELINE_STATE);
+}
+
+void NullRenderContext::OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+	Record(COMMAND_PIPELINE_STATE);
+}
+
+void NullRenderContext::RSSetState(ID3D11RasterizerState* rasterizerState)
+{
+	Record(COMMAND_PIPELINE_STATE);
+}
+
+void NullRenderContext::RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports)
+{
+	m_boundState.viewportCount = count;
+	Record(COMMAND_VIEWPORTS);
+}
+
+void NullRenderContext::DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	Record(COMMAND_DRAW);
+	++m_stats.draws;
+	m_stats.indices += (uint64_t) indexCountPerInstance * instanceCount;
+	m_stats.instances += instanceCount;
+
+	if (!m_boundState.inputLayout)
+		Error("Draw without an input layout");
+	if (!m_boundState.vertexShader)
+		Error("Draw without a vertex shader");
+	if (!m_boundState.vertexBuffers[0])
+		Error("Draw without a vertex buffer");
+	if (!m_boundState.indexBuffer)
+		Error("Draw without an index buffer");
+	if (m_boundState.renderTargetCount == 0 && !m_boundState.depthStencilView)
+		Error("Draw without a render target or depth stencil view");
+	if (m_boundState.viewportCount == 0)
+		Error("Draw without a viewport");
+
+	bool isBufferMapped = IsMapped(m_boundState.indexBuffer);
+	for (ID3D11Buffer* buffer : m_boundState.vertexBuffers)
+		isBufferMapped = isBufferMapped || IsMapped(buffer);
+	for (auto& stageBuffers : m_boundState.constantBuffers)
+	{
+		for (ID3D11Buffer* buffer : stageBuffers)
+			isBufferMapped = isBufferMapped || IsMapped(buffer);
+	}
+
+	if (isBufferMapped)
+		Error("Draw with a bound buffer still mapped");
+}
+
+void NullRenderContext::ClearRenderTargetView(ID3D11RenderTargetView* renderTargetView, const FLOAT color[4])
+{
+	Record(COMMAND_CLEAR);
+}
+
+void NullRenderContext::ClearDepthStencilView(ID3D11DepthStencilView* depthStencilView, UINT clearFlags, FLOAT depth, UINT8 stencil)
+{
+	Record(COMMAND_CLEAR);
+}
+
+HRESULT NullRenderContext::Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT mapFlags, D3D11_MAPPED_SUBRESOURCE* mapped)
+{
+	UINT rowPitch = 0;
+	UINT size = GetByteSize(resource, &rowPitch);
+	if (size == 0 || !mapped)
+	{
+		Error("Map of a resource that cannot be mapped");
+		return E_INVALIDARG;
+	}
+
+	MappedMemory& memory = m_mappedMemory[resource];
+	if (memory.isMapped)
+	{
+		Error("Map of a resource that is already mapped");
+		return E_FAIL;
+	}
+
+	// Deferred contexts can only write, and the first write to a resource in a command list has to discard it
+	if (m_isDeferred)
+	{
+		if (mapType == D3D11_MAP_WRITE_DISCARD)
+			m_discardedResources.insert(resource);
+		else if (mapType != D3D11_MAP_WRITE_NO_OVERWRITE)
+			Error("Map on a deferred context that does not discard or write without overwriting");
+		else if (m_discardedResources.find(resource) == m_discardedResources.end())
+			Error("Map on a deferred context without overwriting, before the resource was discarded");
+	}
+
+	if (memory.data.size() < size)
+		memory.data.resize(size);
+
+	memory.isMapped = true;
+	mapped->pData = memory.data.data();
+	mapped->RowPitch = rowPitch;
+	mapped->DepthPitch = size;
+
+	Record(COMMAND_MAP, size);
+	if (mapType != D3D11_MAP_READ)
+		m_stats.bytesMapped += size;
+
+	return S_OK;
+}
+
+void NullRenderContext::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+	auto it = m_mappedMemory.find(resource);
+	if (it == m_mappedMemory.end() || !it->second.isMapped)
+		Error("Unmap of a resource that is not mapped");
+	else
+		it->second.isMapped = false;
+
+	Record(COMMAND_UNMAP);
+}
+
+void NullRenderContext::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch)
+{
+	if (IsMapped(resource))
+		Error("UpdateSubresource of a resource that is mapped");
+
+	UINT size;
+	if (box)
+	{
+		D3D11_RESOURCE_DIMENSION dimension;
+		resource->GetType(&dimension);
+		if (dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+			size = box->right - box->left;
+		else
+			size = rowPitch * (box->bottom - box->top) * (box->back - box->front);
+	}
+	else
+	{
+		size = GetByteSize(resource, nullptr);
+	}
+
+	Record(COMMAND_UPDATE_SUBRESOURCE, size);
+	m_stats.bytesUpdated += size;
+}
+
+void NullRenderContext::CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z, ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox)
+{
+	if (IsMapped(destination) || IsMapped(source))
+		Error("CopySubresourceRegion of a resource that is mapped");
+
+	UINT size = GetByteSize(source, nullptr);
+	Record(COMMAND_COPY, size);
+	m_stats.bytesCopied += size;
+}
+
+void NullRenderContext::End(ID3D11Asynchronous* async)
+{
+	Record(COMMAND_QUERY);
+}
+
+HRESULT NullRenderContext::GetData(ID3D11Asynchronous* async, void* data, UINT size, UINT flags)
+{
+	if (data)
+		memset(data, 0, size);
+
+	return S_OK;
+}
+
+void NullRenderContext::Record(CommandType type, UINT bytes)
+{
+	++m_stats.commandCounts[type];
+	if (m_commands.size() < kMaxLoggedCommands)
+		m_commands.push_back({ type, bytes });
+}
+
+void NullRenderContext::Error(const string& message)
+{
+	++m_stats.errors;
+	if (m_errors.size() < kMaxErrors)
+		m_errors.push_back(message);
+}
+
+void NullRenderContext::BindConstantBuffers(unsigned stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	for (UINT slot = startSlot; slot < startSlot + count && slot < kConstantBufferSlots; ++slot)
+		m_boundState.constantBuffers[stage][slot] = buffers[slot - startSlot];
+
+	Record(COMMAND_CONSTANT_BUFFERS);
+}
+
+bool NullRenderContext::IsMapped(ID3D11Resource* resource) const
+{
+	if (!resource)
+		return false;
+
+	auto it = m_mappedMemory.find(resource);
+	return it != m_mappedMemory.end() && it->second.isMapped;
+}
+
+// Of the first subresource, which is the only one the engine maps
+UINT NullRenderContext::GetByteSize(ID3D11Resource* resource, UINT* rowPitch)
+{
+	if (rowPitch)
+		*rowPitch = 0;
+
+	if (!resource)
+		return 0;
+
+	D3D11_RESOURCE_DIMENSION dimension;
+	resource->GetType(&dimension);
+
+	if (dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+	{
+		D3D11_BUFFER_DESC desc;
+		static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+		if (rowPitch)
+			*rowPitch = desc.ByteWidth;
+		return desc.ByteWidth;
+	}
+
+	if (dimension == D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+
+		UINT bytesPerPixel;
+		switch (desc.Format)
+		{
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		case DXGI_FORMAT_R32G32B32A32_UINT:
+			bytesPerPixel = 16;
+			break;
+		case DXGI_FORMAT_R32G32B32_FLOAT:
+			bytesPerPixel = 12;
+			break;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		case DXGI_FORMAT_R16G16B16A16_UNORM:
+		case DXGI_FORMAT_R32G32_FLOAT:
+			bytesPerPixel = 8;
+			break;
+		case DXGI_FORMAT_R16_FLOAT:
+		case DXGI_FORMAT_R16_UNORM:
+		case DXGI_FORMAT_R16_TYPELESS:
+		case DXGI_FORMAT_D16_UNORM:
+		case DXGI_FORMAT_R8G8_UNORM:
+			bytesPerPixel = 2;
+			break;
+		case DXGI_FORMAT_R8_UNORM:
+		case DXGI_FORMAT_A8_UNORM:
+			bytesPerPixel = 1;
+			break;
+		default:
+			bytesPerPixel = 4;		// Most of what the engine uses, 8 bit color and 32 bit depth
+			break;
+		}
+
+		if (rowPitch)
+			*rowPitch = desc.Width * bytesPerPixel;
+		return desc.Width * desc.Height * bytesPerPixel;
+	}
+
+	return 0;
+}
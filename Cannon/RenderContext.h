@@ -0,0 +1,272 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// What DrawCall, Texture2D, Shader and the mesh and upload buffers send their commands to.
+// The methods are the part of ID3D11DeviceContext the engine uses, with the same names and arguments, so the code
+//  that records commands reads the same whichever backend is behind it.
+// A deferred context keeps its command list when recording finishes, and the immediate context it was created from
+//  runs that list with ExecuteCommandList.
+class RenderContext
+{
+public:
+
+	virtual ~RenderContext() {}
+
+	virtual bool IsDeferred() const = 0;
+	virtual std::unique_ptr<RenderContext> CreateDeferredContext() = 0;	// Null if the backend has none
+	virtual bool FinishCommandList() = 0;
+	virtual void ExecuteCommandList(RenderContext& deferredContext) = 0;	// State is restored after the list runs
+
+	virtual void IASetInputLayout(ID3D11InputLayout* inputLayout) = 0;
+	virtual void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) = 0;
+	virtual void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) = 0;
+	virtual void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) = 0;
+
+	virtual void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) = 0;
+	virtual void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) = 0;
+	virtual void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) = 0;
+	virtual void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) = 0;
+	virtual void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) = 0;
+	virtual void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) = 0;
+	virtual void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) = 0;
+	virtual void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) = 0;
+
+	virtual void OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView) = 0;
+	virtual void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) = 0;
+	virtual void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) = 0;
+	virtual void RSSetState(ID3D11RasterizerState* rasterizerState) = 0;
+	virtual void RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports) = 0;
+
+	virtual void DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) = 0;
+	virtual void ClearRenderTargetView(ID3D11RenderTargetView* renderTargetView, const FLOAT color[4]) = 0;
+	virtual void ClearDepthStencilView(ID3D11DepthStencilView* depthStencilView, UINT clearFlags, FLOAT depth, UINT8 stencil) = 0;
+
+	virtual HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT mapFlags, D3D11_MAPPED_SUBRESOURCE* mapped) = 0;
+	virtual void Unmap(ID3D11Resource* resource, UINT subresource) = 0;
+	virtual void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch) = 0;
+	virtual void CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z, ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox) = 0;
+
+	virtual void End(ID3D11Asynchronous* async) = 0;
+	virtual HRESULT GetData(ID3D11Asynchronous* async, void* data, UINT size, UINT flags) = 0;
+};
+
+// Forwards everything to a D3D11 device context
+class D3D11RenderContext : public RenderContext
+{
+public:
+
+	explicit D3D11RenderContext(ID3D11DeviceContext* context);
+
+	ID3D11DeviceContext* GetD3DContext() const { return m_context.Get(); }
+
+	bool IsDeferred() const override;
+	std::unique_ptr<RenderContext> CreateDeferredContext() override;
+	bool FinishCommandList() override;
+	void ExecuteCommandList(RenderContext& deferredContext) override;
+
+	void IASetInputLayout(ID3D11InputLayout* inputLayout) override;
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) override;
+	void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) override;
+
+	void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView) override;
+	void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) override;
+	void RSSetState(ID3D11RasterizerState* rasterizerState) override;
+	void RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports) override;
+
+	void DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+	void ClearRenderTargetView(ID3D11RenderTargetView* renderTargetView, const FLOAT color[4]) override;
+	void ClearDepthStencilView(ID3D11DepthStencilView* depthStencilView, UINT clearFlags, FLOAT depth, UINT8 stencil) override;
+
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT mapFlags, D3D11_MAPPED_SUBRESOURCE* mapped) override;
+	void Unmap(ID3D11Resource* resource, UINT subresource) override;
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch) override;
+	void CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z, ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox) override;
+
+	void End(ID3D11Asynchronous* async) override;
+	HRESULT GetData(ID3D11Asynchronous* async, void* data, UINT size, UINT flags) override;
+
+private:
+
+	::Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_context;
+	::Microsoft::WRL::ComPtr<ID3D11CommandList> m_commandList;		// Of a deferred context, until it is executed
+};
+
+// Runs nothing. Records each command and what it would have sent to the GPU, and checks the state a draw needs is
+//  bound and that maps are used the way D3D11 allows, so the CPU side of a frame can be profiled and checked on a
+//  machine without a GPU.
+// Map hands out CPU memory of the size of the resource, kept per resource so what is written can be read back.
+// Queries are always done, so nothing waits on them.
+class NullRenderContext : public RenderContext
+{
+public:
+
+	enum CommandType
+	{
+		COMMAND_INPUT_LAYOUT,
+		COMMAND_VERTEX_BUFFERS,
+		COMMAND_INDEX_BUFFER,
+		COMMAND_TOPOLOGY,
+		COMMAND_SHADER,
+		COMMAND_CONSTANT_BUFFERS,
+		COMMAND_SHADER_RESOURCES,
+		COMMAND_SAMPLERS,
+		COMMAND_RENDER_TARGETS,
+		COMMAND_PIPELINE_STATE,		// Blend, depth stencil or rasterizer state
+		COMMAND_VIEWPORTS,
+		COMMAND_DRAW,
+		COMMAND_CLEAR,
+		COMMAND_MAP,
+		COMMAND_UNMAP,
+		COMMAND_UPDATE_SUBRESOURCE,
+		COMMAND_COPY,
+		COMMAND_QUERY,
+		COMMAND_EXECUTE_COMMAND_LIST,
+		COMMAND_TYPE_COUNT
+	};
+
+	struct Command
+	{
+		CommandType type;
+		UINT bytes;			// Written or copied by the command, zero for the ones that only bind
+	};
+
+	struct Stats
+	{
+		unsigned commandCounts[COMMAND_TYPE_COUNT] = {};
+		unsigned draws = 0;
+		uint64_t indices = 0;			// Over all instances
+		uint64_t instances = 0;
+		size_t bytesMapped = 0;			// Handed out by maps for writing
+		size_t bytesUpdated = 0;		// Sent with UpdateSubresource
+		size_t bytesCopied = 0;
+		unsigned commandListsExecuted = 0;
+		unsigned errors = 0;			// Including the ones past kMaxErrors, which are counted but not kept
+	};
+
+	static const size_t kMaxLoggedCommands = 1 << 16;
+	static const size_t kMaxErrors = 64;
+
+	NullRenderContext();
+	explicit NullRenderContext(bool isDeferred);
+
+	// Commands since the last ResetStats, up to kMaxLoggedCommands. Those of a command list are added when it runs.
+	const std::vector<Command>& GetCommands() const { return m_commands; }
+	const std::vector<std::string>& GetErrors() const { return m_errors; }
+	const Stats& GetStats() const { return m_stats; }
+	void ResetStats();
+
+	static const char* GetCommandName(CommandType type);
+
+	bool IsDeferred() const override;
+	std::unique_ptr<RenderContext> CreateDeferredContext() override;
+	bool FinishCommandList() override;
+	void ExecuteCommandList(RenderContext& deferredContext) override;
+
+	void IASetInputLayout(ID3D11InputLayout* inputLayout) override;
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+	void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) override;
+	void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) override;
+
+	void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void GSSetShader(ID3D11GeometryShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* classInstances, UINT classInstanceCount) override;
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void GSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers) override;
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views) override;
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers) override;
+
+	void OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView) override;
+	void OMSetBlendState(ID3D11BlendState* blendState, const FLOAT blendFactor[4], UINT sampleMask) override;
+	void OMSetDepthStencilState(ID3D11DepthStencilState* depthStencilState, UINT stencilRef) override;
+	void RSSetState(ID3D11RasterizerState* rasterizerState) override;
+	void RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports) override;
+
+	void DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+	void ClearRenderTargetView(ID3D11RenderTargetView* renderTargetView, const FLOAT color[4]) override;
+	void ClearDepthStencilView(ID3D11DepthStencilView* depthStencilView, UINT clearFlags, FLOAT depth, UINT8 stencil) override;
+
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT mapFlags, D3D11_MAPPED_SUBRESOURCE* mapped) override;
+	void Unmap(ID3D11Resource* resource, UINT subresource) override;
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch) override;
+	void CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z, ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox) override;
+
+	void End(ID3D11Asynchronous* async) override;
+	HRESULT GetData(ID3D11Asynchronous* async, void* data, UINT size, UINT flags) override;
+
+private:
+
+	static const UINT kVertexBufferSlots = 2;
+	static const UINT kConstantBufferSlots = D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT;
+
+	// What has to be bound, and not mapped, for a draw
+	struct BoundState
+	{
+		ID3D11InputLayout* inputLayout = nullptr;
+		ID3D11VertexShader* vertexShader = nullptr;
+		ID3D11PixelShader* pixelShader = nullptr;
+		ID3D11Buffer* vertexBuffers[kVertexBufferSlots] = {};
+		ID3D11Buffer* indexBuffer = nullptr;
+		ID3D11Buffer* constantBuffers[3][kConstantBufferSlots] = {};	// Of the vertex, geometry and pixel stages
+		UINT renderTargetCount = 0;
+		ID3D11DepthStencilView* depthStencilView = nullptr;
+		UINT viewportCount = 0;
+	};
+
+	struct MappedMemory
+	{
+		std::vector<unsigned char> data;
+		bool isMapped = false;
+	};
+
+	void Record(CommandType type, UINT bytes = 0);
+	void Error(const std::string& message);
+	void BindConstantBuffers(unsigned stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers);
+	bool IsMapped(ID3D11Resource* resource) const;
+	static UINT GetByteSize(ID3D11Resource* resource, UINT* rowPitch);
+
+	bool m_isDeferred;
+	bool m_isFinished;					// A deferred context that has a command list waiting to be executed
+	BoundState m_boundState;
+	std::unordered_map<ID3D11Resource*, MappedMemory> m_mappedMemory;
+	std::unordered_set<ID3D11Resource*> m_discardedResources;	// On a deferred context, since its command list began
+
+	std::vector<Command> m_commands;
+	std::vector<std::string> m_errors;
+	Stats m_stats;
+};
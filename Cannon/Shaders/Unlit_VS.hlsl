@@ -13,9 +13,14 @@
 
 #include "Shared.hlsl"
 
-cbuffer g_cbMatrices
+// Per draw, apart from the per view matrices so those are only uploaded when the view changes
+cbuffer g_cbObject
 {
 	float4x4 mtxWorld;
+};
+
+cbuffer g_cbView
+{
 	float4x4 mtxViewProj;
 };
 
@@ -0,0 +1,302 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "SurfaceChunkGrid.h"
+#include "Common/Timer.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace DirectX;
+using namespace std;
+
+SurfaceChunkGrid::SurfaceChunkGrid(float chunkSize, float duplicateTolerance) :
+	m_chunkSize(chunkSize),
+	m_duplicateTolerance(duplicateTolerance),
+	m_duplicateRemovalEnabled(true)
+{
+	assert(chunkSize > 0.0f && duplicateTolerance > 0.0f);
+}
+
+SurfaceChunkGrid::ChunkCoordinate SurfaceChunkGrid::GetChunkCoordinate(const XMVECTOR& worldPosition) const
+{
+	XMFLOAT3 position;
+	XMStoreFloat3(&position, worldPosition);
+
+	ChunkCoordinate coordinate;
+	coordinate.x = (int)floorf(position.x / m_chunkSize);
+	coordinate.y = (int)floorf(position.y / m_chunkSize);
+	coordinate.z = (int)floorf(position.z / m_chunkSize);
+	return coordinate;
+}
+
+void SurfaceChunkGrid::SetDuplicateRemovalEnabled(bool enabled)
+{
+	lock_guard<mutex> lock(m_buildMutex);
+	m_duplicateRemovalEnabled = enabled;
+}
+
+void SurfaceChunkGrid::UpdatePatch(const winrt::guid& patchID, Mesh& patchMesh, const XMMATRIX& worldTransform)
+{
+	lock_guard<mutex> lock(m_buildMutex);
+
+	// Move the patch into world space and sort its triangles into cells by centroid
+	map<ChunkCoordinate, vector<ChunkTriangle>> buckets;
+
+	auto& vertices = patchMesh.GetVertices();
+	auto& indices = patchMesh.GetIndices();
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		ChunkTriangle triangle;
+		XMVECTOR centroid = XMVectorZero();
+		for (unsigned c = 0; c < 3; ++c)
+		{
+			const Mesh::Vertex& vertex = vertices[indices[i + c]];
+			XMVECTOR position = XMVector3Transform(vertex.position, worldTransform);
+			XMVECTOR normal = XMVector3Normalize(XMVector3TransformNormal(vertex.normal, worldTransform));
+			XMStoreFloat3(&triangle.positions[c], position);
+			XMStoreFloat3(&triangle.normals[c], normal);
+			centroid += position;
+		}
+
+		buckets[GetChunkCoordinate(centroid / 3.0f)].push_back(triangle);
+	}
+
+	set<ChunkCoordinate> dirtyChunks;
+
+	auto& patchChunks = m_patchChunks[patchID];
+	for (auto& coordinate : patchChunks)
+	{
+		if (buckets.find(coordinate) != buckets.end())
+			continue;
+
+		m_chunkContents[coordinate].patchTriangles.erase(patchID);
+		dirtyChunks.insert(coordinate);
+	}
+
+	patchChunks.clear();
+	for (auto& bucket : buckets)
+	{
+		m_chunkContents[bucket.first].patchTriangles[patchID] = move(bucket.second);
+		patchChunks.push_back(bucket.first);
+		dirtyChunks.insert(bucket.first);
+	}
+
+	if (patchChunks.empty())
+		m_patchChunks.erase(patchID);
+
+	for (auto& coordinate : dirtyChunks)
+		RebuildChunk(coordinate);
+}
+
+void SurfaceChunkGrid::RemovePatch(const winrt::guid& patchID)
+{
+	lock_guard<mutex> lock(m_buildMutex);
+
+	auto patchIterator = m_patchChunks.find(patchID);
+	if (patchIterator == m_patchChunks.end())
+		return;
+
+	vector<ChunkCoordinate> dirtyChunks;
+	dirtyChunks.swap(patchIterator->second);
+	m_patchChunks.erase(patchIterator);
+
+	for (auto& coordinate : dirtyChunks)
+	{
+		m_chunkContents[coordinate].patchTriangles.erase(patchID);
+		RebuildChunk(coordinate);
+	}
+}
+
+void SurfaceChunkGrid::Clear()
+{
+	lock_guard<mutex> lock(m_buildMutex);
+	m_chunkContents.clear();
+	m_patchChunks.clear();
+
+	lock_guard<mutex> chunksLock(m_chunksMutex);
+	m_chunks.clear();
+}
+
+void SurfaceChunkGrid::GetChunks(vector<shared_ptr<const Chunk>>& chunks)
+{
+	lock_guard<mutex> lock(m_chunksMutex);
+
+	chunks.clear();
+	chunks.reserve(m_chunks.size());
+	for (auto& chunkPair : m_chunks)
+		chunks.push_back(chunkPair.second);
+}
+
+size_t SurfaceChunkGrid::GetChunkCount()
+{
+	lock_guard<mutex> lock(m_chunksMutex);
+	return m_chunks.size();
+}
+
+// Triangles from overlapping patches rarely share exact vertices, so duplicates are matched on their
+//  centroid (snapped to the tolerance, relative to the chunk origin) plus a coarsely quantized normal
+unsigned long long SurfaceChunkGrid::CalculateDuplicateKey(const ChunkTriangle& triangle, const ChunkCoordinate& coordinate) const
+{
+	float origin[3] = { coordinate.x * m_chunkSize, coordinate.y * m_chunkSize, coordinate.z * m_chunkSize };
+	float centroid[3] =
+	{
+		(triangle.positions[0].x + triangle.positions[1].x + triangle.positions[2].x) / 3.0f,
+		(triangle.positions[0].y + triangle.positions[1].y + triangle.positions[2].y) / 3.0f,
+		(triangle.positions[0].z + triangle.positions[1].z + triangle.positions[2].z) / 3.0f,
+	};
+
+	XMVECTOR p0 = XMLoadFloat3(&triangle.positions[0]);
+	XMVECTOR faceNormal = XMVector3Normalize(XMVector3Cross(XMLoadFloat3(&triangle.positions[1]) - p0, XMLoadFloat3(&triangle.positions[2]) - p0));
+	float normal[3] = { XMVectorGetX(faceNormal), XMVectorGetY(faceNormal), XMVectorGetZ(faceNormal) };
+
+	unsigned long long key = 0;
+	for (unsigned axis = 0; axis < 3; ++axis)
+	{
+		long long cell = (long long)floorf((centroid[axis] - origin[axis]) / m_duplicateTolerance + 0.5f);
+		key = (key << 16) | ((unsigned long long)max(0ll, min(cell, 0xffffll)));
+	}
+	for (unsigned axis = 0; axis < 3; ++axis)
+	{
+		unsigned bucket = (unsigned)floorf((normal[axis] * 0.5f + 0.5f) * 7.0f + 0.5f);
+		key = (key << 4) | min(bucket, 0xfu);
+	}
+
+	return key;
+}
+
+void SurfaceChunkGrid::RebuildChunk(const ChunkCoordinate& coordinate)
+{
+	auto contentsIterator = m_chunkContents.find(coordinate);
+	if (contentsIterator == m_chunkContents.end() || contentsIterator->second.patchTriangles.empty())
+	{
+		if (contentsIterator != m_chunkContents.end())
+			m_chunkContents.erase(contentsIterator);
+
+		lock_guard<mutex> lock(m_chunksMutex);
+		m_chunks.erase(coordinate);
+		return;
+	}
+
+	auto mesh = make_shared<Mesh>();
+	auto& vertices = mesh->GetVertices();
+	auto& indices = mesh->GetIndices();
+
+	// Patches are visited in a stable order, so the first patch to claim a triangle keeps it.
+	// Keys are only published after a whole patch is done, so a patch never dedupes against itself.
+	unordered_set<unsigned long long> claimedTriangles;
+	vector<unsigned long long> patchKeys;
+
+	struct PositionHash
+	{
+		size_t operator()(const XMFLOAT3& p) const
+		{
+			unsigned bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return ((size_t)bits[0] * 73856093) ^ ((size_t)bits[1] * 19349663) ^ ((size_t)bits[2] * 83492791);
+		}
+	};
+	struct PositionEqual
+	{
+		bool operator()(const XMFLOAT3& a, const XMFLOAT3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+	};
+	unordered_map<XMFLOAT3, unsigned, PositionHash, PositionEqual> vertexLookup;
+
+	for (auto& patchPair : contentsIterator->second.patchTriangles)
+	{
+		patchKeys.clear();
+		for (auto& triangle : patchPair.second)
+		{
+			if (m_duplicateRemovalEnabled)
+			{
+				unsigned long long key = CalculateDuplicateKey(triangle, coordinate);
+				if (claimedTriangles.find(key) != claimedTriangles.end())
+					continue;
+				patchKeys.push_back(key);
+			}
+
+			for (unsigned c = 0; c < 3; ++c)
+			{
+				// Weld vertices that share a position and normal
+				auto lookupIterator = vertexLookup.find(triangle.positions[c]);
+				if (lookupIterator != vertexLookup.end())
+				{
+					const Mesh::Vertex& existing = vertices[lookupIterator->second];
+					if (XMVector3Equal(existing.normal, XMLoadFloat3(&triangle.normals[c])))
+					{
+						indices.push_back(lookupIterator->second);
+						continue;
+					}
+				}
+
+				Mesh::Vertex vertex;
+				vertex.position = XMVectorSetW(XMLoadFloat3(&triangle.positions[c]), 1.0f);
+				vertex.normal = XMLoadFloat3(&triangle.normals[c]);
+				vertex.texcoord = XMFLOAT2(0.0f, 0.0f);
+
+				vertexLookup[triangle.positions[c]] = (unsigned)vertices.size();
+				indices.push_back((unsigned)vertices.size());
+				vertices.push_back(vertex);
+			}
+		}
+
+		claimedTriangles.insert(patchKeys.begin(), patchKeys.end());
+	}
+
+	mesh->UpdateBoundingBox();
+
+	auto chunk = make_shared<Chunk>();
+	chunk->coordinate = coordinate;
+	chunk->mesh = mesh;
+	chunk->bounds = mesh->GetBoundingBox();
+	chunk->lastUpdateTime = Timer::GetSystemRelativeTime();
+
+	lock_guard<mutex> lock(m_chunksMutex);
+	m_chunks[coordinate] = chunk;
+}
+
+bool SurfaceChunkGrid::TestRayIntersection(XMVECTOR rayOrigin, XMVECTOR rayDirection, float& distance, XMVECTOR& normal)
+{
+	vector<shared_ptr<const Chunk>> chunks;
+	GetChunks(chunks);
+
+	// Visit chunks in the order the ray enters their bounds, and stop once the next box is further than the best hit
+	vector<pair<float, const Chunk*>> candidates;
+	for (auto& chunk : chunks)
+	{
+		float boxDistance;
+		if (chunk->bounds.Intersects(rayOrigin, rayDirection, boxDistance))
+			candidates.push_back(make_pair(boxDistance, chunk.get()));
+	}
+	sort(candidates.begin(), candidates.end(), [](const pair<float, const Chunk*>& a, const pair<float, const Chunk*>& b) { return a.first < b.first; });
+
+	bool hit = false;
+	distance = FLT_MAX;
+	for (auto& candidate : candidates)
+	{
+		if (candidate.first > distance)
+			break;
+
+		float currentDistance;
+		XMVECTOR currentNormal;
+		if (candidate.second->mesh->TestRayIntersection(rayOrigin, rayDirection, XMMatrixIdentity(), currentDistance, currentNormal) && currentDistance < distance)
+		{
+			hit = true;
+			distance = currentDistance;
+			normal = currentNormal;
+		}
+	}
+
+	return hit;
+}
@@ -0,0 +1,94 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include "Common/Intersectable.h"
+#include "DrawCall.h"
+
+// Re-buckets surface patch triangles into a uniform world space grid of chunks.
+// The system hands out patches with arbitrary, heavily overlapping extents. Each chunk instead owns the triangles
+//  whose centroid falls inside its cell, with duplicates from overlapping patches removed, and gets its own mesh and BVH.
+// Patches are added and removed on the surface observation thread; only the chunks they touch are rebuilt.
+// Readers get immutable chunk snapshots, so ray tests and drawing never wait on a rebuild.
+class SurfaceChunkGrid : public Intersectable
+{
+public:
+
+	struct ChunkCoordinate
+	{
+		int x, y, z;
+
+		bool operator<(const ChunkCoordinate& b) const
+		{
+			if (x != b.x) return x < b.x;
+			if (y != b.y) return y < b.y;
+			return z < b.z;
+		}
+		bool operator==(const ChunkCoordinate& b) const { return x == b.x && y == b.y && z == b.z; }
+	};
+
+	struct Chunk
+	{
+		ChunkCoordinate coordinate;
+		std::shared_ptr<Mesh> mesh;		// World space geometry, bounding box hierarchy already built
+		DirectX::BoundingBox bounds;	// Bounds of the actual geometry, not the cell
+		long long lastUpdateTime;		// Timer::GetSystemRelativeTime() of the last rebuild
+	};
+
+	SurfaceChunkGrid(float chunkSize = 1.0f, float duplicateTolerance = 0.02f);
+
+	float GetChunkSize() const { return m_chunkSize; }
+	ChunkCoordinate GetChunkCoordinate(const DirectX::XMVECTOR& worldPosition) const;
+
+	// Sources that never overlap (e.g. fused TSDF blocks) should turn this off, so neighboring small triangles aren't merged
+	void SetDuplicateRemovalEnabled(bool enabled);
+
+	// These are called from the surface observation thread
+	void UpdatePatch(const winrt::guid& patchID, Mesh& patchMesh, const DirectX::XMMATRIX& worldTransform);
+	void RemovePatch(const winrt::guid& patchID);
+	void Clear();
+
+	// Safe to call from any thread, returns the current set of chunk snapshots
+	void GetChunks(std::vector<std::shared_ptr<const Chunk>>& chunks);
+	size_t GetChunkCount();
+
+	virtual bool TestRayIntersection(DirectX::XMVECTOR rayOrigin, DirectX::XMVECTOR rayDirection, float& distance, DirectX::XMVECTOR& normal);
+
+private:
+
+	struct ChunkTriangle
+	{
+		DirectX::XMFLOAT3 positions[3];
+		DirectX::XMFLOAT3 normals[3];
+	};
+
+	// Build side state for one chunk, only touched by the observation thread
+	struct ChunkContents
+	{
+		std::map<winrt::guid, std::vector<ChunkTriangle>> patchTriangles;
+	};
+
+	void RebuildChunk(const ChunkCoordinate& coordinate);
+	unsigned long long CalculateDuplicateKey(const ChunkTriangle& triangle, const ChunkCoordinate& coordinate) const;
+
+	float m_chunkSize;
+	float m_duplicateTolerance;
+	bool m_duplicateRemovalEnabled;
+
+	std::map<ChunkCoordinate, ChunkContents> m_chunkContents;
+	std::map<winrt::guid, std::vector<ChunkCoordinate>> m_patchChunks;	// Which chunks each patch currently contributes to
+	std::mutex m_buildMutex;
+
+	std::map<ChunkCoordinate, std::shared_ptr<const Chunk>> m_chunks;
+	std::mutex m_chunksMutex;
+};
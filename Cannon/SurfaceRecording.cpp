@@ -0,0 +1,304 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+// No precompiled header on purpose, see SurfaceRecording.h
+
+#include "SurfaceRecording.h"
+
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+// File layout, all little endian:
+//  uint32 magic, uint32 version
+//  then per event: uint8 type, int64 timestamp, uint8[16] id
+//   and for PatchUpdated: int64 surfaceUpdateTime, float[16] worldTransform, float[3] vertexScale,
+//   uint32 vertexCount, uint32 indexCount, int16[4 * vertexCount] positions, int8[4 * vertexCount] normals, uint16[indexCount] indices
+static const uint32_t s_recordingMagic = 0x52524d53;	// "SMRR"
+static const uint32_t s_recordingVersion = 1;
+
+SurfaceRecordEvent::SurfaceRecordEvent() :
+	type(Type::PatchUpdated),
+	timestamp(0),
+	surfaceUpdateTime(0)
+{
+	memset(id, 0, sizeof(id));
+	memset(worldTransform, 0, sizeof(worldTransform));
+	worldTransform[0] = worldTransform[5] = worldTransform[10] = worldTransform[15] = 1.0f;
+	vertexScale[0] = vertexScale[1] = vertexScale[2] = 1.0f;
+}
+
+SurfaceRecorder::SurfaceRecorder() :
+	m_file(nullptr),
+	m_startTime(0),
+	m_hasStartTime(false),
+	m_eventCount(0),
+	m_bytesWritten(0)
+{
+}
+
+SurfaceRecorder::~SurfaceRecorder()
+{
+	Close();
+}
+
+bool SurfaceRecorder::Open(const string& filename)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	if (m_file)
+		fclose(m_file);
+
+	m_file = fopen(filename.c_str(), "wb");
+	m_hasStartTime = false;
+	m_eventCount = 0;
+	m_bytesWritten = 0;
+
+	if (!m_file)
+		return false;
+
+	Write(&s_recordingMagic, sizeof(s_recordingMagic));
+	Write(&s_recordingVersion, sizeof(s_recordingVersion));
+	return true;
+}
+
+void SurfaceRecorder::Close()
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	if (m_file)
+	{
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+bool SurfaceRecorder::IsOpen()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_file != nullptr;
+}
+
+unsigned SurfaceRecorder::GetEventCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_eventCount;
+}
+
+unsigned long long SurfaceRecorder::GetBytesWritten()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_bytesWritten;
+}
+
+long long SurfaceRecorder::GetRelativeTime(long long timestamp)
+{
+	if (!m_hasStartTime)
+	{
+		m_startTime = timestamp;
+		m_hasStartTime = true;
+	}
+
+	return (timestamp > m_startTime) ? timestamp - m_startTime : 0;
+}
+
+void SurfaceRecorder::Write(const void* data, size_t size)
+{
+	if (size == 0)
+		return;
+
+	fwrite(data, size, 1, m_file);
+	m_bytesWritten += size;
+}
+
+void SurfaceRecorder::WritePatch(const uint8_t id[16], long long timestamp, long long surfaceUpdateTime, const float worldTransform[16], const float vertexScale[3],
+	const uint16_t* indices, unsigned indexCount, const int16_t* positions, const int8_t* normals, unsigned vertexCount)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_file)
+		return;
+
+	uint8_t type = (uint8_t)SurfaceRecordEvent::Type::PatchUpdated;
+	long long relativeTime = GetRelativeTime(timestamp);
+
+	Write(&type, sizeof(type));
+	Write(&relativeTime, sizeof(relativeTime));
+	Write(id, 16);
+	Write(&surfaceUpdateTime, sizeof(surfaceUpdateTime));
+	Write(worldTransform, sizeof(float) * 16);
+	Write(vertexScale, sizeof(float) * 3);
+	Write(&vertexCount, sizeof(vertexCount));
+	Write(&indexCount, sizeof(indexCount));
+	Write(positions, sizeof(int16_t) * 4 * vertexCount);
+	Write(normals, sizeof(int8_t) * 4 * vertexCount);
+	Write(indices, sizeof(uint16_t) * indexCount);
+
+	++m_eventCount;
+}
+
+void SurfaceRecorder::WriteRemoval(const uint8_t id[16], long long timestamp)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_file)
+		return;
+
+	uint8_t type = (uint8_t)SurfaceRecordEvent::Type::PatchRemoved;
+	long long relativeTime = GetRelativeTime(timestamp);
+
+	Write(&type, sizeof(type));
+	Write(&relativeTime, sizeof(relativeTime));
+	Write(id, 16);
+
+	++m_eventCount;
+}
+
+SurfaceReplay::SurfaceReplay() :
+	m_nextEvent(0),
+	m_speed(1.0f)
+{
+}
+
+// Reads keep count of the bytes left in the file, so a count read from a damaged file can never ask for more than that
+static bool ReadBytes(FILE* pFile, uint64_t& remainingBytes, void* data, size_t size)
+{
+	if (size > remainingBytes || fread(data, size, 1, pFile) != 1)
+		return false;
+
+	remainingBytes -= size;
+	return true;
+}
+
+template<typename T>
+static bool ReadValue(FILE* pFile, uint64_t& remainingBytes, T& value)
+{
+	return ReadBytes(pFile, remainingBytes, &value, sizeof(T));
+}
+
+template<typename T>
+static bool ReadArray(FILE* pFile, uint64_t& remainingBytes, vector<T>& values, size_t count)
+{
+	if (count > remainingBytes / sizeof(T))
+		return false;
+
+	values.resize(count);
+	return count == 0 || ReadBytes(pFile, remainingBytes, values.data(), sizeof(T) * count);
+}
+
+static bool GetFileSize(FILE* pFile, uint64_t& size)
+{
+#ifdef _WIN32
+	if (_fseeki64(pFile, 0, SEEK_END) != 0)
+		return false;
+	long long end = _ftelli64(pFile);
+#else
+	if (fseeko(pFile, 0, SEEK_END) != 0)
+		return false;
+	long long end = ftello(pFile);
+#endif
+
+	rewind(pFile);
+	size = (uint64_t)end;
+	return end >= 0;
+}
+
+bool SurfaceReplay::Open(const string& filename)
+{
+	m_events.clear();
+	m_nextEvent = 0;
+
+	FILE* pFile = fopen(filename.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	uint64_t remainingBytes = 0;
+	uint32_t magic = 0, version = 0;
+	if (!GetFileSize(pFile, remainingBytes) ||
+		!ReadValue(pFile, remainingBytes, magic) || !ReadValue(pFile, remainingBytes, version) || magic != s_recordingMagic || version != s_recordingVersion)
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	// A recording cut short (e.g. the app was killed) keeps every complete event before the cut
+	for (;;)
+	{
+		uint8_t type;
+		if (!ReadValue(pFile, remainingBytes, type))
+			break;
+
+		SurfaceRecordEvent event;
+		event.type = (SurfaceRecordEvent::Type)type;
+		if (!ReadValue(pFile, remainingBytes, event.timestamp) || !ReadBytes(pFile, remainingBytes, event.id, sizeof(event.id)))
+			break;
+
+		if (event.type == SurfaceRecordEvent::Type::PatchUpdated)
+		{
+			uint32_t vertexCount = 0, indexCount = 0;
+			if (!ReadValue(pFile, remainingBytes, event.surfaceUpdateTime) ||
+				!ReadBytes(pFile, remainingBytes, event.worldTransform, sizeof(event.worldTransform)) ||
+				!ReadBytes(pFile, remainingBytes, event.vertexScale, sizeof(event.vertexScale)) ||
+				!ReadValue(pFile, remainingBytes, vertexCount) || !ReadValue(pFile, remainingBytes, indexCount) ||
+				!ReadArray(pFile, remainingBytes, event.positions, 4 * (size_t)vertexCount) ||
+				!ReadArray(pFile, remainingBytes, event.normals, 4 * (size_t)vertexCount) ||
+				!ReadArray(pFile, remainingBytes, event.indices, indexCount))
+				break;
+
+			// The mesh conversion indexes the vertices with these, a patch with any index out of range
+			//  or a partial triangle is dropped
+			bool hasBadIndex = (indexCount % 3 != 0);
+			for (uint16_t index : event.indices)
+				hasBadIndex |= (index >= vertexCount);
+			if (hasBadIndex)
+				continue;
+		}
+		else if (event.type != SurfaceRecordEvent::Type::PatchRemoved)
+		{
+			// Damaged from here on, there is no telling where the next event starts
+			break;
+		}
+
+		m_events.push_back(move(event));
+	}
+
+	fclose(pFile);
+	return true;
+}
+
+void SurfaceReplay::SetSpeed(float speed)
+{
+	assert(speed >= 0.0f);
+	m_speed = speed;
+}
+
+void SurfaceReplay::Restart()
+{
+	m_nextEvent = 0;
+}
+
+long long SurfaceReplay::GetDuration() const
+{
+	return m_events.empty() ? 0 : m_events.back().timestamp;
+}
+
+void SurfaceReplay::GetDueEvents(long long elapsedTime, vector<const SurfaceRecordEvent*>& events)
+{
+	while (m_nextEvent < m_events.size())
+	{
+		const SurfaceRecordEvent& event = m_events[m_nextEvent];
+		if (m_speed > 0.0f && (double)event.timestamp > (double)elapsedTime * m_speed)
+			break;
+
+		events.push_back(&event);
+		++m_nextEvent;
+	}
+}
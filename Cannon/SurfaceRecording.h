@@ -0,0 +1,113 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+// Like TsdfVolume, this file and SurfaceRecording.cpp only depend on the standard library, so recorded sessions
+//  can be replayed and benchmarked off-device.
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One surface observer event, as captured by SurfaceRecorder.
+// Vertex data is kept in the raw formats the system hands out, so replay goes through the same conversion as live data.
+struct SurfaceRecordEvent
+{
+	enum class Type : uint8_t
+	{
+		PatchUpdated,
+		PatchRemoved,
+	};
+
+	Type type;
+	long long timestamp;			// 100ns ticks since the recording started
+	uint8_t id[16];					// Surface guid
+
+	// Only used by PatchUpdated
+	long long surfaceUpdateTime;	// When the system last updated the surface, as a file time
+	float worldTransform[16];		// Patch to world, row major like float4x4
+	float vertexScale[3];			// SpatialSurfaceMesh::VertexPositionScale
+	std::vector<uint16_t> indices;	// R16_UINT triangle list
+	std::vector<int16_t> positions;	// R16G16B16A16_SNORM, 4 per vertex
+	std::vector<int8_t> normals;	// R8G8B8A8_SNORM, 4 per vertex
+
+	SurfaceRecordEvent();
+
+	unsigned GetVertexCount() const { return (unsigned)(positions.size() / 4); }
+};
+
+// Appends surface events to a compact binary file.
+// Safe to call from any thread, writes are serialized.
+class SurfaceRecorder
+{
+public:
+
+	SurfaceRecorder();
+	~SurfaceRecorder();
+
+	bool Open(const std::string& filename);
+	void Close();
+	bool IsOpen();
+
+	// The first event written sets the time origin, timestamps are in 100ns ticks
+	void WritePatch(const uint8_t id[16], long long timestamp, long long surfaceUpdateTime, const float worldTransform[16], const float vertexScale[3],
+		const uint16_t* indices, unsigned indexCount, const int16_t* positions, const int8_t* normals, unsigned vertexCount);
+	void WriteRemoval(const uint8_t id[16], long long timestamp);
+
+	unsigned GetEventCount();
+	unsigned long long GetBytesWritten();
+
+private:
+
+	long long GetRelativeTime(long long timestamp);
+	void Write(const void* data, size_t size);
+
+	FILE* m_file;
+	long long m_startTime;
+	bool m_hasStartTime;
+	unsigned m_eventCount;
+	unsigned long long m_bytesWritten;
+	std::mutex m_mutex;
+};
+
+// Plays a recording back in order.
+// Timing is driven by the caller, so replay is deterministic: the same elapsed times always return the same events.
+class SurfaceReplay
+{
+public:
+
+	SurfaceReplay();
+
+	bool Open(const std::string& filename);
+
+	// 1 plays at the original pace, 4 four times faster, 0 makes every event due immediately
+	void SetSpeed(float speed);
+	float GetSpeed() const { return m_speed; }
+
+	void Restart();
+	bool IsFinished() const { return m_nextEvent >= m_events.size(); }
+
+	size_t GetEventCount() const { return m_events.size(); }
+	long long GetDuration() const;	// 100ns ticks at the original pace
+
+	// Appends every event that is due after elapsedTime ticks of playback. Pointers stay valid while this object is alive.
+	void GetDueEvents(long long elapsedTime, std::vector<const SurfaceRecordEvent*>& events);
+
+private:
+
+	std::vector<SurfaceRecordEvent> m_events;
+	size_t m_nextEvent;
+	float m_speed;
+};
@@ -10,14 +10,18 @@
 //*********************************************************
 // Author: Casey Meekhof cmeekhof@microsoft.com
 
-#include "pch.h"
-
 #include "TrackedHands.h"
+#include "GestureRecognizer.h"
+#include "HandCollision.h"
 
 
 TrackedHands::TrackedHands() :
 	m_timestamps{ 0 },
-	m_isNewFrameAvailable(false)
+	m_predictedDisplayTime(0),
+	m_isNewFrameAvailable(false),
+	m_jointPredictionFilterType(RecordedValue::FilterType::OneEuro),
+	m_gestures(std::make_unique<GestureRecognizer>()),
+	m_collision(std::make_unique<HandCollision>())
 {
 	m_headPosition = XMVectorZero();
 	m_headForward = XMVectorZero();
@@ -31,6 +35,10 @@ TrackedHands::TrackedHands() :
 	}
 }
 
+TrackedHands::~TrackedHands()
+{
+}
+
 void TrackedHands::ResetHand(size_t handIndex)
 {
 	if (handIndex >= HAND_COUNT)
@@ -38,10 +46,15 @@ void TrackedHands::ResetHand(size_t handIndex)
 
 	for (size_t jointIndex = 0; jointIndex < kHandJointCount; ++jointIndex)
 	{
-		m_handJoints[handIndex * kHandJointCount + jointIndex].Reset();
-		m_handOrientations[handIndex * kHandJointCount + jointIndex].Reset();
 		m_handRadii[handIndex * kHandJointCount + jointIndex] = 0.0f;
 	}	
+
+	m_handJointHistories[handIndex].Reset();
+	m_handOrientationHistories[handIndex].Reset();
+	m_handJointDerivatives[handIndex].Reset();
+	m_handFilters[handIndex].Reset();
+	m_oneEuroPredictors[handIndex].Reset();
+	m_kalmanPredictors[handIndex].Reset();
 }
 
 bool TrackedHands::IsHandTracked(size_t handIndex)
@@ -52,11 +65,11 @@ bool TrackedHands::IsHandTracked(size_t handIndex)
 		return false;
 }
 
-XMVECTOR TrackedHands::GetJoint(size_t handIndex, HandJointIndex jointIndex)
+XMVECTOR TrackedHands::GetJoint(size_t handIndex, HandJointIndex jointIndex, unsigned framesAgo)
 {
 	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
 	{
-		return m_handJoints[handIndex * kHandJointCount + (size_t)jointIndex].GetValue(0);
+		return m_handJointHistories[handIndex].GetValue((size_t)jointIndex, framesAgo);
 	}
 	else
 	{
@@ -64,11 +77,11 @@ XMVECTOR TrackedHands::GetJoint(size_t handIndex, HandJointIndex jointIndex)
 	}
 }
 
-XMVECTOR TrackedHands::GetJointOrientation(size_t handIndex, HandJointIndex jointIndex)
+XMVECTOR TrackedHands::GetJointOrientation(size_t handIndex, HandJointIndex jointIndex, unsigned framesAgo)
 {
 	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
 	{
-		return m_handOrientations[handIndex * kHandJointCount + (size_t)jointIndex].GetValue(0);
+		return m_handOrientationHistories[handIndex].GetValue((size_t)jointIndex, framesAgo);
 	}
 	else
 	{
@@ -94,8 +107,8 @@ XMMATRIX TrackedHands::GetOrientedJoint(size_t handIndex, HandJointIndex jointIn
 
 XMVECTOR TrackedHands::GetIndexTipSurfacePosition(size_t handIndex, int framesAgo)
 {
-	XMVECTOR indexTip = GetJointHistory(handIndex, HandJointIndex::IndexTip).GetValue(framesAgo);
-	XMVECTOR indexDistal = GetJointHistory(handIndex, HandJointIndex::IndexDistal).GetValue(framesAgo);
+	XMVECTOR indexTip = GetJoint(handIndex, HandJointIndex::IndexTip, (unsigned)framesAgo);
+	XMVECTOR indexDistal = GetJoint(handIndex, HandJointIndex::IndexDistal, (unsigned)framesAgo);
 	float indexRadius = GetJointRadius(handIndex, HandJointIndex::IndexTip);
 
 	return XMVectorSetW(indexTip + XMVector3Normalize(indexTip - indexDistal) * indexRadius * 1.5f, 1.0f);
@@ -113,16 +126,29 @@ float TrackedHands::GetJointRadius(size_t handIndex, HandJointIndex jointIndex)
 	}
 }
 
-RecordedValue& TrackedHands::GetJointHistory(size_t handIndex, HandJointIndex jointIndex)
+const HandPositionHistory& TrackedHands::GetJointHistory(size_t handIndex)
 {
-	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
+	if (handIndex < HAND_COUNT)
+	{
+		return m_handJointHistories[handIndex];
+	}
+	else
 	{
-		return m_handJoints[handIndex * kHandJointCount + (size_t)jointIndex];
+		static HandPositionHistory blankHistory;
+		return blankHistory;
+	}
+}
+
+const HandOrientationHistory& TrackedHands::GetJointOrientationHistory(size_t handIndex)
+{
+	if (handIndex < HAND_COUNT)
+	{
+		return m_handOrientationHistories[handIndex];
 	}
 	else
 	{
-		static RecordedValue blankRecordedValue;
-		return blankRecordedValue;
+		static HandOrientationHistory blankHistory;
+		return blankHistory;
 	}
 }
 
@@ -130,7 +156,63 @@ XMVECTOR TrackedHands::GetSmoothedJoint(size_t handIndex, HandJointIndex jointIn
 {
 	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
 	{
-		return m_handJoints[handIndex * kHandJointCount + (size_t)jointIndex].GetSmoothedValue(0);
+		return m_handFilters[handIndex].GetFilteredValue((size_t)jointIndex);
+	}
+	else
+	{
+		return XMVectorZero();
+	}
+}
+
+XMVECTOR TrackedHands::GetJointVelocity(size_t handIndex, HandJointIndex jointIndex)
+{
+	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
+	{
+		return m_handJointDerivatives[handIndex].GetVelocity((size_t)jointIndex);
+	}
+	else
+	{
+		return XMVectorZero();
+	}
+}
+
+XMVECTOR TrackedHands::GetJointAcceleration(size_t handIndex, HandJointIndex jointIndex)
+{
+	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
+	{
+		return m_handJointDerivatives[handIndex].GetAcceleration((size_t)jointIndex);
+	}
+	else
+	{
+		return XMVectorZero();
+	}
+}
+
+void TrackedHands::SetDerivativeWindowSize(unsigned frameCount)
+{
+	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+	{
+		m_handJointDerivatives[handIndex].SetWindowSize(frameCount);
+		m_handJointDerivatives[handIndex].Update(m_handJointHistories[handIndex]);
+	}
+}
+
+XMVECTOR TrackedHands::GetPredictedJoint(size_t handIndex, HandJointIndex jointIndex)
+{
+	return GetPredictedJoint(handIndex, jointIndex, m_predictedDisplayTime);
+}
+
+XMVECTOR TrackedHands::GetPredictedJoint(size_t handIndex, HandJointIndex jointIndex, long long displayTimestamp)
+{
+	if (handIndex < HAND_COUNT && (size_t)jointIndex < kHandJointCount)
+	{
+		// The batch filter already smooths every joint with double exponential, the predictors only run for the timed filters
+		if (m_jointPredictionFilterType == RecordedValue::FilterType::OneEuro)
+			return m_oneEuroPredictors[handIndex].GetPredictedValue((size_t)jointIndex, displayTimestamp);
+		else if (m_jointPredictionFilterType == RecordedValue::FilterType::KalmanConstantVelocity)
+			return m_kalmanPredictors[handIndex].GetPredictedValue((size_t)jointIndex, displayTimestamp);
+		else
+			return GetSmoothedJoint(handIndex, jointIndex);
 	}
 	else
 	{
@@ -138,6 +220,29 @@ XMVECTOR TrackedHands::GetSmoothedJoint(size_t handIndex, HandJointIndex jointIn
 	}
 }
 
+void TrackedHands::SetJointPredictionFilter(RecordedValue::FilterType filterType)
+{
+	m_jointPredictionFilterType = filterType;
+
+	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+	{
+		m_oneEuroPredictors[handIndex].Reset();
+		m_kalmanPredictors[handIndex].Reset();
+	}
+}
+
+void TrackedHands::SetOneEuroParameters(float minCutoff, float beta, float derivativeCutoff, float maxPredictionTime)
+{
+	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+		m_oneEuroPredictors[handIndex].SetParameters(minCutoff, beta, derivativeCutoff, maxPredictionTime);
+}
+
+void TrackedHands::SetKalmanParameters(float processNoise, float measurementNoise, float maxPredictionTime)
+{
+	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
+		m_kalmanPredictors[handIndex].SetParameters(processNoise, measurementNoise, maxPredictionTime);
+}
+
 XMVECTOR TrackedHands::GetSmoothedPalmDirection(size_t handIndex)
 {
 	if (IsHandTracked(handIndex) && handIndex < HAND_COUNT)
@@ -163,21 +268,24 @@ XMVECTOR TrackedHands::CalculatePalmDirection(size_t handIndex, XMVECTOR wrist,
 		return XMVector3Normalize(XMVector3Cross(wristToIndexDir, wristToPinkyDir));
 }
 
-void TrackedHands::UpdateFromMixedReality(MixedReality& mixedReality)
+void TrackedHands::UpdateFromInput(HandInput& input)
 {
 	m_isNewFrameAvailable = false;
+	m_predictedDisplayTime = input.GetPredictedDisplayTime();
+	m_gestures->ClearEvents();
 
 	for (size_t handIndex = 0; handIndex < HAND_COUNT; ++handIndex)
 	{
-		const auto pHandData = mixedReality.GetHand(handIndex);
+		long long timestamp = 0;
+		const HandJoint* pHandJoints = input.GetHandJoints(handIndex, timestamp);
 
-		if (pHandData)
+		if (pHandJoints)
 		{
 			m_handTrackedStates[handIndex] = true;
 
-			if (pHandData->lastTimestamp > m_timestamps[handIndex])
+			if (timestamp > m_timestamps[handIndex])
 			{
-				m_timestamps[handIndex] = pHandData->lastTimestamp;
+				m_timestamps[handIndex] = timestamp;
 				m_isNewFrameAvailable = true;
 			}
 			else
@@ -188,25 +296,42 @@ void TrackedHands::UpdateFromMixedReality(MixedReality& mixedReality)
 		else
 		{
 			m_handTrackedStates[handIndex] = false;
+			m_gestures->LoseHand(handIndex);
+			m_collision->LoseHand(handIndex);
 			//ResetHand(handIndex);
 			continue;
 		}
 
 		for (size_t jointIndex = 0; jointIndex < kHandJointCount; ++jointIndex)
 		{
-			size_t finalIndex = handIndex * kHandJointCount + jointIndex;
-			XMVECTOR worldPosition = pHandData->handJoints[jointIndex].position;
+			m_handFilterInputs[jointIndex] = pHandJoints[jointIndex].position;
+			m_handFilterInputs[kHandJointCount + jointIndex] = pHandJoints[jointIndex].orientation;
+		}
+
+		auto& handFilter = m_handFilters[handIndex];
+		handFilter.Update(m_handFilterInputs);
+
+		m_handJointHistories[handIndex].Record(&m_handFilterInputs[0], m_timestamps[handIndex]);
+		m_handOrientationHistories[handIndex].Record(&m_handFilterInputs[kHandJointCount], m_timestamps[handIndex]);
+		m_handJointDerivatives[handIndex].Update(m_handJointHistories[handIndex]);
 
-			m_handJoints[finalIndex].RecordValue(worldPosition);
-			XMVECTOR worldOrientation = pHandData->handJoints[jointIndex].orientation;
-			m_handOrientations[finalIndex].RecordValue(worldOrientation);
-			m_handRadii[finalIndex] = pHandData->handJoints[jointIndex].radius;			
+		if (m_jointPredictionFilterType == RecordedValue::FilterType::OneEuro)
+			m_oneEuroPredictors[handIndex].Update(&m_handFilterInputs[0], m_timestamps[handIndex]);
+		else if (m_jointPredictionFilterType == RecordedValue::FilterType::KalmanConstantVelocity)
+			m_kalmanPredictors[handIndex].Update(&m_handFilterInputs[0], m_timestamps[handIndex]);
+
+		for (size_t jointIndex = 0; jointIndex < kHandJointCount; ++jointIndex)
+		{
+			m_handRadii[handIndex * kHandJointCount + jointIndex] = pHandJoints[jointIndex].radius;			
 		}		
+
+		m_gestures->UpdateHand(handIndex, *this);
+		m_collision->UpdateHand(handIndex, *this);
 	}
 
-	m_headPosition = mixedReality.GetHeadPosition();
-	m_headForward = mixedReality.GetHeadForwardDirection();
-	m_headUp = mixedReality.GetHeadUpDirection();
+	m_headPosition = input.GetHeadPosition();
+	m_headForward = input.GetHeadForwardDirection();
+	m_headUp = input.GetHeadUpDirection();
 
 	XMMATRIX worldTransform = XMMatrixLookToRH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), m_headForward, m_headUp);
 	m_headTransform = XMMatrixMultiply(XMMatrixTranspose(worldTransform), XMMatrixTranslationFromVector(m_headPosition));
@@ -12,41 +12,83 @@
 
 #pragma once
 
-#include "MixedReality.h"
+// Like HandInput.h, TrackedHands and the GestureRecognizer and HandCollision it owns only depend on DirectXMath and
+//  the standard library, so recorded hands can be run through them without the holographic APIs.
+
+#include "HandInput.h"
 #include "RecordedValue.h"
+#include "Common/FilterDoubleExponentialBatch.h"
+#include "Common/FilterOneEuroBatch.h"
+#include "Common/FilterKalmanConstantVelocityBatch.h"
+#include "Common/JointHistory.h"
+#include "Common/JointDerivatives.h"
+
+#include <memory>
 
 #define HAND_COUNT 2
 
 constexpr size_t kHandJointCount = (size_t)HandJointIndex::Count;
+constexpr size_t kHandHistoryCapacity = 16;	// Frames of joint history kept per hand, must be a power of two
+
+typedef JointHistory<kHandJointCount, kHandHistoryCapacity> HandPositionHistory;
+typedef JointHistory<kHandJointCount, kHandHistoryCapacity, 4> HandOrientationHistory;
+typedef JointDerivatives<kHandJointCount, kHandHistoryCapacity> HandJointDerivatives;
+
+class GestureRecognizer;
+class HandCollision;
 
 class TrackedHands
 {
 public:	
 	TrackedHands();
+	~TrackedHands();
 	void ResetHand(size_t handIndex);
 
-	void UpdateFromMixedReality(MixedReality& mixedReality);
+	void UpdateFromInput(HandInput& input);	// MixedReality, live or replayed
 	const XMMATRIX& GetHeadTransform() { return m_headTransform; }
 	bool IsHandTracked(size_t handIndex);
 	
-	XMVECTOR GetJoint(size_t handIndex, HandJointIndex jointIndex);
-	XMVECTOR GetJointOrientation(size_t handIndex, HandJointIndex jointIndex);	// XMVECTOR is a quaternion in this case
+	XMVECTOR GetJoint(size_t handIndex, HandJointIndex jointIndex, unsigned framesAgo = 0);
+	XMVECTOR GetJointOrientation(size_t handIndex, HandJointIndex jointIndex, unsigned framesAgo = 0);	// XMVECTOR is a quaternion in this case
 	XMMATRIX GetOrientedJoint(size_t handIndex, HandJointIndex jointIndex);
 	XMVECTOR GetIndexTipSurfacePosition(size_t handIndex, int framesAgo = 0);
 	float GetJointRadius(size_t handIndex, HandJointIndex jointIndex);
-	RecordedValue& GetJointHistory(size_t handIndex, HandJointIndex jointIndex);
+	const HandPositionHistory& GetJointHistory(size_t handIndex);
+	const HandOrientationHistory& GetJointOrientationHistory(size_t handIndex);
 
 	XMVECTOR GetSmoothedJoint(size_t handIndex, HandJointIndex jointIndex);
+
+	// Savitzky-Golay estimates at the newest hand frame, computed for all joints once per frame
+	XMVECTOR GetJointVelocity(size_t handIndex, HandJointIndex jointIndex);		// Meters per second
+	XMVECTOR GetJointAcceleration(size_t handIndex, HandJointIndex jointIndex);	// Meters per second squared
+	void SetDerivativeWindowSize(unsigned frameCount);	// Frames in the fit, 3 to kHandHistoryCapacity
+
+	// Filtered joint position extrapolated to the display time of the frame being rendered (or to displayTimestamp),
+	//  use this for anything drawn attached to a hand. DoubleExponential returns GetSmoothedJoint, it cannot predict by time.
+	XMVECTOR GetPredictedJoint(size_t handIndex, HandJointIndex jointIndex);
+	XMVECTOR GetPredictedJoint(size_t handIndex, HandJointIndex jointIndex, long long displayTimestamp);
+	long long GetPredictedDisplayTime() { return m_predictedDisplayTime; }
+	void SetJointPredictionFilter(RecordedValue::FilterType filterType);
+	void SetOneEuroParameters(float minCutoff = 1.0f, float beta = 5.0f, float derivativeCutoff = 1.0f, float maxPredictionTime = 0.05f);
+	void SetKalmanParameters(float processNoise = 2.0f, float measurementNoise = 0.006f, float maxPredictionTime = 0.05f);
+
 	XMVECTOR GetSmoothedPalmDirection(size_t handIndex);
 	static XMVECTOR CalculatePointingDirection(XMVECTOR wrist, XMVECTOR indexBase, XMVECTOR pinkyBase); //Direction from wrist through middle knuckle area
 	static XMVECTOR CalculatePalmDirection(size_t handIndex, XMVECTOR wrist, XMVECTOR indexBase, XMVECTOR pinkyBase); // Normal to palm of hand
 
+	// Pinch, poke, grab and palm up state of each hand, updated with every new hand frame
+	GestureRecognizer& GetGestures() { return *m_gestures; }
+
+	// Capsules covering each hand for touch tests against boxes and meshes, updated with every new hand frame
+	HandCollision& GetCollision() { return *m_collision; }
+
 	XMVECTOR GetHeadPosition() { return m_headPosition; }
 	XMVECTOR GetHeadForward() { return m_headForward; }
 	XMVECTOR GetHeadUp() { return m_headUp; }
 	
 private:
 	long long m_timestamps[HAND_COUNT];
+	long long m_predictedDisplayTime;
 	bool m_isNewFrameAvailable;
 
 	// Head pose at last hand tracking frame
@@ -56,7 +98,22 @@ private:
 	XMMATRIX m_headTransform;
 
 	bool m_handTrackedStates[HAND_COUNT];	
-	RecordedValue m_handJoints[HAND_COUNT * kHandJointCount];
-	RecordedValue m_handOrientations[HAND_COUNT * kHandJointCount];
+	HandPositionHistory m_handJointHistories[HAND_COUNT];
+	HandOrientationHistory m_handOrientationHistories[HAND_COUNT];
+	HandJointDerivatives m_handJointDerivatives[HAND_COUNT];
+
+	// Smoothing for every joint position of a hand, in one batch so it runs four joints at a time.
+	// Orientations are not smoothed, nothing reads a smoothed orientation.
+	FilterDoubleExponentialBatch<kHandJointCount> m_handFilters[HAND_COUNT];
+	XMVECTOR m_handFilterInputs[2 * kHandJointCount];	// Positions, then orientations
 	float m_handRadii[HAND_COUNT * kHandJointCount];
+
+	// Time based filters for display time prediction of joint positions, only the selected kind is updated.
+	// Batched per hand like m_handFilters, they only hold filter state (~2 KB per hand), no value history.
+	RecordedValue::FilterType m_jointPredictionFilterType;
+	FilterOneEuroBatch<kHandJointCount> m_oneEuroPredictors[HAND_COUNT];
+	FilterKalmanConstantVelocityBatch<kHandJointCount> m_kalmanPredictors[HAND_COUNT];
+
+	std::unique_ptr<GestureRecognizer> m_gestures;
+	std::unique_ptr<HandCollision> m_collision;
 };
@@ -0,0 +1,846 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+// No precompiled header on purpose, see TsdfVolume.h
+
+#include "TsdfVolume.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+	typedef TsdfVolume::Vector3 Vector3;
+
+	inline Vector3 Add(const Vector3& a, const Vector3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline Vector3 Subtract(const Vector3& a, const Vector3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline Vector3 Scale(const Vector3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+	inline float Dot(const Vector3& a, const Vector3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline Vector3 Cross(const Vector3& a, const Vector3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+	inline float Length(const Vector3& a) { return sqrtf(Dot(a, a)); }
+
+	inline Vector3 Normalize(const Vector3& a)
+	{
+		float length = Length(a);
+		return (length > 0.0f) ? Scale(a, 1.0f / length) : a;
+	}
+
+	// Closest point on a triangle to a point, from Ericson's Real-Time Collision Detection (5.1.5)
+	Vector3 ClosestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c)
+	{
+		Vector3 ab = Subtract(b, a);
+		Vector3 ac = Subtract(c, a);
+		Vector3 ap = Subtract(p, a);
+		float d1 = Dot(ab, ap);
+		float d2 = Dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+
+		Vector3 bp = Subtract(p, b);
+		float d3 = Dot(ab, bp);
+		float d4 = Dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3)
+			return b;
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return Add(a, Scale(ab, d1 / (d1 - d3)));
+
+		Vector3 cp = Subtract(p, c);
+		float d5 = Dot(ab, cp);
+		float d6 = Dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6)
+			return c;
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return Add(a, Scale(ac, d2 / (d2 - d6)));
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			return Add(b, Scale(Subtract(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+
+		float denominator = 1.0f / (va + vb + vc);
+		float v = vb * denominator;
+		float w = vc * denominator;
+		return Add(a, Add(Scale(ab, v), Scale(ac, w)));
+	}
+
+	inline int FloorDivide(int value, int divisor)
+	{
+		return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+	}
+
+	// Cube corners and edges for marching cubes, a case index has bit n set when corner n is inside (negative)
+	const int kCornerOffsets[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	const int kEdgeCorners[12][2] = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 }, { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+
+	// Triangles of each case as edge triples, counter-clockwise seen from outside, ended by -1. At most 5 per cell.
+	// A face with its inside corners on one diagonal always cuts them off from each other, so the two cells sharing
+	//  a face agree on how the surface crosses it and the result has no cracks. No triangle edge runs across a face
+	//  between unconnected crossings, so neighboring cells never emit the same edge twice either.
+	const signed char kTriangleTable[256][16] =
+	{
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 0, 9, 10, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 11, 3, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 1, 10, 11, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 0, 10, 11, 0, 9, 10, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 1, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 7, 4, 0, 3, 4, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 0, 9, 10, 0, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1, -1, -1, -1 },
+		{ 11, 3, 2, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 11, 3, 2, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1, -1, -1, -1 },
+		{ 11, 3, 1, 10, 11, 1, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1, -1, -1, -1 },
+		{ 11, 3, 0, 10, 11, 0, 9, 10, 0, 8, 7, 4, -1, -1, -1, -1 },
+		{ 11, 7, 4, 10, 11, 4, 9, 10, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 1, 0, 4, 5, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 1, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 10, 2, 1, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 0, 5, 10, 0, 4, 5, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1, -1, -1, -1 },
+		{ 11, 3, 2, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 1, 0, 4, 5, 0, 11, 3, 2, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1, -1, -1, -1 },
+		{ 11, 3, 1, 10, 11, 1, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1, -1, -1, -1 },
+		{ 11, 3, 0, 10, 11, 0, 5, 10, 0, 4, 5, 0, -1, -1, -1, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 7, 5, 9, 8, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 1, 0, 7, 5, 0, 8, 7, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 1, 8, 7, 5, 9, 8, 5, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 10, 2, 1, -1, -1, -1, -1 },
+		{ 10, 2, 0, 5, 10, 0, 7, 5, 0, 8, 7, 0, -1, -1, -1, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 2, 8, 7, 5, 9, 8, 5, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1, -1, -1, -1 },
+		{ 5, 1, 0, 7, 5, 0, 8, 7, 0, 11, 3, 2, -1, -1, -1, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 1, 10, 11, 1, 8, 7, 5, 9, 8, 5, -1, -1, -1, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 11, 3, 0, 10, 11, 0, 5, 10, 0, 7, 5, 0, 8, 7, 0, -1 },
+		{ 11, 7, 5, 10, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 2, 1, 5, 6, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 6, 2, 1, 5, 6, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 2, 0, 5, 6, 0, 9, 5, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1, -1, -1, -1 },
+		{ 11, 3, 2, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 11, 3, 2, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1, -1, -1, -1 },
+		{ 11, 3, 1, 6, 11, 1, 5, 6, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1, -1, -1, -1 },
+		{ 11, 3, 0, 6, 11, 0, 5, 6, 0, 9, 5, 0, -1, -1, -1, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 7, 4, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 8, 7, 4, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1, -1, -1, -1 },
+		{ 6, 2, 1, 5, 6, 1, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 7, 4, 0, 3, 4, 6, 2, 1, 5, 6, 1, -1, -1, -1, -1 },
+		{ 6, 2, 0, 5, 6, 0, 9, 5, 0, 8, 7, 4, -1, -1, -1, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 11, 3, 2, 8, 7, 4, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1, -1, -1, -1 },
+		{ 9, 1, 0, 11, 3, 2, 8, 7, 4, 5, 6, 10, -1, -1, -1, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 11, 3, 1, 6, 11, 1, 5, 6, 1, 8, 7, 4, -1, -1, -1, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 11, 3, 0, 6, 11, 0, 5, 6, 0, 9, 5, 0, 8, 7, 4, -1 },
+		{ 5, 6, 11, 9, 5, 11, 11, 7, 4, 9, 11, 4, -1, -1, -1, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 1, 0, 6, 10, 0, 4, 6, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1, -1, -1, -1 },
+		{ 6, 2, 1, 4, 6, 1, 9, 4, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 6, 2, 1, 4, 6, 1, 9, 4, 1, -1, -1, -1, -1 },
+		{ 6, 2, 0, 4, 6, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 2, 6, 10, 9, 4, 6, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1, -1, -1, -1 },
+		{ 10, 1, 0, 6, 10, 0, 4, 6, 0, 11, 3, 2, -1, -1, -1, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 11, 3, 1, 6, 11, 1, 4, 6, 1, 9, 4, 1, -1, -1, -1, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 11, 3, 0, 6, 11, 0, 4, 6, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 7, 6, 9, 8, 6, 10, 9, 6, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1, -1, -1, -1 },
+		{ 10, 1, 0, 6, 10, 0, 7, 6, 0, 8, 7, 0, -1, -1, -1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 2, 1, 7, 6, 1, 8, 7, 1, 9, 8, 1, -1, -1, -1, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 2, 0, 7, 6, 0, 8, 7, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 2, 8, 7, 6, 9, 8, 6, 10, 9, 6, -1, -1, -1, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 10, 1, 0, 6, 10, 0, 7, 6, 0, 8, 7, 0, 11, 3, 2, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1, -1, -1, -1 },
+		{ 11, 3, 1, 6, 11, 1, 7, 6, 1, 8, 7, 1, 9, 8, 1, -1 },
+		{ 0, 1, 9, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 3, 0, 6, 11, 0, 7, 6, 0, 8, 7, 0, -1, -1, -1, -1 },
+		{ 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 1, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 10, 2, 1, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 0, 9, 10, 0, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1, -1, -1, -1 },
+		{ 7, 3, 2, 6, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 7, 3, 2, 6, 7, 2, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1, -1, -1, -1 },
+		{ 7, 3, 1, 6, 7, 1, 10, 6, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1, -1, -1, -1 },
+		{ 7, 3, 0, 6, 7, 0, 10, 6, 0, 9, 10, 0, -1, -1, -1, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 6, 4, 8, 11, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 11, 6, 4, 8, 11, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1, -1, -1, -1 },
+		{ 10, 2, 1, 11, 6, 4, 8, 11, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 10, 2, 1, -1, -1, -1, -1 },
+		{ 10, 2, 0, 9, 10, 0, 11, 6, 4, 8, 11, 4, -1, -1, -1, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 8, 3, 2, 4, 8, 2, 6, 4, 2, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 8, 3, 2, 4, 8, 2, 6, 4, 2, -1, -1, -1, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 3, 1, 4, 8, 1, 6, 4, 1, 10, 6, 1, -1, -1, -1, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 8, 3, 6, 4, 3, 6, 3, 0, 10, 6, 0, 9, 10, 0, -1 },
+		{ 10, 6, 4, 9, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 1, 0, 4, 5, 0, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1, -1, -1, -1 },
+		{ 10, 2, 1, 4, 5, 9, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 10, 2, 1, 4, 5, 9, 6, 7, 11, -1, -1, -1, -1 },
+		{ 10, 2, 0, 5, 10, 0, 4, 5, 0, 6, 7, 11, -1, -1, -1, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 7, 3, 2, 6, 7, 2, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1, -1, -1, -1 },
+		{ 5, 1, 0, 4, 5, 0, 7, 3, 2, 6, 7, 2, -1, -1, -1, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 7, 3, 1, 6, 7, 1, 10, 6, 1, 4, 5, 9, -1, -1, -1, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 7, 3, 0, 6, 7, 0, 10, 6, 0, 5, 10, 0, 4, 5, 0, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1, -1, -1, -1 },
+		{ 11, 6, 5, 8, 11, 5, 9, 8, 5, -1, -1, -1, -1, -1, -1, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1, -1, -1, -1 },
+		{ 5, 1, 0, 6, 5, 0, 11, 6, 0, 8, 11, 0, -1, -1, -1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 2, 1, 11, 6, 5, 8, 11, 5, 9, 8, 5, -1, -1, -1, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 10, 2, 1, -1 },
+		{ 10, 2, 0, 5, 10, 0, 6, 5, 0, 11, 6, 0, 8, 11, 0, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1, -1, -1, -1 },
+		{ 8, 3, 2, 9, 8, 2, 5, 9, 2, 6, 5, 2, -1, -1, -1, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 2, 6, 8, 3, 6, 5, 1, 0, 6, 5, 0, 8, 6, 0, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 9, 8, 6, 5, 8, 8, 3, 1, 6, 8, 1, 10, 6, 1, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1, -1, -1, -1 },
+		{ 8, 3, 0, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 7, 11, 10, 5, 7, 10, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1, -1, -1, -1 },
+		{ 11, 2, 1, 7, 11, 1, 5, 7, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 11, 2, 1, 7, 11, 1, 5, 7, 1, -1, -1, -1, -1 },
+		{ 11, 2, 0, 7, 11, 0, 5, 7, 0, 9, 5, 0, -1, -1, -1, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 7, 3, 2, 5, 7, 2, 10, 5, 2, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1, -1, -1, -1 },
+		{ 9, 1, 0, 7, 3, 2, 5, 7, 2, 10, 5, 2, -1, -1, -1, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 7, 3, 1, 5, 7, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 3, 0, 5, 7, 0, 9, 5, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 5, 4, 11, 10, 4, 8, 11, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1, -1, -1, -1 },
+		{ 9, 1, 0, 10, 5, 4, 11, 10, 4, 8, 11, 4, -1, -1, -1, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 11, 2, 1, 8, 11, 1, 4, 8, 1, 5, 4, 1, -1, -1, -1, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 4, 8, 11, 5, 4, 11, 11, 2, 0, 5, 11, 0, 9, 5, 0, -1 },
+		{ 2, 3, 11, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 3, 2, 4, 8, 2, 5, 4, 2, 10, 5, 2, -1, -1, -1, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 1, 0, 8, 3, 2, 4, 8, 2, 5, 4, 2, 10, 5, 2, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1, -1, -1, -1 },
+		{ 8, 3, 1, 4, 8, 1, 5, 4, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 8, 3, 5, 4, 3, 5, 3, 0, 9, 5, 0, -1, -1, -1, -1 },
+		{ 9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1, -1, -1, -1 },
+		{ 10, 1, 0, 11, 10, 0, 7, 11, 0, 4, 7, 0, -1, -1, -1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 11, 2, 1, 7, 11, 1, 4, 7, 1, 9, 4, 1, -1, -1, -1, -1 },
+		{ 0, 3, 8, 11, 2, 1, 7, 11, 1, 4, 7, 1, 9, 4, 1, -1 },
+		{ 11, 2, 0, 7, 11, 0, 4, 7, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1, -1, -1, -1 },
+		{ 7, 3, 2, 4, 7, 2, 9, 4, 2, 10, 9, 2, -1, -1, -1, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 10, 1, 0, 7, 10, 0, 4, 7, 0, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 7, 3, 1, 4, 7, 1, 9, 4, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1, -1, -1, -1 },
+		{ 7, 3, 0, 4, 7, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 9, 8, 11, 10, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1, -1, -1, -1, -1, -1, -1 },
+		{ 10, 1, 0, 11, 10, 0, 8, 11, 0, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 11, 2, 1, 8, 11, 1, 9, 8, 1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1, -1, -1, -1 },
+		{ 11, 2, 0, 8, 11, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 3, 2, 9, 8, 2, 10, 9, 2, -1, -1, -1, -1, -1, -1, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 3, 2, 10, 8, 3, 10, 10, 1, 0, 8, 10, 0, -1, -1, -1, -1 },
+		{ 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 3, 1, 9, 8, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ 8, 3, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+		{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	};
+}
+
+TsdfVolume::TsdfVolume() :
+	TsdfVolume(Settings())
+{
+}
+
+TsdfVolume::TsdfVolume(const Settings& settings) :
+	m_settings(settings),
+	m_inverseVoxelSize(1.0f / settings.voxelSize),
+	m_blockWorldSize(settings.voxelSize * kBlockSize),
+	m_integrationCounter(0)
+{
+	assert(settings.voxelSize > 0.0f && settings.truncationDistance >= settings.voxelSize);
+}
+
+uint64_t TsdfVolume::PackKey(int x, int y, int z)
+{
+	const uint64_t bias = 1 << 20;
+	return (((uint64_t)(x + bias) & 0x1fffff) << 42) | (((uint64_t)(y + bias) & 0x1fffff) << 21) | ((uint64_t)(z + bias) & 0x1fffff);
+}
+
+TsdfVolume::BlockCoordinate TsdfVolume::UnpackKey(uint64_t key)
+{
+	const int bias = 1 << 20;
+	BlockCoordinate coordinate;
+	coordinate.x = (int)((key >> 42) & 0x1fffff) - bias;
+	coordinate.y = (int)((key >> 21) & 0x1fffff) - bias;
+	coordinate.z = (int)(key & 0x1fffff) - bias;
+	return coordinate;
+}
+
+const TsdfVolume::Block* TsdfVolume::FindBlock(int x, int y, int z) const
+{
+	auto blockIterator = m_blocks.find(PackKey(x, y, z));
+	return (blockIterator != m_blocks.end()) ? blockIterator->second.get() : nullptr;
+}
+
+bool TsdfVolume::GetVoxel(int x, int y, int z, float& distance) const
+{
+	int blockX = FloorDivide(x, kBlockSize), blockY = FloorDivide(y, kBlockSize), blockZ = FloorDivide(z, kBlockSize);
+	const Block* block = FindBlock(blockX, blockY, blockZ);
+	if (!block)
+		return false;
+
+	int voxelIndex = ((z - blockZ * kBlockSize) * kBlockSize + (y - blockY * kBlockSize)) * kBlockSize + (x - blockX * kBlockSize);
+	if (block->weight[voxelIndex] <= 0.0f)
+		return false;
+
+	distance = block->distance[voxelIndex];
+	return true;
+}
+
+// Binning and the per voxel distance search only read the input mesh and the settings, so they run without the lock.
+// Readers are only blocked while new blocks are inserted and the samples are fused into them.
+void TsdfVolume::IntegrateMesh(const Vector3* positions, size_t vertexCount, const unsigned* indices, size_t indexCount)
+{
+	lock_guard<mutex> integrationLock(m_integrationMutex);
+
+	// Bin triangles into every block whose truncation band they can reach
+	vector<BlockWork> work;
+	unordered_map<uint64_t, size_t> workLookup;
+	const float halfBlockDiagonal = m_blockWorldSize * 0.8660254f;
+	Vector3 meshMinimum = { FLT_MAX, FLT_MAX, FLT_MAX };
+	Vector3 meshMaximum = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+			continue;
+
+		const Vector3& a = positions[indices[i]];
+		const Vector3& b = positions[indices[i + 1]];
+		const Vector3& c = positions[indices[i + 2]];
+
+		Vector3 normal = Cross(Subtract(b, a), Subtract(c, a));
+		if (Length(normal) <= 0.0f)
+			continue;
+		normal = Normalize(normal);
+
+		float minimum[3] = { min(a.x, min(b.x, c.x)), min(a.y, min(b.y, c.y)), min(a.z, min(b.z, c.z)) };
+		float maximum[3] = { max(a.x, max(b.x, c.x)), max(a.y, max(b.y, c.y)), max(a.z, max(b.z, c.z)) };
+		meshMinimum = { min(meshMinimum.x, minimum[0]), min(meshMinimum.y, minimum[1]), min(meshMinimum.z, minimum[2]) };
+		meshMaximum = { max(meshMaximum.x, maximum[0]), max(meshMaximum.y, maximum[1]), max(meshMaximum.z, maximum[2]) };
+		int minimumBlock[3], maximumBlock[3];
+		for (unsigned axis = 0; axis < 3; ++axis)
+		{
+			minimumBlock[axis] = (int)floorf((minimum[axis] - m_settings.truncationDistance) / m_blockWorldSize);
+			maximumBlock[axis] = (int)floorf((maximum[axis] + m_settings.truncationDistance) / m_blockWorldSize);
+		}
+
+		for (int z = minimumBlock[2]; z <= maximumBlock[2]; ++z)
+		for (int y = minimumBlock[1]; y <= maximumBlock[1]; ++y)
+		for (int x = minimumBlock[0]; x <= maximumBlock[0]; ++x)
+		{
+			// Large triangles have loose bounds, skip blocks too far from the triangle's plane
+			Vector3 blockCenter = { (x + 0.5f) * m_blockWorldSize, (y + 0.5f) * m_blockWorldSize, (z + 0.5f) * m_blockWorldSize };
+			if (fabsf(Dot(Subtract(blockCenter, a), normal)) > m_settings.truncationDistance + halfBlockDiagonal)
+				continue;
+
+			uint64_t key = PackKey(x, y, z);
+			auto lookupIterator = workLookup.find(key);
+			if (lookupIterator == workLookup.end())
+			{
+				lookupIterator = workLookup.insert(make_pair(key, work.size())).first;
+				work.push_back({ key, {}, {} });
+			}
+			work[lookupIterator->second].triangles.push_back((unsigned)i);
+		}
+	}
+
+	if (work.empty())
+		return;
+
+	// Each worker owns whole blocks at a time, the samples are private to the work item
+	unsigned threadCount = m_settings.workerThreadCount ? m_settings.workerThreadCount : max(1u, thread::hardware_concurrency());
+	threadCount = (unsigned)min((size_t)threadCount, (work.size() + 3) / 4);
+
+	atomic<size_t> nextWork(0);
+	m_workers.Run(threadCount, [&](unsigned)
+	{
+		for (size_t workIndex = nextWork++; workIndex < work.size(); workIndex = nextWork++)
+			SampleBlock(work[workIndex], positions, indices);
+	});
+
+	unique_lock<shared_mutex> lock(m_blocksMutex);
+
+	++m_integrationCounter;
+
+	vector<uint64_t> touchedKeys;
+	vector<size_t> newWork;
+	touchedKeys.reserve(work.size());
+	for (size_t workIndex = 0; workIndex < work.size(); ++workIndex)
+	{
+		touchedKeys.push_back(work[workIndex].key);
+		if (m_blocks.find(work[workIndex].key) == m_blocks.end())
+			newWork.push_back(workIndex);
+	}
+
+	// Make room for the new blocks from the ones this mesh does not touch, and skip the new blocks that still do not fit.
+	// Those are the farthest from the mesh center, where a large patch is the least reliable.
+	vector<bool> isSkipped(work.size(), false);
+	size_t requiredCount = m_blocks.size() + newWork.size();
+	if (requiredCount > m_settings.maxBlockCount)
+	{
+		size_t excessCount = requiredCount - m_settings.maxBlockCount;
+		excessCount -= EvictBlocks(touchedKeys, excessCount);
+		excessCount = min(excessCount, newWork.size());
+		if (excessCount > 0)
+		{
+			Vector3 meshCenter = Scale(Add(meshMinimum, meshMaximum), 0.5f);
+			auto getDistanceSquared = [&](size_t workIndex)
+			{
+				BlockCoordinate coordinate = UnpackKey(work[workIndex].key);
+				Vector3 blockCenter = { (coordinate.x + 0.5f) * m_blockWorldSize, (coordinate.y + 0.5f) * m_blockWorldSize, (coordinate.z + 0.5f) * m_blockWorldSize };
+				Vector3 offset = Subtract(blockCenter, meshCenter);
+				return Dot(offset, offset);
+			};
+
+			nth_element(newWork.begin(), newWork.begin() + (excessCount - 1), newWork.end(),
+				[&](size_t a, size_t b) { return getDistanceSquared(a) > getDistanceSquared(b); });
+			for (size_t i = 0; i < excessCount; ++i)
+				isSkipped[newWork[i]] = true;
+		}
+	}
+
+	for (size_t workIndex = 0; workIndex < work.size(); ++workIndex)
+	{
+		if (isSkipped[workIndex])
+			continue;
+
+		const BlockWork& blockWork = work[workIndex];
+		auto& block = m_blocks[blockWork.key];
+		if (!block)
+		{
+			block.reset(new Block());
+			fill(begin(block->distance), end(block->distance), m_settings.truncationDistance);
+			fill(begin(block->weight), end(block->weight), 0.0f);
+			block->dirty = false;
+		}
+
+		FuseBlock(*block, blockWork);
+		block->lastUpdate = m_integrationCounter;
+		MarkDirtyWithNeighbors(blockWork.key);
+	}
+}
+
+void TsdfVolume::SampleBlock(BlockWork& work, const Vector3* positions, const unsigned* indices) const
+{
+	const BlockCoordinate blockCoordinate = UnpackKey(work.key);
+	const int baseVoxel[3] = { blockCoordinate.x * kBlockSize, blockCoordinate.y * kBlockSize, blockCoordinate.z * kBlockSize };
+	const float truncation = m_settings.truncationDistance;
+
+	// Closest signed distance from this mesh for each voxel, before it gets fused with the history
+	float nearestDistance[kBlockVoxelCount];
+	float nearestAlignment[kBlockVoxelCount];
+	work.signedDistances.assign(kBlockVoxelCount, FLT_MAX);
+	fill(begin(nearestDistance), end(nearestDistance), FLT_MAX);
+
+	for (unsigned triangleIndex : work.triangles)
+	{
+		const Vector3& a = positions[indices[triangleIndex]];
+		const Vector3& b = positions[indices[triangleIndex + 1]];
+		const Vector3& c = positions[indices[triangleIndex + 2]];
+		Vector3 normal = Normalize(Cross(Subtract(b, a), Subtract(c, a)));
+
+		int minimumVoxel[3], maximumVoxel[3];
+		const float minimum[3] = { min(a.x, min(b.x, c.x)), min(a.y, min(b.y, c.y)), min(a.z, min(b.z, c.z)) };
+		const float maximum[3] = { max(a.x, max(b.x, c.x)), max(a.y, max(b.y, c.y)), max(a.z, max(b.z, c.z)) };
+		for (unsigned axis = 0; axis < 3; ++axis)
+		{
+			minimumVoxel[axis] = max(0, (int)ceilf((minimum[axis] - truncation) * m_inverseVoxelSize) - baseVoxel[axis]);
+			maximumVoxel[axis] = min(kBlockSize - 1, (int)floorf((maximum[axis] + truncation) * m_inverseVoxelSize) - baseVoxel[axis]);
+		}
+
+		for (int z = minimumVoxel[2]; z <= maximumVoxel[2]; ++z)
+		for (int y = minimumVoxel[1]; y <= maximumVoxel[1]; ++y)
+		for (int x = minimumVoxel[0]; x <= maximumVoxel[0]; ++x)
+		{
+			Vector3 voxelPosition = { (baseVoxel[0] + x) * m_settings.voxelSize, (baseVoxel[1] + y) * m_settings.voxelSize, (baseVoxel[2] + z) * m_settings.voxelSize };
+			Vector3 offset = Subtract(voxelPosition, ClosestPointOnTriangle(voxelPosition, a, b, c));
+			float distance = Length(offset);
+			if (distance >= truncation)
+				continue;
+
+			// Near shared edges and corners several triangles are equally close;
+			//  the one facing the voxel most directly gives the most reliable sign
+			float alignment = (distance > 0.0f) ? fabsf(Dot(offset, normal)) / distance : 1.0f;
+
+			int voxelIndex = (z * kBlockSize + y) * kBlockSize + x;
+			float tolerance = m_settings.voxelSize * 1e-3f;
+			if (distance < nearestDistance[voxelIndex] - tolerance ||
+				(distance <= nearestDistance[voxelIndex] + tolerance && alignment > nearestAlignment[voxelIndex]))
+			{
+				nearestDistance[voxelIndex] = distance;
+				nearestAlignment[voxelIndex] = alignment;
+				work.signedDistances[voxelIndex] = (Dot(offset, normal) >= 0.0f) ? distance : -distance;
+			}
+		}
+	}
+}
+
+void TsdfVolume::FuseBlock(Block& block, const BlockWork& work)
+{
+	for (int voxelIndex = 0; voxelIndex < kBlockVoxelCount; ++voxelIndex)
+	{
+		if (work.signedDistances[voxelIndex] == FLT_MAX)
+			continue;
+
+		float weight = block.weight[voxelIndex];
+		block.distance[voxelIndex] = (block.distance[voxelIndex] * weight + work.signedDistances[voxelIndex]) / (weight + 1.0f);
+		block.weight[voxelIndex] = min(weight + 1.0f, m_settings.maxWeight);
+	}
+}
+
+// Cells are owned by the block holding their minimum corner, so the blocks on the negative
+//  side of a changed block read its voxels and have to be re-meshed too
+void TsdfVolume::MarkDirtyWithNeighbors(uint64_t key)
+{
+	BlockCoordinate coordinate = UnpackKey(key);
+	for (int dz = -1; dz <= 0; ++dz)
+	for (int dy = -1; dy <= 0; ++dy)
+	for (int dx = -1; dx <= 0; ++dx)
+	{
+		uint64_t neighborKey = PackKey(coordinate.x + dx, coordinate.y + dy, coordinate.z + dz);
+		auto blockIterator = m_blocks.find(neighborKey);
+		if (blockIterator == m_blocks.end() || blockIterator->second->dirty)
+			continue;
+
+		blockIterator->second->dirty = true;
+		m_dirtyBlocks.push_back(neighborKey);
+	}
+}
+
+size_t TsdfVolume::EvictBlocks(const vector<uint64_t>& protectedKeys, size_t evictionCount)
+{
+	vector<uint64_t> sortedProtectedKeys = protectedKeys;
+	sort(sortedProtectedKeys.begin(), sortedProtectedKeys.end());
+
+	vector<pair<uint64_t, uint64_t>> candidates;	// Last update, key
+	candidates.reserve(m_blocks.size());
+	for (auto& blockPair : m_blocks)
+	{
+		if (!binary_search(sortedProtectedKeys.begin(), sortedProtectedKeys.end(), blockPair.first))
+			candidates.push_back(make_pair(blockPair.second->lastUpdate, blockPair.first));
+	}
+
+	evictionCount = min(evictionCount, candidates.size());
+	if (evictionCount == 0)
+		return 0;
+
+	nth_element(candidates.begin(), candidates.begin() + (evictionCount - 1), candidates.end());
+	for (size_t i = 0; i < evictionCount; ++i)
+	{
+		uint64_t key = candidates[i].second;
+		m_blocks.erase(key);
+		m_evictedBlocks.push_back(key);
+		MarkDirtyWithNeighbors(key);
+	}
+
+	return evictionCount;
+}
+
+void TsdfVolume::ExtractDirtyBlocks(vector<BlockMesh>& updatedBlocks, vector<BlockCoordinate>& removedBlocks)
+{
+	updatedBlocks.clear();
+	removedBlocks.clear();
+
+	vector<uint64_t> dirtyBlocks;
+	vector<uint64_t> evictedBlocks;
+	{
+		unique_lock<shared_mutex> lock(m_blocksMutex);
+		dirtyBlocks.swap(m_dirtyBlocks);
+		evictedBlocks.swap(m_evictedBlocks);
+		for (uint64_t key : dirtyBlocks)
+		{
+			auto blockIterator = m_blocks.find(key);
+			if (blockIterator != m_blocks.end())
+				blockIterator->second->dirty = false;
+		}
+	}
+
+	shared_lock<shared_mutex> lock(m_blocksMutex);
+
+	for (uint64_t key : evictedBlocks)
+	{
+		if (m_blocks.find(key) == m_blocks.end())
+			removedBlocks.push_back(UnpackKey(key));
+	}
+
+	for (uint64_t key : dirtyBlocks)
+	{
+		if (m_blocks.find(key) == m_blocks.end())
+			continue;
+
+		BlockMesh blockMesh;
+		ExtractBlock(key, blockMesh);
+		if (blockMesh.indices.empty())
+			removedBlocks.push_back(blockMesh.coordinate);
+		else
+			updatedBlocks.push_back(move(blockMesh));
+	}
+}
+
+void TsdfVolume::ExtractBlock(uint64_t key, BlockMesh& blockMesh) const
+{
+	blockMesh.coordinate = UnpackKey(key);
+	const int baseVoxel[3] = { blockMesh.coordinate.x * kBlockSize, blockMesh.coordinate.y * kBlockSize, blockMesh.coordinate.z * kBlockSize };
+
+	// Vertices are keyed by the two voxels of the edge they sit on, and always interpolated
+	//  from the lower keyed voxel, so neighboring blocks produce bit identical seam vertices
+	map<pair<uint64_t, uint64_t>, unsigned> edgeVertices;
+
+	for (int z = 0; z < kBlockSize; ++z)
+	for (int y = 0; y < kBlockSize; ++y)
+	for (int x = 0; x < kBlockSize; ++x)
+	{
+		int cornerVoxels[8][3];
+		float cornerDistances[8];
+		bool cellObserved = true;
+		unsigned caseIndex = 0;
+		for (unsigned corner = 0; corner < 8 && cellObserved; ++corner)
+		{
+			for (unsigned axis = 0; axis < 3; ++axis)
+				cornerVoxels[corner][axis] = baseVoxel[axis] + (axis == 0 ? x : (axis == 1 ? y : z)) + kCornerOffsets[corner][axis];
+
+			cellObserved = GetVoxel(cornerVoxels[corner][0], cornerVoxels[corner][1], cornerVoxels[corner][2], cornerDistances[corner]);
+			if (cornerDistances[corner] < 0.0f)
+				caseIndex |= 1u << corner;
+		}
+
+		if (!cellObserved || caseIndex == 0 || caseIndex == 255)
+			continue;
+
+		auto getEdgeVertex = [&](unsigned cornerA, unsigned cornerB) -> unsigned
+		{
+			uint64_t keyA = PackKey(cornerVoxels[cornerA][0], cornerVoxels[cornerA][1], cornerVoxels[cornerA][2]);
+			uint64_t keyB = PackKey(cornerVoxels[cornerB][0], cornerVoxels[cornerB][1], cornerVoxels[cornerB][2]);
+			if (keyB < keyA)
+			{
+				swap(keyA, keyB);
+				swap(cornerA, cornerB);
+			}
+
+			auto edgeKey = make_pair(keyA, keyB);
+			auto vertexIterator = edgeVertices.find(edgeKey);
+			if (vertexIterator != edgeVertices.end())
+				return vertexIterator->second;
+
+			float t = cornerDistances[cornerA] / (cornerDistances[cornerA] - cornerDistances[cornerB]);
+			Vector3 positionA = { cornerVoxels[cornerA][0] * m_settings.voxelSize, cornerVoxels[cornerA][1] * m_settings.voxelSize, cornerVoxels[cornerA][2] * m_settings.voxelSize };
+			Vector3 positionB = { cornerVoxels[cornerB][0] * m_settings.voxelSize, cornerVoxels[cornerB][1] * m_settings.voxelSize, cornerVoxels[cornerB][2] * m_settings.voxelSize };
+
+			unsigned vertexIndex = (unsigned)blockMesh.positions.size();
+			blockMesh.positions.push_back(Add(positionA, Scale(Subtract(positionB, positionA), t)));
+			blockMesh.normals.push_back({ 0.0f, 0.0f, 0.0f });
+			edgeVertices[edgeKey] = vertexIndex;
+			return vertexIndex;
+		};
+
+		const signed char* triangleEdges = kTriangleTable[caseIndex];
+		for (unsigned i = 0; triangleEdges[i] >= 0; i += 3)
+		{
+			unsigned triangle[3];
+			for (unsigned vertex = 0; vertex < 3; ++vertex)
+				triangle[vertex] = getEdgeVertex(kEdgeCorners[triangleEdges[i + vertex]][0], kEdgeCorners[triangleEdges[i + vertex]][1]);
+
+			const Vector3& p0 = blockMesh.positions[triangle[0]];
+			Vector3 faceNormal = Cross(Subtract(blockMesh.positions[triangle[1]], p0), Subtract(blockMesh.positions[triangle[2]], p0));
+			for (unsigned vertexIndex : triangle)
+			{
+				blockMesh.indices.push_back(vertexIndex);
+				blockMesh.normals[vertexIndex] = Add(blockMesh.normals[vertexIndex], faceNormal);
+			}
+		}
+	}
+
+	// Prefer the field gradient for normals, it is continuous across block seams
+	const float h = m_settings.voxelSize * 0.5f;
+	for (size_t i = 0; i < blockMesh.positions.size(); ++i)
+	{
+		const Vector3& p = blockMesh.positions[i];
+		float dxPositive, dxNegative, dyPositive, dyNegative, dzPositive, dzNegative;
+		if (GetDistanceUnlocked({ p.x + h, p.y, p.z }, dxPositive) && GetDistanceUnlocked({ p.x - h, p.y, p.z }, dxNegative) &&
+			GetDistanceUnlocked({ p.x, p.y + h, p.z }, dyPositive) && GetDistanceUnlocked({ p.x, p.y - h, p.z }, dyNegative) &&
+			GetDistanceUnlocked({ p.x, p.y, p.z + h }, dzPositive) && GetDistanceUnlocked({ p.x, p.y, p.z - h }, dzNegative))
+		{
+			Vector3 gradient = { dxPositive - dxNegative, dyPositive - dyNegative, dzPositive - dzNegative };
+			if (Length(gradient) > 0.0f)
+			{
+				blockMesh.normals[i] = Normalize(gradient);
+				continue;
+			}
+		}
+
+		blockMesh.normals[i] = Normalize(blockMesh.normals[i]);
+	}
+}
+
+bool TsdfVolume::GetDistance(const Vector3& position, float& distance) const
+{
+	shared_lock<shared_mutex> lock(m_blocksMutex);
+	return GetDistanceUnlocked(position, distance);
+}
+
+bool TsdfVolume::GetDistanceUnlocked(const Vector3& position, float& distance) const
+{
+	float voxelX = position.x * m_inverseVoxelSize;
+	float voxelY = position.y * m_inverseVoxelSize;
+	float voxelZ = position.z * m_inverseVoxelSize;
+	int x = (int)floorf(voxelX), y = (int)floorf(voxelY), z = (int)floorf(voxelZ);
+	float fx = voxelX - x, fy = voxelY - y, fz = voxelZ - z;
+
+	float corners[8];
+	for (unsigned corner = 0; corner < 8; ++corner)
+	{
+		if (!GetVoxel(x + (corner & 1), y + ((corner >> 1) & 1), z + (corner >> 2), corners[corner]))
+			return false;
+	}
+
+	float x00 = corners[0] + (corners[1] - corners[0]) * fx;
+	float x10 = corners[2] + (corners[3] - corners[2]) * fx;
+	float x01 = corners[4] + (corners[5] - corners[4]) * fx;
+	float x11 = corners[6] + (corners[7] - corners[6]) * fx;
+	float y0 = x00 + (x10 - x00) * fy;
+	float y1 = x01 + (x11 - x01) * fy;
+	distance = y0 + (y1 - y0) * fz;
+	return true;
+}
+
+size_t TsdfVolume::GetBlockCount() const
+{
+	shared_lock<shared_mutex> lock(m_blocksMutex);
+	return m_blocks.size();
+}
+
+size_t TsdfVolume::GetMemoryUsage() const
+{
+	shared_lock<shared_mutex> lock(m_blocksMutex);
+	return m_blocks.size() * (sizeof(Block) + sizeof(uint64_t) + sizeof(void*) * 2);
+}
+
+void TsdfVolume::Clear()
+{
+	unique_lock<shared_mutex> lock(m_blocksMutex);
+	for (auto& blockPair : m_blocks)
+		m_evictedBlocks.push_back(blockPair.first);
+	m_blocks.clear();
+	m_dirtyBlocks.clear();
+}
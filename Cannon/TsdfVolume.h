@@ -0,0 +1,133 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+// This file and TsdfVolume.cpp only depend on the standard library, so the fusion code can be built and
+//  exercised off-device (e.g. on Linux) by feeding it recorded or synthetic meshes.
+
+#include "Common/WorkerPool.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+
+// Sparse, voxel hashed truncated signed distance field.
+// Surface meshes are fused into 8x8x8 voxel blocks that are only allocated near observed surfaces,
+//  so memory follows observed surface area instead of the number of patches the system hands out.
+// Blocks touched by an integration are marked dirty and re-meshed incrementally by ExtractDirtyBlocks.
+// The block budget holds after every integration: the least recently updated blocks are evicted first, and if the
+//  mesh alone needs more blocks than that frees, the new blocks farthest from its center are not allocated.
+class TsdfVolume
+{
+public:
+
+	static const int kBlockSize = 8;
+	static const int kBlockVoxelCount = kBlockSize * kBlockSize * kBlockSize;
+
+	struct Vector3
+	{
+		float x, y, z;
+	};
+
+	struct BlockCoordinate
+	{
+		int x, y, z;
+
+		bool operator==(const BlockCoordinate& b) const { return x == b.x && y == b.y && z == b.z; }
+	};
+
+	struct Settings
+	{
+		float voxelSize = 0.04f;			// Edge length of a voxel in meters
+		float truncationDistance = 0.12f;	// Distances are only stored within this band around the surface
+		size_t maxBlockCount = 16384;		// Memory budget, each block is ~4 KB
+		float maxWeight = 32.0f;			// Caps how much history a voxel keeps, lower adapts faster to change
+		unsigned workerThreadCount = 0;		// 0 to use the hardware concurrency
+	};
+
+	// Re-meshed surface for one block, in world space
+	struct BlockMesh
+	{
+		BlockCoordinate coordinate;
+		std::vector<Vector3> positions;
+		std::vector<Vector3> normals;
+		std::vector<unsigned> indices;
+	};
+
+	TsdfVolume();
+	TsdfVolume(const Settings& settings);
+
+	const Settings& GetSettings() const { return m_settings; }
+
+	// Fuses a world space triangle mesh with outward facing winding (counter-clockwise seen from free space).
+	// Concurrent calls run one after the other, each one splits its work over the worker threads.
+	void IntegrateMesh(const Vector3* positions, size_t vertexCount, const unsigned* indices, size_t indexCount);
+
+	// Re-meshes every block that changed since the last call.
+	// Blocks that became empty or were evicted are reported in removedBlocks.
+	void ExtractDirtyBlocks(std::vector<BlockMesh>& updatedBlocks, std::vector<BlockCoordinate>& removedBlocks);
+
+	// Trilinearly interpolated signed distance, positive in free space. Returns false outside the observed band.
+	bool GetDistance(const Vector3& position, float& distance) const;
+
+	size_t GetBlockCount() const;
+	size_t GetMemoryUsage() const;
+	void Clear();
+
+private:
+
+	struct Block
+	{
+		float distance[kBlockVoxelCount];
+		float weight[kBlockVoxelCount];
+		uint64_t lastUpdate;
+		bool dirty;
+	};
+
+	struct BlockWork
+	{
+		uint64_t key;
+		std::vector<unsigned> triangles;
+		std::vector<float> signedDistances;	// Closest signed distance from the mesh per voxel, FLT_MAX where none is in the band
+	};
+
+	static uint64_t PackKey(int x, int y, int z);
+	static BlockCoordinate UnpackKey(uint64_t key);
+
+	const Block* FindBlock(int x, int y, int z) const;
+	bool GetVoxel(int x, int y, int z, float& distance) const;	// Global voxel coordinates
+	bool GetDistanceUnlocked(const Vector3& position, float& distance) const;
+
+	void SampleBlock(BlockWork& work, const Vector3* positions, const unsigned* indices) const;
+	void FuseBlock(Block& block, const BlockWork& work);
+	void MarkDirtyWithNeighbors(uint64_t key);
+	size_t EvictBlocks(const std::vector<uint64_t>& protectedKeys, size_t evictionCount);	// Returns how many were evicted
+	void ExtractBlock(uint64_t key, BlockMesh& blockMesh) const;
+
+	Settings m_settings;
+	float m_inverseVoxelSize;
+	float m_blockWorldSize;
+
+	std::unordered_map<uint64_t, std::unique_ptr<Block>> m_blocks;
+	std::vector<uint64_t> m_dirtyBlocks;
+	std::vector<uint64_t> m_evictedBlocks;
+	uint64_t m_integrationCounter;
+
+	mutable std::shared_mutex m_blocksMutex;
+
+	WorkerPool m_workers;
+	std::mutex m_integrationMutex;	// The workers run one integration at a time
+};
@@ -0,0 +1,233 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#include "pch.h"
+
+#include "RenderContext.h"
+#include "UploadRing.h"
+
+#include <cassert>
+
+using namespace std;
+
+extern Microsoft::WRL::ComPtr<ID3D11Device> g_d3dDevice;
+extern std::unique_ptr<RenderContext> g_renderContext;
+
+UploadRing::UploadRing() :
+	m_size(0),
+	m_head(0),
+	m_position(0),
+	m_retiredPosition(0),
+	m_generation(0),
+	m_needsDiscard(true),
+	m_isMapped(false),
+	m_frameIndex(0)
+{
+}
+
+UploadRing::~UploadRing()
+{
+	if (m_isMapped)
+		Unmap();
+}
+
+void* UploadRing::Map(UINT size, Allocation& allocation)
+{
+	assert(!m_isMapped);
+
+	allocation = Allocation();
+	if (size == 0)
+		return nullptr;
+
+	UINT alignedSize = Align(size);
+	MakeRoom(alignedSize);
+	if (!m_buffer)
+		return nullptr;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(g_renderContext->Map(m_buffer.Get(), 0, m_needsDiscard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped)))
+		return nullptr;
+
+	m_needsDiscard = false;
+	m_isMapped = true;
+
+	allocation.buffer = m_buffer.Get();
+	allocation.offset = m_head;
+	allocation.size = size;
+	allocation.position = m_position;
+	allocation.generation = m_generation;
+	allocation.frameIndex = m_frameIndex;
+
+	m_head += alignedSize;
+	m_position += alignedSize;
+
+	++m_stats.allocations;
+	m_stats.bytesWritten += size;
+
+	return static_cast<unsigned char*>(mapped.pData) + allocation.offset;
+}
+
+void UploadRing::Unmap()
+{
+	assert(m_isMapped);
+
+	g_renderContext->Unmap(m_buffer.Get(), 0);
+	m_isMapped = false;
+}
+
+bool UploadRing::Upload(const void* data, UINT size, Allocation& allocation)
+{
+	void* destination = Map(size, allocation);
+	if (!destination)
+		return false;
+
+	memcpy(destination, data, size);
+	Unmap();
+	return true;
+}
+
+void UploadRing::Reserve(UINT size)
+{
+	if (size > 0)
+		MakeRoom(Align(size));
+}
+
+bool UploadRing::IsValid(const Allocation& allocation) const
+{
+	// A later frame may reuse it once the frame that wrote it is fenced, while draws of this frame still read it.
+	// Written over once the head is a whole lap past its start.
+	return allocation.buffer && allocation.frameIndex == m_frameIndex && allocation.generation == m_generation && m_position <= allocation.position + m_size;
+}
+
+void UploadRing::EndFrame()
+{
+	uint64_t fencedPosition = m_pendingFrames.empty() ? m_retiredPosition : m_pendingFrames.back().endPosition;
+	if (m_buffer && m_position > fencedPosition)
+	{
+		PendingFrame frame;
+		if (!m_freeQueries.empty())
+		{
+			frame.query = m_freeQueries.back();
+			m_freeQueries.pop_back();
+		}
+		else
+		{
+			D3D11_QUERY_DESC desc = { D3D11_QUERY_EVENT, 0 };
+			g_d3dDevice->CreateQuery(&desc, &frame.query);
+		}
+
+		if (frame.query)
+		{
+			g_renderContext->End(frame.query.Get());
+			frame.endPosition = m_position;
+			m_pendingFrames.push_back(frame);
+		}
+	}
+
+	RetireFrames();
+	m_stats.framesInFlight = (unsigned) m_pendingFrames.size();
+	++m_frameIndex;
+}
+
+void UploadRing::ResetStats()
+{
+	m_stats = Stats();
+	m_stats.framesInFlight = (unsigned) m_pendingFrames.size();
+}
+
+bool UploadRing::CreateBuffer(UINT size)
+{
+	m_buffer.Reset();
+	m_size = 0;
+
+	D3D11_BUFFER_DESC desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = size;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_INDEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	if (FAILED(g_d3dDevice->CreateBuffer(&desc, nullptr, &m_buffer)))
+		return false;
+
+	m_size = size;
+	return true;
+}
+
+// Moves the head to where size bytes can be written without touching anything the GPU may still read
+void UploadRing::MakeRoom(UINT size)
+{
+	if (!m_buffer || size > m_size)
+	{
+		UINT bufferSize = m_size > kDefaultSize ? m_size : kDefaultSize;
+		while (bufferSize < size)
+			bufferSize *= 2;
+
+		CreateBuffer(bufferSize);
+
+		// What was written before lives on in the old buffer for as long as the GPU needs it
+		for (auto& frame : m_pendingFrames)
+			m_freeQueries.push_back(frame.query);
+		m_pendingFrames.clear();
+
+		m_head = 0;
+		m_retiredPosition = m_position;
+		m_needsDiscard = true;
+		++m_generation;
+		return;
+	}
+
+	uint64_t start = m_position;
+	UINT head = m_head;
+	if (head + size > m_size)
+	{
+		start += m_size - head;
+		head = 0;
+	}
+
+	// The allocation goes over what was written a lap before it
+	if (start + size > m_retiredPosition + m_size)
+		RetireFrames();
+
+	if (start + size > m_retiredPosition + m_size)
+	{
+		for (auto& frame : m_pendingFrames)
+			m_freeQueries.push_back(frame.query);
+		m_pendingFrames.clear();
+
+		m_retiredPosition = start;
+		m_needsDiscard = true;
+		++m_generation;
+		++m_stats.discards;
+	}
+	else if (head != m_head)
+	{
+		++m_stats.wraps;
+	}
+
+	m_position = start;
+	m_head = head;
+}
+
+void UploadRing::RetireFrames()
+{
+	while (!m_pendingFrames.empty())
+	{
+		PendingFrame& frame = m_pendingFrames.front();
+		if (g_renderContext->GetData(frame.query.Get(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			break;
+
+		m_retiredPosition = max(m_retiredPosition, frame.endPosition);
+		m_freeQueries.push_back(frame.query);
+		m_pendingFrames.pop_front();
+	}
+}
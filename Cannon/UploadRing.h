@@ -0,0 +1,101 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+// Author: Casey Meekhof cmeekhof@microsoft.com
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Ring of transient vertex, index and instance data in one large dynamic buffer.
+// Each allocation is written with D3D11_MAP_WRITE_NO_OVERWRITE right after the previous one, so writes go straight to
+//  memory the GPU reads from, with no driver copies and no buffers created or resized as data changes size.
+// A frame ends with an event query. When the ring wraps, the front is reused if the GPU has passed the frames that
+//  wrote it, otherwise the buffer is discarded and the driver hands out fresh memory rather than stalling.
+// The fence of a frame only covers the draws of that frame, so an allocation is only good in the frame it was written
+//  in, and only until the ring comes around to it again. IsValid tells whether to write it again.
+class UploadRing
+{
+public:
+
+	static const UINT kAlignment = 16;				// Of every allocation, enough for index and instance offsets
+	static const UINT kDefaultSize = 4 * 1024 * 1024;
+
+	struct Allocation
+	{
+		ID3D11Buffer* buffer = nullptr;
+		UINT offset = 0;			// Bytes into buffer
+		UINT size = 0;
+		uint64_t position = 0;		// Of the start, in bytes written to the ring ever
+		uint64_t generation = 0;	// Of the buffer memory, a discard or a new buffer starts another
+		uint64_t frameIndex = 0;	// Frame it was written in
+	};
+
+	struct Stats
+	{
+		unsigned allocations = 0;
+		size_t bytesWritten = 0;
+		unsigned wraps = 0;			// Times the ring went back to its front, reusing memory the GPU was done with
+		unsigned discards = 0;		// Wraps that found the GPU still reading the front and discarded the buffer instead
+		unsigned framesInFlight = 0;	// Frames written but not yet passed by the GPU, when the last frame ended
+	};
+
+	UploadRing();
+	~UploadRing();
+
+	// Maps size bytes for writing, Unmap before drawing with them. Returns nullptr if the buffer could not be mapped.
+	void* Map(UINT size, Allocation& allocation);
+	void Unmap();
+	bool Upload(const void* data, UINT size, Allocation& allocation);
+
+	// Makes sure the next allocations of up to size bytes in total neither wrap nor discard, so none of them can
+	//  overwrite another. Use before writing data that has to survive until a draw that also uses later allocations.
+	void Reserve(UINT size);
+
+	bool IsValid(const Allocation& allocation) const;
+
+	// Fences what was written since the last call, call once per frame
+	void EndFrame();
+	uint64_t GetFrameIndex() const { return m_frameIndex; }		// Frames ended so far
+
+	const Stats& GetStats() const { return m_stats; }
+	void ResetStats();
+
+	static UINT Align(UINT size) { return (size + kAlignment - 1) & ~(kAlignment - 1); }
+
+private:
+
+	struct PendingFrame
+	{
+		::Microsoft::WRL::ComPtr<ID3D11Query> query;
+		uint64_t endPosition;
+	};
+
+	bool CreateBuffer(UINT size);
+	void MakeRoom(UINT size);
+	void RetireFrames();
+
+	::Microsoft::WRL::ComPtr<ID3D11Buffer> m_buffer;
+	UINT m_size;
+	UINT m_head;					// Offset of the next allocation
+	uint64_t m_position;			// Bytes written ever, including the ends skipped when wrapping
+	uint64_t m_retiredPosition;		// Everything before this the GPU is done with
+	uint64_t m_generation;
+	bool m_needsDiscard;			// Next map discards, as the first one of a buffer does
+	bool m_isMapped;
+	uint64_t m_frameIndex;
+
+	std::deque<PendingFrame> m_pendingFrames;
+	std::vector<::Microsoft::WRL::ComPtr<ID3D11Query>> m_freeQueries;
+
+	Stats m_stats;
+};